@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "image.hpp"
+
+
+bool readBMP(const char * imagepath, BMPImage & image){
+
+	printf("Reading image %s\n", imagepath);
+
+	// Data read from the header of the BMP file
+	unsigned char header[54];
+	unsigned int dataPos;
+	unsigned int imageSize;
+	unsigned int width, height;
+
+	// Open the file
+	FILE * file = fopen(imagepath,"rb");
+	if (!file){
+		printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", imagepath);
+		return false;
+	}
+
+	// Read the header, i.e. the 54 first bytes
+
+	// If less than 54 bytes are read, problem
+	if ( fread(header, 1, 54, file)!=54 ){
+		printf("Not a correct BMP file\n");
+		fclose(file);
+		return false;
+	}
+	// A BMP files always begins with "BM"
+	if ( header[0]!='B' || header[1]!='M' ){
+		printf("Not a correct BMP file\n");
+		fclose(file);
+		return false;
+	}
+	// Make sure this is a 24bpp file
+	if ( *(int*)&(header[0x1E])!=0  )         {printf("Not a correct BMP file\n");    fclose(file); return false;}
+	if ( *(int*)&(header[0x1C])!=24 )         {printf("Not a correct BMP file\n");    fclose(file); return false;}
+
+	// Read the information about the image
+	dataPos    = *(int*)&(header[0x0A]);
+	imageSize  = *(int*)&(header[0x22]);
+	width      = *(int*)&(header[0x12]);
+	height     = *(int*)&(header[0x16]);
+
+	// Some BMP files are misformatted, guess missing information
+	if (imageSize==0)    imageSize=width*height*3; // 3 : one byte for each Red, Green and Blue component
+	if (dataPos==0)      dataPos=54; // The BMP header is done that way
+
+	// Read the actual data from the file into the buffer
+	image.width = width;
+	image.height = height;
+	image.data.resize(imageSize);
+	fseek(file, dataPos, SEEK_SET);
+	size_t read = fread(image.data.data(), 1, imageSize, file);
+
+	// Everything is in memory now, the file can be closed.
+	fclose (file);
+
+	if (read != imageSize){
+		printf("Not a correct BMP file\n");
+		return false;
+	}
+	return true;
+}
+
+
+#define FOURCC_DXT1 0x31545844 // Equivalent to "DXT1" in ASCII
+#define FOURCC_DXT3 0x33545844 // Equivalent to "DXT3" in ASCII
+#define FOURCC_DXT5 0x35545844 // Equivalent to "DXT5" in ASCII
+#define FOURCC_DX10 0x30315844 // Equivalent to "DX10" in ASCII
+
+// DDS_HEADER flags
+#define DDSD_CAPS        0x1
+#define DDSD_HEIGHT      0x2
+#define DDSD_WIDTH       0x4
+#define DDSD_PIXELFORMAT 0x1000
+#define DDSD_MIPMAPCOUNT 0x20000
+#define DDSD_LINEARSIZE  0x80000
+#define DDPF_FOURCC      0x4
+#define DDSCAPS_COMPLEX  0x8
+#define DDSCAPS_TEXTURE  0x1000
+#define DDSCAPS_MIPMAP   0x400000
+
+// DXGI_FORMAT values used by the DX10 header
+#define DXGI_BC1_UNORM      71
+#define DXGI_BC1_UNORM_SRGB 72
+#define DXGI_BC2_UNORM      74
+#define DXGI_BC2_UNORM_SRGB 75
+#define DXGI_BC3_UNORM      77
+#define DXGI_BC3_UNORM_SRGB 78
+#define DXGI_BC7_UNORM      98
+#define DXGI_BC7_UNORM_SRGB 99
+#define DX10_TEXTURE2D      3
+
+static bool formatFromDXGI(unsigned int dxgi, BlockFormat & format, bool & srgb){
+	switch (dxgi){
+	case DXGI_BC1_UNORM: case DXGI_BC1_UNORM_SRGB: format = BLOCK_BC1; break;
+	case DXGI_BC2_UNORM: case DXGI_BC2_UNORM_SRGB: format = BLOCK_BC2; break;
+	case DXGI_BC3_UNORM: case DXGI_BC3_UNORM_SRGB: format = BLOCK_BC3; break;
+	case DXGI_BC7_UNORM: case DXGI_BC7_UNORM_SRGB: format = BLOCK_BC7; break;
+	default: return false;
+	}
+	srgb = dxgi == DXGI_BC1_UNORM_SRGB || dxgi == DXGI_BC2_UNORM_SRGB
+		|| dxgi == DXGI_BC3_UNORM_SRGB || dxgi == DXGI_BC7_UNORM_SRGB;
+	return true;
+}
+
+static unsigned int formatToDXGI(BlockFormat format, bool srgb){
+	switch (format){
+	case BLOCK_BC1: return srgb ? DXGI_BC1_UNORM_SRGB : DXGI_BC1_UNORM;
+	case BLOCK_BC2: return srgb ? DXGI_BC2_UNORM_SRGB : DXGI_BC2_UNORM;
+	case BLOCK_BC3: return srgb ? DXGI_BC3_UNORM_SRGB : DXGI_BC3_UNORM;
+	default:        return srgb ? DXGI_BC7_UNORM_SRGB : DXGI_BC7_UNORM;
+	}
+}
+
+bool parseDDSHeader(const unsigned char * bytes, size_t size, DDSImage & image, size_t & dataOffset){
+
+	/* verify the type of file */
+	if (size < 4 + 124 || strncmp((const char*)bytes, "DDS ", 4) != 0)
+		return false;
+
+	/* get the surface desc */
+	const unsigned char * header = bytes + 4;
+	unsigned int flags       = *(unsigned int*)&(header[4 ]);
+	unsigned int height      = *(unsigned int*)&(header[8 ]);
+	unsigned int width       = *(unsigned int*)&(header[12]);
+	unsigned int mipMapCount = *(unsigned int*)&(header[24]);
+	unsigned int fourCC      = *(unsigned int*)&(header[80]);
+
+	dataOffset = 4 + 124;
+	image.srgb = false;
+	switch (fourCC){
+	case FOURCC_DXT1: image.format = BLOCK_BC1; break;
+	case FOURCC_DXT3: image.format = BLOCK_BC2; break;
+	case FOURCC_DXT5: image.format = BLOCK_BC3; break;
+	case FOURCC_DX10: {
+		if (size < dataOffset + 20)
+			return false;
+		const unsigned int * dx10 = (const unsigned int*)(bytes + dataOffset);
+		if (dx10[1] != DX10_TEXTURE2D || !formatFromDXGI(dx10[0], image.format, image.srgb))
+			return false;
+		dataOffset += 20;
+		break;
+	}
+	default:
+		return false;
+	}
+
+	if (!(flags & DDSD_MIPMAPCOUNT) || mipMapCount == 0)
+		mipMapCount = 1;
+
+	/* lay out the mip chain, each level halves down to 1x1 */
+	image.width = width;
+	image.height = height;
+	image.levels.clear();
+	size_t total = 0;
+	for (unsigned int level = 0; level < mipMapCount; ++level){
+		DDSLevel l;
+		l.width = width >> level ? width >> level : 1;
+		l.height = height >> level ? height >> level : 1;
+		l.offset = total;
+		l.size = compressedSize(image.format, l.width, l.height);
+		total += l.size;
+		image.levels.push_back(l);
+		if (l.width == 1 && l.height == 1)
+			break;
+	}
+	return true;
+}
+
+bool readDDS(const char * imagepath, DDSImage & image){
+
+	/* try to open the file */
+	FILE * fp = fopen(imagepath, "rb");
+	if (fp == NULL){
+		printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", imagepath);
+		return false;
+	}
+
+	// Magic, header and the optional DX10 extension
+	unsigned char header[4 + 124 + 20];
+	size_t headerSize = fread(header, 1, sizeof(header), fp);
+	size_t dataOffset;
+	if (!parseDDSHeader(header, headerSize, image, dataOffset)){
+		printf("%s: not a supported DDS file\n", imagepath);
+		fclose(fp);
+		return false;
+	}
+
+	size_t total = image.levels.back().offset + image.levels.back().size;
+	image.data.resize(total);
+	fseek(fp, (long)dataOffset, SEEK_SET);
+	size_t read = fread(image.data.data(), 1, total, fp);
+	fclose(fp);
+
+	if (read != total){
+		printf("%s: DDS file is truncated\n", imagepath);
+		return false;
+	}
+	return true;
+}
+
+bool writeDDS(const char * imagepath, const DDSImage & image){
+
+	// The legacy header has no way to say BC7 or sRGB
+	bool dx10 = image.format == BLOCK_BC7 || image.srgb;
+
+	unsigned int header[31];
+	memset(header, 0, sizeof(header));
+	unsigned int mipMapCount = (unsigned int)image.levels.size();
+	header[0]  = 124;
+	header[1]  = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_LINEARSIZE | (mipMapCount > 1 ? DDSD_MIPMAPCOUNT : 0);
+	header[2]  = image.height;
+	header[3]  = image.width;
+	header[4]  = image.levels.empty() ? 0 : (unsigned int)image.levels[0].size;
+	header[6]  = mipMapCount;
+	header[18] = 32; // DDS_PIXELFORMAT size
+	header[19] = DDPF_FOURCC;
+	header[26] = DDSCAPS_TEXTURE | (mipMapCount > 1 ? DDSCAPS_COMPLEX | DDSCAPS_MIPMAP : 0);
+	if (dx10)
+		header[20] = FOURCC_DX10;
+	else
+		header[20] = image.format == BLOCK_BC1 ? FOURCC_DXT1 : image.format == BLOCK_BC2 ? FOURCC_DXT3 : FOURCC_DXT5;
+
+	FILE * fp = fopen(imagepath, "wb");
+	if (fp == NULL){
+		printf("%s could not be opened for writing\n", imagepath);
+		return false;
+	}
+	bool ok = fwrite("DDS ", 1, 4, fp) == 4 && fwrite(header, sizeof(header), 1, fp) == 1;
+	if (ok && dx10){
+		unsigned int ext[5] = { formatToDXGI(image.format, image.srgb), DX10_TEXTURE2D, 0, 1, 0 };
+		ok = fwrite(ext, sizeof(ext), 1, fp) == 1;
+	}
+	if (ok && !image.data.empty())
+		ok = fwrite(image.data.data(), 1, image.data.size(), fp) == image.data.size();
+	ok = fclose(fp) == 0 && ok;
+	if (!ok)
+		printf("Could not write %s\n", imagepath);
+	return ok;
+}
@@ -0,0 +1,76 @@
+#ifndef IMAGE_HPP
+#define IMAGE_HPP
+
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+// Image files decoded on the CPU. Nothing in here touches OpenGL, so it can
+// be used from worker threads and from offline tools (texbake).
+
+// Decoded 24 bit BMP, rows bottom-up, BGR
+struct BMPImage {
+	unsigned int width;
+	unsigned int height;
+	std::vector<unsigned char> data;
+};
+
+// Reads and decodes a .BMP file.
+bool readBMP(const char * imagepath, BMPImage & image);
+
+// Block compressed formats, 4x4 pixels per block
+enum BlockFormat {
+	BLOCK_BC1, // DXT1, RGB (+1 bit alpha), 8 bytes per block
+	BLOCK_BC2, // DXT3, RGB + explicit 4 bit alpha, 16 bytes
+	BLOCK_BC3, // DXT5, RGB + interpolated alpha, 16 bytes
+	BLOCK_BC7  // BPTC, high quality RGBA, 16 bytes
+};
+
+inline size_t blockBytes(BlockFormat format){
+	return format == BLOCK_BC1 ? 8 : 16;
+}
+
+// Bytes of one block compressed width x height image
+inline size_t compressedSize(BlockFormat format, unsigned int width, unsigned int height){
+	return size_t((width + 3) / 4) * ((height + 3) / 4) * blockBytes(format);
+}
+
+struct DDSLevel {
+	unsigned int width;
+	unsigned int height;
+	size_t offset; // into DDSImage::data
+	size_t size;
+};
+
+// Block compressed texture with its mip chain, level 0 first
+struct DDSImage {
+	unsigned int width;
+	unsigned int height;
+	BlockFormat format;
+	bool srgb;
+	std::vector<DDSLevel> levels;
+	std::vector<unsigned char> data;
+};
+
+// True if path ends in ".dds" (any case)
+inline bool isDDSPath(const char * path){
+	size_t n = strlen(path);
+	if (n < 4)
+		return false;
+	const char * ext = path + n - 4;
+	return ext[0] == '.' && (ext[1] | 0x20) == 'd' && (ext[2] | 0x20) == 'd' && (ext[3] | 0x20) == 's';
+}
+
+// Parses the header at the start of a .DDS file in memory: DXT1/DXT3/DXT5
+// FourCC or a DX10 header with a BC1/2/3/7 DXGI format. Fills everything but
+// image.data; the level offsets are relative to dataOffset in the file.
+bool parseDDSHeader(const unsigned char * bytes, size_t size, DDSImage & image, size_t & dataOffset);
+
+// Reads a .DDS file including the whole mip chain stored in it.
+bool readDDS(const char * imagepath, DDSImage & image);
+
+// Writes image as .DDS. A DX10 header is used when the legacy header cannot
+// describe the format (BC7, sRGB).
+bool writeDDS(const char * imagepath, const DDSImage & image);
+
+#endif
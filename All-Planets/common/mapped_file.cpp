@@ -0,0 +1,159 @@
+#include "mapped_file.hpp"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile() : bytes(nullptr), length(0), opened(false)
+#ifdef _WIN32
+	, fileHandle(nullptr), mappingHandle(nullptr)
+#endif
+{}
+
+MappedFile::~MappedFile(){
+	close();
+}
+
+MappedFile::MappedFile(MappedFile && other) : MappedFile(){
+	moveFrom(other);
+}
+
+MappedFile & MappedFile::operator=(MappedFile && other){
+	if (this != &other){
+		close();
+		moveFrom(other);
+	}
+	return *this;
+}
+
+void MappedFile::moveFrom(MappedFile & other){
+	bytes = other.bytes;
+	length = other.length;
+	opened = other.opened;
+	other.bytes = nullptr;
+	other.length = 0;
+	other.opened = false;
+#ifdef _WIN32
+	fileHandle = other.fileHandle;
+	mappingHandle = other.mappingHandle;
+	other.fileHandle = nullptr;
+	other.mappingHandle = nullptr;
+#endif
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const char * path){
+	close();
+
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize)){
+		CloseHandle(file);
+		return false;
+	}
+
+	fileHandle = file;
+	length = (size_t)fileSize.QuadPart;
+	opened = true;
+
+	// Windows refuses to map empty files; an empty mapping is still a valid open file.
+	if (length == 0)
+		return true;
+
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping == NULL){
+		close();
+		return false;
+	}
+	mappingHandle = mapping;
+
+	bytes = (const unsigned char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (bytes == nullptr){
+		close();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::close(){
+	if (bytes)
+		UnmapViewOfFile(bytes);
+	if (mappingHandle)
+		CloseHandle((HANDLE)mappingHandle);
+	if (fileHandle)
+		CloseHandle((HANDLE)fileHandle);
+	bytes = nullptr;
+	mappingHandle = nullptr;
+	fileHandle = nullptr;
+	length = 0;
+	opened = false;
+}
+
+void MappedFile::adviseSequential() const {
+	// FILE_FLAG_SEQUENTIAL_SCAN is already passed to CreateFileA.
+}
+
+#else
+
+bool MappedFile::open(const char * path){
+	close();
+
+	int fd = ::open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0){
+		::close(fd);
+		return false;
+	}
+
+	length = (size_t)st.st_size;
+	opened = true;
+
+	// mmap() rejects zero-length mappings; an empty mapping is still a valid open file.
+	if (length > 0){
+		void * ptr = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (ptr == MAP_FAILED){
+			::close(fd);
+			length = 0;
+			opened = false;
+			return false;
+		}
+		bytes = (const unsigned char *)ptr;
+	}
+
+	// The mapping keeps its own reference to the file.
+	::close(fd);
+	return true;
+}
+
+void MappedFile::close(){
+	if (bytes)
+		munmap((void *)bytes, length);
+	bytes = nullptr;
+	length = 0;
+	opened = false;
+}
+
+void MappedFile::adviseSequential() const {
+	if (bytes)
+		madvise((void *)bytes, length, MADV_SEQUENTIAL);
+}
+
+#endif
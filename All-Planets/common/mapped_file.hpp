@@ -0,0 +1,43 @@
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include <cstddef>
+
+// Read-only memory mapping of a whole file.
+// The pointer returned by data() stays valid until close() is called or the
+// object is destroyed. Pages are faulted in by the OS on first access, so
+// opening a huge file is cheap and only the touched parts cost memory.
+class MappedFile {
+public:
+	MappedFile();
+	~MappedFile();
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile & operator=(const MappedFile &) = delete;
+	MappedFile(MappedFile && other);
+	MappedFile & operator=(MappedFile && other);
+
+	// Maps the file. Returns false if it cannot be opened or mapped.
+	bool open(const char * path);
+	void close();
+
+	bool isOpen() const { return opened; }
+	const unsigned char * data() const { return bytes; }
+	size_t size() const { return length; }
+
+	// Hints the OS that the mapping will be read front to back.
+	void adviseSequential() const;
+
+private:
+	void moveFrom(MappedFile & other);
+
+	const unsigned char * bytes;
+	size_t length;
+	bool opened;
+#ifdef _WIN32
+	void * fileHandle;
+	void * mappingHandle;
+#endif
+};
+
+#endif
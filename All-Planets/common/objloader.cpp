@@ -2,111 +2,349 @@
 #include <stdio.h>
 #include <string>
 #include <cstring>
+#include <algorithm>
 
 #include <glm/glm.hpp>
 
 #include "objloader.hpp"
+#include "mapped_file.hpp"
+#include "parallel.hpp"
+#include "text_parse.hpp"
 
-// Very, VERY simple OBJ loader.
-// Here is a short list of features a real function would provide : 
-// - Binary files. Reading a model should be just a few memcpy's away, not parsing a file at runtime. In short : OBJ is not very great.
-// - Animations & bones (includes bones weights)
-// - Multiple UVs
-// - All attributes should be optional, not "forced"
-// - More stable. Change a line in the OBJ file and it crashes.
-// - More secure. Change another line and you can inject code.
-// - Loading from memory, stream, etc
+namespace {
 
-bool loadOBJ(
-	const char * path, 
-	std::vector<glm::vec3> & out_vertices, 
+// One triangle corner as written in the file, 0-based. Negative indices
+// count back from the end of their chunk's data and are flagged in
+// relative until the chunk's offset in the whole file is known.
+struct ObjCorner {
+	int v, vt, vn;
+	unsigned char relative;
+};
+
+enum { RelativeV = 1, RelativeVT = 2, RelativeVN = 4 };
+
+struct ObjChunk {
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec2> uvs;
+	std::vector<glm::vec3> normals;
+	std::vector<ObjCorner> corners;
+	bool ok = true;
+	size_t errorLine = 0;
+};
+
+inline void skipBlanks(const char *& p, const char * end){
+	while (p < end && isBlank(*p)) p++;
+}
+
+// Reads one "v", "v/vt", "v//vn" or "v/vt/vn" corner.
+bool parseCorner(const char *& p, const char * end, const ObjChunk & chunk, ObjCorner & corner){
+	long idx[3] = { 0, 0, 0 };
+	if (!parseInt(p, end, idx[0])) return false;
+	for (int k = 1; k < 3 && p < end && *p == '/'; k++){
+		p++;
+		if (p < end && *p != '/' && !isSpace(*p) && !parseInt(p, end, idx[k])) return false;
+	}
+
+	const size_t counts[3] = { chunk.positions.size(), chunk.uvs.size(), chunk.normals.size() };
+	const unsigned char flags[3] = { RelativeV, RelativeVT, RelativeVN };
+	int out[3];
+	corner.relative = 0;
+	for (int k = 0; k < 3; k++){
+		if (idx[k] > 0){
+			out[k] = (int)(idx[k] - 1);
+		}else if (idx[k] < 0){
+			out[k] = (int)((long)counts[k] + idx[k]);
+			corner.relative |= flags[k];
+		}else{
+			if (k == 0) return false;
+			out[k] = -1;
+		}
+	}
+	corner.v = out[0];
+	corner.vt = out[1];
+	corner.vn = out[2];
+	return true;
+}
+
+// With cornerLines, also records the line of every corner; the error path
+// uses that to find the face a bad index came from.
+void parseObjChunk(const char * p, const char * end, size_t firstLine, ObjChunk & chunk,
+		std::vector<size_t> * cornerLines = nullptr){
+	// ~40 bytes per line is typical; one guess for all arrays is plenty.
+	size_t guess = (end - p) / 40;
+	chunk.positions.reserve(guess / 2);
+	chunk.corners.reserve(guess * 3);
+
+	std::vector<ObjCorner> polygon;
+	size_t line = firstLine;
+	while (p < end){
+		skipBlanks(p, end);
+		bool ok = true;
+
+		if (p + 1 < end && p[0] == 'v' && isBlank(p[1])){
+			p += 2;
+			glm::vec3 v;
+			skipBlanks(p, end); ok = parseFloat(p, end, v.x);
+			skipBlanks(p, end); ok = ok && parseFloat(p, end, v.y);
+			skipBlanks(p, end); ok = ok && parseFloat(p, end, v.z);
+			chunk.positions.push_back(v);
+		}else if (p + 2 < end && p[0] == 'v' && p[1] == 't' && isBlank(p[2])){
+			p += 3;
+			glm::vec2 uv(0.0f);
+			skipBlanks(p, end); ok = parseFloat(p, end, uv.x);
+			skipBlanks(p, end);
+			if (p < end && *p != '\n') ok = ok && parseFloat(p, end, uv.y);
+			uv.y = -uv.y; // DDS textures are stored upside down, see loadOBJ
+			chunk.uvs.push_back(uv);
+		}else if (p + 2 < end && p[0] == 'v' && p[1] == 'n' && isBlank(p[2])){
+			p += 3;
+			glm::vec3 n;
+			skipBlanks(p, end); ok = parseFloat(p, end, n.x);
+			skipBlanks(p, end); ok = ok && parseFloat(p, end, n.y);
+			skipBlanks(p, end); ok = ok && parseFloat(p, end, n.z);
+			chunk.normals.push_back(n);
+		}else if (p + 1 < end && p[0] == 'f' && isBlank(p[1])){
+			p += 2;
+			polygon.clear();
+			for (;;){
+				skipBlanks(p, end);
+				if (p >= end || *p == '\n' || *p == '#') break;
+				ObjCorner c;
+				if (!parseCorner(p, end, chunk, c)){ ok = false; break; }
+				polygon.push_back(c);
+			}
+			ok = ok && polygon.size() >= 3;
+			// Fan triangulation; exact for the convex polygons exporters write
+			for (size_t i = 2; ok && i < polygon.size(); i++){
+				chunk.corners.push_back(polygon[0]);
+				chunk.corners.push_back(polygon[i - 1]);
+				chunk.corners.push_back(polygon[i]);
+				if (cornerLines) cornerLines->insert(cornerLines->end(), 3, line);
+			}
+		}
+
+		if (!ok && chunk.ok){
+			chunk.ok = false;
+			chunk.errorLine = line;
+		}
+
+		// Comments, groups, materials, smoothing groups, ... : skip to the next line
+		const char * nl = (const char *)memchr(p, '\n', end - p);
+		p = nl ? nl + 1 : end;
+		line++;
+	}
+}
+
+// Open addressing table from a (v, vt, vn) triple to an output vertex index.
+// Kept at most half full; grows by doubling.
+class CornerTable {
+public:
+	explicit CornerTable(size_t expected) : count(0){
+		size_t capacity = 16;
+		while (capacity < expected * 2) capacity *= 2;
+		reset(capacity);
+	}
+
+	// Returns the index stored for c, or stores and returns next.
+	unsigned int findOrInsert(const ObjCorner & c, unsigned int next, bool & inserted){
+		Key key = { c.v, c.vt, c.vn };
+		size_t h = hash(key) & mask;
+		for (;;){
+			if (keys[h].v == -1){
+				keys[h] = key;
+				values[h] = next;
+				inserted = true;
+				if (++count * 2 > keys.size()) grow();
+				return next;
+			}
+			if (keys[h].v == key.v && keys[h].vt == key.vt && keys[h].vn == key.vn){
+				inserted = false;
+				return values[h];
+			}
+			h = (h + 1) & mask;
+		}
+	}
+
+private:
+	struct Key { int v, vt, vn; };
+
+	static size_t hash(const Key & k){
+		unsigned long long h = (unsigned int)k.v * 0x9E3779B97F4A7C15ull;
+		h ^= (unsigned int)k.vt * 0xC2B2AE3D27D4EB4Full;
+		h ^= (unsigned int)k.vn * 0x165667B19E3779F9ull;
+		return (size_t)(h ^ (h >> 32));
+	}
+
+	void reset(size_t capacity){
+		Key empty = { -1, -1, -1 };
+		keys.assign(capacity, empty);
+		values.assign(capacity, 0);
+		mask = capacity - 1;
+	}
+
+	void grow(){
+		std::vector<Key> oldKeys;
+		std::vector<unsigned int> oldValues;
+		oldKeys.swap(keys);
+		oldValues.swap(values);
+		reset(oldKeys.size() * 2);
+		for (size_t i = 0; i < oldKeys.size(); i++){
+			if (oldKeys[i].v == -1) continue;
+			size_t h = hash(oldKeys[i]) & mask;
+			while (keys[h].v != -1) h = (h + 1) & mask;
+			keys[h] = oldKeys[i];
+			values[h] = oldValues[i];
+		}
+	}
+
+	std::vector<Key> keys;
+	std::vector<unsigned int> values;
+	size_t mask;
+	size_t count;
+};
+
+}
+
+bool loadOBJIndexed(
+	const char * path,
+	std::vector<unsigned int> & out_indices,
+	std::vector<glm::vec3> & out_vertices,
 	std::vector<glm::vec2> & out_uvs,
 	std::vector<glm::vec3> & out_normals
 ){
 	printf("Loading OBJ file %s...\n", path);
 
-	std::vector<unsigned int> vertexIndices, uvIndices, normalIndices;
-	std::vector<glm::vec3> temp_vertices; 
-	std::vector<glm::vec2> temp_uvs;
-	std::vector<glm::vec3> temp_normals;
-
-
-	FILE * file = fopen(path, "r");
-	if( file == NULL ){
+	MappedFile file;
+	if (!file.open(path)){
 		printf("Impossible to open the file ! Are you in the right path ? See Tutorial 1 for details\n");
-		getchar();
 		return false;
 	}
+	file.adviseSequential();
+	const char * data = (const char *)file.data();
+	const char * end = data + file.size();
+
+	// Line aligned chunks, one per thread, but not smaller than 1 MB
+	size_t chunkCount = std::max<size_t>(1, std::min<size_t>(workerThreadCount(), file.size() / (1 << 20)));
+	std::vector<const char *> bounds(chunkCount + 1);
+	bounds[0] = data;
+	bounds[chunkCount] = end;
+	for (size_t i = 1; i < chunkCount; i++){
+		const char * p = std::max(bounds[i - 1], data + file.size() * i / chunkCount);
+		const char * nl = (const char *)memchr(p, '\n', end - p);
+		bounds[i] = nl ? nl + 1 : end;
+	}
+
+	std::vector<ObjChunk> chunks(chunkCount);
+	std::vector<size_t> firstLines(chunkCount, 1);
+	for (size_t i = 1; i < chunkCount; i++)
+		firstLines[i] = firstLines[i - 1] + std::count(bounds[i - 1], bounds[i], '\n');
+	parallelFor(chunkCount, 1, [&](size_t first, size_t last){
+		for (size_t i = first; i < last; i++)
+			parseObjChunk(bounds[i], bounds[i + 1], firstLines[i], chunks[i]);
+	});
 
-	while( 1 ){
-
-		char lineHeader[128];
-		// read the first word of the line
-		int res = fscanf(file, "%s", lineHeader);
-		if (res == EOF)
-			break; // EOF = End Of File. Quit the loop.
-
-		// else : parse lineHeader
-		
-		if ( strcmp( lineHeader, "v" ) == 0 ){
-			glm::vec3 vertex;
-			fscanf(file, "%f %f %f\n", &vertex.x, &vertex.y, &vertex.z );
-			temp_vertices.push_back(vertex);
-		}else if ( strcmp( lineHeader, "vt" ) == 0 ){
-			glm::vec2 uv;
-			fscanf(file, "%f %f\n", &uv.x, &uv.y );
-			uv.y = -uv.y; // Invert V coordinate since we will only use DDS texture, which are inverted. Remove if you want to use TGA or BMP loaders.
-			temp_uvs.push_back(uv);
-		}else if ( strcmp( lineHeader, "vn" ) == 0 ){
-			glm::vec3 normal;
-			fscanf(file, "%f %f %f\n", &normal.x, &normal.y, &normal.z );
-			temp_normals.push_back(normal);
-		}else if ( strcmp( lineHeader, "f" ) == 0 ){
-			std::string vertex1, vertex2, vertex3;
-			unsigned int vertexIndex[3], uvIndex[3], normalIndex[3];
-			int matches = fscanf(file, "%d/%d/%d %d/%d/%d %d/%d/%d\n", &vertexIndex[0], &uvIndex[0], &normalIndex[0], &vertexIndex[1], &uvIndex[1], &normalIndex[1], &vertexIndex[2], &uvIndex[2], &normalIndex[2] );
-			if (matches != 9){
-				printf("File can't be read by our simple parser :-( Try exporting with other options\n");
-				fclose(file);
+	// Offsets of every chunk's data in the file-wide arrays
+	std::vector<glm::vec3> positions, normals;
+	std::vector<glm::vec2> uvs;
+	std::vector<ObjCorner> corners;
+	size_t nv = 0, nvt = 0, nvn = 0, nc = 0;
+	for (const ObjChunk & c : chunks){
+		if (!c.ok){
+			printf("%s:%zu: malformed line, file can't be read\n", path, c.errorLine);
+			return false;
+		}
+		nv += c.positions.size(); nvt += c.uvs.size(); nvn += c.normals.size(); nc += c.corners.size();
+	}
+	positions.reserve(nv); uvs.reserve(nvt); normals.reserve(nvn); corners.reserve(nc);
+	for (size_t i = 0; i < chunkCount; i++){
+		ObjChunk & c = chunks[i];
+		int baseV = (int)positions.size(), baseVT = (int)uvs.size(), baseVN = (int)normals.size();
+		for (size_t j = 0; j < c.corners.size(); j++){
+			ObjCorner corner = c.corners[j];
+			if (corner.relative & RelativeV) corner.v += baseV;
+			if (corner.relative & RelativeVT) corner.vt += baseVT;
+			if (corner.relative & RelativeVN) corner.vn += baseVN;
+			// A relative index before the start of its list, or any index past the end;
+			// missing vt/vn are -1 and not relative
+			bool bad = corner.v < 0 || corner.v >= (int)nv
+				|| ((corner.relative & RelativeVT) && corner.vt < 0) || corner.vt >= (int)nvt
+				|| ((corner.relative & RelativeVN) && corner.vn < 0) || corner.vn >= (int)nvn;
+			if (bad){
+				ObjChunk again;
+				std::vector<size_t> lines;
+				parseObjChunk(bounds[i], bounds[i + 1], firstLines[i], again, &lines);
+				printf("%s:%zu: face index out of range, file can't be read\n", path, lines[j]);
 				return false;
 			}
-			vertexIndices.push_back(vertexIndex[0]);
-			vertexIndices.push_back(vertexIndex[1]);
-			vertexIndices.push_back(vertexIndex[2]);
-			uvIndices    .push_back(uvIndex[0]);
-			uvIndices    .push_back(uvIndex[1]);
-			uvIndices    .push_back(uvIndex[2]);
-			normalIndices.push_back(normalIndex[0]);
-			normalIndices.push_back(normalIndex[1]);
-			normalIndices.push_back(normalIndex[2]);
-		}else{
-			// Probably a comment, eat up the rest of the line
-			char stupidBuffer[1000];
-			fgets(stupidBuffer, 1000, file);
+			corners.push_back(corner);
+		}
+		positions.insert(positions.end(), c.positions.begin(), c.positions.end());
+		uvs.insert(uvs.end(), c.uvs.begin(), c.uvs.end());
+		normals.insert(normals.end(), c.normals.begin(), c.normals.end());
+		c = ObjChunk();
+	}
+
+	bool shared = true;
+	for (const ObjCorner & c : corners){
+		shared = shared && (c.vt < 0 || c.vt == c.v) && (c.vn < 0 || c.vn == c.v);
+	}
+
+	out_indices.clear();
+	out_vertices.clear();
+	out_uvs.clear();
+	out_normals.clear();
+	out_indices.reserve(corners.size());
+
+	if (shared){
+		// Every corner uses one index for all of its attributes: no remapping needed
+		out_vertices.swap(positions);
+		out_uvs.assign(nv, glm::vec2(0.0f));
+		out_normals.assign(nv, glm::vec3(0.0f));
+		for (const ObjCorner & c : corners){
+			out_indices.push_back((unsigned int)c.v);
+			if (c.vt >= 0) out_uvs[c.v] = uvs[c.vt];
+			if (c.vn >= 0) out_normals[c.v] = normals[c.vn];
 		}
+		return true;
+	}
 
+	CornerTable table(nv + nv / 2);
+	out_vertices.reserve(nv);
+	out_uvs.reserve(nv);
+	out_normals.reserve(nv);
+	for (const ObjCorner & c : corners){
+		bool inserted;
+		unsigned int index = table.findOrInsert(c, (unsigned int)out_vertices.size(), inserted);
+		if (inserted){
+			out_vertices.push_back(positions[c.v]);
+			out_uvs.push_back(c.vt >= 0 ? uvs[c.vt] : glm::vec2(0.0f));
+			out_normals.push_back(c.vn >= 0 ? normals[c.vn] : glm::vec3(0.0f));
+		}
+		out_indices.push_back(index);
 	}
+	return true;
+}
 
-	// For each vertex of each triangle
-	for( unsigned int i=0; i<vertexIndices.size(); i++ ){
-
-		// Get the indices of its attributes
-		unsigned int vertexIndex = vertexIndices[i];
-		unsigned int uvIndex = uvIndices[i];
-		unsigned int normalIndex = normalIndices[i];
-		
-		// Get the attributes thanks to the index
-		glm::vec3 vertex = temp_vertices[ vertexIndex-1 ];
-		glm::vec2 uv = temp_uvs[ uvIndex-1 ];
-		glm::vec3 normal = temp_normals[ normalIndex-1 ];
-		
-		// Put the attributes in buffers
-		out_vertices.push_back(vertex);
-		out_uvs     .push_back(uv);
-		out_normals .push_back(normal);
-	
+bool loadOBJ(
+	const char * path, 
+	std::vector<glm::vec3> & out_vertices, 
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals
+){
+	std::vector<unsigned int> indices;
+	std::vector<glm::vec3> vertices, normals;
+	std::vector<glm::vec2> uvs;
+	if (!loadOBJIndexed(path, indices, vertices, uvs, normals))
+		return false;
+
+	out_vertices.reserve(out_vertices.size() + indices.size());
+	out_uvs.reserve(out_uvs.size() + indices.size());
+	out_normals.reserve(out_normals.size() + indices.size());
+	for (unsigned int i : indices){
+		out_vertices.push_back(vertices[i]);
+		out_uvs     .push_back(uvs[i]);
+		out_normals .push_back(normals[i]);
 	}
-	fclose(file);
 	return true;
 }
 
@@ -1,6 +1,21 @@
 #ifndef OBJLOADER_H
 #define OBJLOADER_H
 
+// Loads an OBJ file as indexed geometry with 32 bit indices.
+// The file is memory mapped and parsed in parallel, one line-aligned chunk
+// per thread. Every face form is accepted (v, v/vt, v//vn, v/vt/vn, with
+// negative relative indices) and polygons are triangulated as fans.
+// Each distinct v/vt/vn combination becomes one output vertex; attributes
+// the file does not provide are zero. V is flipped for DDS textures, like loadOBJ.
+bool loadOBJIndexed(
+	const char * path,
+	std::vector<unsigned int> & out_indices,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals
+);
+
+// Same data as loadOBJIndexed, expanded to three vertices per triangle.
 bool loadOBJ(
 	const char * path, 
 	std::vector<glm::vec3> & out_vertices, 
@@ -0,0 +1,41 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// Number of threads worth using for CPU bound work on this machine.
+inline unsigned int workerThreadCount(){
+	unsigned int n = std::thread::hardware_concurrency();
+	return n == 0 ? 1 : n;
+}
+
+// Splits [0, count) into contiguous ranges of at least minChunk elements and
+// calls f(begin, end) for each of them, one range per thread. The calling
+// thread takes the first range. Returns once every range is done.
+template <typename F>
+void parallelFor(size_t count, size_t minChunk, F f){
+	if (count == 0)
+		return;
+	size_t maxChunks = (count + std::max<size_t>(minChunk, 1) - 1) / std::max<size_t>(minChunk, 1);
+	size_t chunks = std::min<size_t>(workerThreadCount(), maxChunks);
+	if (chunks <= 1){
+		f(size_t(0), count);
+		return;
+	}
+
+	std::vector<std::thread> threads;
+	threads.reserve(chunks - 1);
+	for (size_t c = 1; c < chunks; c++){
+		size_t begin = count * c / chunks;
+		size_t end = count * (c + 1) / chunks;
+		threads.emplace_back([&f, begin, end](){ f(begin, end); });
+	}
+	f(size_t(0), count / chunks);
+	for (auto & t : threads)
+		t.join();
+}
+
+#endif
@@ -1,110 +1,323 @@
 #include <stdio.h>
 #include <string>
 #include <vector>
-#include <iostream>
-#include <fstream>
+#include <filesystem>
+#include <system_error>
+#include <thread>
+#include <chrono>
 #include <algorithm>
 using namespace std;
 
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 
 #include <GL/glew.h>
 
+#include <glfw3.h>
+
 #include "shader.hpp"
 
-GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path){
+#ifndef GL_MAX_SHADER_COMPILER_THREADS_KHR
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
 
-	// Create the shaders
-	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
-
-	// Read the Vertex Shader code from the file
-	std::string VertexShaderCode;
-	std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
-	if(VertexShaderStream.is_open()){
-		std::string Line = "";
-		while(getline(VertexShaderStream, Line))
-			VertexShaderCode += "\n" + Line;
-		VertexShaderStream.close();
-	}else{
-		printf("Impossible to open %s. Are you in the right directory ? Don't forget to read the FAQ !\n", vertex_file_path);
-		getchar();
-		return 0;
+static std::string ShaderCacheDirectory = "shadercache";
+
+void setShaderCacheDirectory(const char * directory){
+	ShaderCacheDirectory = directory;
+}
+
+// Whole file in one read; false if it cannot be opened
+static bool readTextFile(const char * path, std::string & text){
+	FILE * file = fopen(path, "rb");
+	if (!file)
+		return false;
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	text.resize(size > 0 ? (size_t)size : 0);
+	size_t read = text.empty() ? 0 : fread(&text[0], 1, text.size(), file);
+	fclose(file);
+	text.resize(read);
+	return true;
+}
+
+// Defines go right after "#version ...", which must stay the first line
+static std::string insertDefines(const std::string & source, const char * defines){
+	if (!defines || !*defines)
+		return source;
+	size_t versionLine = source.find("#version");
+	size_t insertAt = 0;
+	if (versionLine != std::string::npos){
+		insertAt = source.find('\n', versionLine);
+		insertAt = insertAt == std::string::npos ? source.size() : insertAt + 1;
 	}
+	std::string text = source.substr(0, insertAt);
+	if (!text.empty() && text.back() != '\n')
+		text += '\n';
+	text += defines;
+	if (text.back() != '\n')
+		text += '\n';
+	return text + source.substr(insertAt);
+}
 
-	// Read the Fragment Shader code from the file
-	std::string FragmentShaderCode;
-	std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
-	if(FragmentShaderStream.is_open()){
-		std::string Line = "";
-		while(getline(FragmentShaderStream, Line))
-			FragmentShaderCode += "\n" + Line;
-		FragmentShaderStream.close();
+static uint64_t fnv1a(uint64_t hash, const void * data, size_t size){
+	const unsigned char * bytes = (const unsigned char *)data;
+	for (size_t i = 0; i < size; i++){
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
 	}
+	return hash;
+}
+
+static uint64_t fnv1a(uint64_t hash, const char * text){
+	// The terminator goes in too, so "ab"+"c" and "a"+"bc" differ
+	return fnv1a(hash, text ? text : "", text ? strlen(text) + 1 : 1);
+}
+
+static bool hasExtension(const char * name){
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; i++){
+		const char * extension = (const char *)glGetStringi(GL_EXTENSIONS, i);
+		if (extension && strcmp(extension, name) == 0)
+			return true;
+	}
+	return false;
+}
+
+// Asks the driver for background compile threads. Returns true if the
+// GL_COMPLETION_STATUS queries are available.
+static bool enableParallelCompile(){
+	typedef void (GLAPIENTRY * MaxThreadsProc)(GLuint count);
+	MaxThreadsProc maxThreads = NULL;
+	if (hasExtension("GL_KHR_parallel_shader_compile"))
+		maxThreads = (MaxThreadsProc)glfwGetProcAddress("glMaxShaderCompilerThreadsKHR");
+	else if (hasExtension("GL_ARB_parallel_shader_compile"))
+		maxThreads = (MaxThreadsProc)glfwGetProcAddress("glMaxShaderCompilerThreadsARB");
+	if (!maxThreads)
+		return false;
+	maxThreads(0xFFFFFFFFu); // as many as the implementation likes
+	return true;
+}
+
+static bool programBinariesSupported(){
+	if (ShaderCacheDirectory.empty() || !glGetProgramBinary || !glProgramBinary)
+		return false;
+	GLint formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	return formats > 0;
+}
+
+// Cache file: header followed by the driver's binary
+struct ProgramBinaryHeader {
+	char magic[4];        // "PGMB"
+	uint32_t version;
+	uint64_t key;
+	uint32_t binaryFormat;
+	uint32_t length;
+};
+static const uint32_t ProgramBinaryVersion = 1;
+
+static std::string binaryPath(uint64_t key){
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+	return ShaderCacheDirectory + "/" + name;
+}
+
+static GLuint loadProgramBinary(uint64_t key){
+	FILE * file = fopen(binaryPath(key).c_str(), "rb");
+	if (!file)
+		return 0;
+	ProgramBinaryHeader header;
+	std::vector<char> binary;
+	bool ok = fread(&header, sizeof(header), 1, file) == 1
+		&& memcmp(header.magic, "PGMB", 4) == 0
+		&& header.version == ProgramBinaryVersion
+		&& header.key == key;
+	if (ok){
+		binary.resize(header.length);
+		ok = fread(binary.data(), 1, binary.size(), file) == binary.size();
+	}
+	fclose(file);
+	if (!ok)
+		return 0;
 
+	GLuint ProgramID = glCreateProgram();
+	glProgramBinary(ProgramID, header.binaryFormat, binary.data(), (GLsizei)binary.size());
 	GLint Result = GL_FALSE;
-	int InfoLogLength;
+	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
+	if (Result != GL_TRUE){
+		// E.g. a driver update the version string did not reveal; compile from source instead
+		printf("Cached program binary rejected, recompiling\n");
+		glDeleteProgram(ProgramID);
+		return 0;
+	}
+	return ProgramID;
+}
 
+static void storeProgramBinary(uint64_t key, GLuint ProgramID){
+	GLint length = 0;
+	glGetProgramiv(ProgramID, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+	ProgramBinaryHeader header;
+	memcpy(header.magic, "PGMB", 4);
+	header.version = ProgramBinaryVersion;
+	header.key = key;
+	std::vector<char> binary(length);
+	GLenum format = 0;
+	glGetProgramBinary(ProgramID, length, NULL, &format, binary.data());
+	header.binaryFormat = format;
+	header.length = (uint32_t)length;
 
-	// Compile Vertex Shader
-	printf("Compiling shader : %s\n", vertex_file_path);
-	char const * VertexSourcePointer = VertexShaderCode.c_str();
-	glShaderSource(VertexShaderID, 1, &VertexSourcePointer , NULL);
-	glCompileShader(VertexShaderID);
+	std::error_code ec;
+	std::filesystem::create_directories(ShaderCacheDirectory, ec);
+	std::string path = binaryPath(key);
+	std::string tmp = path + ".tmp";
+	FILE * file = fopen(tmp.c_str(), "wb");
+	if (!file)
+		return;
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+		&& fwrite(binary.data(), 1, binary.size(), file) == binary.size();
+	ok = fclose(file) == 0 && ok;
+	if (ok)
+		std::filesystem::rename(tmp, path, ec);
+	if (!ok || ec)
+		std::remove(tmp.c_str());
+}
 
-	// Check Vertex Shader
-	glGetShaderiv(VertexShaderID, GL_COMPILE_STATUS, &Result);
-	glGetShaderiv(VertexShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+static void printShaderLog(GLuint ShaderID){
+	int InfoLogLength;
+	glGetShaderiv(ShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
 	if ( InfoLogLength > 0 ){
-		std::vector<char> VertexShaderErrorMessage(InfoLogLength+1);
-		glGetShaderInfoLog(VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
-		printf("%s\n", &VertexShaderErrorMessage[0]);
+		std::vector<char> ShaderErrorMessage(InfoLogLength+1);
+		glGetShaderInfoLog(ShaderID, InfoLogLength, NULL, &ShaderErrorMessage[0]);
+		printf("%s\n", &ShaderErrorMessage[0]);
 	}
+}
 
+struct PendingProgram {
+	size_t index;
+	uint64_t key;
+	GLuint VertexShaderID;
+	GLuint FragmentShaderID;
+	GLuint ProgramID;
+};
 
+void LoadShaderPrograms(const ShaderProgramDesc * descs, size_t count, GLuint * programs){
 
-	// Compile Fragment Shader
-	printf("Compiling shader : %s\n", fragment_file_path);
-	char const * FragmentSourcePointer = FragmentShaderCode.c_str();
-	glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer , NULL);
-	glCompileShader(FragmentShaderID);
+	bool useCache = programBinariesSupported();
 
-	// Check Fragment Shader
-	glGetShaderiv(FragmentShaderID, GL_COMPILE_STATUS, &Result);
-	glGetShaderiv(FragmentShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	if ( InfoLogLength > 0 ){
-		std::vector<char> FragmentShaderErrorMessage(InfoLogLength+1);
-		glGetShaderInfoLog(FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
-		printf("%s\n", &FragmentShaderErrorMessage[0]);
+	// The driver identity is part of every key: binaries are only valid for the driver that made them
+	uint64_t driverHash = 14695981039346656037ull;
+	driverHash = fnv1a(driverHash, (const char *)glGetString(GL_VENDOR));
+	driverHash = fnv1a(driverHash, (const char *)glGetString(GL_RENDERER));
+	driverHash = fnv1a(driverHash, (const char *)glGetString(GL_VERSION));
+
+	std::vector<PendingProgram> pending;
+	std::vector<std::string> vertexSources(count), fragmentSources(count);
+	for (size_t i = 0; i < count; i++){
+		programs[i] = 0;
+		std::string VertexShaderCode, FragmentShaderCode;
+		if (!readTextFile(descs[i].vertex_file_path, VertexShaderCode)){
+			printf("Impossible to open %s. Are you in the right directory ? Don't forget to read the FAQ !\n", descs[i].vertex_file_path);
+			continue;
+		}
+		if (!readTextFile(descs[i].fragment_file_path, FragmentShaderCode)){
+			printf("Impossible to open %s. Are you in the right directory ? Don't forget to read the FAQ !\n", descs[i].fragment_file_path);
+			continue;
+		}
+		vertexSources[i] = insertDefines(VertexShaderCode, descs[i].defines);
+		fragmentSources[i] = insertDefines(FragmentShaderCode, descs[i].defines);
+
+		uint64_t key = fnv1a(driverHash, vertexSources[i].c_str());
+		key = fnv1a(key, fragmentSources[i].c_str());
+
+		if (useCache && (programs[i] = loadProgramBinary(key)) != 0){
+			printf("Loaded cached program : %s + %s\n", descs[i].vertex_file_path, descs[i].fragment_file_path);
+			continue;
+		}
+		PendingProgram p = { i, key, 0, 0, 0 };
+		pending.push_back(p);
 	}
+	if (pending.empty())
+		return;
 
+	// Issue every compile and link first; with parallel compile the driver
+	// works on all of them while we get to the next one
+	bool parallel = enableParallelCompile();
+	for (PendingProgram & p : pending){
+		printf("Compiling shader : %s\n", descs[p.index].vertex_file_path);
+		p.VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
+		char const * VertexSourcePointer = vertexSources[p.index].c_str();
+		glShaderSource(p.VertexShaderID, 1, &VertexSourcePointer , NULL);
+		glCompileShader(p.VertexShaderID);
 
+		printf("Compiling shader : %s\n", descs[p.index].fragment_file_path);
+		p.FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+		char const * FragmentSourcePointer = fragmentSources[p.index].c_str();
+		glShaderSource(p.FragmentShaderID, 1, &FragmentSourcePointer , NULL);
+		glCompileShader(p.FragmentShaderID);
 
-	// Link the program
-	printf("Linking program\n");
-	GLuint ProgramID = glCreateProgram();
-	glAttachShader(ProgramID, VertexShaderID);
-	glAttachShader(ProgramID, FragmentShaderID);
-	glLinkProgram(ProgramID);
+		p.ProgramID = glCreateProgram();
+		glAttachShader(p.ProgramID, p.VertexShaderID);
+		glAttachShader(p.ProgramID, p.FragmentShaderID);
+		if (useCache)
+			glProgramParameteri(p.ProgramID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		glLinkProgram(p.ProgramID);
+	}
 
-	// Check the program
-	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
-	glGetProgramiv(ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	if ( InfoLogLength > 0 ){
-		std::vector<char> ProgramErrorMessage(InfoLogLength+1);
-		glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
-		printf("%s\n", &ProgramErrorMessage[0]);
+	if (parallel){
+		// Status queries would block; poll until the driver is done with all of them
+		for (;;){
+			bool complete = true;
+			for (const PendingProgram & p : pending){
+				GLint done = GL_FALSE;
+				glGetProgramiv(p.ProgramID, GL_COMPLETION_STATUS_KHR, &done);
+				complete = complete && done == GL_TRUE;
+			}
+			if (complete)
+				break;
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
 	}
 
-	
-	glDetachShader(ProgramID, VertexShaderID);
-	glDetachShader(ProgramID, FragmentShaderID);
-	
-	glDeleteShader(VertexShaderID);
-	glDeleteShader(FragmentShaderID);
+	for (const PendingProgram & p : pending){
+		printShaderLog(p.VertexShaderID);
+		printShaderLog(p.FragmentShaderID);
 
-	return ProgramID;
+		// Check the program
+		GLint Result = GL_FALSE;
+		int InfoLogLength;
+		glGetProgramiv(p.ProgramID, GL_LINK_STATUS, &Result);
+		glGetProgramiv(p.ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+		if ( InfoLogLength > 0 ){
+			std::vector<char> ProgramErrorMessage(InfoLogLength+1);
+			glGetProgramInfoLog(p.ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
+			printf("%s\n", &ProgramErrorMessage[0]);
+		}
+
+		glDetachShader(p.ProgramID, p.VertexShaderID);
+		glDetachShader(p.ProgramID, p.FragmentShaderID);
+
+		glDeleteShader(p.VertexShaderID);
+		glDeleteShader(p.FragmentShaderID);
+
+		if (Result == GL_TRUE && useCache)
+			storeProgramBinary(p.key, p.ProgramID);
+		programs[p.index] = p.ProgramID;
+	}
 }
 
+GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path){
 
+	ShaderProgramDesc desc = { vertex_file_path, fragment_file_path, NULL };
+	GLuint ProgramID = 0;
+	LoadShaderPrograms(&desc, 1, &ProgramID);
+	if (ProgramID == 0)
+		getchar();
+	return ProgramID;
+}
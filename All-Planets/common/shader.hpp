@@ -1,6 +1,28 @@
 #ifndef SHADER_HPP
 #define SHADER_HPP
 
+#include <cstddef>
+
+// One program to build: vertex + fragment shader file, plus optional lines
+// ("#define X 1\n...") inserted right after the #version line.
+struct ShaderProgramDesc {
+	const char * vertex_file_path;
+	const char * fragment_file_path;
+	const char * defines;
+};
+
 GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path);
 
+// Builds count programs at once. A linked binary from an earlier run is used
+// when the shader sources, defines and driver are unchanged and the driver
+// accepts it; everything else is compiled, with KHR/ARB_parallel_shader_compile
+// when available so the driver compiles all misses concurrently, and its
+// binary is stored for the next run. programs[i] is 0 if a shader file cannot
+// be read.
+void LoadShaderPrograms(const ShaderProgramDesc * descs, size_t count, GLuint * programs);
+
+// Directory of the program binary cache, "shadercache" by default. An empty
+// string disables the cache.
+void setShaderCacheDirectory(const char * directory);
+
 #endif
@@ -0,0 +1,49 @@
+#ifndef TEXT_PARSE_HPP
+#define TEXT_PARSE_HPP
+
+#include <charconv>
+#include <cstdlib>
+#include <system_error>
+
+// Number parsing helpers for text formats (ASCII STL, OBJ) that are read
+// straight out of a mapped file, i.e. from buffers that are not null
+// terminated. Both advance p past the number on success.
+
+inline bool isBlank(char c){
+	return c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
+}
+
+inline bool isSpace(char c){
+	return isBlank(c) || c == '\n';
+}
+
+inline bool parseFloat(const char *& p, const char * end, float & out){
+	if (p < end && *p == '+') p++;
+#if defined(__cpp_lib_to_chars)
+	std::from_chars_result result = std::from_chars(p, end, out);
+	if (result.ec != std::errc()) return false;
+	p = result.ptr;
+	return true;
+#else
+	// No floating point from_chars: copy the token so strtof sees a terminator.
+	char buf[64];
+	size_t n = 0;
+	while (p + n < end && n < sizeof(buf) - 1 && !isSpace(p[n]) && p[n] != '/'){ buf[n] = p[n]; n++; }
+	buf[n] = '\0';
+	char * stop;
+	out = std::strtof(buf, &stop);
+	if (stop == buf) return false;
+	p += stop - buf;
+	return true;
+#endif
+}
+
+inline bool parseInt(const char *& p, const char * end, long & out){
+	if (p < end && *p == '+') p++;
+	std::from_chars_result result = std::from_chars(p, end, out);
+	if (result.ec != std::errc()) return false;
+	p = result.ptr;
+	return true;
+}
+
+#endif
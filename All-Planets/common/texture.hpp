@@ -1,6 +1,11 @@
 #ifndef TEXTURE_HPP
 #define TEXTURE_HPP
 
+#include "image.hpp"
+
+// Creates a mipmapped, trilinear filtered texture from a decoded BMP
+GLuint uploadBMP(const BMPImage & image);
+
 // Load a .BMP file using our custom loader
 GLuint loadBMP_custom(const char * imagepath);
 
@@ -9,7 +14,14 @@ GLuint loadBMP_custom(const char * imagepath);
 //// Load a .TGA file using GLFW's own loader
 //GLuint loadTGA_glfw(const char * imagepath);
 
-// Load a .DDS file using GLFW's own loader
+// OpenGL internal format for a block compressed format
+GLenum compressedFormat(BlockFormat format, bool srgb);
+
+// Creates a texture from a block compressed image, using the mip chain stored
+// in it as is (no runtime mipmap generation)
+GLuint uploadDDS(const DDSImage & image);
+
+// Load a .DDS file using our custom loader
 GLuint loadDDS(const char * imagepath);
 
 
@@ -0,0 +1,442 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "texture_bake.hpp"
+#include "texture_bake_kernels.h"
+#include "parallel.hpp"
+
+#include <playground/mesh_simd.h>
+
+
+void bmpToRGBA(const BMPImage & bmp, RGBAImage & image){
+	image.width = bmp.width;
+	image.height = bmp.height;
+	image.pixels.resize(size_t(bmp.width) * bmp.height * 4);
+	// BMP rows are padded to 4 bytes
+	size_t stride = (size_t(bmp.width) * 3 + 3) & ~size_t(3);
+	if (bmp.data.size() < stride * bmp.height)
+		stride = size_t(bmp.width) * 3;
+	for (unsigned int y = 0; y < bmp.height; y++){
+		const unsigned char * src = bmp.data.data() + y * stride;
+		unsigned char * dst = image.pixels.data() + size_t(y) * bmp.width * 4;
+		for (unsigned int x = 0; x < bmp.width; x++){
+			dst[4*x+0] = src[3*x+2];
+			dst[4*x+1] = src[3*x+1];
+			dst[4*x+2] = src[3*x+0];
+			dst[4*x+3] = 255;
+		}
+	}
+}
+
+
+// sRGB <-> linear conversion tables
+struct SRGBTables {
+	float toLinear[256];
+	unsigned char toSRGB[4096]; // indexed by linear value * 4095
+
+	SRGBTables(){
+		for (int i = 0; i < 256; i++){
+			float c = i / 255.0f;
+			toLinear[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+		}
+		for (int i = 0; i < 4096; i++){
+			float l = i / 4095.0f;
+			float c = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+			toSRGB[i] = (unsigned char)std::min(255.0f, c * 255.0f + 0.5f);
+		}
+	}
+};
+
+static const SRGBTables & srgbTables(){
+	static const SRGBTables tables;
+	return tables;
+}
+
+void buildMipChain(const RGBAImage & base, bool srgb, std::vector<RGBAImage> & chain){
+	const SRGBTables & tables = srgbTables();
+	chain.assign(1, base);
+	while (chain.back().width > 1 || chain.back().height > 1){
+		const RGBAImage & src = chain.back();
+		RGBAImage dst;
+		dst.width = std::max(1u, src.width / 2);
+		dst.height = std::max(1u, src.height / 2);
+		dst.pixels.resize(size_t(dst.width) * dst.height * 4);
+
+		parallelFor(dst.height, 16, [&](size_t begin, size_t end){
+			for (size_t y = begin; y < end; y++){
+				// Odd sizes: the last row/column is repeated rather than read out of bounds
+				const unsigned char * row0 = src.pixels.data() + std::min<size_t>(2*y, src.height - 1) * src.width * 4;
+				const unsigned char * row1 = src.pixels.data() + std::min<size_t>(2*y + 1, src.height - 1) * src.width * 4;
+				unsigned char * out = dst.pixels.data() + y * dst.width * 4;
+				for (size_t x = 0; x < dst.width; x++){
+					size_t x0 = std::min<size_t>(2*x, src.width - 1) * 4;
+					size_t x1 = std::min<size_t>(2*x + 1, src.width - 1) * 4;
+					for (int c = 0; c < 3; c++){
+						if (srgb){
+							float l = tables.toLinear[row0[x0+c]] + tables.toLinear[row0[x1+c]]
+								+ tables.toLinear[row1[x0+c]] + tables.toLinear[row1[x1+c]];
+							out[4*x+c] = tables.toSRGB[int(l * (4095.0f / 4.0f) + 0.5f)];
+						}
+						else{
+							out[4*x+c] = (unsigned char)((row0[x0+c] + row0[x1+c] + row1[x0+c] + row1[x1+c] + 2) / 4);
+						}
+					}
+					out[4*x+3] = (unsigned char)((row0[x0+3] + row0[x1+3] + row1[x0+3] + row1[x1+3] + 2) / 4);
+				}
+			}
+		});
+		chain.push_back(std::move(dst));
+	}
+}
+
+
+using bake_detail::BlockChannels;
+using bake_detail::KernelTable;
+
+static const KernelTable & scalarKernels(){
+	static const KernelTable table = bake_detail::makeKernelTable<mesh::simd_detail::f32x1>();
+	return table;
+}
+
+static const KernelTable * sse2Kernels(){
+#ifdef MESH_SIMD_SSE2
+	static const KernelTable table = bake_detail::makeKernelTable<mesh::simd_detail::f32x4>();
+	return &table;
+#else
+	return nullptr;
+#endif
+}
+
+// Follows the level the mesh kernels run at (mesh::set_simd_level)
+static const KernelTable & kernels(){
+	return mesh::simd_select(scalarKernels(), sse2Kernels(), bake_detail::avx2Kernels());
+}
+
+static void loadBlock(const unsigned char * rgba, BlockChannels & block){
+	for (int i = 0; i < 16; i++)
+		for (int c = 0; c < 4; c++)
+			block.c[c][i] = rgba[4*i+c];
+}
+
+// Principal axis of the 16 block pixels over the first n channels. Endpoints
+// are the extreme projections onto it, lo and hi, as floats in 0..255.
+static void principalEndpoints(const KernelTable & k, const BlockChannels & block, int n, float * lo, float * hi){
+	float mean[4], minC[4], maxC[4];
+	float cov[4][4];
+	k.statistics(block, n, mean, minC, maxC, cov);
+
+	// Power iteration, starting from the bounding box diagonal
+	float axis[4];
+	for (int c = 0; c < n; c++)
+		axis[c] = maxC[c] - minC[c];
+	for (int iteration = 0; iteration < 8; iteration++){
+		float next[4];
+		float length = 0;
+		for (int a = 0; a < n; a++){
+			next[a] = 0;
+			for (int b = 0; b < n; b++)
+				next[a] += cov[a][b] * axis[b];
+			length = std::max(length, std::fabs(next[a]));
+		}
+		if (length < 1e-6f)
+			break;
+		for (int c = 0; c < n; c++)
+			axis[c] = next[c] / length;
+	}
+	float axisLength = 0;
+	for (int c = 0; c < n; c++)
+		axisLength += axis[c] * axis[c];
+	if (axisLength < 1e-12f){
+		// Flat block
+		for (int c = 0; c < n; c++)
+			lo[c] = hi[c] = mean[c];
+		return;
+	}
+
+	float minT, maxT;
+	k.projectRange(block, n, mean, axis, minT, maxT);
+	for (int c = 0; c < n; c++){
+		lo[c] = mean[c] + axis[c] * minT / axisLength;
+		hi[c] = mean[c] + axis[c] * maxT / axisLength;
+		// Inset by 1/16 of the range: the extremes are rarely hit exactly
+		float inset = (hi[c] - lo[c]) / 16.0f;
+		lo[c] = std::min(255.0f, std::max(0.0f, lo[c] + inset));
+		hi[c] = std::min(255.0f, std::max(0.0f, hi[c] - inset));
+	}
+}
+
+static inline int quantize(float v, int maxValue){
+	return std::min(maxValue, std::max(0, int(v * maxValue / 255.0f + 0.5f)));
+}
+
+static inline uint16_t pack565(const float * c){
+	return uint16_t((quantize(c[0], 31) << 11) | (quantize(c[1], 63) << 5) | quantize(c[2], 31));
+}
+
+static inline void unpack565(uint16_t v, int * c){
+	int r = (v >> 11) & 31, g = (v >> 5) & 63, b = v & 31;
+	c[0] = (r << 3) | (r >> 2);
+	c[1] = (g << 2) | (g >> 4);
+	c[2] = (b << 3) | (b >> 2);
+}
+
+static inline void store16(unsigned char * out, uint16_t v){
+	out[0] = (unsigned char)(v & 0xFF);
+	out[1] = (unsigned char)(v >> 8);
+}
+
+// BC1 colour block, always in 4 colour mode (color0 > color1) so no index
+// means transparent. Also the colour half of BC3.
+static void encodeColorBlock(const unsigned char * rgba, unsigned char * out){
+	const KernelTable & k = kernels();
+	BlockChannels block;
+	loadBlock(rgba, block);
+	float lo[3], hi[3];
+	principalEndpoints(k, block, 3, lo, hi);
+	uint16_t c0 = pack565(hi), c1 = pack565(lo);
+	if (c0 < c1)
+		std::swap(c0, c1);
+	store16(out, c0);
+	store16(out + 2, c1);
+
+	uint32_t indices = 0;
+	if (c0 != c1){
+		int ends[2][3];
+		unpack565(c0, ends[0]);
+		unpack565(c1, ends[1]);
+		float palette[4][4];
+		for (int c = 0; c < 3; c++){
+			palette[0][c] = float(ends[0][c]);
+			palette[1][c] = float(ends[1][c]);
+			palette[2][c] = float((2 * ends[0][c] + ends[1][c]) / 3);
+			palette[3][c] = float((ends[0][c] + 2 * ends[1][c]) / 3);
+		}
+		int best[16];
+		k.nearest(block, 3, palette, 4, best);
+		for (int i = 0; i < 16; i++)
+			indices |= uint32_t(best[i]) << (2 * i);
+	}
+	for (int b = 0; b < 4; b++)
+		out[4 + b] = (unsigned char)(indices >> (8 * b));
+}
+
+// BC3 alpha block in 8 value mode (alpha0 > alpha1)
+static void encodeAlphaBlock(const unsigned char * rgba, unsigned char * out){
+	int minA = 255, maxA = 0;
+	for (int i = 0; i < 16; i++){
+		minA = std::min(minA, int(rgba[4*i+3]));
+		maxA = std::max(maxA, int(rgba[4*i+3]));
+	}
+	out[0] = (unsigned char)maxA;
+	out[1] = (unsigned char)minA;
+
+	uint64_t indices = 0;
+	if (maxA != minA){
+		for (int i = 0; i < 16; i++){
+			// Position between alpha1 (0) and alpha0 (7), then the BC3 index for it
+			int p = ((rgba[4*i+3] - minA) * 14 + (maxA - minA)) / (2 * (maxA - minA));
+			int index = p == 7 ? 0 : p == 0 ? 1 : 8 - p;
+			indices |= uint64_t(index) << (3 * i);
+		}
+	}
+	for (int b = 0; b < 6; b++)
+		out[2 + b] = (unsigned char)(indices >> (8 * b));
+}
+
+void encodeBC1Block(const unsigned char * rgba, unsigned char * out){
+	encodeColorBlock(rgba, out);
+}
+
+void encodeBC3Block(const unsigned char * rgba, unsigned char * out){
+	encodeAlphaBlock(rgba, out);
+	encodeColorBlock(rgba, out + 8);
+}
+
+
+// Little endian bit writer for the 128 bit BC7 block
+struct BlockBits {
+	unsigned char * out;
+	int position;
+
+	explicit BlockBits(unsigned char * block) : out(block), position(0){
+		memset(out, 0, 16);
+	}
+	void write(unsigned int value, int count){
+		for (int i = 0; i < count; i++, position++)
+			if (value & (1u << i))
+				out[position >> 3] |= (unsigned char)(1u << (position & 7));
+	}
+};
+
+// BC7 mode 6: one subset, 7.7.7.7 endpoints with a p-bit each, 4 bit indices.
+// Covers RGBA in one mode and is a good fit for smooth photographic maps.
+void encodeBC7Block(const unsigned char * rgba, unsigned char * out){
+	static const int weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	const KernelTable & k = kernels();
+	BlockChannels block;
+	loadBlock(rgba, block);
+	float ends[2][4];
+	principalEndpoints(k, block, 4, ends[0], ends[1]);
+
+	// Quantise each endpoint to 7 bits + shared p-bit, picking the p-bit with less error
+	int q[2][4], pbit[2];
+	int endpoint[2][4];
+	for (int e = 0; e < 2; e++){
+		float bestError = 1e30f;
+		for (int p = 0; p < 2; p++){
+			float error = 0;
+			int candidate[4];
+			for (int c = 0; c < 4; c++){
+				candidate[c] = std::min(127, std::max(0, int((ends[e][c] - p) / 2.0f + 0.5f)));
+				float d = float((candidate[c] << 1) | p) - ends[e][c];
+				error += d * d;
+			}
+			if (error < bestError){
+				bestError = error;
+				pbit[e] = p;
+				for (int c = 0; c < 4; c++)
+					q[e][c] = candidate[c];
+			}
+		}
+		for (int c = 0; c < 4; c++)
+			endpoint[e][c] = (q[e][c] << 1) | pbit[e];
+	}
+
+	float palette[16][4];
+	for (int i = 0; i < 16; i++)
+		for (int c = 0; c < 4; c++)
+			palette[i][c] = float(((64 - weights[i]) * endpoint[0][c] + weights[i] * endpoint[1][c] + 32) >> 6);
+
+	int indices[16];
+	k.nearest(block, 4, palette, 16, indices);
+
+	// The anchor (first) index is stored without its top bit, so it must be < 8
+	if (indices[0] & 8){
+		for (int c = 0; c < 4; c++)
+			std::swap(q[0][c], q[1][c]);
+		std::swap(pbit[0], pbit[1]);
+		for (int i = 0; i < 16; i++)
+			indices[i] = 15 - indices[i];
+	}
+
+	BlockBits bits(out);
+	bits.write(1 << 6, 7); // mode 6
+	for (int c = 0; c < 4; c++){
+		bits.write(q[0][c], 7);
+		bits.write(q[1][c], 7);
+	}
+	bits.write(pbit[0], 1);
+	bits.write(pbit[1], 1);
+	bits.write(indices[0], 3);
+	for (int i = 1; i < 16; i++)
+		bits.write(indices[i], 4);
+}
+
+
+void compressImage(const RGBAImage & image, BlockFormat format, std::vector<unsigned char> & blocks){
+	size_t blocksX = (image.width + 3) / 4;
+	size_t blocksY = (image.height + 3) / 4;
+	size_t bytes = blockBytes(format);
+	blocks.resize(blocksX * blocksY * bytes);
+
+	parallelFor(blocksY, 4, [&](size_t begin, size_t end){
+		unsigned char block[64];
+		for (size_t by = begin; by < end; by++){
+			for (size_t bx = 0; bx < blocksX; bx++){
+				for (size_t y = 0; y < 4; y++){
+					size_t sy = std::min<size_t>(by * 4 + y, image.height - 1);
+					for (size_t x = 0; x < 4; x++){
+						size_t sx = std::min<size_t>(bx * 4 + x, image.width - 1);
+						memcpy(block + (y * 4 + x) * 4, image.pixels.data() + (sy * image.width + sx) * 4, 4);
+					}
+				}
+				unsigned char * out = blocks.data() + (by * blocksX + bx) * bytes;
+				switch (format){
+				case BLOCK_BC1: encodeBC1Block(block, out); break;
+				case BLOCK_BC3: encodeBC3Block(block, out); break;
+				default:        encodeBC7Block(block, out); break;
+				}
+			}
+		}
+	});
+}
+
+void bakeTexture(const std::vector<RGBAImage> & chain, BlockFormat format, bool srgb, DDSImage & out){
+	out.width = chain.empty() ? 0 : chain[0].width;
+	out.height = chain.empty() ? 0 : chain[0].height;
+	out.format = format;
+	out.srgb = srgb;
+	out.levels.clear();
+	out.data.clear();
+
+	std::vector<unsigned char> blocks;
+	for (const RGBAImage & level : chain){
+		compressImage(level, format, blocks);
+		DDSLevel l;
+		l.width = level.width;
+		l.height = level.height;
+		l.offset = out.data.size();
+		l.size = blocks.size();
+		out.levels.push_back(l);
+		out.data.insert(out.data.end(), blocks.begin(), blocks.end());
+	}
+}
+
+
+// OpenGL enums for the KTX header, spelled out so this file needs no GL headers
+#define KTX_GL_RGB                                  0x1907
+#define KTX_GL_RGBA                                 0x1908
+#define KTX_GL_COMPRESSED_RGB_S3TC_DXT1_EXT         0x83F0
+#define KTX_GL_COMPRESSED_RGBA_S3TC_DXT3_EXT        0x83F2
+#define KTX_GL_COMPRESSED_RGBA_S3TC_DXT5_EXT        0x83F3
+#define KTX_GL_COMPRESSED_SRGB_S3TC_DXT1_EXT        0x8C4C
+#define KTX_GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT  0x8C4E
+#define KTX_GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT  0x8C4F
+#define KTX_GL_COMPRESSED_RGBA_BPTC_UNORM           0x8E8C
+#define KTX_GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM     0x8E8D
+
+bool writeKTX(const char * imagepath, const DDSImage & image){
+	static const unsigned char identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+	uint32_t internalFormat;
+	switch (image.format){
+	case BLOCK_BC1: internalFormat = image.srgb ? KTX_GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : KTX_GL_COMPRESSED_RGB_S3TC_DXT1_EXT; break;
+	case BLOCK_BC2: internalFormat = image.srgb ? KTX_GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT : KTX_GL_COMPRESSED_RGBA_S3TC_DXT3_EXT; break;
+	case BLOCK_BC3: internalFormat = image.srgb ? KTX_GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : KTX_GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; break;
+	default:        internalFormat = image.srgb ? KTX_GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM : KTX_GL_COMPRESSED_RGBA_BPTC_UNORM; break;
+	}
+
+	uint32_t header[13] = {
+		0x04030201,            // endianness
+		0, 1, 0,               // glType, glTypeSize, glFormat: compressed
+		internalFormat,
+		uint32_t(image.format == BLOCK_BC1 ? KTX_GL_RGB : KTX_GL_RGBA),
+		image.width, image.height, 0,
+		0, 1,                  // array elements, faces
+		uint32_t(image.levels.size()),
+		0                      // no key/value data
+	};
+
+	FILE * fp = fopen(imagepath, "wb");
+	if (fp == NULL){
+		printf("%s could not be opened for writing\n", imagepath);
+		return false;
+	}
+	bool ok = fwrite(identifier, sizeof(identifier), 1, fp) == 1 && fwrite(header, sizeof(header), 1, fp) == 1;
+	// Block sizes are multiples of 8 bytes, so no mip padding is needed
+	for (size_t i = 0; ok && i < image.levels.size(); i++){
+		const DDSLevel & l = image.levels[i];
+		uint32_t size = uint32_t(l.size);
+		ok = fwrite(&size, sizeof(size), 1, fp) == 1
+			&& fwrite(image.data.data() + l.offset, 1, l.size, fp) == l.size;
+	}
+	ok = fclose(fp) == 0 && ok;
+	if (!ok)
+		printf("Could not write %s\n", imagepath);
+	return ok;
+}
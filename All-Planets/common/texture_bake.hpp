@@ -0,0 +1,45 @@
+#ifndef TEXTURE_BAKE_HPP
+#define TEXTURE_BAKE_HPP
+
+#include <vector>
+
+#include "image.hpp"
+
+// Offline texture processing used by the texbake tool: mip chain generation
+// and BC1/BC3/BC7 block compression. CPU only.
+
+// 8 bit RGBA pixels, rows in the same order as the source image
+struct RGBAImage {
+	unsigned int width;
+	unsigned int height;
+	std::vector<unsigned char> pixels;
+};
+
+// Expands a 24 bit BMP to RGBA with opaque alpha. Rows stay bottom-up, which
+// is what glTexImage2D was given for the BMP, so existing UVs map the same.
+void bmpToRGBA(const BMPImage & bmp, RGBAImage & image);
+
+// Builds the full mip chain down to 1x1 with a 2x2 box filter, level 0 being
+// a copy of base. With srgb set, colour is averaged in linear light (alpha is
+// always linear), so mips of bright/dark detail do not darken.
+void buildMipChain(const RGBAImage & base, bool srgb, std::vector<RGBAImage> & chain);
+
+// Encodes one 4x4 block of RGBA pixels (row major, 64 bytes).
+void encodeBC1Block(const unsigned char * rgba, unsigned char * out);
+void encodeBC3Block(const unsigned char * rgba, unsigned char * out);
+void encodeBC7Block(const unsigned char * rgba, unsigned char * out);
+
+// Block compresses one image (BC1, BC3 or BC7). Rows of blocks are spread
+// over all hardware threads, and within a block the endpoint fit and the
+// palette search run on SSE2/AVX2 when the mesh kernels do (see
+// mesh::set_simd_level); every level writes the same blocks, give or take
+// float rounding in the fit. Partial edge blocks repeat the last row/column.
+void compressImage(const RGBAImage & image, BlockFormat format, std::vector<unsigned char> & blocks);
+
+// Compresses every level of chain into one DDSImage.
+void bakeTexture(const std::vector<RGBAImage> & chain, BlockFormat format, bool srgb, DDSImage & out);
+
+// Writes a baked texture as KTX 1.1 (the same blocks and mip chain as writeDDS).
+bool writeKTX(const char * imagepath, const DDSImage & image);
+
+#endif
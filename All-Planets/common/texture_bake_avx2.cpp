@@ -0,0 +1,20 @@
+// AVX2/FMA instantiation of the BC encoder kernels. This unit is compiled
+// with -mavx2 -mfma (/arch:AVX2), and texture_bake.cpp only calls into it
+// when the mesh kernels run at the AVX2 level, which checks the CPU supports
+// both.
+#include "texture_bake_kernels.h"
+
+namespace bake_detail {
+
+#ifdef MESH_SIMD_AVX2
+	const KernelTable * avx2Kernels(){
+		static const KernelTable table = makeKernelTable<mesh::simd_detail::f32x8>();
+		return &table;
+	}
+#else
+	const KernelTable * avx2Kernels(){
+		return nullptr;
+	}
+#endif
+
+}
@@ -0,0 +1,137 @@
+#ifndef TEXTURE_BAKE_KERNELS_H
+#define TEXTURE_BAKE_KERNELS_H
+
+// Per block loops of the BC encoders, written against the vector interface
+// of playground/mesh_simd_kernels.h and instantiated per instruction set the
+// same way: a vector holds one channel of several of the 16 block pixels.
+// Only texture_bake.cpp and texture_bake_avx2.cpp include this.
+
+#include <playground/mesh_simd_kernels.h>
+
+namespace bake_detail {
+
+	// A 4x4 block, one array of 16 pixels per channel (RGBA, 0..255)
+	struct BlockChannels {
+		float c[4][16];
+	};
+
+	// All work on the first n channels of a block. Pixel values, palette
+	// entries and squared distances are whole numbers well below 2^24, so
+	// nearest() is exact and agrees between instruction sets; the sums of
+	// statistics() may round differently.
+	struct KernelTable {
+		size_t width;
+		// Per channel mean, min and max, and the covariance matrix
+		void (*statistics)(const BlockChannels & block, int n, float * mean, float * minC, float * maxC, float (*cov)[4]);
+		// Smallest and largest projection of (pixel - mean) onto axis
+		void (*projectRange)(const BlockChannels & block, int n, const float * mean, const float * axis,
+			float & minT, float & maxT);
+		// For every pixel, the first of the count palette entries at the
+		// smallest squared distance
+		void (*nearest)(const BlockChannels & block, int n, const float (*palette)[4], int count, int * indices);
+	};
+
+	// Defined in texture_bake_avx2.cpp; null when that unit was built without AVX2.
+	const KernelTable * avx2Kernels();
+
+	namespace {
+
+		template <typename V>
+		float sumLanes(typename V::reg a){
+			float lanes[16];
+			V::store(lanes, a);
+			float sum = 0.0f;
+			for (size_t k = 0; k < V::width; k++)
+				sum += lanes[k];
+			return sum;
+		}
+
+		template <typename V>
+		void statisticsKernel(const BlockChannels & block, int n, float * mean, float * minC, float * maxC, float (*cov)[4]){
+			typedef typename V::reg reg;
+			for (int c = 0; c < n; c++){
+				reg sum = V::splat(0.0f), lo = V::splat(255.0f), hi = V::splat(0.0f);
+				for (size_t i = 0; i < 16; i += V::width){
+					reg v = V::load(block.c[c] + i);
+					sum = V::add(sum, v);
+					lo = V::min(v, lo);
+					hi = V::max(v, hi);
+				}
+				mean[c] = sumLanes<V>(sum) / 16.0f;
+				minC[c] = 255.0f;
+				maxC[c] = 0.0f;
+				V::reduce(lo, minC[c], maxC[c]);
+				V::reduce(hi, minC[c], maxC[c]);
+			}
+
+			reg acc[4][4];
+			for (int a = 0; a < n; a++)
+				for (int b = a; b < n; b++)
+					acc[a][b] = V::splat(0.0f);
+			for (size_t i = 0; i < 16; i += V::width){
+				reg d[4];
+				for (int c = 0; c < n; c++)
+					d[c] = V::sub(V::load(block.c[c] + i), V::splat(mean[c]));
+				for (int a = 0; a < n; a++)
+					for (int b = a; b < n; b++)
+						acc[a][b] = V::madd(d[a], d[b], acc[a][b]);
+			}
+			for (int a = 0; a < n; a++)
+				for (int b = a; b < n; b++)
+					cov[a][b] = cov[b][a] = sumLanes<V>(acc[a][b]);
+		}
+
+		template <typename V>
+		void projectRangeKernel(const BlockChannels & block, int n, const float * mean, const float * axis,
+				float & minT, float & maxT){
+			typedef typename V::reg reg;
+			minT = 1e30f;
+			maxT = -1e30f;
+			for (size_t i = 0; i < 16; i += V::width){
+				reg t = V::splat(0.0f);
+				for (int c = 0; c < n; c++)
+					t = V::madd(V::sub(V::load(block.c[c] + i), V::splat(mean[c])), V::splat(axis[c]), t);
+				V::reduce(t, minT, maxT);
+			}
+		}
+
+		template <typename V>
+		void nearestKernel(const BlockChannels & block, int n, const float (*palette)[4], int count, int * indices){
+			typedef typename V::reg reg;
+			for (size_t i = 0; i < 16; i += V::width){
+				reg v[4];
+				for (int c = 0; c < n; c++)
+					v[c] = V::load(block.c[c] + i);
+				reg bestError = V::splat(1e30f), best = V::splat(0.0f);
+				for (int p = 0; p < count; p++){
+					reg error = V::splat(0.0f);
+					for (int c = 0; c < n; c++){
+						reg d = V::sub(v[c], V::splat(palette[p][c]));
+						error = V::madd(d, d, error);
+					}
+					// Strictly less: ties keep the lower index
+					typename V::mask closer = V::less(error, bestError);
+					bestError = V::select(closer, error, bestError);
+					best = V::select(closer, V::splat(float(p)), best);
+				}
+				float lanes[16];
+				V::store(lanes, best);
+				for (size_t k = 0; k < V::width; k++)
+					indices[i + k] = int(lanes[k]);
+			}
+		}
+
+		template <typename V>
+		KernelTable makeKernelTable(){
+			KernelTable table;
+			table.width = V::width;
+			table.statistics = statisticsKernel<V>;
+			table.projectRange = projectRangeKernel<V>;
+			table.nearest = nearestKernel<V>;
+			return table;
+		}
+
+	}
+}
+
+#endif
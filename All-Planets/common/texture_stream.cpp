@@ -0,0 +1,130 @@
+#include <stdio.h>
+
+#include <algorithm>
+
+#include "texture_stream.hpp"
+#include "texture.hpp"
+
+
+DDSStream::DDSStream() : dataOffset(0), format(0), textureID(0), nextLevel(-1), rowsDone(0)
+{
+	image.width = image.height = 0;
+	image.format = BLOCK_BC1;
+	image.srgb = false;
+}
+
+size_t DDSStream::totalBytes() const {
+	if (image.levels.empty())
+		return 0;
+	return image.levels.back().offset + image.levels.back().size;
+}
+
+bool DDSStream::open(const char * path, bool prefetch){
+	if (!file.open(path)){
+		printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", path);
+		return false;
+	}
+	if (!parseDDSHeader(file.data(), file.size(), image, dataOffset)){
+		printf("%s: not a supported DDS file\n", path);
+		file.close();
+		return false;
+	}
+	size_t end = dataOffset + totalBytes();
+	if (file.size() < end){
+		printf("%s: DDS file is truncated\n", path);
+		file.close();
+		return false;
+	}
+
+	format = compressedFormat(image.format, image.srgb);
+	nextLevel = (int)image.levels.size() - 1;
+	rowsDone = 0;
+
+	if (prefetch){
+		file.adviseSequential();
+		unsigned char touched = 0;
+		for (size_t i = dataOffset; i < end; i += 4096)
+			touched ^= file.data()[i];
+		// Keep the loop from being optimised away
+		volatile unsigned char sink = touched;
+		(void)sink;
+	}
+	return true;
+}
+
+GLuint DDSStream::begin(size_t tailBytes){
+	glGenTextures(1, &textureID);
+	glBindTexture(GL_TEXTURE_2D, textureID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, image.levels.size() > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, nextLevel);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, nextLevel);
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	size_t uploaded = 0;
+	do {
+		const DDSLevel & l = image.levels[nextLevel];
+		glCompressedTexImage2D(GL_TEXTURE_2D, nextLevel, format, l.width, l.height, 0,
+			(GLsizei)l.size, file.data() + dataOffset + l.offset);
+		uploaded += l.size;
+		finishLevel();
+	} while (!done() && uploaded + image.levels[nextLevel].size <= tailBytes);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+	return textureID;
+}
+
+size_t DDSStream::step(size_t budgetBytes){
+	if (done())
+		return 0;
+
+	glBindTexture(GL_TEXTURE_2D, textureID);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	size_t uploaded = 0;
+	while (!done()){
+		const DDSLevel & l = image.levels[nextLevel];
+		const unsigned char * data = file.data() + dataOffset + l.offset;
+		size_t remaining = budgetBytes > uploaded ? budgetBytes - uploaded : 0;
+
+		// A level that fits goes up in one call
+		if (rowsDone == 0 && l.size <= remaining){
+			glCompressedTexImage2D(GL_TEXTURE_2D, nextLevel, format, l.width, l.height, 0, (GLsizei)l.size, data);
+			uploaded += l.size;
+			finishLevel();
+			continue;
+		}
+
+		// Otherwise in strips of whole block rows
+		unsigned int blockRows = (l.height + 3) / 4;
+		size_t rowBytes = l.size / blockRows;
+		size_t rows = std::min<size_t>(blockRows - rowsDone, remaining / rowBytes);
+		if (rows == 0){
+			if (uploaded > 0)
+				break;
+			rows = 1;
+		}
+		if (rowsDone == 0)
+			glCompressedTexImage2D(GL_TEXTURE_2D, nextLevel, format, l.width, l.height, 0, (GLsizei)l.size, NULL);
+		unsigned int y = rowsDone * 4;
+		unsigned int h = std::min<unsigned int>((unsigned int)rows * 4, l.height - y);
+		glCompressedTexSubImage2D(GL_TEXTURE_2D, nextLevel, 0, y, l.width, h, format,
+			(GLsizei)(rows * rowBytes), data + rowsDone * rowBytes);
+		uploaded += rows * rowBytes;
+		rowsDone += (unsigned int)rows;
+		if (rowsDone == blockRows)
+			finishLevel();
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	return uploaded;
+}
+
+void DDSStream::finishLevel(){
+	// The texture is bound; sampling may now use this level
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, nextLevel);
+	nextLevel--;
+	rowsDone = 0;
+	if (done())
+		file.close();
+}
@@ -0,0 +1,61 @@
+#ifndef TEXTURE_STREAM_HPP
+#define TEXTURE_STREAM_HPP
+
+#include <GL/glew.h>
+
+#include <cstddef>
+
+#include "image.hpp"
+#include "mapped_file.hpp"
+
+// Uploads a .DDS mip chain over several frames, smallest levels first.
+//
+// begin() creates the texture and uploads the mip tail right away, so the
+// texture can be sampled on the first frame (blurry). Each step() then
+// uploads more of the next larger level, in strips of block rows, within a
+// byte budget. GL_TEXTURE_BASE_LEVEL is lowered whenever a level is
+// complete, so sampling never touches a level that is still incomplete.
+//
+// open() does no GL calls and can run on a worker thread; begin() and step()
+// must run on the thread that owns the GL context. The texture belongs to the
+// caller; the stream never deletes it.
+class DDSStream {
+public:
+	DDSStream();
+
+	DDSStream(const DDSStream &) = delete;
+	DDSStream & operator=(const DDSStream &) = delete;
+
+	// Maps the file and parses its header. With prefetch set, every page of
+	// the mip data is touched once, so step() does not wait on the disk.
+	bool open(const char * path, bool prefetch = false);
+
+	// Creates the texture and uploads the smallest levels while their total
+	// stays within tailBytes (always at least the smallest level).
+	GLuint begin(size_t tailBytes);
+
+	// Uploads up to budgetBytes of the remaining levels (always at least one
+	// block row). Returns the number of bytes uploaded.
+	size_t step(size_t budgetBytes);
+
+	bool done() const { return nextLevel < 0; }
+	GLuint texture() const { return textureID; }
+	// Finest level uploaded so far (the current GL_TEXTURE_BASE_LEVEL)
+	int baseLevel() const { return nextLevel + 1; }
+	// Size of the whole chain once streamed
+	size_t totalBytes() const;
+	const DDSImage & layout() const { return image; }
+
+private:
+	void finishLevel();
+
+	MappedFile file;
+	DDSImage image; // levels only, the data stays in the mapping
+	size_t dataOffset;
+	GLenum format;
+	GLuint textureID;
+	int nextLevel;        // level being streamed, -1 when done
+	unsigned int rowsDone; // block rows of nextLevel already uploaded
+};
+
+#endif
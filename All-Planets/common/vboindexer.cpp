@@ -1,143 +1,291 @@
 #include <vector>
-#include <map>
+#include <cmath>
+#include <cstdint>
+#include <limits>
 
 #include <glm/glm.hpp>
 
 #include "vboindexer.hpp"
 
-#include <string.h> // for memcmp
+#include <string.h> // for memcpy
 
+namespace {
 
-// Returns true iif v1 can be considered equal to v2
-bool is_near(float v1, float v2){
-	return fabs( v1-v2 ) < 0.01f;
+// Position, UV and normal of one vertex as raw float bits
+struct VertexKey {
+	uint32_t k[8];
+	bool operator==(const VertexKey & o) const { return memcmp(k, o.k, sizeof(k)) == 0; }
+};
+
+// Raw float bits, with -0 folded onto +0
+uint32_t floatBits(float v){
+	v += 0.0f;
+	uint32_t bits;
+	memcpy(&bits, &v, sizeof(bits));
+	return bits;
 }
 
-// Searches through all already-exported vertices
-// for a similar one.
-// Similar = same position + same UVs + same normal
-bool getSimilarVertexIndex( 
-	glm::vec3 & in_vertex, 
-	glm::vec2 & in_uv, 
-	glm::vec3 & in_normal, 
-	std::vector<glm::vec3> & out_vertices,
-	std::vector<glm::vec2> & out_uvs,
-	std::vector<glm::vec3> & out_normals,
-	unsigned short & result
+// Grid cell of a scaled coordinate, clamped to the int32 range
+uint32_t gridCell(double scaled){
+	double cell = std::floor(scaled);
+	if (!(cell > -2147483648.0)) cell = -2147483648.0; // also catches NaN
+	if (cell > 2147483647.0) cell = 2147483647.0;
+	return (uint32_t)(int32_t)cell;
+}
+
+uint64_t hashWords(const uint32_t * k, int count){
+	uint64_t h = 0x9E3779B97F4A7C15ull;
+	for (int i = 0; i < count; i++)
+		h = (h ^ k[i]) * 0xFF51AFD7ED558CCDull;
+	return h ^ (h >> 32);
+}
+
+size_t tableCapacity(size_t count){
+	// Open addressing with linear probing, at most half full
+	size_t capacity = 16;
+	while (capacity < 2 * count) capacity *= 2;
+	return capacity;
+}
+
+const unsigned int empty = std::numeric_limits<unsigned int>::max();
+
+// Bit identical attributes: one hash lookup per vertex
+void weldExact(
+	const std::vector<glm::vec3> & in_vertices,
+	const std::vector<glm::vec2> & in_uvs,
+	const std::vector<glm::vec3> & in_normals,
+	std::vector<unsigned int> & remap,
+	std::vector<unsigned int> & firsts
+){
+	size_t count = in_vertices.size();
+	size_t capacity = tableCapacity(count);
+	std::vector<unsigned int> slots(capacity, empty);
+	std::vector<VertexKey> keys;
+
+	for (size_t i = 0; i < count; i++){
+		VertexKey key;
+		for (int c = 0; c < 3; c++) key.k[c]     = floatBits(in_vertices[i][c]);
+		for (int c = 0; c < 2; c++) key.k[3 + c] = floatBits(in_uvs[i][c]);
+		for (int c = 0; c < 3; c++) key.k[5 + c] = floatBits(in_normals[i][c]);
+
+		size_t slot = (size_t)hashWords(key.k, 8) & (capacity - 1);
+		while (slots[slot] != empty && !(keys[slots[slot]] == key))
+			slot = (slot + 1) & (capacity - 1);
+
+		if (slots[slot] == empty){
+			slots[slot] = (unsigned int)firsts.size();
+			firsts.push_back((unsigned int)i);
+			keys.push_back(key);
+		}
+		remap[i] = slots[slot];
+	}
+}
+
+// With a tolerance a vertex merges into the first output vertex whose every
+// attribute is within epsilon of its own, as the original linear search did.
+// Output vertices are binned by position in a grid of cells 2 * epsilon
+// wide, so such a vertex lies in the input's cell or, along each axis, the
+// cell on the nearer side: 8 cells to look at, wherever the borders fall.
+void weldNear(
+	const std::vector<glm::vec3> & in_vertices,
+	const std::vector<glm::vec2> & in_uvs,
+	const std::vector<glm::vec3> & in_normals,
+	float epsilon,
+	std::vector<unsigned int> & remap,
+	std::vector<unsigned int> & firsts
 ){
-	// Lame linear search
-	for ( unsigned int i=0; i<out_vertices.size(); i++ ){
-		if (
-			is_near( in_vertex.x , out_vertices[i].x ) &&
-			is_near( in_vertex.y , out_vertices[i].y ) &&
-			is_near( in_vertex.z , out_vertices[i].z ) &&
-			is_near( in_uv.x     , out_uvs     [i].x ) &&
-			is_near( in_uv.y     , out_uvs     [i].y ) &&
-			is_near( in_normal.x , out_normals [i].x ) &&
-			is_near( in_normal.y , out_normals [i].y ) &&
-			is_near( in_normal.z , out_normals [i].z )
-		){
-			result = i;
-			return true;
+	struct Cell {
+		uint32_t k[3];
+		unsigned int head; // last output vertex of the cell, chained by nextInCell
+	};
+	size_t count = in_vertices.size();
+	size_t capacity = tableCapacity(count);
+	std::vector<unsigned int> slots(capacity, empty);
+	std::vector<Cell> cells;
+	std::vector<unsigned int> nextInCell;
+	double inverseCell = 0.5 / epsilon;
+
+	auto findSlot = [&](const uint32_t k[3]){
+		size_t slot = (size_t)hashWords(k, 3) & (capacity - 1);
+		while (slots[slot] != empty && memcmp(cells[slots[slot]].k, k, sizeof(cells[0].k)) != 0)
+			slot = (slot + 1) & (capacity - 1);
+		return slot;
+	};
+	auto isNear = [&](size_t i, size_t j){
+		for (int c = 0; c < 3; c++) if (!(std::fabs(in_vertices[i][c] - in_vertices[j][c]) < epsilon)) return false;
+		for (int c = 0; c < 2; c++) if (!(std::fabs(in_uvs[i][c] - in_uvs[j][c]) < epsilon)) return false;
+		for (int c = 0; c < 3; c++) if (!(std::fabs(in_normals[i][c] - in_normals[j][c]) < epsilon)) return false;
+		return true;
+	};
+
+	for (size_t i = 0; i < count; i++){
+		uint32_t own[3], side[3];
+		for (int c = 0; c < 3; c++){
+			double scaled = in_vertices[i][c] * inverseCell;
+			own[c] = gridCell(scaled);
+			side[c] = scaled - std::floor(scaled) < 0.5 ? (uint32_t)-1 : 1u;
+		}
+
+		unsigned int match = empty;
+		for (int neighbour = 0; neighbour < 8; neighbour++){
+			uint32_t k[3];
+			for (int c = 0; c < 3; c++) k[c] = own[c] + (neighbour & (1 << c) ? side[c] : 0u);
+			size_t slot = findSlot(k);
+			if (slots[slot] == empty) continue;
+			for (unsigned int o = cells[slots[slot]].head; o != empty; o = nextInCell[o])
+				if (o < match && isNear(i, firsts[o])) match = o;
+		}
+
+		if (match == empty){
+			match = (unsigned int)firsts.size();
+			firsts.push_back((unsigned int)i);
+			size_t slot = findSlot(own);
+			if (slots[slot] == empty){
+				slots[slot] = (unsigned int)cells.size();
+				cells.push_back({ { own[0], own[1], own[2] }, empty });
+			}
+			nextInCell.push_back(cells[slots[slot]].head);
+			cells[slots[slot]].head = match;
 		}
+		remap[i] = match;
 	}
-	// No other vertex could be used instead.
-	// Looks like we'll have to add it to the VBO.
-	return false;
 }
 
-void indexVBO_slow(
+// Finds the output vertex of every input vertex. remap[i] is the output
+// vertex of input i, firsts[o] the first input vertex that became output o.
+void weldVertices(
+	const std::vector<glm::vec3> & in_vertices,
+	const std::vector<glm::vec2> & in_uvs,
+	const std::vector<glm::vec3> & in_normals,
+	float epsilon,
+	std::vector<unsigned int> & remap,
+	std::vector<unsigned int> & firsts
+){
+	remap.resize(in_vertices.size());
+	firsts.clear();
+	if (epsilon > 0.0f)
+		weldNear(in_vertices, in_uvs, in_normals, epsilon, remap, firsts);
+	else
+		weldExact(in_vertices, in_uvs, in_normals, remap, firsts);
+}
+
+template <typename Index>
+bool fits(size_t vertexCount){
+	return vertexCount == 0 || vertexCount - 1 <= std::numeric_limits<Index>::max();
+}
+
+void gather(const std::vector<glm::vec3> & in, const std::vector<unsigned int> & firsts, std::vector<glm::vec3> & out){
+	out.resize(firsts.size());
+	for (size_t o = 0; o < firsts.size(); o++) out[o] = in[firsts[o]];
+}
+
+void gather(const std::vector<glm::vec2> & in, const std::vector<unsigned int> & firsts, std::vector<glm::vec2> & out){
+	out.resize(firsts.size());
+	for (size_t o = 0; o < firsts.size(); o++) out[o] = in[firsts[o]];
+}
+
+void averageOver(const std::vector<glm::vec3> & in, const std::vector<unsigned int> & remap, size_t outCount, std::vector<glm::vec3> & out){
+	out.assign(outCount, glm::vec3(0.0f));
+	for (size_t i = 0; i < remap.size(); i++) out[remap[i]] += in[i];
+	for (size_t o = 0; o < outCount; o++){
+		float length = glm::length(out[o]);
+		if (length > 0.0f) out[o] /= length;
+	}
+}
+
+template <typename Index>
+void narrow(const std::vector<unsigned int> & remap, std::vector<Index> & out_indices){
+	out_indices.resize(remap.size());
+	for (size_t i = 0; i < remap.size(); i++) out_indices[i] = (Index)remap[i];
+}
+
+void narrow(const std::vector<unsigned int> & remap, size_t vertexCount, IndexBuffer & out_indices){
+	out_indices.indices16.clear();
+	out_indices.indices32.clear();
+	if (fits<unsigned short>(vertexCount))
+		narrow(remap, out_indices.indices16);
+	else
+		out_indices.indices32 = remap;
+}
+
+}
+
+template <typename Index>
+bool indexVBO(
 	std::vector<glm::vec3> & in_vertices,
 	std::vector<glm::vec2> & in_uvs,
 	std::vector<glm::vec3> & in_normals,
 
-	std::vector<unsigned short> & out_indices,
+	std::vector<Index> & out_indices,
 	std::vector<glm::vec3> & out_vertices,
 	std::vector<glm::vec2> & out_uvs,
-	std::vector<glm::vec3> & out_normals
+	std::vector<glm::vec3> & out_normals,
+	float epsilon
 ){
-	// For each input vertex
-	for ( unsigned int i=0; i<in_vertices.size(); i++ ){
-
-		// Try to find a similar vertex in out_XXXX
-		unsigned short index;
-		bool found = getSimilarVertexIndex(in_vertices[i], in_uvs[i], in_normals[i],     out_vertices, out_uvs, out_normals, index);
-
-		if ( found ){ // A similar vertex is already in the VBO, use it instead !
-			out_indices.push_back( index );
-		}else{ // If not, it needs to be added in the output data.
-			out_vertices.push_back( in_vertices[i]);
-			out_uvs     .push_back( in_uvs[i]);
-			out_normals .push_back( in_normals[i]);
-			out_indices .push_back( (unsigned short)out_vertices.size() - 1 );
-		}
+	std::vector<unsigned int> remap, firsts;
+	weldVertices(in_vertices, in_uvs, in_normals, epsilon, remap, firsts);
+	if (!fits<Index>(firsts.size())){
+		out_indices.clear(); out_vertices.clear(); out_uvs.clear(); out_normals.clear();
+		return false;
 	}
+	narrow(remap, out_indices);
+	gather(in_vertices, firsts, out_vertices);
+	gather(in_uvs, firsts, out_uvs);
+	gather(in_normals, firsts, out_normals);
+	return true;
 }
 
-struct PackedVertex{
-	glm::vec3 position;
-	glm::vec2 uv;
-	glm::vec3 normal;
-	bool operator<(const PackedVertex that) const{
-		return memcmp((void*)this, (void*)&that, sizeof(PackedVertex))>0;
-	};
-};
+void indexVBO(
+	std::vector<glm::vec3> & in_vertices,
+	std::vector<glm::vec2> & in_uvs,
+	std::vector<glm::vec3> & in_normals,
 
-bool getSimilarVertexIndex_fast( 
-	PackedVertex & packed, 
-	std::map<PackedVertex,unsigned short> & VertexToOutIndex,
-	unsigned short & result
+	IndexBuffer & out_indices,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals,
+	float epsilon
 ){
-	std::map<PackedVertex,unsigned short>::iterator it = VertexToOutIndex.find(packed);
-	if ( it == VertexToOutIndex.end() ){
-		return false;
-	}else{
-		result = it->second;
-		return true;
-	}
+	std::vector<unsigned int> remap, firsts;
+	weldVertices(in_vertices, in_uvs, in_normals, epsilon, remap, firsts);
+	narrow(remap, firsts.size(), out_indices);
+	gather(in_vertices, firsts, out_vertices);
+	gather(in_uvs, firsts, out_uvs);
+	gather(in_normals, firsts, out_normals);
 }
 
-void indexVBO(
+template <typename Index>
+bool indexVBO_TBN(
 	std::vector<glm::vec3> & in_vertices,
 	std::vector<glm::vec2> & in_uvs,
 	std::vector<glm::vec3> & in_normals,
+	std::vector<glm::vec3> & in_tangents,
+	std::vector<glm::vec3> & in_bitangents,
 
-	std::vector<unsigned short> & out_indices,
+	std::vector<Index> & out_indices,
 	std::vector<glm::vec3> & out_vertices,
 	std::vector<glm::vec2> & out_uvs,
-	std::vector<glm::vec3> & out_normals
+	std::vector<glm::vec3> & out_normals,
+	std::vector<glm::vec3> & out_tangents,
+	std::vector<glm::vec3> & out_bitangents,
+	float epsilon
 ){
-	std::map<PackedVertex,unsigned short> VertexToOutIndex;
-
-	// For each input vertex
-	for ( unsigned int i=0; i<in_vertices.size(); i++ ){
-
-		PackedVertex packed = {in_vertices[i], in_uvs[i], in_normals[i]};
-		
-
-		// Try to find a similar vertex in out_XXXX
-		unsigned short index;
-		bool found = getSimilarVertexIndex_fast( packed, VertexToOutIndex, index);
-
-		if ( found ){ // A similar vertex is already in the VBO, use it instead !
-			out_indices.push_back( index );
-		}else{ // If not, it needs to be added in the output data.
-			out_vertices.push_back( in_vertices[i]);
-			out_uvs     .push_back( in_uvs[i]);
-			out_normals .push_back( in_normals[i]);
-			unsigned short newindex = (unsigned short)out_vertices.size() - 1;
-			out_indices .push_back( newindex );
-			VertexToOutIndex[ packed ] = newindex;
-		}
+	std::vector<unsigned int> remap, firsts;
+	weldVertices(in_vertices, in_uvs, in_normals, epsilon, remap, firsts);
+	if (!fits<Index>(firsts.size())){
+		out_indices.clear(); out_vertices.clear(); out_uvs.clear(); out_normals.clear();
+		out_tangents.clear(); out_bitangents.clear();
+		return false;
 	}
+	narrow(remap, out_indices);
+	gather(in_vertices, firsts, out_vertices);
+	gather(in_uvs, firsts, out_uvs);
+	gather(in_normals, firsts, out_normals);
+	averageOver(in_tangents, remap, firsts.size(), out_tangents);
+	averageOver(in_bitangents, remap, firsts.size(), out_bitangents);
+	return true;
 }
 
-
-
-
-
-
-
 void indexVBO_TBN(
 	std::vector<glm::vec3> & in_vertices,
 	std::vector<glm::vec2> & in_uvs,
@@ -145,33 +293,32 @@ void indexVBO_TBN(
 	std::vector<glm::vec3> & in_tangents,
 	std::vector<glm::vec3> & in_bitangents,
 
-	std::vector<unsigned short> & out_indices,
+	IndexBuffer & out_indices,
 	std::vector<glm::vec3> & out_vertices,
 	std::vector<glm::vec2> & out_uvs,
 	std::vector<glm::vec3> & out_normals,
 	std::vector<glm::vec3> & out_tangents,
-	std::vector<glm::vec3> & out_bitangents
+	std::vector<glm::vec3> & out_bitangents,
+	float epsilon
 ){
-	// For each input vertex
-	for ( unsigned int i=0; i<in_vertices.size(); i++ ){
-
-		// Try to find a similar vertex in out_XXXX
-		unsigned short index;
-		bool found = getSimilarVertexIndex(in_vertices[i], in_uvs[i], in_normals[i],     out_vertices, out_uvs, out_normals, index);
-
-		if ( found ){ // A similar vertex is already in the VBO, use it instead !
-			out_indices.push_back( index );
-
-			// Average the tangents and the bitangents
-			out_tangents[index] += in_tangents[i];
-			out_bitangents[index] += in_bitangents[i];
-		}else{ // If not, it needs to be added in the output data.
-			out_vertices.push_back( in_vertices[i]);
-			out_uvs     .push_back( in_uvs[i]);
-			out_normals .push_back( in_normals[i]);
-			out_tangents .push_back( in_tangents[i]);
-			out_bitangents .push_back( in_bitangents[i]);
-			out_indices .push_back( (unsigned short)out_vertices.size() - 1 );
-		}
-	}
+	std::vector<unsigned int> remap, firsts;
+	weldVertices(in_vertices, in_uvs, in_normals, epsilon, remap, firsts);
+	narrow(remap, firsts.size(), out_indices);
+	gather(in_vertices, firsts, out_vertices);
+	gather(in_uvs, firsts, out_uvs);
+	gather(in_normals, firsts, out_normals);
+	averageOver(in_tangents, remap, firsts.size(), out_tangents);
+	averageOver(in_bitangents, remap, firsts.size(), out_bitangents);
 }
+
+// The two index types glDrawElements accepts besides GL_UNSIGNED_BYTE
+template bool indexVBO<unsigned short>(std::vector<glm::vec3> &, std::vector<glm::vec2> &, std::vector<glm::vec3> &,
+	std::vector<unsigned short> &, std::vector<glm::vec3> &, std::vector<glm::vec2> &, std::vector<glm::vec3> &, float);
+template bool indexVBO<unsigned int>(std::vector<glm::vec3> &, std::vector<glm::vec2> &, std::vector<glm::vec3> &,
+	std::vector<unsigned int> &, std::vector<glm::vec3> &, std::vector<glm::vec2> &, std::vector<glm::vec3> &, float);
+template bool indexVBO_TBN<unsigned short>(std::vector<glm::vec3> &, std::vector<glm::vec2> &, std::vector<glm::vec3> &,
+	std::vector<glm::vec3> &, std::vector<glm::vec3> &, std::vector<unsigned short> &, std::vector<glm::vec3> &,
+	std::vector<glm::vec2> &, std::vector<glm::vec3> &, std::vector<glm::vec3> &, std::vector<glm::vec3> &, float);
+template bool indexVBO_TBN<unsigned int>(std::vector<glm::vec3> &, std::vector<glm::vec2> &, std::vector<glm::vec3> &,
+	std::vector<glm::vec3> &, std::vector<glm::vec3> &, std::vector<unsigned int> &, std::vector<glm::vec3> &,
+	std::vector<glm::vec2> &, std::vector<glm::vec3> &, std::vector<glm::vec3> &, std::vector<glm::vec3> &, float);
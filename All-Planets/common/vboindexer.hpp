@@ -1,17 +1,77 @@
 #ifndef VBOINDEXER_HPP
 #define VBOINDEXER_HPP
 
+#include <cstddef>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Index buffer in the narrowest type that addresses every vertex: 16 bit up
+// to 65536 vertices, 32 bit beyond. Draw with GL_UNSIGNED_SHORT when
+// indexSize() is 2 and GL_UNSIGNED_INT when it is 4.
+struct IndexBuffer {
+	std::vector<unsigned short> indices16;
+	std::vector<unsigned int> indices32;
+
+	bool wide() const { return !indices32.empty(); }
+	size_t size() const { return wide() ? indices32.size() : indices16.size(); }
+	size_t indexSize() const { return wide() ? sizeof(unsigned int) : sizeof(unsigned short); }
+	const void * data() const { return wide() ? (const void *)indices32.data() : (const void *)indices16.data(); }
+};
+
+// Merges identical position/UV/normal triples into one vertex. Vertices are
+// looked up in an open addressing hash table, so the cost is linear in the
+// number of input vertices. With epsilon == 0 only bit identical attributes
+// (+0 and -0 alike) merge; otherwise a vertex merges into the first earlier
+// one whose every attribute differs from its own by less than epsilon,
+// found through a position grid whatever side of a cell border either is on.
+// Index is unsigned short or unsigned int. Returns false, leaving the
+// outputs empty, if the vertices do not fit that index type.
+template <typename Index>
+bool indexVBO(
+	std::vector<glm::vec3> & in_vertices,
+	std::vector<glm::vec2> & in_uvs,
+	std::vector<glm::vec3> & in_normals,
+
+	std::vector<Index> & out_indices,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals,
+	float epsilon = 0.0f
+);
+
+// Same, picking the index type from the number of vertices after merging.
 void indexVBO(
 	std::vector<glm::vec3> & in_vertices,
 	std::vector<glm::vec2> & in_uvs,
 	std::vector<glm::vec3> & in_normals,
 
-	std::vector<unsigned short> & out_indices,
+	IndexBuffer & out_indices,
 	std::vector<glm::vec3> & out_vertices,
 	std::vector<glm::vec2> & out_uvs,
-	std::vector<glm::vec3> & out_normals
+	std::vector<glm::vec3> & out_normals,
+	float epsilon = 0.0f
 );
 
+// indexVBO for normal mapped meshes. Tangents and bitangents do not take part
+// in the comparison; those of merged vertices are averaged (summed, then
+// normalized).
+template <typename Index>
+bool indexVBO_TBN(
+	std::vector<glm::vec3> & in_vertices,
+	std::vector<glm::vec2> & in_uvs,
+	std::vector<glm::vec3> & in_normals,
+	std::vector<glm::vec3> & in_tangents,
+	std::vector<glm::vec3> & in_bitangents,
+
+	std::vector<Index> & out_indices,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals,
+	std::vector<glm::vec3> & out_tangents,
+	std::vector<glm::vec3> & out_bitangents,
+	float epsilon = 0.01f
+);
 
 void indexVBO_TBN(
 	std::vector<glm::vec3> & in_vertices,
@@ -20,12 +80,13 @@ void indexVBO_TBN(
 	std::vector<glm::vec3> & in_tangents,
 	std::vector<glm::vec3> & in_bitangents,
 
-	std::vector<unsigned short> & out_indices,
+	IndexBuffer & out_indices,
 	std::vector<glm::vec3> & out_vertices,
 	std::vector<glm::vec2> & out_uvs,
 	std::vector<glm::vec3> & out_normals,
 	std::vector<glm::vec3> & out_tangents,
-	std::vector<glm::vec3> & out_bitangents
+	std::vector<glm::vec3> & out_bitangents,
+	float epsilon = 0.01f
 );
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,250 @@
+#include "AssetLoader.h"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+
+#include <common/parallel.hpp>
+#include <common/texture.hpp>
+#include <common/texture_stream.hpp>
+#include <playground/mesh_cache.h>
+
+AssetLoader::AssetLoader(unsigned int threads) : thread_count(threads), stopping(false), pending(0), placeholder_texture(0)
+{
+  if (thread_count == 0)
+    thread_count = std::max(1u, workerThreadCount() - 1);
+}
+
+AssetLoader::~AssetLoader()
+{
+  Shutdown();
+}
+
+void AssetLoader::StartWorkers()
+{
+  if (!workers.empty()) return;
+  stopping = false;
+  for (unsigned int i = 0; i < thread_count; i++)
+    workers.emplace_back(&AssetLoader::WorkerLoop, this);
+}
+
+void AssetLoader::WorkerLoop()
+{
+  for (;;) {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(job_mutex);
+      job_ready.wait(lock, [this]() { return stopping || !jobs.empty(); });
+      if (stopping) return;
+      job = std::move(jobs.front());
+      jobs.pop_front();
+    }
+    job();
+  }
+}
+
+void AssetLoader::Shutdown()
+{
+  {
+    std::lock_guard<std::mutex> lock(job_mutex);
+    stopping = true;
+    jobs.clear();
+  }
+  job_ready.notify_all();
+  for (auto& t : workers)
+    t.join();
+  workers.clear();
+
+  std::lock_guard<std::mutex> lock(upload_mutex);
+  uploads.clear();
+  pending = 0;
+  streams.clear();
+  mesh_waiters.clear();
+  texture_waiters.clear();
+  placeholder_mesh.reset();
+  if (placeholder_texture != 0) {
+    glDeleteTextures(1, &placeholder_texture);
+    placeholder_texture = 0;
+  }
+}
+
+void AssetLoader::QueueUpload(Job upload)
+{
+  std::lock_guard<std::mutex> lock(upload_mutex);
+  uploads.push_back(std::move(upload));
+}
+
+GLuint AssetLoader::PlaceholderTexture()
+{
+  if (placeholder_texture == 0) {
+    const GLubyte grey[3] = { 128, 128, 128 };
+    glGenTextures(1, &placeholder_texture);
+    glBindTexture(GL_TEXTURE_2D, placeholder_texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, grey);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  }
+  return placeholder_texture;
+}
+
+MeshHandle AssetLoader::PlaceholderMesh()
+{
+  if (!placeholder_mesh) {
+    placeholder_mesh = registry.LoadSphere(mesh::sphere_params(mesh::sphere_kind::uv, 1, 75.0f));
+  }
+  return placeholder_mesh;
+}
+
+void AssetLoader::RequestMesh(RenderingObject* target, const std::string& stl_path)
+{
+  // Loaded, keyed and uploaded in the format current at request time, even
+  // if SetVertexFormat changes it before the upload
+  mesh::vertex_format format = registry.VertexFormat();
+  std::string key = ResourceRegistry::MeshKey(stl_path, 150.0f, format, mesh::cache_optimized);
+  if (MeshHandle loaded = registry.FindMesh(key)) {
+    target->SetMesh(loaded);
+    if (!target->texture_present)
+      target->SetTextureID(PlaceholderTexture());
+    return;
+  }
+
+  // Something to draw on the very first frame
+  target->SetMesh(PlaceholderMesh());
+  if (!target->texture_present)
+    target->SetTextureID(PlaceholderTexture());
+
+  pending++;
+  auto waiting = mesh_waiters.find(key);
+  if (waiting != mesh_waiters.end()) {
+    // Already being loaded for another object
+    waiting->second.push_back(target->LoadHandle());
+    registry.CountMeshHit();
+    return;
+  }
+  mesh_waiters[key].push_back(target->LoadHandle());
+
+  StartWorkers();
+  {
+    std::lock_guard<std::mutex> lock(job_mutex);
+    jobs.push_back([this, key, stl_path, format]() {
+      std::shared_ptr<mesh::loaded_mesh> loaded = std::make_shared<mesh::loaded_mesh>();
+      bool ok = mesh::load_stl_mesh(stl_path, 150.0f, *loaded, format);
+      std::shared_ptr<const mesh::triangle_bvh> bvh = ok ? ResourceRegistry::BuildBvh(*loaded) : nullptr;
+      QueueUpload([this, key, format, loaded, ok, bvh]() {
+        std::vector<Waiter> targets;
+        targets.swap(mesh_waiters[key]);
+        mesh_waiters.erase(key);
+        if (ok) {
+          MeshHandle resource = registry.AddMesh(key, *loaded, format, bvh);
+          for (const Waiter& waiter : targets)
+            if (std::shared_ptr<RenderingObject*> target = waiter.lock())
+              (*target)->SetMesh(resource);
+        }
+        pending -= targets.size();
+      });
+    });
+  }
+  job_ready.notify_one();
+}
+
+void AssetLoader::RequestTexture(RenderingObject* target, const std::string& image_path)
+{
+  std::string key = ResourceRegistry::TextureKey(image_path);
+  if (TextureHandle loaded = registry.FindTexture(key)) {
+    target->SetTexture(loaded);
+    return;
+  }
+
+  if (!target->texture_present)
+    target->SetTextureID(PlaceholderTexture());
+
+  pending++;
+  auto waiting = texture_waiters.find(key);
+  if (waiting != texture_waiters.end()) {
+    waiting->second.push_back(target->LoadHandle());
+    registry.CountTextureHit();
+    return;
+  }
+  texture_waiters[key].push_back(target->LoadHandle());
+
+  StartWorkers();
+  {
+    std::lock_guard<std::mutex> lock(job_mutex);
+    jobs.push_back([this, key, image_path]() {
+      if (isDDSPath(image_path.c_str())) {
+        // Baked .dds: map it and warm the page cache here, stream the levels from the main thread
+        std::shared_ptr<DDSStream> stream = std::make_shared<DDSStream>();
+        bool ok = stream->open(image_path.c_str(), true);
+        QueueUpload([this, key, stream, ok]() {
+          TextureHandle resource;
+          if (ok) {
+            resource = registry.AdoptTexture(key, stream->begin(stream_tail_bytes), stream->totalBytes());
+            if (!stream->done())
+              streams.push_back(ActiveStream{ stream, resource });
+          }
+          FinishTexture(key, resource);
+        });
+        return;
+      }
+
+      std::shared_ptr<BMPImage> image = std::make_shared<BMPImage>();
+      bool ok = readBMP(image_path.c_str(), *image);
+      QueueUpload([this, key, image, ok]() {
+        FinishTexture(key, ok ? registry.AddTexture(key, *image) : TextureHandle());
+      });
+    });
+  }
+  job_ready.notify_one();
+}
+
+void AssetLoader::FinishTexture(const std::string& key, TextureHandle resource)
+{
+  std::vector<Waiter> targets;
+  targets.swap(texture_waiters[key]);
+  texture_waiters.erase(key);
+  if (resource) {
+    for (const Waiter& waiter : targets)
+      if (std::shared_ptr<RenderingObject*> target = waiter.lock())
+        (*target)->SetTexture(resource);
+  }
+  pending -= targets.size();
+}
+
+void AssetLoader::ProcessUploads(double budget_ms, size_t stream_bytes)
+{
+  typedef std::chrono::steady_clock clock;
+  clock::time_point start = clock::now();
+  for (;;) {
+    Job upload;
+    {
+      std::lock_guard<std::mutex> lock(upload_mutex);
+      if (uploads.empty()) break;
+      upload = std::move(uploads.front());
+      uploads.pop_front();
+    }
+    upload();
+    if (std::chrono::duration<double, std::milli>(clock::now() - start).count() >= budget_ms)
+      break;
+  }
+
+  // Finer mip levels of streamed textures, oldest request first
+  while (!streams.empty() && stream_bytes > 0) {
+    ActiveStream& active = streams.front();
+    size_t used = active.stream->step(stream_bytes);
+    stream_bytes -= std::min(used, stream_bytes);
+    if (!active.stream->done()) break;
+    streams.pop_front();
+  }
+}
+
+size_t AssetLoader::Streaming()
+{
+  return streams.size();
+}
+
+size_t AssetLoader::Pending()
+{
+  return pending;
+}
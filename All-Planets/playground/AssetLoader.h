@@ -0,0 +1,104 @@
+#ifndef ASSET_LOADER_H
+#define ASSET_LOADER_H
+
+#include <GL/glew.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "RenderingObject.h"
+#include "ResourceRegistry.h"
+
+class DDSStream;
+
+/**
+* Loads meshes and textures in the background.
+*
+* Worker threads do all file I/O, parsing and CPU processing (STL parsing, the
+* .pmesh cache, BMP decoding, DDS reading). Finished results are queued for
+* the main thread, which owns the GL context and uploads them from
+* ProcessUploads() within a per-frame time budget. Until its mesh arrives, every requested
+* object draws a coarse grey placeholder sphere.
+*
+* Requests go through the ResourceRegistry: a mesh or texture that is already
+* loaded, or already on its way, is shared instead of being loaded again.
+*/
+class AssetLoader
+{
+public:
+	// threads == 0: one worker per hardware thread, minus the render thread
+	explicit AssetLoader(unsigned int threads = 0);
+	virtual ~AssetLoader();
+
+	// Main thread. Gives target a placeholder right away and loads the STL in the background.
+	void RequestMesh(RenderingObject* target, const std::string& stl_path);
+	// Main thread. Decodes the BMP in the background; target keeps the placeholder
+	// texture until then. A baked .dds is streamed: its mip tail arrives first and
+	// the finer levels follow over the next frames.
+	void RequestTexture(RenderingObject* target, const std::string& image_path);
+
+	// Main thread, once per frame. Runs queued uploads until budget_ms is spent
+	// (at least one upload per call, so progress is always made), then streams
+	// up to stream_bytes of mip levels into partially uploaded .dds textures.
+	void ProcessUploads(double budget_ms, size_t stream_bytes = 4 << 20);
+
+	// Number of requests that have not been uploaded yet
+	size_t Pending();
+	// Number of .dds textures that are usable but still missing their finer levels
+	size_t Streaming();
+
+	// Main thread. Stops the workers and deletes the placeholder texture. Queued uploads are
+	// dropped; call before the GL context goes away.
+	void Shutdown();
+
+	ResourceRegistry& Registry() { return registry; }
+
+private:
+	typedef std::function<void()> Job;
+	typedef std::weak_ptr<RenderingObject*> Waiter; //<<< see RenderingObject::LoadHandle
+
+	void StartWorkers();
+	void WorkerLoop();
+	void QueueUpload(Job upload);
+	GLuint PlaceholderTexture();
+	MeshHandle PlaceholderMesh();
+	void FinishTexture(const std::string& key, TextureHandle resource);
+
+	struct ActiveStream {
+		std::shared_ptr<DDSStream> stream;
+		TextureHandle resource; //<<< keeps the texture alive until streaming is done
+	};
+	// Mip levels uploaded together with the first frame of a streamed texture
+	static const size_t stream_tail_bytes = 64 * 1024;
+
+	unsigned int thread_count;
+	std::vector<std::thread> workers;
+
+	std::mutex job_mutex;
+	std::condition_variable job_ready;
+	std::deque<Job> jobs;
+	bool stopping;
+
+	std::mutex upload_mutex;
+	std::deque<Job> uploads;
+
+	size_t pending; //<<< requests not uploaded yet, main thread only
+	GLuint placeholder_texture;
+	MeshHandle placeholder_mesh;
+
+	ResourceRegistry registry;
+	// Objects waiting for a resource that is being loaded, by registry key; those destroyed
+	// in the meantime have expired. Main thread only.
+	std::unordered_map<std::string, std::vector<Waiter>> mesh_waiters;
+	std::unordered_map<std::string, std::vector<Waiter>> texture_waiters;
+	std::deque<ActiveStream> streams; //<<< main thread only
+};
+
+#endif
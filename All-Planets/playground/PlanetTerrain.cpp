@@ -0,0 +1,216 @@
+#include "PlanetTerrain.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#include <common/parallel.hpp>
+#include <playground/RenderingObject.h>
+
+// Chunks queued for the workers at most; the rest are asked for again next frame
+static const size_t max_queued_chunks = 64;
+
+PlanetTerrain::PlanetTerrain(const terrain::planet_params& params, size_t capacity, unsigned int threads)
+  : params(params), capacity(std::max<size_t>(capacity, terrain::root_count)), thread_count(threads), format(mesh::packed_format()),
+    chunk_vertices(terrain::chunk_vertex_count(params.grid)), chunk_bytes(0), index_count(0), VertexArrayID(0),
+    vertexbuffer(0), indexbuffer(0), frame(0), stopping(false)
+{
+  if (thread_count == 0)
+    thread_count = std::max(1u, workerThreadCount() - 1);
+  chunk_bytes = chunk_vertices * mesh::layout_of(format).stride;
+}
+
+PlanetTerrain::~PlanetTerrain()
+{
+  // The GL objects must go in Shutdown, while there still is a context
+  StopWorkers();
+}
+
+void PlanetTerrain::Initialize(const std::string& heightmap_path)
+{
+  if (!heightmap_path.empty() && !heights.load_bmp(heightmap_path))
+    printf("No heightmap %s, terrain relief is procedural\n", heightmap_path.c_str());
+
+  std::vector<uint32_t> indices;
+  terrain::chunk_indices(params.grid, indices);
+  index_count = (GLsizei)indices.size();
+
+  glGenVertexArrays(1, &VertexArrayID);
+  glBindVertexArray(VertexArrayID);
+  glGenBuffers(1, &vertexbuffer);
+  glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
+  glBufferData(GL_ARRAY_BUFFER, capacity * chunk_bytes, nullptr, GL_DYNAMIC_DRAW);
+  RenderingObject::BindInterleavedAttributes(format);
+  glGenBuffers(1, &indexbuffer);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexbuffer);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint32_t), indices.data(), GL_STATIC_DRAW);
+  glBindVertexArray(0);
+
+  // The roots are always there to fall back on
+  for (uint32_t i = 0; i < terrain::root_count; i++) {
+    BuiltChunk root;
+    Build(terrain::root_chunk(i), root);
+    Upload(root, UINT64_MAX);
+  }
+  StartWorkers();
+}
+
+void PlanetTerrain::StartWorkers()
+{
+  if (!workers.empty()) return;
+  stopping = false;
+  for (unsigned int i = 0; i < thread_count; i++)
+    workers.emplace_back(&PlanetTerrain::WorkerLoop, this);
+}
+
+void PlanetTerrain::StopWorkers()
+{
+  {
+    std::lock_guard<std::mutex> lock(job_mutex);
+    stopping = true;
+    jobs.clear();
+  }
+  job_ready.notify_all();
+  for (auto& t : workers)
+    t.join();
+  workers.clear();
+}
+
+void PlanetTerrain::WorkerLoop()
+{
+  for (;;) {
+    terrain::chunk_key key;
+    {
+      std::unique_lock<std::mutex> lock(job_mutex);
+      job_ready.wait(lock, [this]() { return stopping || !jobs.empty(); });
+      if (stopping) return;
+      key = jobs.front();
+      jobs.pop_front();
+    }
+    BuiltChunk chunk;
+    Build(key, chunk);
+    std::lock_guard<std::mutex> lock(built_mutex);
+    built.push_back(std::move(chunk));
+  }
+}
+
+void PlanetTerrain::Build(const terrain::chunk_key& key, BuiltChunk& out) const
+{
+  terrain::chunk_mesh chunk;
+  terrain::build_chunk(params, &heights, key, chunk);
+  mesh::packed_vertices packed;
+  mesh::pack_vertices(chunk.vertices.data(), chunk.vertices.size(), format, glm::vec3(0.0f), glm::vec3(0.0f), packed);
+  out.key = key;
+  out.origin = chunk.origin;
+  out.bounds = chunk.bounds;
+  out.data.swap(packed.data);
+}
+
+int PlanetTerrain::FreeSlot()
+{
+  if (slots.size() < capacity) {
+    slots.push_back(Slot());
+    return (int)slots.size() - 1;
+  }
+  // Least recently used, but nothing the last frame needed
+  int oldest = -1;
+  for (size_t s = 0; s < slots.size(); s++)
+    if (slots[s].last_used < frame && (oldest < 0 || slots[s].last_used < slots[oldest].last_used))
+      oldest = (int)s;
+  if (oldest >= 0)
+    resident.erase(slots[oldest].id);
+  return oldest;
+}
+
+void PlanetTerrain::Upload(const BuiltChunk& chunk, uint64_t last_used)
+{
+  uint64_t id = chunk.key.id();
+  if (resident.count(id)) return;
+  int s = FreeSlot();
+  if (s < 0) return; // pool full of chunks in use; asked for again once one is free
+
+  glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
+  glBufferSubData(GL_ARRAY_BUFFER, s * chunk_bytes, chunk.data.size(), chunk.data.data());
+  slots[s].id = id;
+  slots[s].origin = chunk.origin;
+  slots[s].bounds = chunk.bounds;
+  slots[s].last_used = last_used;
+  resident[id] = s;
+}
+
+void PlanetTerrain::Update(const glm::vec3& eye, const glm::mat4& clip_from_model, int max_uploads)
+{
+  for (int n = 0; n < max_uploads; n++) {
+    BuiltChunk chunk;
+    {
+      std::lock_guard<std::mutex> lock(built_mutex);
+      if (built.empty()) break;
+      chunk = std::move(built.front());
+      built.pop_front();
+    }
+    in_flight.erase(chunk.key.id());
+    Upload(chunk, frame);
+  }
+
+  // Every chunk the walk passes through is in use this frame: the drawn
+  // ones, and their ancestors to fall back on when the camera pulls away
+  frame++;
+  terrain::select_chunks(params, eye, mesh::frustum_planes(clip_from_model),
+    [this](const terrain::chunk_key& key) -> const terrain::chunk_bounds* {
+      auto found = resident.find(key.id());
+      if (found == resident.end()) return nullptr;
+      Slot& slot = slots[found->second];
+      slot.last_used = std::max(slot.last_used, frame);
+      return &slot.bounds;
+    }, draw_keys, wanted);
+  draw_slots.clear();
+  for (const terrain::chunk_key& key : draw_keys)
+    draw_slots.push_back(resident[key.id()]);
+
+  // Replace what is still queued with what this frame asks for
+  {
+    std::lock_guard<std::mutex> lock(job_mutex);
+    for (const terrain::chunk_key& key : jobs)
+      in_flight.erase(key.id());
+    jobs.clear();
+    for (const terrain::chunk_key& key : wanted) {
+      if (in_flight.size() >= max_queued_chunks) break;
+      if (in_flight.insert(key.id()).second)
+        jobs.push_back(key);
+    }
+  }
+  job_ready.notify_all();
+}
+
+void PlanetTerrain::Draw(GLuint texture, GLint position_scale_id, GLint position_offset_id, GLint octahedral_id)
+{
+  if (draw_slots.empty()) return;
+  glBindVertexArray(VertexArrayID);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glUniform3f(position_scale_id, 1.0f, 1.0f, 1.0f);
+  glUniform1i(octahedral_id, format.normal == mesh::normal_encoding::octahedral16 ? 1 : 0);
+  for (uint32_t s : draw_slots) {
+    glUniform3fv(position_offset_id, 1, &slots[s].origin[0]);
+    glDrawElementsBaseVertex(GL_TRIANGLES, index_count, GL_UNSIGNED_INT, (void*)0, (GLint)(s * chunk_vertices));
+  }
+}
+
+void PlanetTerrain::Shutdown()
+{
+  StopWorkers();
+  {
+    std::lock_guard<std::mutex> lock(built_mutex);
+    built.clear();
+  }
+  in_flight.clear();
+  slots.clear();
+  resident.clear();
+  draw_slots.clear();
+
+  if (vertexbuffer != 0) glDeleteBuffers(1, &vertexbuffer);
+  if (indexbuffer != 0) glDeleteBuffers(1, &indexbuffer);
+  if (VertexArrayID != 0) glDeleteVertexArrays(1, &VertexArrayID);
+  vertexbuffer = 0;
+  indexbuffer = 0;
+  VertexArrayID = 0;
+}
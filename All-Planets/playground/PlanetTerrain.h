@@ -0,0 +1,110 @@
+#ifndef PLANET_TERRAIN_H
+#define PLANET_TERRAIN_H
+
+#include <GL/glew.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "playground/terrain.h"
+#include "playground/vertex_format.h"
+
+/**
+* Quadtree terrain of one planet (see terrain.h).
+*
+* Update() picks the chunks to draw for the camera. Missing chunks are built
+* on worker threads while their parent is drawn in their place. Built chunks
+* go into a fixed pool of slots carved out of one vertex buffer, all drawn
+* with one shared index buffer; once the pool is full, the chunk that has gone
+* unused longest makes room. GPU memory is the pool, whatever the altitude,
+* and the triangle count is what the few levels around the eye need.
+*/
+class PlanetTerrain
+{
+public:
+	// capacity: chunk slots in the pool; threads == 0: one worker per hardware thread, minus the render thread
+	explicit PlanetTerrain(const terrain::planet_params& params = terrain::planet_params(), size_t capacity = 384,
+	                       unsigned int threads = 0);
+	virtual ~PlanetTerrain();
+
+	// Main thread, with the GL context. Loads the heightmap (without one the relief is all noise),
+	// creates the pool, builds the 24 root chunks, which never leave it, and starts the workers.
+	void Initialize(const std::string& heightmap_path);
+	// Main thread, once per frame. Puts up to max_uploads built chunks into the pool, then picks the
+	// chunks to draw for eye (model space: inverse(M) * camera position) and clip_from_model
+	// (P * V * M) and queues the missing ones, coarsest first.
+	void Update(const glm::vec3& eye, const glm::mat4& clip_from_model, int max_uploads = 8);
+	// Draws the chunks Update picked with the bound program; M must already be set. Vertex positions
+	// are relative to their chunk, whose origin goes to the decode offset.
+	void Draw(GLuint texture, GLint position_scale_id, GLint position_offset_id, GLint octahedral_id);
+	// Stops the workers and frees the GL objects; call before the GL context goes away.
+	void Shutdown();
+
+	size_t DrawnChunks() const { return draw_slots.size(); }
+	size_t DrawnTriangles() const { return draw_slots.size() * index_count / 3; }
+	size_t ResidentChunks() const { return resident.size(); }
+	size_t PoolBytes() const { return capacity * chunk_bytes; }
+
+private:
+	struct Slot {
+		uint64_t id;
+		glm::vec3 origin;
+		terrain::chunk_bounds bounds;
+		uint64_t last_used; //<<< frame it was last drawn or passed through
+	};
+	struct BuiltChunk {
+		terrain::chunk_key key;
+		glm::vec3 origin;
+		terrain::chunk_bounds bounds;
+		std::vector<uint8_t> data; //<<< vertices in format
+	};
+
+	void StartWorkers();
+	void StopWorkers();
+	void WorkerLoop();
+	void Build(const terrain::chunk_key& key, BuiltChunk& out) const;
+	void Upload(const BuiltChunk& chunk, uint64_t last_used);
+	int FreeSlot();
+
+	terrain::planet_params params;
+	terrain::heightmap heights;
+	size_t capacity;
+	unsigned int thread_count;
+	mesh::vertex_format format;
+	size_t chunk_vertices;
+	size_t chunk_bytes;
+	GLsizei index_count;
+
+	GLuint VertexArrayID;
+	GLuint vertexbuffer; //<<< capacity slots of chunk_bytes
+	GLuint indexbuffer;  //<<< one chunk's indices, shared by all
+
+	// Pool, main thread only
+	std::vector<Slot> slots;
+	std::unordered_map<uint64_t, uint32_t> resident; //<<< chunk id -> slot
+	uint64_t frame;
+	std::vector<uint32_t> draw_slots;
+	std::vector<terrain::chunk_key> draw_keys;
+	std::vector<terrain::chunk_key> wanted;
+	std::unordered_set<uint64_t> in_flight; //<<< queued or being built
+
+	std::vector<std::thread> workers;
+	std::mutex job_mutex;
+	std::condition_variable job_ready;
+	std::deque<terrain::chunk_key> jobs;
+	bool stopping;
+
+	std::mutex built_mutex;
+	std::deque<BuiltChunk> built;
+};
+
+#endif
@@ -1,33 +1,47 @@
 #include "RenderingObject.h"
+#include <algorithm>
+#include <cstddef>
+#include <common/mapped_file.hpp>
 #include <common/texture.hpp>
 #include <playground/parse_stl.h>
-
-#ifndef M_PI
-#define M_PI 3.14159265358979323846
-#endif
-
-RenderingObject::RenderingObject() : texture_present(false), M(glm::mat4(1.0f)) {
+#include <playground/mesh_pipeline.h>
+#include <playground/mesh_cache.h>
+#include <playground/mesh_lod.h>
+#include <playground/smooth_normals.h>
+
+RenderingObject::RenderingObject() : VertexArrayID(0), VertexBufferSize(0), VertexCount(0), IndexCount(0),
+    vertexbuffer(0), normalbuffer(0), indexbuffer(0), uvbuffer(0), texID(0), textureSamplerID(0),
+    texture_present(false), M(glm::mat4(1.0f)), bounds_min(0.0f), bounds_max(0.0f),
+    VertexFormat(mesh::compact_format()), CurrentLod(0), meshlets_culled(false) {
     uvbufferdata = std::vector<glm::vec2>();  // Initialize empty vector
 }
 RenderingObject::~RenderingObject() {}
 
+std::weak_ptr<RenderingObject*> RenderingObject::LoadHandle()
+{
+  if (!load_anchor.self)
+    load_anchor.self = std::make_shared<RenderingObject*>(this);
+  return load_anchor.self;
+}
+
 void RenderingObject::InitializeVAO()
 {
   glGenVertexArrays(1, &VertexArrayID);
 }
 
-void RenderingObject::SetVertices(std::vector< glm::vec3 > vertices)
+void RenderingObject::SetVertices(const std::vector< glm::vec3 >& vertices)
 {
   glBindVertexArray(VertexArrayID);
   glGenBuffers(1, &vertexbuffer);
   VertexBufferSize = vertices.size() * sizeof(glm::vec3);
+  VertexCount = vertices.size();
   glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
   glBufferData(GL_ARRAY_BUFFER, VertexBufferSize, &vertices[0], GL_STATIC_DRAW);
   glEnableVertexAttribArray(0);
   glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
 }
 
-void RenderingObject::SetNormals(std::vector< glm::vec3 > normals)
+void RenderingObject::SetNormals(const std::vector< glm::vec3 >& normals)
 {
   glBindVertexArray(VertexArrayID);
   glGenBuffers(1, &normalbuffer);
@@ -37,7 +51,7 @@ void RenderingObject::SetNormals(std::vector< glm::vec3 > normals)
   glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
 }
 
-void RenderingObject::SetTexture(std::vector< glm::vec2 > uvbufferdata, GLubyte texturedata[])
+void RenderingObject::SetTexture(const std::vector< glm::vec2 >& uvbufferdata, GLubyte texturedata[])
 {
   texture_present = true;
   glGenTextures(1, &texID);
@@ -52,35 +66,37 @@ void RenderingObject::SetTexture(std::vector< glm::vec2 > uvbufferdata, GLubyte
   );
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
+  glBindVertexArray(VertexArrayID);
   glGenBuffers(1, &uvbuffer);
   glBindBuffer(GL_ARRAY_BUFFER, uvbuffer);
   glBufferData(GL_ARRAY_BUFFER, uvbufferdata.size() * sizeof(glm::vec2), &uvbufferdata[0], GL_STATIC_DRAW);
+  glEnableVertexAttribArray(2);
+  glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
 }
 
-void RenderingObject::SetTexture(std::vector<glm::vec2> uvbufferdata, std::string bmpPath) {
-    texture_present = true;
-
-    // Generate and bind texture
-    glGenTextures(1, &texID);
-    glBindTexture(GL_TEXTURE_2D, texID);
-
-    // Load texture from file
-    texID = loadBMP_custom(bmpPath.c_str());
-
-    // Set texture parameters
-    glBindTexture(GL_TEXTURE_2D, texID);
+void RenderingObject::SetTextureID(GLuint texture) {
+    texture_resource.reset();
+    texture_present = texture != 0;
+    texID = texture;
+}
 
-    // Change back to GL_REPEAT for proper wrapping
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+void RenderingObject::SetTexture(std::string imagePath) {
+    texture_resource.reset();
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    // The loaders create the texture with repeat wrapping and trilinear filtering;
+    // a baked .dds brings its own mip chain, a BMP gets one generated
+    if (isDDSPath(imagePath.c_str()))
+        texID = loadDDS(imagePath.c_str());
+    else
+        texID = loadBMP_custom(imagePath.c_str());
+    texture_present = texID != 0;
+}
 
-    // Generate mipmaps
-    glGenerateMipmap(GL_TEXTURE_2D);
+void RenderingObject::SetTexture(const std::vector<glm::vec2>& uvbufferdata, std::string imagePath) {
+    SetTexture(imagePath);
 
     // Set up UV buffer
+    glBindVertexArray(VertexArrayID);
     glGenBuffers(1, &uvbuffer);
     glBindBuffer(GL_ARRAY_BUFFER, uvbuffer);
     glBufferData(GL_ARRAY_BUFFER, uvbufferdata.size() * sizeof(glm::vec2), &uvbufferdata[0], GL_STATIC_DRAW);
@@ -92,232 +108,333 @@ void RenderingObject::SetTexture(std::vector<glm::vec2> uvbufferdata, std::strin
 
 void RenderingObject::DrawObject()
 {
-    if (VertexBufferSize == 0) {
+    if (VertexCount == 0) {
         return;  // Don't draw if there are no vertices
     }
-  
-  // 1rst attribute buffer : vertices
-  glEnableVertexAttribArray(0);
-  glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-  glVertexAttribPointer(
-    0,                  // attribute 0. No particular reason for 0, but must match the layout in the shader.
-    3,  // size
-    GL_FLOAT,           // type
-    GL_FALSE,           // normalized?
-    0,                  // stride
-    (void*)0            // array buffer offset
-  );
 
-  // 2nd attribute buffer : color
-  glEnableVertexAttribArray(1);
-  glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
-  glVertexAttribPointer(
-    1,                  // attribute 0. No particular reason for 0, but must match the layout in the shader.
-    3,  // size
-    GL_FLOAT,           // type
-    GL_FALSE,           // normalized?
-    0,                  // stride
-    (void*)0            // array buffer offset
-  );
+  // Attribute bindings are recorded in the VAO when the buffers are uploaded
+  glBindVertexArray(VertexArrayID);
 
-  if (texture_present && !uvbufferdata.empty())
+  if (texture_present)
   {
-      // Bind texture before setting up the attribute
       glActiveTexture(GL_TEXTURE0);
       glBindTexture(GL_TEXTURE_2D, texID);
-
-      // Enable and bind UV coordinates
-      glEnableVertexAttribArray(2);
-      glBindBuffer(GL_ARRAY_BUFFER, uvbuffer);
-      glVertexAttribPointer(
-          2,                  // attribute 2
-          2,                  // size (u, v)
-          GL_FLOAT,          // type
-          GL_FALSE,          // normalized?
-          0,                 // stride
-          (void*)0           // array buffer offset
-      );
   }
 
   // Draw
-  glDrawArrays(GL_TRIANGLES, 0, VertexBufferSize / sizeof(glm::vec3));
-
-  // Disable vertex arrays
-  glDisableVertexAttribArray(0);
-  glDisableVertexAttribArray(1);
-  if (texture_present) {
-      glDisableVertexAttribArray(2);
+  if (IndexCount > 0 && CurrentLod == 0 && meshlets_culled) {
+      if (!visible_counts.empty())
+          glMultiDrawElements(GL_TRIANGLES, visible_counts.data(), GL_UNSIGNED_INT, visible_offsets.data(),
+                              (GLsizei)visible_counts.size());
+  }
+  else if (IndexCount > 0 && CurrentLod < (int)Lods.size()) {
+      const mesh::lod_level& lod = Lods[CurrentLod];
+      glDrawElements(GL_TRIANGLES, lod.index_count, GL_UNSIGNED_INT, (void*)(lod.index_offset * sizeof(uint32_t)));
   }
+  else if (IndexCount > 0)
+      glDrawElements(GL_TRIANGLES, IndexCount, GL_UNSIGNED_INT, (void*)0);
+  else
+      glDrawArrays(GL_TRIANGLES, 0, VertexCount);
 }
 
-void RenderingObject::LoadSTL(std::string stl_file_name) {
-    auto info = stl::parse_stl(stl_file_name);
-    std::vector<stl::triangle> triangles = info.triangles;
-    std::vector<glm::vec3> vertices;
-    std::vector<glm::vec3> normals;
-    uvbufferdata.clear();  // Clear any existing UV data
-
-    // Calculate bounding box to determine scaling
-    float min_x = std::numeric_limits<float>::max();
-    float max_x = std::numeric_limits<float>::lowest();
-    float min_y = std::numeric_limits<float>::max();
-    float max_y = std::numeric_limits<float>::lowest();
-    float min_z = std::numeric_limits<float>::max();
-    float max_z = std::numeric_limits<float>::lowest();
-
-    // First pass: find bounding box
-    for (auto t : triangles) {
-        min_x = std::min({ min_x, t.v1.x, t.v2.x, t.v3.x });
-        max_x = std::max({ max_x, t.v1.x, t.v2.x, t.v3.x });
-        min_y = std::min({ min_y, t.v1.y, t.v2.y, t.v3.y });
-        max_y = std::max({ max_y, t.v1.y, t.v2.y, t.v3.y });
-        min_z = std::min({ min_z, t.v1.z, t.v2.z, t.v3.z });
-        max_z = std::max({ max_z, t.v1.z, t.v2.z, t.v3.z });
-    }
+void RenderingObject::ApplyVertexDecode(GLint position_scale_id, GLint position_offset_id, GLint octahedral_id) const
+{
+  glUniform3fv(position_scale_id, 1, &Decode.position_scale[0]);
+  glUniform3fv(position_offset_id, 1, &Decode.position_offset[0]);
+  glUniform1i(octahedral_id, Decode.octahedral() ? 1 : 0);
+}
 
-    // Calculate scaling factor
-    float scale_x = max_x - min_x;
-    float scale_y = max_y - min_y;
-    float scale_z = max_z - min_z;
-    float max_scale = std::max({ scale_x, scale_y, scale_z });
-    float scaling_factor = 150.0f / max_scale;
-
-    // Calculate center
-    float center_x = (min_x + max_x) / 2.0f;
-    float center_y = (min_y + max_y) / 2.0f;
-    float center_z = (min_z + max_z) / 2.0f;
-
-    for (auto t : triangles) {
-        // Add vertices
-        glm::vec3 v1((t.v1.x - center_x) * scaling_factor,
-            (t.v1.y - center_y) * scaling_factor,
-            (t.v1.z - center_z) * scaling_factor);
-        glm::vec3 v2((t.v2.x - center_x) * scaling_factor,
-            (t.v2.y - center_y) * scaling_factor,
-            (t.v2.z - center_z) * scaling_factor);
-        glm::vec3 v3((t.v3.x - center_x) * scaling_factor,
-            (t.v3.y - center_y) * scaling_factor,
-            (t.v3.z - center_z) * scaling_factor);
-
-        vertices.push_back(v1);
-        vertices.push_back(v2);
-        vertices.push_back(v3);
-
-        // Normalize vertices for UV calculation
-        glm::vec3 n1 = glm::normalize(v1);
-        glm::vec3 n2 = glm::normalize(v2);
-        glm::vec3 n3 = glm::normalize(v3);
-
-        // Generate UV coordinates
-        glm::vec2 uv1 = generateUV(n1);
-        glm::vec2 uv2 = generateUV(n2);
-        glm::vec2 uv3 = generateUV(n3);
-
-        // Fix texture seam if needed
-        if (isSeamVertex(n1) || isSeamVertex(n2) || isSeamVertex(n3)) {
-            float u1 = uv1.x, u2 = uv2.x, u3 = uv3.x;
-            if (std::abs(u1 - u2) > 0.5f) {
-                if (u1 < u2) u1 += 1.0f;
-                else u2 += 1.0f;
-            }
-            if (std::abs(u2 - u3) > 0.5f) {
-                if (u2 < u3) u2 += 1.0f;
-                else u3 += 1.0f;
-            }
-            if (std::abs(u3 - u1) > 0.5f) {
-                if (u3 < u1) u3 += 1.0f;
-                else u1 += 1.0f;
-            }
-            uv1.x = u1;
-            uv2.x = u2;
-            uv3.x = u3;
-        }
+int RenderingObject::SelectLod(const glm::vec3& eye, float projection_scale, float max_pixel_error, float hysteresis)
+{
+  if (Lods.empty()) return CurrentLod = 0;
+
+  // Errors are in model units, so they grow with the largest scale in M; the
+  // distance is taken to the nearest point of the bounding sphere
+  float scale = std::max(glm::length(glm::vec3(M[0])), std::max(glm::length(glm::vec3(M[1])), glm::length(glm::vec3(M[2]))));
+  glm::vec3 center = glm::vec3(M * glm::vec4(0.5f * (bounds_min + bounds_max), 1.0f));
+  float radius = 0.5f * glm::length(bounds_max - bounds_min) * scale;
+  float distance = std::max(glm::length(center - eye) - radius, 1e-3f);
+
+  CurrentLod = mesh::select_lod(Lods.data(), Lods.size(), projection_scale * scale / distance, max_pixel_error,
+                                CurrentLod, hysteresis);
+  return CurrentLod;
+}
 
-        // Store UV coordinates directly in member variable
-        uvbufferdata.push_back(uv1);
-        uvbufferdata.push_back(uv2);
-        uvbufferdata.push_back(uv3);
-    }
+size_t RenderingObject::CullMeshlets(const glm::mat4& VP, const glm::vec3& eye)
+{
+  meshlets_culled = false;
+  if (IndexCount == 0) return 0;
+  if (CurrentLod != 0 || Meshlets.empty())
+    return (CurrentLod < (int)Lods.size() ? Lods[CurrentLod].index_count : IndexCount) / 3;
+
+  // Meshlet bounds are in model space; so are the eye and planes tested against them
+  glm::vec3 model_eye = glm::vec3(glm::inverse(M) * glm::vec4(eye, 1.0f));
+  visible_ranges.clear();
+  size_t kept = mesh::cull_meshlets(Meshlets.data(), Meshlets.size(), model_eye, mesh::frustum_planes(VP * M), visible_ranges);
+
+  visible_counts.clear();
+  visible_offsets.clear();
+  for (const mesh::draw_range& range : visible_ranges) {
+    visible_counts.push_back((GLsizei)range.index_count);
+    visible_offsets.push_back((const void*)(range.index_offset * sizeof(uint32_t)));
+  }
+  meshlets_culled = true;
+  return kept / 3;
+}
 
-    this->SetVertices(vertices);
-    computeVertexNormalsOfTriangles(vertices, normals);
-    this->SetNormals(normals);
+void RenderingObject::SetMesh(const mesh::loaded_mesh& loaded)
+{
+  bounds_min = loaded.bounds_min();
+  bounds_max = loaded.bounds_max();
+  if (loaded.packed_as(VertexFormat))
+    UploadMesh(loaded.packed_data(), loaded.packed_size(), loaded.decode, loaded.vertex_count(), loaded.indices(),
+               loaded.index_count());
+  else
+    SetMesh(loaded.vertices(), loaded.vertex_count(), loaded.indices(), loaded.index_count());
+  Lods.assign(loaded.lods(), loaded.lods() + loaded.lod_count());
+  Meshlets.assign(loaded.meshlets(), loaded.meshlets() + loaded.meshlet_count());
+  Bvh = ResourceRegistry::BuildBvh(loaded);
 }
-bool RenderingObject::isSeamVertex(const glm::vec3& normalized) {
-    // Check if vertex is near the texture seam
-    float angle = atan2(normalized.z, normalized.x);
-    float threshold = 0.005f; // Smaller threshold for more precise seam detection
-    return std::abs(std::abs(angle) - M_PI) < threshold;
+
+void RenderingObject::SetMesh(const mesh::vertex* vertices, size_t vertex_count, const uint32_t* indices, size_t index_count)
+{
+  mesh::packed_vertices packed;
+  mesh::pack_vertices(vertices, vertex_count, VertexFormat, bounds_min, bounds_max, packed);
+  UploadMesh(packed.data.data(), packed.data.size(), packed.decode, vertex_count, indices, index_count);
 }
 
-glm::vec2 RenderingObject::generateUV(const glm::vec3& vertex) {
-    // Normalize the vertex
-    glm::vec3 normalized = glm::normalize(vertex);
+void RenderingObject::UploadMesh(const uint8_t* packed, size_t packed_size, const mesh::vertex_decode& decode,
+                                 size_t vertex_count, const uint32_t* indices, size_t index_count)
+{
+  ReleaseMesh();
+  Decode = decode;
 
-    // Calculate spherical coordinates
-    float u = 0.5f + (atan2(normalized.z, normalized.x) / (2.0f * M_PI));
-    float v = 0.5f + (asin(normalized.y) / M_PI);
+  glBindVertexArray(VertexArrayID);
 
-    // Ensure UV coordinates are properly wrapped
-    u = 1.0f - u; // Flip the U coordinate to fix the mirroring
+  glGenBuffers(1, &vertexbuffer);
+  VertexBufferSize = packed_size;
+  VertexCount = vertex_count;
+  glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
+  glBufferData(GL_ARRAY_BUFFER, VertexBufferSize, packed, GL_STATIC_DRAW);
+  BindInterleavedAttributes(Decode.format);
 
-    // More precise wrapping
-    if (u > 1.0f) u -= floor(u);
-    if (u < 0.0f) u += ceil(-u);
+  glGenBuffers(1, &indexbuffer);
+  IndexCount = index_count;
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexbuffer);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_count * sizeof(uint32_t), indices, GL_STATIC_DRAW);
+}
 
-    v = glm::clamp(v, 0.0f, 1.0f);
+void RenderingObject::SetMesh(MeshHandle resource)
+{
+  ReleaseMesh();
+  if (!resource) return;
+  mesh_resource = resource;
+
+  // The buffers are shared, only the attribute bindings in this object's VAO are its own
+  glBindVertexArray(VertexArrayID);
+  Decode = resource->decode;
+  vertexbuffer = resource->vertexbuffer;
+  VertexBufferSize = resource->vertex_count * mesh::layout_of(Decode.format).stride;
+  VertexCount = resource->vertex_count;
+  glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
+  BindInterleavedAttributes(Decode.format);
+
+  indexbuffer = resource->indexbuffer;
+  IndexCount = resource->index_count;
+  Lods = resource->lods;
+  Meshlets = resource->meshlets;
+  Bvh = resource->bvh;
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexbuffer);
 
-    return glm::vec2(u, v);
+  bounds_min = resource->bounds_min;
+  bounds_max = resource->bounds_max;
 }
 
-std::vector<glm::vec3> RenderingObject::getAllTriangleNormalsForVertex(stl::point vertex, std::vector<stl::triangle> triangles)
+void RenderingObject::SetTexture(TextureHandle resource)
 {
-  std::vector<glm::vec3> returnValue;
-  for (auto t : triangles)
-  {
-    if (t.v1.equals(vertex) || t.v2.equals(vertex) || t.v3.equals(vertex))
-    {
-      glm::vec3 normal = { t.normal.x,t.normal.y,t.normal.z };
-      returnValue.push_back(normal);
-    }
-  }
-  return returnValue;
+  SetTextureID(resource ? resource->texID : 0);
+  texture_resource = resource;
 }
 
-glm::vec3 RenderingObject::computeMeanVector(std::vector<glm::vec3> vec)
+void RenderingObject::ReleaseMesh()
 {
-  glm::vec3 mean = { 0,0,0 };
-  for (auto v : vec)
-  {
-    mean += v;
+  // Replacing a mesh (e.g. the placeholder) frees the previous buffers,
+  // unless they belong to a shared resource
+  if (mesh_resource) {
+    mesh_resource.reset();
+    vertexbuffer = 0;
+    indexbuffer = 0;
   }
-  normalize(mean);
-  return mean;
+  if (vertexbuffer != 0) glDeleteBuffers(1, &vertexbuffer);
+  if (normalbuffer != 0) glDeleteBuffers(1, &normalbuffer);
+  if (uvbuffer != 0) glDeleteBuffers(1, &uvbuffer);
+  if (indexbuffer != 0) glDeleteBuffers(1, &indexbuffer);
+  vertexbuffer = 0;
+  normalbuffer = 0;
+  uvbuffer = 0;
+  indexbuffer = 0;
+  VertexCount = 0;
+  IndexCount = 0;
+  Decode = mesh::vertex_decode();
+  Lods.clear();
+  CurrentLod = 0;
+  Meshlets.clear();
+  meshlets_culled = false;
+  Bvh.reset();
 }
 
-void RenderingObject::computeVertexNormalsOfTriangles(std::vector< glm::vec3 >& vertices, std::vector< glm::vec3 >& normals)
+void RenderingObject::BindInterleavedAttributes(const mesh::vertex_format& format)
 {
-  std::vector<stl::triangle> triangles;
-  //compute triangles with normals from vertices
-  for (int i = 0; i < vertices.size(); i = i + 3)
-  {
-    glm::vec3 edge1 = vertices.at(i + 1) - vertices.at(i);
-    glm::vec3 edge2 = vertices.at(i + 2) - vertices.at(i);
-    glm::vec3 triangleNormal = glm::normalize(glm::cross(edge1, edge2));
-    stl::point v1 = { vertices.at(i)[0],vertices.at(i)[1],vertices.at(i)[2] };
-    stl::point v2 = { vertices.at(i + 1)[0],vertices.at(i + 1)[1],vertices.at(i + 1)[2] };
-    stl::point v3 = { vertices.at(i + 2)[0],vertices.at(i + 2)[1],vertices.at(i + 2)[2] };
-    stl::point normal = { triangleNormal[0],triangleNormal[1],triangleNormal[2] };
-
-    stl::triangle currentTriangle = { normal,v1,v2,v3 };
-    triangles.push_back(currentTriangle);
-  }
+  // One interleaved buffer: position, normal, UV, encoded as format says
+  mesh::vertex_layout layout = mesh::layout_of(format);
+  GLsizei stride = (GLsizei)layout.stride;
 
-  //compute vertex normals
-  for (glm::vec3 vertice : vertices)
-  {
-    stl::point verticeConv = { vertice[0],vertice[1],vertice[2] };
-    normals.push_back(computeMeanVector(getAllTriangleNormalsForVertex(verticeConv, triangles)));
-  }
+  glEnableVertexAttribArray(0);
+  if (format.position == mesh::position_encoding::float3)
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)layout.position);
+  else
+    glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void*)layout.position);
+
+  glEnableVertexAttribArray(1);
+  if (format.normal == mesh::normal_encoding::float3)
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)layout.normal);
+  else if (format.normal == mesh::normal_encoding::octahedral16)
+    glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, stride, (void*)layout.normal);
+  else
+    glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void*)layout.normal);
+
+  glEnableVertexAttribArray(2);
+  if (format.uv == mesh::uv_encoding::float2)
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void*)layout.uv);
+  else
+    glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, stride, (void*)layout.uv);
+}
+
+void RenderingObject::LoadSTL(std::string stl_file_name) {
+    // A bake holds the whole triangle soup and its working buffers; past this
+    // size that would not fit, so the file is streamed instead
+    const uint64_t stream_bytes = uint64_t(512) << 20;
+    MappedFile file;
+    if (file.open(stl_file_name.c_str()) && file.size() > stream_bytes) {
+        file.close();
+        StreamSTL(stl_file_name);
+        return;
+    }
+    file.close();
+
+    mesh::loaded_mesh loaded;
+    if (mesh::load_stl_mesh(stl_file_name, 150.0f, loaded, VertexFormat))
+        SetMesh(loaded);
+}
 
-}
\ No newline at end of file
+void RenderingObject::StreamSTL(std::string stl_file_name, size_t batch_triangles) {
+    uvbufferdata.clear();
+
+    // Pass 1: bounds. Nothing but the current batch is kept.
+    mesh::bounds_stage bounds;
+    if (!stl::stream_stl(stl_file_name, batch_triangles, [&](const stl::triangle* batch, size_t count) {
+        bounds.add(batch, count);
+    })) return;
+    if (bounds.triangles == 0) return;
+    mesh::fit_transform fit(bounds, 150.0f);
+    ReleaseMesh();
+
+    size_t vertex_count = 3 * bounds.triangles;
+    VertexBufferSize = vertex_count * sizeof(glm::vec3);
+    VertexCount = vertex_count;
+    bounds_min = (bounds.min - fit.center) * fit.scale;
+    bounds_max = (bounds.max - fit.center) * fit.scale;
+
+    // Allocate the GPU buffers up front, batches are copied into them in place
+    glBindVertexArray(VertexArrayID);
+    glGenBuffers(1, &vertexbuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
+    glBufferData(GL_ARRAY_BUFFER, VertexBufferSize, NULL, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+
+    glGenBuffers(1, &uvbuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, uvbuffer);
+    glBufferData(GL_ARRAY_BUFFER, vertex_count * sizeof(glm::vec2), NULL, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, 0);
+
+    glGenBuffers(1, &normalbuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
+    glBufferData(GL_ARRAY_BUFFER, vertex_count * sizeof(glm::vec3), NULL, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
+
+    std::vector<glm::vec3> vertices;
+    std::vector<glm::vec2> uvs;
+    std::vector<glm::vec3> normals;
+    mesh::normal_accumulator accumulator;
+    mesh::slab_plan plan(bounds_min, bounds_max);
+    // A mesh whose corners all fit in one slab is accumulated right away
+    bool one_slab = vertex_count <= mesh::default_slab_corners;
+
+    // Pass 2: recentre/scale -> UVs -> slab histogram or normal accumulation -> upload positions and UVs
+    size_t offset = 0;
+    stl::stream_stl(stl_file_name, batch_triangles, [&](const stl::triangle* batch, size_t count) {
+        vertices.clear();
+        uvs.clear();
+        fit.apply(batch, count, vertices);
+        mesh::spherical_uvs(vertices.data(), vertices.size(), uvs);
+        if (one_slab) accumulator.add(vertices.data(), vertices.size());
+        else plan.add(vertices.data(), vertices.size());
+
+        glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
+        glBufferSubData(GL_ARRAY_BUFFER, offset * sizeof(glm::vec3), vertices.size() * sizeof(glm::vec3), vertices.data());
+        glBindBuffer(GL_ARRAY_BUFFER, uvbuffer);
+        glBufferSubData(GL_ARRAY_BUFFER, offset * sizeof(glm::vec2), uvs.size() * sizeof(glm::vec2), uvs.data());
+        offset += vertices.size();
+    });
+
+    // Then per slab: sum its normals over one pass, resolve and upload them in
+    // another. The first slab uploads whole batches (zero outside the slab),
+    // later ones only write their own vertices into the mapped buffer.
+    std::vector<float> edges = one_slab ? std::vector<float>() : plan.split(mesh::default_slab_corners);
+    size_t slabs = one_slab ? 1 : edges.size() - 1;
+    glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
+    for (size_t slab = 0; slab < slabs; slab++) {
+        if (!one_slab) {
+            accumulator.set_slab(plan.axis(), edges[slab], edges[slab + 1]);
+            stl::stream_stl(stl_file_name, batch_triangles, [&](const stl::triangle* batch, size_t count) {
+                vertices.clear();
+                fit.apply(batch, count, vertices);
+                accumulator.add(vertices.data(), vertices.size());
+            });
+        }
+
+        offset = 0;
+        stl::stream_stl(stl_file_name, batch_triangles, [&](const stl::triangle* batch, size_t count) {
+            vertices.clear();
+            fit.apply(batch, count, vertices);
+            size_t bytes = vertices.size() * sizeof(glm::vec3);
+            if (slab == 0) {
+                normals.assign(vertices.size(), glm::vec3(0.0f));
+                accumulator.resolve(vertices.data(), vertices.size(), normals.data());
+                glBufferSubData(GL_ARRAY_BUFFER, offset * sizeof(glm::vec3), bytes, normals.data());
+            } else if (void* mapped = glMapBufferRange(GL_ARRAY_BUFFER, offset * sizeof(glm::vec3), bytes, GL_MAP_WRITE_BIT)) {
+                accumulator.resolve(vertices.data(), vertices.size(), static_cast<glm::vec3*>(mapped));
+                glUnmapBuffer(GL_ARRAY_BUFFER);
+            }
+            offset += vertices.size();
+        });
+    }
+}
+
+bool RenderingObject::isSeamVertex(const glm::vec3& normalized) {
+    return mesh::is_seam_vertex(normalized);
+}
+
+glm::vec2 RenderingObject::generateUV(const glm::vec3& vertex) {
+    return mesh::spherical_uv(vertex);
+}
+
+void RenderingObject::computeVertexNormalsOfTriangles(std::vector< glm::vec3 >& vertices, std::vector< glm::vec3 >& normals)
+{
+  size_t first = normals.size();
+  normals.resize(first + vertices.size() - vertices.size() % 3);
+  mesh::smooth_normals(vertices.data(), vertices.size(), normals.data() + first);
+}
@@ -4,8 +4,15 @@
 // Include GLEW, GLM, GLFW
 #include <GL/glew.h>
 #include <glm/glm.hpp>
+#include <memory>
 #include <vector>
 #include "playground/parse_stl.h"
+#include "playground/mesh_pipeline.h"
+#include "playground/mesh_bvh.h"
+#include "playground/mesh_cache.h"
+#include "playground/mesh_meshlet.h"
+#include "playground/vertex_format.h"
+#include "playground/ResourceRegistry.h"
 
 
 class RenderingObject
@@ -15,13 +22,59 @@ public:
 	virtual ~RenderingObject();
 
 	void InitializeVAO();
-	void SetVertices(std::vector< glm::vec3 >);
-	void SetNormals(std::vector< glm::vec3 >);
-	void SetTexture(std::vector< glm::vec2 >, GLubyte texturedata[]);
-	void SetTexture(std::vector< glm::vec2 >, std::string bmpPath);
+	void SetVertices(const std::vector< glm::vec3 >&);
+	void SetNormals(const std::vector< glm::vec3 >&);
+	void SetTexture(const std::vector< glm::vec2 >&, GLubyte texturedata[]);
+	void SetTexture(const std::vector< glm::vec2 >&, std::string imagePath);
+	void SetTexture(std::string imagePath); //<<< .bmp or baked .dds; texture only, for meshes whose UVs are already uploaded
+	void SetTextureID(GLuint texture); //<<< uses an already created texture
 	void DrawObject();
+	// Sets the uniforms that undo the vertex encoding of the current mesh; call before DrawObject
+	void ApplyVertexDecode(GLint position_scale_id, GLint position_offset_id, GLint octahedral_id) const;
+	// Picks the LOD level DrawObject draws from the error it would show on screen (see mesh::select_lod),
+	// using M and the mesh bounds. projection_scale comes from mesh::lod_projection_scale.
+	int SelectLod(const glm::vec3& eye, float projection_scale, float max_pixel_error = 1.0f, float hysteresis = 0.2f);
+	// While level 0 is drawn, makes DrawObject draw only the meshlets that face eye (world space) and lie
+	// in the frustum of VP * M (see mesh::meshlet_visible); call after SelectLod, whenever the camera or M
+	// move. Returns the number of triangles DrawObject will draw.
+	size_t CullMeshlets(const glm::mat4& VP, const glm::vec3& eye);
+
+	// Uploads an indexed mesh as one interleaved vertex buffer in VertexFormat plus a 32 bit
+	// index buffer, replacing any mesh uploaded before. Quantised positions are taken
+	// relative to bounds_min/bounds_max, so set those first.
+	void SetMesh(const mesh::vertex* vertices, size_t vertex_count, const uint32_t* indices, size_t index_count);
+	void SetMesh(const mesh::loaded_mesh& loaded); //<<< also builds the picking BVH, which the raw overload leaves empty
+	// Draws a registry mesh/texture; the object keeps the resource alive while it uses it
+	void SetMesh(MeshHandle resource);
+	void SetTexture(TextureHandle resource);
+	// Points attributes 0 (position), 1 (normal) and 2 (UV) of the bound VAO at the interleaved
+	// vertices of format in the bound GL_ARRAY_BUFFER
+	static void BindInterleavedAttributes(const mesh::vertex_format& format);
+	// The current mesh placed by M, for a mesh::scene_bvh (bvh is null while there is no BVH)
+	mesh::bvh_instance BvhInstance() const { return mesh::bvh_instance{ Bvh.get(), M }; }
+	// Expires when the object is destroyed; the AssetLoader keeps this instead of the object
+	// while a mesh or texture is on its way, so a load that finishes later is dropped
+	std::weak_ptr<RenderingObject*> LoadHandle();
+
+	/**
+	* Loads an STL file, recentred and scaled to 150 units, with spherical UVs and smooth normals.
+	* The indexed result is baked to "<file>.pmesh"; later runs map that cache and upload it
+	* directly as long as the STL's size and modification time are unchanged. Files too large
+	* to bake in memory (over 512 MB) go through StreamSTL instead, unindexed and uncached.
+	*/
 	void LoadSTL(std::string);
 
+	/**
+	* Loads an STL file without ever holding the whole mesh in memory. The file is read in
+	* batches of batch_triangles which are pushed through bounds, recentring/scaling, UV
+	* generation and normal accumulation and copied straight into the GPU buffers.
+	* The file is read three times (bounds, positions/UVs, normals), plus twice per extra slab
+	* when its normal sums would not fit mesh::default_slab_corners (see mesh::slab_plan), so
+	* memory stays bounded whatever the file size. UVs go to the GPU only, so use
+	* SetTexture(bmpPath) afterwards.
+	*/
+	void StreamSTL(std::string, size_t batch_triangles = mesh::default_batch_triangles);
+
 	// Check if a vertex is a seam vertex
 	bool isSeamVertex(const glm::vec3& normalized);
 
@@ -32,12 +85,17 @@ public:
   //vertex array object (VAO)
   GLuint VertexArrayID;
   int VertexBufferSize;
+  int VertexCount;
+  int IndexCount; //<<< 0 for non-indexed meshes
 
   //vertices VBO / 3D object
   GLuint vertexbuffer;
 
   //normals VBO
   GLuint normalbuffer;
+
+  //index buffer (indexed meshes only)
+  GLuint indexbuffer;
   
   //texture
   GLuint uvbuffer;
@@ -48,8 +106,31 @@ public:
   //Model matrix: moves object from model to world space
   glm::mat4 M;
 
+  //Model space bounds of the loaded mesh
+  glm::vec3 bounds_min;
+  glm::vec3 bounds_max;
+
+  //Format used by SetMesh(vertices, ...), and how the current vertex buffer is encoded
+  mesh::vertex_format VertexFormat;
+  mesh::vertex_decode Decode;
+
+  //LOD chain of the current mesh (empty: all IndexCount indices are one level) and the level drawn
+  std::vector<mesh::lod_level> Lods;
+  int CurrentLod;
+
+  //meshlets of LOD level 0 (empty: level 0 is always drawn whole)
+  std::vector<mesh::meshlet> Meshlets;
+
+  //BVH over the triangles of LOD level 0 in model space, for picking and spatial queries (null: none)
+  std::shared_ptr<const mesh::triangle_bvh> Bvh;
+
+  //shared resources, null when the object owns its buffers/texture
+  MeshHandle mesh_resource;
+  TextureHandle texture_resource;
+
   /**
-  * Computes the normals of triangles by computing the cross product.
+  * Computes smooth vertex normals: angle weighted face normals averaged over all corners
+  * sharing a position (see mesh::smooth_normals).
   * @param[in] vertices   Vector of vertices, 3 vertices represent one triangle.
   * @param[out] normals   Vector of normals, needs to be empty and is filled by the function.
   */
@@ -57,9 +138,27 @@ public:
 
 protected:
 
-  std::vector<glm::vec3> getAllTriangleNormalsForVertex(stl::point vertex, std::vector<stl::triangle> triangles);
-  glm::vec3 computeMeanVector(std::vector<glm::vec3>);
+  void ReleaseMesh();
+  //Uploads vertices already packed as decode describes, and the indices
+  void UploadMesh(const uint8_t* packed, size_t packed_size, const mesh::vertex_decode& decode, size_t vertex_count,
+                  const uint32_t* indices, size_t index_count);
+
   std::vector<glm::vec2> uvbufferdata;
+
+  //backs LoadHandle; not copied with the object, since a copy lives at another address
+  struct LoadAnchor {
+    std::shared_ptr<RenderingObject*> self;
+    LoadAnchor() {}
+    LoadAnchor(const LoadAnchor&) {}
+    LoadAnchor& operator=(const LoadAnchor&) { return *this; }
+  };
+  LoadAnchor load_anchor;
+
+  //index ranges CullMeshlets kept, as glMultiDrawElements takes them
+  bool meshlets_culled;
+  std::vector<mesh::draw_range> visible_ranges;
+  std::vector<GLsizei> visible_counts;
+  std::vector<const void*> visible_offsets;
   
 
 };
@@ -0,0 +1,249 @@
+#include "ResourceRegistry.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include <glfw3.h>
+#include <common/texture.hpp>
+
+namespace {
+
+  // Handles may outlive the window (globals are destroyed after main), so the
+  // GL objects are only deleted while a context is current.
+  void DeleteMesh(MeshResource* resource)
+  {
+    if (glfwGetCurrentContext() != NULL) {
+      glDeleteBuffers(1, &resource->vertexbuffer);
+      glDeleteBuffers(1, &resource->indexbuffer);
+    }
+    delete resource;
+  }
+
+  void DeleteTexture(TextureResource* resource)
+  {
+    if (glfwGetCurrentContext() != NULL)
+      glDeleteTextures(1, &resource->texID);
+    delete resource;
+  }
+
+  std::string FormatKey(const mesh::vertex_format& format)
+  {
+    return "|format=" + std::to_string((int)format.position) + "," + std::to_string((int)format.normal) + "," +
+      std::to_string((int)format.uv);
+  }
+
+}
+
+ResourceRegistry::ResourceRegistry() : vertex_format(mesh::compact_format())
+{
+  std::memset(&stats, 0, sizeof(stats));
+}
+
+std::string ResourceRegistry::MeshKey(const std::string& stl_path, float extent, const mesh::vertex_format& format,
+                                      uint32_t flags)
+{
+  return "mesh:" + stl_path + "|extent=" + std::to_string(extent) + "|flags=" + std::to_string(flags) +
+    FormatKey(format);
+}
+
+std::string ResourceRegistry::TextureKey(const std::string& image_path)
+{
+  return "texture:" + image_path + "|mipmaps";
+}
+
+std::string ResourceRegistry::SphereKey(const mesh::sphere_params& params, const mesh::vertex_format& format)
+{
+  static const char* kinds[] = { "uv", "ico", "cube" };
+  return std::string("sphere:") + kinds[(int)params.kind] + "|level=" + std::to_string(params.level) +
+    "|radius=" + std::to_string(params.radius) + FormatKey(format);
+}
+
+MeshHandle ResourceRegistry::FindMesh(const std::string& key)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = meshes.find(key);
+  if (it == meshes.end()) return MeshHandle();
+  MeshHandle handle = it->second.lock();
+  if (handle) stats.mesh_hits++;
+  else meshes.erase(it);
+  return handle;
+}
+
+TextureHandle ResourceRegistry::FindTexture(const std::string& key)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = textures.find(key);
+  if (it == textures.end()) return TextureHandle();
+  TextureHandle handle = it->second.lock();
+  if (handle) stats.texture_hits++;
+  else textures.erase(it);
+  return handle;
+}
+
+void ResourceRegistry::SetVertexFormat(const mesh::vertex_format& format)
+{
+  vertex_format = format;
+}
+
+std::shared_ptr<const mesh::triangle_bvh> ResourceRegistry::BuildBvh(const mesh::loaded_mesh& loaded)
+{
+  return loaded.bvh ? loaded.bvh : mesh::build_picking_bvh(loaded);
+}
+
+MeshHandle ResourceRegistry::AddMesh(const std::string& key, const mesh::loaded_mesh& loaded,
+                                     const mesh::vertex_format& format, std::shared_ptr<const mesh::triangle_bvh> bvh)
+{
+  mesh::packed_vertices packed;
+  if (loaded.packed_as(format)) {
+    packed.decode = loaded.decode;
+  } else {
+    mesh::pack_vertices(loaded.vertices(), loaded.vertex_count(), format, loaded.bounds_min(), loaded.bounds_max(), packed);
+  }
+  const uint8_t* packed_data = packed.data.empty() ? loaded.packed_data() : packed.data.data();
+  size_t packed_size = packed.data.empty() ? loaded.packed_size() : packed.data.size();
+
+  MeshResource* resource = new MeshResource();
+  resource->vertex_count = (int)loaded.vertex_count();
+  resource->index_count = (int)loaded.index_count();
+  resource->bounds_min = loaded.bounds_min();
+  resource->bounds_max = loaded.bounds_max();
+  resource->decode = packed.decode;
+  resource->lods.assign(loaded.lods(), loaded.lods() + loaded.lod_count());
+  resource->meshlets.assign(loaded.meshlets(), loaded.meshlets() + loaded.meshlet_count());
+  resource->bvh = bvh ? bvh : BuildBvh(loaded);
+  resource->bytes = packed_size + loaded.index_count() * sizeof(uint32_t);
+
+  glGenBuffers(1, &resource->vertexbuffer);
+  glBindBuffer(GL_ARRAY_BUFFER, resource->vertexbuffer);
+  glBufferData(GL_ARRAY_BUFFER, packed_size, packed_data, GL_STATIC_DRAW);
+  glGenBuffers(1, &resource->indexbuffer);
+  // Not bound as GL_ELEMENT_ARRAY_BUFFER: that would change whatever VAO is bound
+  glBindBuffer(GL_COPY_WRITE_BUFFER, resource->indexbuffer);
+  glBufferData(GL_COPY_WRITE_BUFFER, loaded.index_count() * sizeof(uint32_t), loaded.indices(), GL_STATIC_DRAW);
+
+  MeshHandle handle(resource, DeleteMesh);
+  std::lock_guard<std::mutex> lock(mutex);
+  meshes[key] = handle;
+  stats.mesh_misses++;
+  return handle;
+}
+
+TextureHandle ResourceRegistry::AddTexture(const std::string& key, const BMPImage& image)
+{
+  TextureResource* resource = new TextureResource();
+  resource->texID = uploadBMP(image);
+  // Full mip chain adds a third on top of the base level
+  resource->bytes = (size_t)image.width * image.height * 3 * 4 / 3;
+
+  TextureHandle handle(resource, DeleteTexture);
+  std::lock_guard<std::mutex> lock(mutex);
+  textures[key] = handle;
+  stats.texture_misses++;
+  return handle;
+}
+
+TextureHandle ResourceRegistry::AddTexture(const std::string& key, const DDSImage& image)
+{
+  TextureResource* resource = new TextureResource();
+  resource->texID = uploadDDS(image);
+  resource->bytes = image.data.size();
+
+  TextureHandle handle(resource, DeleteTexture);
+  std::lock_guard<std::mutex> lock(mutex);
+  textures[key] = handle;
+  stats.texture_misses++;
+  return handle;
+}
+
+TextureHandle ResourceRegistry::AdoptTexture(const std::string& key, GLuint texture, size_t bytes)
+{
+  TextureResource* resource = new TextureResource();
+  resource->texID = texture;
+  resource->bytes = bytes;
+
+  TextureHandle handle(resource, DeleteTexture);
+  std::lock_guard<std::mutex> lock(mutex);
+  textures[key] = handle;
+  stats.texture_misses++;
+  return handle;
+}
+
+MeshHandle ResourceRegistry::LoadMesh(const std::string& stl_path, float extent, bool optimize)
+{
+  std::string key = MeshKey(stl_path, extent, vertex_format, optimize ? mesh::cache_optimized : 0);
+  MeshHandle handle = FindMesh(key);
+  if (handle) return handle;
+
+  mesh::loaded_mesh loaded;
+  if (!mesh::load_stl_mesh(stl_path, extent, loaded, vertex_format, optimize)) return MeshHandle();
+  return AddMesh(key, loaded, vertex_format);
+}
+
+MeshHandle ResourceRegistry::LoadSphere(const mesh::sphere_params& params)
+{
+  std::string key = SphereKey(params, vertex_format);
+  MeshHandle handle = FindMesh(key);
+  if (handle) return handle;
+
+  mesh::loaded_mesh sphere;
+  mesh::generate_sphere_lods(params, sphere.baked);
+  return AddMesh(key, sphere, vertex_format);
+}
+
+TextureHandle ResourceRegistry::LoadTexture(const std::string& image_path)
+{
+  std::string key = TextureKey(image_path);
+  TextureHandle handle = FindTexture(key);
+  if (handle) return handle;
+
+  if (isDDSPath(image_path.c_str())) {
+    DDSImage image;
+    if (!readDDS(image_path.c_str(), image)) return TextureHandle();
+    return AddTexture(key, image);
+  }
+  BMPImage image;
+  if (!readBMP(image_path.c_str(), image)) return TextureHandle();
+  return AddTexture(key, image);
+}
+
+void ResourceRegistry::CountMeshHit()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  stats.mesh_hits++;
+}
+
+void ResourceRegistry::CountTextureHit()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  stats.texture_hits++;
+}
+
+RegistryStats ResourceRegistry::Stats()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  RegistryStats result = stats;
+  result.live_meshes = result.mesh_bytes = 0;
+  result.live_textures = result.texture_bytes = 0;
+  for (auto& entry : meshes) {
+    if (MeshHandle handle = entry.second.lock()) {
+      result.live_meshes++;
+      result.mesh_bytes += handle->bytes;
+    }
+  }
+  for (auto& entry : textures) {
+    if (TextureHandle handle = entry.second.lock()) {
+      result.live_textures++;
+      result.texture_bytes += handle->bytes;
+    }
+  }
+  return result;
+}
+
+void ResourceRegistry::PrintStats()
+{
+  RegistryStats s = Stats();
+  printf("Meshes:   %zu live, %.2f MB, %zu hits, %zu misses\n",
+    s.live_meshes, s.mesh_bytes / (1024.0 * 1024.0), s.mesh_hits, s.mesh_misses);
+  printf("Textures: %zu live, %.2f MB, %zu hits, %zu misses\n",
+    s.live_textures, s.texture_bytes / (1024.0 * 1024.0), s.texture_hits, s.texture_misses);
+}
@@ -0,0 +1,129 @@
+#ifndef RESOURCE_REGISTRY_H
+#define RESOURCE_REGISTRY_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "playground/mesh_bvh.h"
+#include "playground/mesh_cache.h"
+#include "playground/vertex_format.h"
+#include "playground/sphere_mesh.h"
+
+struct BMPImage;
+struct DDSImage;
+
+// GPU buffers of one loaded mesh. Shared by every RenderingObject drawing it;
+// each object binds them into its own VAO.
+struct MeshResource
+{
+  GLuint vertexbuffer;
+  GLuint indexbuffer;
+  int vertex_count;
+  int index_count;
+  glm::vec3 bounds_min;
+  glm::vec3 bounds_max;
+  mesh::vertex_decode decode; //<<< layout of vertexbuffer and how to decode it
+  std::vector<mesh::lod_level> lods; //<<< index ranges of the LOD chain, empty if there is none
+  std::vector<mesh::meshlet> meshlets; //<<< clusters of LOD level 0 for CPU culling, empty if there are none
+  std::shared_ptr<const mesh::triangle_bvh> bvh; //<<< LOD level 0 in model space, for picking
+  size_t bytes;
+};
+
+struct TextureResource
+{
+  GLuint texID;
+  size_t bytes;
+};
+
+// Reference counted handles. The GL objects are deleted when the last handle goes away.
+typedef std::shared_ptr<const MeshResource> MeshHandle;
+typedef std::shared_ptr<const TextureResource> TextureHandle;
+
+struct RegistryStats
+{
+  size_t mesh_hits;
+  size_t mesh_misses;
+  size_t texture_hits;
+  size_t texture_misses;
+  size_t live_meshes;
+  size_t live_textures;
+  size_t mesh_bytes;     //<<< GPU memory of live meshes
+  size_t texture_bytes;  //<<< GPU memory of live textures, mip chain included
+};
+
+/**
+* Deduplicates meshes and textures by path and processing parameters.
+*
+* Every RenderingObject that uses the same mesh or texture gets a handle to
+* the same GPU allocation, and the file is loaded and processed once. Entries
+* are held weakly: when the last handle is released, the GL objects are
+* freed and the next request loads the file again.
+*
+* Find/Add are main-thread only (they create GL objects). The key helpers and
+* the stats counters may be used from any thread.
+*/
+class ResourceRegistry
+{
+public:
+  ResourceRegistry();
+
+  // Mesh keys name everything the uploaded buffers depend on: the load
+  // parameters, the bake flags (mesh::cache_optimized, ...) and the vertex
+  // format, so a mesh is never shared across formats or bakes.
+  static std::string MeshKey(const std::string& stl_path, float extent, const mesh::vertex_format& format,
+                             uint32_t flags = mesh::cache_optimized);
+  static std::string TextureKey(const std::string& image_path);
+  static std::string SphereKey(const mesh::sphere_params& params, const mesh::vertex_format& format);
+
+  // Returns the live resource for key (counted as a hit), or null.
+  MeshHandle FindMesh(const std::string& key);
+  TextureHandle FindTexture(const std::string& key);
+
+  // Vertex format of meshes uploaded from now on, compact by default.
+  // Meshes already live keep the format they were uploaded with.
+  void SetVertexFormat(const mesh::vertex_format& format);
+  const mesh::vertex_format& VertexFormat() const { return vertex_format; }
+
+  // Picking BVH over LOD level 0 of loaded (all of it without a LOD chain):
+  // loaded.bvh when the load path set it, built otherwise. Any thread.
+  static std::shared_ptr<const mesh::triangle_bvh> BuildBvh(const mesh::loaded_mesh& loaded);
+
+  // Uploads freshly loaded data in format and registers it under key (counted
+  // as a miss); key must name the same format. Vertices already packed in
+  // format are uploaded as they are. Builds the BVH here unless the caller
+  // already did, e.g. on a loader thread.
+  MeshHandle AddMesh(const std::string& key, const mesh::loaded_mesh& loaded, const mesh::vertex_format& format,
+                     std::shared_ptr<const mesh::triangle_bvh> bvh = nullptr);
+  TextureHandle AddTexture(const std::string& key, const BMPImage& image);
+  TextureHandle AddTexture(const std::string& key, const DDSImage& image);
+  // Registers a texture created elsewhere (e.g. one still being streamed); the registry takes ownership
+  TextureHandle AdoptTexture(const std::string& key, GLuint texture, size_t bytes);
+
+  // Synchronous lookup-or-load, for use without the AssetLoader
+  MeshHandle LoadMesh(const std::string& stl_path, float extent = 150.0f, bool optimize = true);
+  MeshHandle LoadSphere(const mesh::sphere_params& params); //<<< generated in place with a LOD chain, no file I/O
+  TextureHandle LoadTexture(const std::string& image_path); //<<< .bmp or baked .dds
+
+  // A miss that is already being loaded elsewhere counts as a hit; the loader reports those.
+  void CountMeshHit();
+  void CountTextureHit();
+
+  RegistryStats Stats();
+  void PrintStats();
+
+private:
+  std::mutex mutex;
+  std::unordered_map<std::string, std::weak_ptr<const MeshResource>> meshes;
+  std::unordered_map<std::string, std::weak_ptr<const TextureResource>> textures;
+  RegistryStats stats;
+  mesh::vertex_format vertex_format;
+};
+
+#endif
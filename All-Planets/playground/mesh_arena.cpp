@@ -0,0 +1,67 @@
+#include "mesh_arena.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <new>
+
+namespace mesh {
+
+  arena::arena(size_t initial_bytes) : block_(0), offset_(0), used_(0), next_size_(std::max<size_t>(initial_bytes, 4096)) {
+    stats_ = arena_stats();
+  }
+
+  arena::~arena() {
+    for (block& b : blocks_) ::operator delete(b.data);
+  }
+
+  arena_stats arena::stats() const {
+    arena_stats s = stats_;
+    s.capacity = 0;
+    for (const block& b : blocks_) s.capacity += b.size;
+    return s;
+  }
+
+  void* arena::do_allocate(size_t bytes, size_t alignment) {
+    stats_.requests++;
+    if (bytes == 0) bytes = 1;
+    for (;;) {
+      if (block_ < blocks_.size()) {
+        const block& b = blocks_[block_];
+        uintptr_t base = (uintptr_t)b.data;
+        size_t start = ((base + offset_ + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base;
+        if (start + bytes <= b.size) {
+          used_ += start + bytes - offset_;
+          offset_ = start + bytes;
+          stats_.peak_bytes = std::max(stats_.peak_bytes, used_);
+          return b.data + start;
+        }
+        // Does not fit: the rest of this block is skipped
+        used_ += b.size - offset_;
+        if (block_ + 1 < blocks_.size() && blocks_[block_ + 1].size >= bytes + alignment) {
+          block_++;
+          offset_ = 0;
+          continue;
+        }
+      }
+
+      // A new block after the current one; blocks kept from before a rewind stay behind it
+      size_t size = std::max(next_size_, bytes + alignment);
+      block fresh = { static_cast<char*>(::operator new(size)), size };
+      stats_.heap_blocks++;
+      next_size_ = size * 2;
+      size_t at = blocks_.empty() ? 0 : block_ + 1;
+      blocks_.insert(blocks_.begin() + at, fresh);
+      block_ = at;
+      offset_ = 0;
+    }
+  }
+
+  arena::scope::scope(arena& a) : arena_(a), block_(a.block_), offset_(a.offset_), used_(a.used_) {}
+
+  arena::scope::~scope() {
+    arena_.block_ = block_;
+    arena_.offset_ = offset_;
+    arena_.used_ = used_;
+  }
+
+}
@@ -0,0 +1,91 @@
+#ifndef MESH_ARENA_H
+#define MESH_ARENA_H
+
+#include <cstddef>
+#include <memory_resource>
+#include <optional>
+#include <vector>
+
+// Scratch memory of the mesh load path. One arena serves a whole load: the
+// stages take their temporary buffers from it as std::pmr containers, and
+// every stage rewinds it when done so the next one reuses the same blocks.
+// Sized up front from the triangle count, a load then takes a constant
+// number of blocks from the heap however many buffers the stages use.
+namespace mesh {
+
+  struct arena_stats {
+    size_t requests;     // allocations served
+    size_t heap_blocks;  // blocks taken from the heap
+    size_t peak_bytes;   // most bytes handed out at once, alignment included
+    size_t capacity;     // bytes held in blocks
+  };
+
+  // Bump allocator over a list of heap blocks. Deallocation is a no-op;
+  // memory comes back when a scope around the allocations ends, or with the
+  // arena. Not thread safe: allocate on one thread only (worker threads may
+  // of course fill buffers allocated here).
+  class arena : public std::pmr::memory_resource {
+  public:
+    explicit arena(size_t initial_bytes = 64 * 1024);
+    ~arena();
+    arena(const arena&) = delete;
+    arena& operator=(const arena&) = delete;
+
+    arena_stats stats() const;
+    size_t used() const { return used_; }
+
+    // Everything allocated while a scope is alive is released when it ends.
+    // Scopes nest; containers allocated inside one must not outlive it.
+    class scope {
+    public:
+      explicit scope(arena& a);
+      ~scope();
+      scope(const scope&) = delete;
+      scope& operator=(const scope&) = delete;
+
+    private:
+      arena& arena_;
+      size_t block_;
+      size_t offset_;
+      size_t used_;
+    };
+
+  private:
+    struct block {
+      char* data;
+      size_t size;
+    };
+
+    void* do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void*, size_t, size_t) override {}
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+    std::vector<block> blocks_;
+    size_t block_;   // block allocations come from
+    size_t offset_;  // first free byte in it
+    size_t used_;    // bytes handed out, including what was skipped at block ends
+    size_t next_size_;
+    arena_stats stats_;
+  };
+
+  // Scratch of one pipeline call: a scope on the caller's arena, or a
+  // private arena when the caller passes none.
+  class scratch_scope {
+  public:
+    explicit scratch_scope(arena* caller) : arena_(caller ? caller : &own_.emplace()), scope_(*arena_) {}
+
+    arena& get() { return *arena_; }
+    operator std::pmr::memory_resource*() { return arena_; }
+    // So std::pmr containers can be constructed from the scope directly
+    template <typename T>
+    operator std::pmr::polymorphic_allocator<T>() { return std::pmr::polymorphic_allocator<T>(arena_); }
+
+  private:
+    std::optional<arena> own_;
+    arena* arena_;
+    arena::scope scope_;
+  };
+
+}
+
+#endif
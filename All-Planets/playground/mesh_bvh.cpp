@@ -0,0 +1,712 @@
+#include "mesh_bvh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+
+#include <common/parallel.hpp>
+
+namespace mesh {
+
+  namespace {
+
+    const int max_bins = 32;
+    // Below this depth splits are SAH; past it they halve, which bounds the depth at twice this
+    const int sah_depth = 32;
+    const int stack_size = 2 * sah_depth + 8;
+    // Nodes with at least this many primitives are binned by several threads
+    const size_t parallel_binning = 1 << 18;
+    // and the subtrees left to parallelFor have at least this many
+    const size_t parallel_subtree = 1 << 16;
+
+    // glm's vector min/max call through a function pointer, which the hot
+    // loops below cannot afford
+    glm::vec3 min3(const glm::vec3& a, const glm::vec3& b) {
+      return glm::vec3(a.x < b.x ? a.x : b.x, a.y < b.y ? a.y : b.y, a.z < b.z ? a.z : b.z);
+    }
+    glm::vec3 max3(const glm::vec3& a, const glm::vec3& b) {
+      return glm::vec3(a.x > b.x ? a.x : b.x, a.y > b.y ? a.y : b.y, a.z > b.z ? a.z : b.z);
+    }
+
+    float half_area(const glm::vec3& lo, const glm::vec3& hi) {
+      glm::vec3 d = max3(hi - lo, glm::vec3(0.0f));
+      return d.x * d.y + d.y * d.z + d.z * d.x;
+    }
+
+    // What a built triangle_bvh points into
+    struct triangle_bvh_storage {
+      std::vector<bvh_node> nodes;
+      std::vector<glm::vec3> corners;
+      std::vector<uint32_t> triangles;
+    };
+
+    struct box {
+      glm::vec3 lo;
+      glm::vec3 hi;
+
+      box() : lo(INFINITY), hi(-INFINITY) {}
+      void grow(const glm::vec3& p) { lo = min3(lo, p); hi = max3(hi, p); }
+      void grow(const glm::vec3& l, const glm::vec3& h) { lo = min3(lo, l); hi = max3(hi, h); }
+      void grow(const box& b) { grow(b.lo, b.hi); }
+    };
+
+    struct bin {
+      box bounds;
+      uint32_t count = 0;
+    };
+
+    // Bins of all three axes, filled in one pass over the primitives
+    struct bin_grid {
+      bin bins[3][max_bins];
+
+      void add(const glm::vec3& position, int count, const glm::vec3& lo, const glm::vec3& hi) {
+        for (int a = 0; a < 3; a++) {
+          bin& into = bins[a][std::min(count - 1, (int)position[a])];
+          into.bounds.grow(lo, hi);
+          into.count++;
+        }
+      }
+      void merge(const bin_grid& other, int count) {
+        for (int a = 0; a < 3; a++)
+          for (int b = 0; b < count; b++) {
+            bins[a][b].bounds.grow(other.bins[a][b].bounds);
+            bins[a][b].count += other.bins[a][b].count;
+          }
+      }
+    };
+
+    // A primitive's box, moved along as the build partitions them, so that
+    // every pass over a node reads memory in order
+    struct primitive {
+      glm::vec3 lo;
+      uint32_t index;
+      glm::vec3 hi;
+      float unused;
+
+      glm::vec3 centroid() const { return 0.5f * (lo + hi); }
+    };
+
+    class builder {
+    public:
+      builder(const glm::vec3* lo, const glm::vec3* hi, size_t count, const bvh_options& options)
+        : primitives_(count), traversal_cost_(options.traversal_cost), max_leaf_(std::max<size_t>(options.max_leaf, 1)),
+          bins_(std::min(std::max(options.bins, 2), max_bins)), deferred_size_(0) {
+        parallelFor(count, 1 << 16, [&](size_t begin, size_t end) {
+          for (size_t i = begin; i < end; i++) primitives_[i] = primitive{ lo[i], (uint32_t)i, hi[i], 0.0f };
+        });
+      }
+
+      // Builds the tree over every primitive into nodes. Large trees are
+      // built top down on this thread, binning large nodes in parallel, until
+      // nodes are small enough, then those subtrees go through parallelFor,
+      // each into a vector of its own, and are spliced in after the top.
+      void build(std::vector<bvh_node>& nodes) {
+        uint32_t count = (uint32_t)primitives_.size();
+        nodes.assign(1, bvh_node());
+        size_t threads = workerThreadCount();
+        if (threads == 1 || count < 2 * parallel_subtree) {
+          build(nodes, 0, 0, count, 0, nullptr);
+          return;
+        }
+        // Small enough for one thread to bin, so parallelFor is not nested
+        deferred_size_ = std::min(std::max<size_t>(count / (16 * threads), parallel_subtree), parallel_binning - 1);
+        std::vector<subtree> deferred;
+        build(nodes, 0, 0, count, 0, &deferred);
+
+        // Subtrees are whole primitive ranges; split the primitives evenly
+        // and let each thread build the subtrees that start in its part
+        std::vector<std::vector<bvh_node>> built(deferred.size());
+        parallelFor(count, deferred_size_, [&](size_t begin, size_t end) {
+          auto t = std::lower_bound(deferred.begin(), deferred.end(), begin,
+                                    [](const subtree& s, size_t first) { return s.begin < first; });
+          for (; t != deferred.end() && t->begin < end; ++t) {
+            std::vector<bvh_node>& tree = built[t - deferred.begin()];
+            tree.resize(1);
+            build(tree, 0, t->begin, t->end, t->depth, nullptr);
+          }
+        });
+
+        for (size_t t = 0; t < deferred.size(); t++) {
+          // The subtree's root takes its slot, its other nodes move to the end
+          uint32_t base = (uint32_t)nodes.size() - 1;
+          for (bvh_node& n : built[t])
+            if (n.count == 0) n.first += base;
+          nodes[deferred[t].node] = built[t][0];
+          nodes.insert(nodes.end(), built[t].begin() + 1, built[t].end());
+        }
+      }
+
+      // The primitives in leaf order
+      void order(std::vector<uint32_t>& out) const {
+        out.resize(primitives_.size());
+        for (size_t i = 0; i < primitives_.size(); i++) out[i] = primitives_[i].index;
+      }
+
+    private:
+      // A node whose subtree is left to the parallel part of build(); it is
+      // filled in when the subtree is spliced in
+      struct subtree {
+        uint32_t node;
+        uint32_t begin;
+        uint32_t end;
+        int depth;
+      };
+
+      // Builds the subtree of [begin, end) into nodes[node]; its descendants are appended to nodes.
+      // With deferred, children of at most deferred_size_ primitives are only recorded there.
+      void build(std::vector<bvh_node>& nodes, uint32_t node, uint32_t begin, uint32_t end, int depth,
+                 std::vector<subtree>* deferred) {
+        uint32_t n = end - begin;
+        box bounds, centroids;
+        measure(begin, end, bounds, centroids);
+        nodes[node].bounds_min = bounds.lo;
+        nodes[node].bounds_max = bounds.hi;
+
+        uint32_t mid = begin;
+        if (n > 1) {
+          if (depth < sah_depth) mid = sah_split(begin, end, bounds, centroids);
+          else if (n > max_leaf_) mid = median_split(begin, end, centroids);
+        }
+        if (mid == begin || mid == end) {
+          nodes[node].first = begin;
+          nodes[node].count = n;
+          return;
+        }
+
+        uint32_t left = (uint32_t)nodes.size();
+        nodes.resize(nodes.size() + 2);
+        nodes[node].first = left;
+        nodes[node].count = 0;
+
+        uint32_t ranges[2][2] = { { begin, mid }, { mid, end } };
+        for (uint32_t c = 0; c < 2; c++) {
+          uint32_t b = ranges[c][0], e = ranges[c][1];
+          if (deferred && e - b <= deferred_size_) deferred->push_back(subtree{ left + c, b, e, depth + 1 });
+          else build(nodes, left + c, b, e, depth + 1, deferred);
+        }
+      }
+
+      // f(b, e) over parts of [0, end - begin), on several threads if the node
+      // is large. Small nodes skip parallelFor, which asks the system for the
+      // thread count every time.
+      template <typename F>
+      void over(uint32_t begin, uint32_t end, F f) const {
+        if (end - begin >= parallel_binning) parallelFor(end - begin, parallel_binning / 4, f);
+        else f(size_t(0), size_t(end - begin));
+      }
+
+      void measure(uint32_t begin, uint32_t end, box& bounds, box& centroids) const {
+        std::mutex merge;
+        over(begin, end, [&](size_t b, size_t e) {
+          box local_bounds, local_centroids;
+          for (size_t i = begin + b; i < begin + e; i++) {
+            local_bounds.grow(primitives_[i].lo, primitives_[i].hi);
+            local_centroids.grow(primitives_[i].centroid());
+          }
+          std::lock_guard<std::mutex> lock(merge);
+          bounds.grow(local_bounds);
+          centroids.grow(local_centroids);
+        });
+      }
+
+      // Partitions at the cheapest bin plane, or returns begin if leaving the node a leaf is cheaper
+      uint32_t sah_split(uint32_t begin, uint32_t end, const box& bounds, const box& centroids) {
+        // Small nodes have few planes worth trying, and sweeping empty bins
+        // would cost more than binning their primitives
+        int bins = std::min(bins_, std::max(2, (int)(end - begin)));
+        glm::vec3 extent = centroids.hi - centroids.lo;
+        glm::vec3 scale(0.0f);
+        for (int a = 0; a < 3; a++)
+          if (extent[a] > 0.0f) scale[a] = (float)bins / extent[a];
+        if (scale == glm::vec3(0.0f))
+          return end - begin > max_leaf_ ? begin + (end - begin) / 2 : begin; // all on one spot
+
+        // Bin position along each axis; scale is 0 on flat axes, which all land in bin 0
+        bin_grid grid;
+        auto fill = [&](bin_grid& into, size_t b, size_t e) {
+          for (size_t i = begin + b; i < begin + e; i++) {
+            const primitive& p = primitives_[i];
+            into.add((p.centroid() - centroids.lo) * scale, bins, p.lo, p.hi);
+          }
+        };
+        if (end - begin < parallel_binning) {
+          fill(grid, 0, end - begin);
+        } else {
+          std::mutex merge;
+          parallelFor(end - begin, parallel_binning / 4, [&](size_t b, size_t e) {
+            bin_grid local;
+            fill(local, b, e);
+            std::lock_guard<std::mutex> lock(merge);
+            grid.merge(local, bins);
+          });
+        }
+
+        // Cost of a split: visiting the node, then each half in proportion
+        // to the chance a ray through the node also passes through it
+        float leaf_cost = (float)(end - begin);
+        float best_cost = INFINITY;
+        int best_axis = -1, best_plane = 0;
+        float area = half_area(bounds.lo, bounds.hi);
+        for (int a = 0; a < 3; a++) {
+          if (scale[a] == 0.0f) continue;
+          float right_cost[max_bins];
+          box right;
+          uint32_t right_count = 0;
+          for (int b = bins - 1; b > 0; b--) {
+            right.grow(grid.bins[a][b].bounds);
+            right_count += grid.bins[a][b].count;
+            right_cost[b] = half_area(right.lo, right.hi) * right_count;
+          }
+          box left;
+          uint32_t left_count = 0;
+          for (int b = 1; b < bins; b++) {
+            left.grow(grid.bins[a][b - 1].bounds);
+            left_count += grid.bins[a][b - 1].count;
+            if (left_count == 0 || left_count == end - begin) continue;
+            float cost = traversal_cost_ + (half_area(left.lo, left.hi) * left_count + right_cost[b]) / area;
+            if (cost < best_cost) {
+              best_cost = cost;
+              best_axis = a;
+              best_plane = b;
+            }
+          }
+        }
+        if (best_axis < 0)
+          return end - begin > max_leaf_ ? median_split(begin, end, centroids) : begin;
+        if (best_cost >= leaf_cost && end - begin <= max_leaf_)
+          return begin;
+
+        float lo = centroids.lo[best_axis], axis_scale = scale[best_axis];
+        primitive* first = primitives_.data();
+        primitive* mid = std::partition(first + begin, first + end, [&](const primitive& p) {
+          return (int)((p.centroid()[best_axis] - lo) * axis_scale) < best_plane;
+        });
+        return (uint32_t)(mid - first);
+      }
+
+      // Halves the node along its longest centroid axis
+      uint32_t median_split(uint32_t begin, uint32_t end, const box& centroids) {
+        glm::vec3 extent = centroids.hi - centroids.lo;
+        int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+        uint32_t mid = begin + (end - begin) / 2;
+        primitive* first = primitives_.data();
+        std::nth_element(first + begin, first + mid, first + end,
+          [&](const primitive& a, const primitive& b) { return a.centroid()[axis] < b.centroid()[axis]; });
+        return mid;
+      }
+
+      std::vector<primitive> primitives_;
+      float traversal_cost_;
+      size_t max_leaf_;
+      int bins_;
+      size_t deferred_size_;
+    };
+
+    // Entry distance of the ray into the box, if it enters before t_max
+    bool slab(const bvh_node& n, const glm::vec3& origin, const glm::vec3& inv_direction, float t_max, float& t) {
+      glm::vec3 t0 = (n.bounds_min - origin) * inv_direction;
+      glm::vec3 t1 = (n.bounds_max - origin) * inv_direction;
+      glm::vec3 t_near = min3(t0, t1), t_far = max3(t0, t1);
+      t = std::max(std::max(t_near.x, t_near.y), std::max(t_near.z, 0.0f));
+      return t <= std::min(std::min(t_far.x, t_far.y), std::min(t_far.z, t_max));
+    }
+
+    float distance_sq(const bvh_node& n, const glm::vec3& p) {
+      glm::vec3 d = max3(max3(n.bounds_min - p, p - n.bounds_max), glm::vec3(0.0f));
+      return glm::dot(d, d);
+    }
+
+    // Squared distance from p to the farthest corner of the box
+    float far_distance_sq(const bvh_node& n, const glm::vec3& p) {
+      glm::vec3 d = max3(p - n.bounds_min, n.bounds_max - p);
+      return glm::dot(d, d);
+    }
+
+    // A subtree's primitives are contiguous in the build order, from its
+    // leftmost leaf to the end of its rightmost one
+    void subtree_range(const bvh_node* nodes, uint32_t node, uint32_t& first, uint32_t& count) {
+      const bvh_node* left = &nodes[node];
+      while (left->count == 0) left = &nodes[left->first];
+      const bvh_node* right = &nodes[node];
+      while (right->count == 0) right = &nodes[right->first + 1];
+      first = left->first;
+      count = right->first + right->count - first;
+    }
+
+    // Depth first, nearer child first; leaf(first, count) may lower t_max,
+    // and subtrees entered beyond it are dropped
+    template <typename Leaf>
+    void walk_ray(const bvh_node* nodes, size_t node_count, const glm::vec3& origin, const glm::vec3& direction, float& t_max,
+                  Leaf leaf) {
+      glm::vec3 inv_direction = 1.0f / direction;
+      float t;
+      if (node_count == 0 || !slab(nodes[0], origin, inv_direction, t_max, t)) return;
+      uint32_t stack[stack_size];
+      float stack_t[stack_size];
+      int top = 0;
+      uint32_t current = 0;
+      for (;;) {
+        const bvh_node& n = nodes[current];
+        if (n.count == 0) {
+          float t_left, t_right;
+          bool left = slab(nodes[n.first], origin, inv_direction, t_max, t_left);
+          bool right = slab(nodes[n.first + 1], origin, inv_direction, t_max, t_right);
+          if (left && right) {
+            bool left_first = t_left <= t_right;
+            stack[top] = left_first ? n.first + 1 : n.first;
+            stack_t[top++] = left_first ? t_right : t_left;
+            current = left_first ? n.first : n.first + 1;
+            continue;
+          }
+          if (left || right) {
+            current = left ? n.first : n.first + 1;
+            continue;
+          }
+        } else {
+          leaf(n.first, n.count, t_max);
+        }
+        do {
+          if (top == 0) return;
+          current = stack[--top];
+        } while (stack_t[top] > t_max);
+      }
+    }
+
+    // Same for a point: boxes are visited nearest first while they are
+    // within bound_sq, which leaf may lower
+    template <typename Leaf>
+    void walk_point(const bvh_node* nodes, size_t node_count, const glm::vec3& p, float& bound_sq, Leaf leaf) {
+      if (node_count == 0 || distance_sq(nodes[0], p) > bound_sq) return;
+      uint32_t stack[stack_size];
+      float stack_d[stack_size];
+      int top = 0;
+      uint32_t current = 0;
+      for (;;) {
+        const bvh_node& n = nodes[current];
+        if (n.count == 0) {
+          float d_left = distance_sq(nodes[n.first], p), d_right = distance_sq(nodes[n.first + 1], p);
+          bool left = d_left <= bound_sq, right = d_right <= bound_sq;
+          if (left && right) {
+            bool left_first = d_left <= d_right;
+            stack[top] = left_first ? n.first + 1 : n.first;
+            stack_d[top++] = left_first ? d_right : d_left;
+            current = left_first ? n.first : n.first + 1;
+            continue;
+          }
+          if (left || right) {
+            current = left ? n.first : n.first + 1;
+            continue;
+          }
+        } else {
+          leaf(n.first, n.count, bound_sq);
+        }
+        do {
+          if (top == 0) return;
+          current = stack[--top];
+        } while (stack_d[top] > bound_sq);
+      }
+    }
+
+    // Every leaf within sqrt(radius_sq) of p, in no particular order:
+    // leaf(first, count) for those that cross the sphere's surface, and
+    // inside(first, count) with the whole primitive range of any subtree
+    // the sphere holds entirely
+    template <typename Leaf, typename Inside>
+    void walk_sphere(const bvh_node* nodes, size_t node_count, const glm::vec3& p, float radius_sq, Leaf leaf,
+                     Inside inside) {
+      if (node_count == 0) return;
+      uint32_t stack[stack_size];
+      int top = 0;
+      stack[top++] = 0;
+      while (top > 0) {
+        uint32_t current = stack[--top];
+        const bvh_node& n = nodes[current];
+        if (distance_sq(n, p) > radius_sq) continue;
+        if (far_distance_sq(n, p) <= radius_sq) {
+          uint32_t first, count;
+          subtree_range(nodes, current, first, count);
+          inside(first, count);
+        } else if (n.count != 0) {
+          leaf(n.first, n.count);
+        } else {
+          stack[top++] = n.first + 1;
+          stack[top++] = n.first;
+        }
+      }
+    }
+
+    // Möller-Trumbore, either side
+    bool intersect(const glm::vec3* corner, const glm::vec3& origin, const glm::vec3& direction, float t_max, float& t,
+                   glm::vec2& barycentric) {
+      glm::vec3 e1 = corner[1] - corner[0], e2 = corner[2] - corner[0];
+      glm::vec3 p = glm::cross(direction, e2);
+      float det = glm::dot(e1, p);
+      if (det == 0.0f) return false;
+      float inv_det = 1.0f / det;
+      glm::vec3 s = origin - corner[0];
+      float u = glm::dot(s, p) * inv_det;
+      if (u < 0.0f || u > 1.0f) return false;
+      glm::vec3 q = glm::cross(s, e1);
+      float v = glm::dot(direction, q) * inv_det;
+      if (v < 0.0f || u + v > 1.0f) return false;
+      t = glm::dot(e2, q) * inv_det;
+      if (t < 0.0f || t > t_max) return false;
+      barycentric = glm::vec2(u, v);
+      return true;
+    }
+
+    // Ericson, Real-Time Collision Detection 5.1.5
+    glm::vec3 closest_on_triangle(const glm::vec3& p, const glm::vec3* corner) {
+      const glm::vec3& a = corner[0];
+      const glm::vec3& b = corner[1];
+      const glm::vec3& c = corner[2];
+      glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+      float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+      if (d1 <= 0.0f && d2 <= 0.0f) return a;
+      glm::vec3 bp = p - b;
+      float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+      if (d3 >= 0.0f && d4 <= d3) return b;
+      float vc = d1 * d4 - d3 * d2;
+      if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) return a + ab * (d1 / (d1 - d3));
+      glm::vec3 cp = p - c;
+      float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+      if (d6 >= 0.0f && d5 <= d6) return c;
+      float vb = d5 * d2 - d1 * d6;
+      if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) return a + ac * (d2 / (d2 - d6));
+      float va = d3 * d6 - d5 * d4;
+      if (va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f) return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+      float denom = 1.0f / (va + vb + vc);
+      return a + ab * (vb * denom) + ac * (vc * denom);
+    }
+
+    bool raycast_mesh(const triangle_bvh& bvh, uint32_t instance, const glm::vec3& origin, const glm::vec3& direction,
+                      float& t_max, ray_hit& hit) {
+      bool found = false;
+      walk_ray(bvh.nodes, bvh.node_count, origin, direction, t_max, [&](uint32_t first, uint32_t count, float& t_limit) {
+        for (uint32_t i = first; i < first + count; i++) {
+          float t;
+          glm::vec2 barycentric;
+          if (intersect(&bvh.corners[3 * (size_t)i], origin, direction, t_limit, t, barycentric)) {
+            t_limit = t;
+            hit.ref = triangle_ref{ instance, bvh.triangles[i] };
+            hit.t = t;
+            hit.barycentric = barycentric;
+            found = true;
+          }
+        }
+      });
+      return found;
+    }
+
+    bool nearest_mesh(const triangle_bvh& bvh, uint32_t instance, const glm::vec3& p, float& best_sq, point_hit& hit) {
+      bool found = false;
+      walk_point(bvh.nodes, bvh.node_count, p, best_sq, [&](uint32_t first, uint32_t count, float& bound_sq) {
+        for (uint32_t i = first; i < first + count; i++) {
+          glm::vec3 q = closest_on_triangle(p, &bvh.corners[3 * (size_t)i]);
+          float d = glm::dot(q - p, q - p);
+          if (d <= bound_sq) {
+            bound_sq = d;
+            hit.ref = triangle_ref{ instance, bvh.triangles[i] };
+            hit.point = q;
+            found = true;
+          }
+        }
+      });
+      if (found) hit.distance = std::sqrt(best_sq);
+      return found;
+    }
+
+    size_t overlap_mesh(const triangle_bvh& bvh, uint32_t instance, const glm::vec3& center, float radius,
+                        std::vector<triangle_ref>& out) {
+      size_t before = out.size();
+      float radius_sq = radius * radius;
+      auto inside = [&](uint32_t first, uint32_t count) {
+        for (uint32_t i = first; i < first + count; i++) out.push_back(triangle_ref{ instance, bvh.triangles[i] });
+      };
+      walk_sphere(bvh.nodes, bvh.node_count, center, radius_sq, [&](uint32_t first, uint32_t count) {
+        for (uint32_t i = first; i < first + count; i++) {
+          const glm::vec3* corner = &bvh.corners[3 * (size_t)i];
+          // A corner in the sphere settles it without the closest point
+          bool hit = false;
+          for (int k = 0; k < 3 && !hit; k++) hit = glm::dot(corner[k] - center, corner[k] - center) <= radius_sq;
+          if (!hit) {
+            glm::vec3 q = closest_on_triangle(center, corner);
+            hit = glm::dot(q - center, q - center) <= radius_sq;
+          }
+          if (hit) out.push_back(triangle_ref{ instance, bvh.triangles[i] });
+        }
+      }, inside);
+      return out.size() - before;
+    }
+
+    // Length the model matrix gives a unit vector, for distances measured in model space
+    float uniform_scale(const glm::mat4& model) {
+      return glm::length(glm::vec3(model[0]));
+    }
+
+  }
+
+  void build_bvh(const glm::vec3* box_min, const glm::vec3* box_max, size_t count, std::vector<bvh_node>& nodes,
+                 std::vector<uint32_t>& order, const bvh_options& options) {
+    nodes.clear();
+    order.clear();
+    if (count == 0) return;
+    nodes.reserve(2 * count / std::max<size_t>(options.max_leaf / 2, 1));
+    builder b(box_min, box_max, count, options);
+    b.build(nodes);
+    b.order(order);
+  }
+
+  void build_triangle_bvh(const vertex* vertices, const uint32_t* indices, size_t index_count, triangle_bvh& out,
+                          const bvh_options& options) {
+    size_t triangle_count = index_count / 3;
+    std::vector<glm::vec3> lo(triangle_count), hi(triangle_count);
+    parallelFor(triangle_count, 1 << 16, [&](size_t begin, size_t end) {
+      for (size_t t = begin; t < end; t++) {
+        const glm::vec3& a = vertices[indices[3 * t]].position;
+        const glm::vec3& b = vertices[indices[3 * t + 1]].position;
+        const glm::vec3& c = vertices[indices[3 * t + 2]].position;
+        lo[t] = min3(a, min3(b, c));
+        hi[t] = max3(a, max3(b, c));
+      }
+    });
+    std::shared_ptr<triangle_bvh_storage> storage = std::make_shared<triangle_bvh_storage>();
+    build_bvh(lo.data(), hi.data(), triangle_count, storage->nodes, storage->triangles, options);
+
+    // Corners in leaf order
+    storage->corners.resize(3 * storage->triangles.size());
+    parallelFor(storage->triangles.size(), 1 << 16, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) {
+        uint32_t t = storage->triangles[i];
+        for (int k = 0; k < 3; k++) storage->corners[3 * i + k] = vertices[indices[3 * (size_t)t + k]].position;
+      }
+    });
+    restore_triangle_bvh(storage->nodes.data(), storage->nodes.size(), storage->triangles.data(), storage->triangles.size(),
+                         storage->corners.data(), storage, out);
+  }
+
+  void restore_triangle_bvh(const bvh_node* nodes, size_t node_count, const uint32_t* triangles, size_t triangle_count,
+                            const glm::vec3* corners, std::shared_ptr<const void> storage, triangle_bvh& out) {
+    out.nodes = nodes;
+    out.node_count = node_count;
+    out.triangles = triangles;
+    out.corners = corners;
+    out.triangle_count = triangle_count;
+    out.storage = std::move(storage);
+  }
+
+  bool valid_bvh(const bvh_node* nodes, size_t node_count, size_t primitive_count) {
+    // A walk holds at most one stack entry per level below the root, plus one
+    std::vector<uint8_t> depth(node_count, 0);
+    for (size_t i = 0; i < node_count; i++) {
+      const bvh_node& n = nodes[i];
+      if (n.count != 0) {
+        if ((uint64_t)n.first + n.count > primitive_count) return false;
+        continue;
+      }
+      if (n.first <= i || (uint64_t)n.first + 1 >= node_count || depth[i] + 2 >= stack_size) return false;
+      for (uint32_t c = n.first; c <= n.first + 1; c++) depth[c] = std::max<uint8_t>(depth[c], depth[i] + 1);
+    }
+    return true;
+  }
+
+  void build_scene_bvh(const bvh_instance* instances, size_t count, scene_bvh& out) {
+    out.instances.assign(instances, instances + count);
+    out.inverse.resize(count);
+    std::vector<uint32_t> placed;
+    std::vector<glm::vec3> lo, hi;
+    for (size_t i = 0; i < count; i++) {
+      out.inverse[i] = glm::inverse(instances[i].model);
+      if (instances[i].bvh == nullptr || instances[i].bvh->node_count == 0) continue;
+      // World box around the transformed model space box
+      const bvh_node& root = instances[i].bvh->nodes[0];
+      glm::vec3 center = 0.5f * (root.bounds_min + root.bounds_max);
+      glm::vec3 extent = 0.5f * (root.bounds_max - root.bounds_min);
+      glm::mat3 linear(instances[i].model);
+      glm::vec3 world_center = glm::vec3(instances[i].model * glm::vec4(center, 1.0f));
+      glm::vec3 world_extent(0.0f);
+      for (int c = 0; c < 3; c++) world_extent += glm::abs(linear[c]) * extent[c];
+      placed.push_back((uint32_t)i);
+      lo.push_back(world_center - world_extent);
+      hi.push_back(world_center + world_extent);
+    }
+    build_bvh(lo.data(), hi.data(), placed.size(), out.nodes, out.order);
+    for (uint32_t& o : out.order) o = placed[o];
+  }
+
+  bool raycast(const triangle_bvh& bvh, const glm::vec3& origin, const glm::vec3& direction, float t_max, ray_hit& hit) {
+    return raycast_mesh(bvh, 0, origin, direction, t_max, hit);
+  }
+
+  bool raycast(const scene_bvh& scene, const glm::vec3& origin, const glm::vec3& direction, float t_max, ray_hit& hit) {
+    bool found = false;
+    // An affine map keeps t: origin + t * direction maps to local_origin + t * local_direction
+    walk_ray(scene.nodes.data(), scene.nodes.size(), origin, direction, t_max, [&](uint32_t first, uint32_t count, float& t_limit) {
+      for (uint32_t i = first; i < first + count; i++) {
+        uint32_t k = scene.order[i];
+        glm::vec3 local_origin = glm::vec3(scene.inverse[k] * glm::vec4(origin, 1.0f));
+        glm::vec3 local_direction = glm::vec3(scene.inverse[k] * glm::vec4(direction, 0.0f));
+        if (raycast_mesh(*scene.instances[k].bvh, k, local_origin, local_direction, t_limit, hit)) found = true;
+      }
+    });
+    return found;
+  }
+
+  bool nearest_point(const triangle_bvh& bvh, const glm::vec3& p, float max_distance, point_hit& hit) {
+    float best_sq = max_distance * max_distance;
+    return nearest_mesh(bvh, 0, p, best_sq, hit);
+  }
+
+  bool nearest_point(const scene_bvh& scene, const glm::vec3& p, float max_distance, point_hit& hit) {
+    bool found = false;
+    float best_sq = max_distance * max_distance;
+    walk_point(scene.nodes.data(), scene.nodes.size(), p, best_sq, [&](uint32_t first, uint32_t count, float& bound_sq) {
+      // The instances of a leaf nearest first too, by their model space
+      // boxes, so that the first mesh searched bounds the others tightly
+      const uint32_t batch = 8;
+      for (uint32_t b = first; b < first + count; b += batch) {
+        uint32_t n = std::min(batch, first + count - b);
+        std::pair<float, uint32_t> near[batch];
+        glm::vec3 local_p[batch];
+        for (uint32_t j = 0; j < n; j++) {
+          uint32_t k = scene.order[b + j];
+          float scale = uniform_scale(scene.instances[k].model);
+          local_p[j] = glm::vec3(scene.inverse[k] * glm::vec4(p, 1.0f));
+          near[j] = std::make_pair(distance_sq(scene.instances[k].bvh->nodes[0], local_p[j]) * scale * scale, j);
+        }
+        std::sort(near, near + n);
+        for (uint32_t j = 0; j < n && near[j].first <= bound_sq; j++) {
+          uint32_t k = scene.order[b + near[j].second];
+          float scale = uniform_scale(scene.instances[k].model);
+          float local_sq = bound_sq / (scale * scale);
+          point_hit local;
+          if (!nearest_mesh(*scene.instances[k].bvh, k, local_p[near[j].second], local_sq, local)) continue;
+          hit = local;
+          hit.point = glm::vec3(scene.instances[k].model * glm::vec4(local.point, 1.0f));
+          hit.distance = local.distance * scale;
+          bound_sq = hit.distance * hit.distance;
+          found = true;
+        }
+      }
+    });
+    return found;
+  }
+
+  size_t overlap_sphere(const triangle_bvh& bvh, const glm::vec3& center, float radius, std::vector<triangle_ref>& out) {
+    return overlap_mesh(bvh, 0, center, radius, out);
+  }
+
+  size_t overlap_sphere(const scene_bvh& scene, const glm::vec3& center, float radius, std::vector<triangle_ref>& out) {
+    size_t before = out.size();
+    float radius_sq = radius * radius;
+    walk_point(scene.nodes.data(), scene.nodes.size(), center, radius_sq, [&](uint32_t first, uint32_t count, float&) {
+      for (uint32_t i = first; i < first + count; i++) {
+        uint32_t k = scene.order[i];
+        float scale = uniform_scale(scene.instances[k].model);
+        overlap_mesh(*scene.instances[k].bvh, k, glm::vec3(scene.inverse[k] * glm::vec4(center, 1.0f)), radius / scale, out);
+      }
+    });
+    return out.size() - before;
+  }
+
+}
@@ -0,0 +1,123 @@
+#ifndef MESH_BVH_H
+#define MESH_BVH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "playground/mesh_pipeline.h"
+
+// Bounding volume hierarchies for picking and spatial queries: one over the
+// triangles of each mesh, in model space, and one over a scene of meshes
+// placed by their model matrices, so that meshes shared between objects are
+// only built once. Queries cost about log(triangles), not triangles.
+namespace mesh {
+
+  // Binary tree node. The two children of an inner node are adjacent.
+  struct bvh_node {
+    glm::vec3 bounds_min;
+    uint32_t first;  // leaf: first primitive (into the build order); inner node: left child, the right one follows
+    glm::vec3 bounds_max;
+    uint32_t count;  // primitives in a leaf, 0 for an inner node
+  };
+  static_assert(sizeof(bvh_node) == 32, "two nodes per 64 byte cache line");
+
+  struct bvh_options {
+    int bins;              // split candidates per axis for the surface area heuristic
+    size_t max_leaf;       // a node with more primitives is always split
+    float traversal_cost;  // cost of visiting a node, relative to testing one primitive
+
+    bvh_options() : bins(16), max_leaf(8), traversal_cost(1.0f) {}
+  };
+
+  // Builds a tree over count boxes with binned SAH: each node is split
+  // where the summed surface area of the two halves, weighted by their
+  // primitive counts, is lowest, among bins planes per axis; it stays a
+  // leaf when that costs more than testing its primitives. The top of a
+  // large tree is built with its nodes binned in parallel, and the subtrees
+  // below it are built in parallel through parallelFor.
+  // order receives the primitives in leaf order.
+  void build_bvh(const glm::vec3* box_min, const glm::vec3* box_max, size_t count, std::vector<bvh_node>& nodes,
+                 std::vector<uint32_t>& order, const bvh_options& options = bvh_options());
+
+  // Triangles of one mesh in model space, copied out in leaf order. The
+  // arrays belong to storage: the buffers of a build, or the mapped mesh
+  // cache the tree was read from, which stays mapped while the tree lives.
+  struct triangle_bvh {
+    const bvh_node* nodes;
+    size_t node_count;
+    const glm::vec3* corners;   // three per triangle
+    const uint32_t* triangles;  // index of each triangle in the source index buffer, / 3
+    size_t triangle_count;
+    std::shared_ptr<const void> storage;
+
+    triangle_bvh() : nodes(nullptr), node_count(0), corners(nullptr), triangles(nullptr), triangle_count(0) {}
+  };
+  // Over the first index_count indices (level 0 of a LOD chain)
+  void build_triangle_bvh(const vertex* vertices, const uint32_t* indices, size_t index_count, triangle_bvh& out,
+                          const bvh_options& options = bvh_options());
+  // The same tree over the nodes, triangles and corners (3 per triangle) of
+  // an earlier build, e.g. in a mapped mesh cache, without copying them;
+  // storage keeps them alive.
+  void restore_triangle_bvh(const bvh_node* nodes, size_t node_count, const uint32_t* triangles, size_t triangle_count,
+                            const glm::vec3* corners, std::shared_ptr<const void> storage, triangle_bvh& out);
+  // True if the queries can walk nodes over primitive_count primitives:
+  // children come after their parent and exist, leaves stay inside
+  // [0, primitive_count), and no path is deeper than the traversal stack.
+  // For trees read back from a file.
+  bool valid_bvh(const bvh_node* nodes, size_t node_count, size_t primitive_count);
+
+  // A mesh placed in the scene
+  struct bvh_instance {
+    const triangle_bvh* bvh;
+    glm::mat4 model;
+  };
+
+  struct scene_bvh {
+    std::vector<bvh_instance> instances;
+    std::vector<glm::mat4> inverse;  // of each model matrix
+    std::vector<bvh_node> nodes;     // over the world space boxes of the instances
+    std::vector<uint32_t> order;
+  };
+  // Instances without triangles are left out of the tree.
+  void build_scene_bvh(const bvh_instance* instances, size_t count, scene_bvh& out);
+
+  // A triangle of a mesh, or of an instance in a scene (instance is 0 for
+  // mesh queries).
+  struct triangle_ref {
+    uint32_t instance;
+    uint32_t triangle;
+  };
+
+  struct ray_hit {
+    triangle_ref ref;
+    float t;                   // hit point = origin + t * direction
+    glm::vec2 barycentric;     // weights of the triangle's second and third corners
+  };
+
+  struct point_hit {
+    triangle_ref ref;
+    glm::vec3 point;           // closest point on the surface
+    float distance;
+  };
+
+  // Closest hit along origin + t * direction for t in [0, t_max], either
+  // side of a triangle. direction need not be normalised.
+  bool raycast(const triangle_bvh& bvh, const glm::vec3& origin, const glm::vec3& direction, float t_max, ray_hit& hit);
+  bool raycast(const scene_bvh& scene, const glm::vec3& origin, const glm::vec3& direction, float t_max, ray_hit& hit);
+
+  // Closest point of the surface to p within max_distance.
+  bool nearest_point(const triangle_bvh& bvh, const glm::vec3& p, float max_distance, point_hit& hit);
+  // Model matrices must not scale unevenly for this and overlap_sphere: distances are measured in model space.
+  bool nearest_point(const scene_bvh& scene, const glm::vec3& p, float max_distance, point_hit& hit);
+
+  // Appends every triangle that reaches into the sphere. Returns how many were appended.
+  size_t overlap_sphere(const triangle_bvh& bvh, const glm::vec3& center, float radius, std::vector<triangle_ref>& out);
+  size_t overlap_sphere(const scene_bvh& scene, const glm::vec3& center, float radius, std::vector<triangle_ref>& out);
+
+}
+
+#endif
@@ -0,0 +1,416 @@
+#include "mesh_cache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <system_error>
+#include <thread>
+
+#include <common/parallel.hpp>
+
+#include "playground/mesh_lod.h"
+#include "playground/mesh_meshlet.h"
+#include "playground/mesh_optimize.h"
+#include "playground/smooth_normals.h"
+
+namespace mesh {
+
+  namespace {
+
+    const char magic[4] = { 'P', 'M', 'S', 'H' };
+
+    uint32_t format_code(const vertex_format& format) {
+      return (uint32_t)format.position | (uint32_t)format.normal << 8 | (uint32_t)format.uv << 16;
+    }
+
+    // False if code names an encoding this build does not know
+    bool format_of(uint32_t code, vertex_format& format) {
+      uint32_t p = code & 0xff, n = (code >> 8) & 0xff, u = (code >> 16) & 0xff;
+      if (p > (uint32_t)position_encoding::unorm16 || n > (uint32_t)normal_encoding::snorm10
+          || u > (uint32_t)uv_encoding::half2 || code >> 24 != 0)
+        return false;
+      format = vertex_format((position_encoding)p, (normal_encoding)n, (uv_encoding)u);
+      return true;
+    }
+
+    bool source_stamp(const std::string& source_path, uint64_t& size, int64_t& mtime) {
+      std::error_code ec;
+      std::filesystem::path p(source_path);
+      uintmax_t s = std::filesystem::file_size(p, ec);
+      if (ec) return false;
+      auto t = std::filesystem::last_write_time(p, ec);
+      if (ec) return false;
+      size = (uint64_t)s;
+      mtime = (int64_t)t.time_since_epoch().count();
+      return true;
+    }
+
+    // Triangles of an STL file: binary records are read in place from the
+    // mapping, ASCII files are parsed into memory first.
+    struct stl_source {
+      stl::binary_stl_view binary;
+      stl::stl_data ascii;
+
+      stl_source() : ascii("") {}
+
+      bool open(const std::string& stl_path) {
+        MappedFile file;
+        if (!file.open(stl_path.c_str())) {
+          printf("ERROR: COULD NOT READ FILE (could not open %s)\n", stl_path.c_str());
+          return false;
+        }
+        if (stl::detect_format(file.data(), file.size()) == stl::stl_format::ascii) {
+          file.adviseSequential();
+          ascii = stl::parse_stl_ascii(reinterpret_cast<const char*>(file.data()), file.size());
+          return true;
+        }
+        if (!binary.open(std::move(file), stl_path)) {
+          printf("ERROR: COULD NOT READ FILE (%s)\n", binary.error().c_str());
+          return false;
+        }
+        return true;
+      }
+
+      size_t size() const { return binary.empty() ? ascii.triangles.size() : binary.size(); }
+
+      void close() {
+        binary.close();
+        std::vector<stl::triangle>().swap(ascii.triangles);
+      }
+
+      // Calls f(batch, count) once, with stl::record or stl::triangle batch
+      template <typename F>
+      void visit(F f) const {
+        if (!binary.empty()) f(binary.begin(), binary.size());
+        else f(ascii.triangles.data(), ascii.triangles.size());
+      }
+    };
+
+    // Arena bytes per triangle the load path peaks at: the soup (positions,
+    // normals, UVs) plus the largest stage working set, smooth_normals and
+    // the LOD simplifier being the big ones
+    const size_t arena_bytes_per_triangle = 256;
+
+  }
+
+  std::string cache_path(const std::string& source_path) {
+    return source_path + ".pmesh";
+  }
+
+  bool cache_view::open(const std::string& cache_file, const std::string& source_path, float extent, uint32_t flags) {
+    close();
+
+    uint64_t source_size;
+    int64_t source_mtime;
+    if (!source_stamp(source_path, source_size, source_mtime)) return false;
+    file_ = std::make_shared<MappedFile>();
+    if (!file_->open(cache_file.c_str())) { close(); return false; }
+
+    if (file_->size() < sizeof(cache_header)) { close(); return false; }
+    const cache_header* h = reinterpret_cast<const cache_header*>(file_->data());
+    uint64_t expected = sizeof(cache_header) + (uint64_t)h->vertex_count * sizeof(vertex) + (uint64_t)h->index_count * sizeof(uint32_t)
+      + (uint64_t)h->lod_count * sizeof(lod_level) + (uint64_t)h->meshlet_count * sizeof(meshlet)
+      + (uint64_t)h->bvh_node_count * sizeof(bvh_node) + (uint64_t)h->bvh_triangle_count * (sizeof(uint32_t) + 3 * sizeof(glm::vec3))
+      + (uint64_t)h->vertex_count * h->packed_stride;
+    bool valid = std::memcmp(h->magic, magic, sizeof(magic)) == 0
+      && h->version == cache_version
+      && h->vertex_stride == sizeof(vertex)
+      && h->extent == extent
+      && h->flags == flags
+      && h->source_size == source_size
+      && h->source_mtime == source_mtime
+      && file_->size() == expected;
+    if (!valid) { close(); return false; }
+
+    header_ = h;
+    if (!payload_valid()) {
+      printf("Mesh cache %s is corrupt, baking it again\n", cache_file.c_str());
+      close();
+      return false;
+    }
+    return true;
+  }
+
+  bool cache_view::payload_valid() const {
+    const cache_header& h = *header_;
+    vertex_format format;
+    if (!format_of(h.packed_format, format) || layout_of(format).stride != h.packed_stride) return false;
+    if (h.bvh_node_count == 0 && h.bvh_triangle_count != 0) return false;
+
+    // Level 0 is what the meshlets tile and the BVH covers
+    uint64_t level_begin = 0, level_end = h.index_count;
+    for (uint32_t i = 0; i < h.lod_count; i++) {
+      const lod_level& l = lods()[i];
+      if ((uint64_t)l.index_offset + l.index_count > h.index_count || l.index_count % 3 != 0) return false;
+    }
+    if (h.lod_count > 0) {
+      level_begin = lods()[0].index_offset;
+      level_end = level_begin + lods()[0].index_count;
+    }
+    for (uint32_t i = 0; i < h.meshlet_count; i++) {
+      const meshlet& m = meshlets()[i];
+      if (m.index_offset < level_begin || (uint64_t)m.index_offset + m.index_count > level_end) return false;
+    }
+    if (!valid_bvh(bvh_nodes(), h.bvh_node_count, h.bvh_triangle_count)) return false;
+
+    std::atomic<bool> in_range(true);
+    const uint32_t* index = indices();
+    parallelFor(h.index_count, 1 << 18, [&](size_t begin, size_t end) {
+      uint32_t largest = 0;
+      for (size_t i = begin; i < end; i++) largest = std::max(largest, index[i]);
+      if (end > begin && largest >= h.vertex_count) in_range = false;
+    });
+    uint64_t level_triangles = (level_end - level_begin) / 3;
+    const uint32_t* triangle = bvh_triangles();
+    parallelFor(h.bvh_triangle_count, 1 << 18, [&](size_t begin, size_t end) {
+      uint32_t largest = 0;
+      for (size_t i = begin; i < end; i++) largest = std::max(largest, triangle[i]);
+      if (end > begin && largest >= level_triangles) in_range = false;
+    });
+    return in_range;
+  }
+
+  cache_view::cache_view(cache_view&& other) : file_(std::move(other.file_)), header_(other.header_) {
+    other.header_ = nullptr;
+  }
+
+  cache_view& cache_view::operator=(cache_view&& other) {
+    if (this != &other) {
+      file_ = std::move(other.file_);
+      header_ = other.header_;
+      other.header_ = nullptr;
+    }
+    return *this;
+  }
+
+  void cache_view::close() {
+    file_.reset();
+    header_ = nullptr;
+  }
+
+  const vertex* cache_view::vertices() const {
+    if (!header_) return nullptr;
+    return reinterpret_cast<const vertex*>(file_->data() + sizeof(cache_header));
+  }
+
+  const uint32_t* cache_view::indices() const {
+    if (!header_) return nullptr;
+    return reinterpret_cast<const uint32_t*>(file_->data() + sizeof(cache_header) + header_->vertex_count * sizeof(vertex));
+  }
+
+  const lod_level* cache_view::lods() const {
+    if (!header_) return nullptr;
+    return reinterpret_cast<const lod_level*>(indices() + header_->index_count);
+  }
+
+  const meshlet* cache_view::meshlets() const {
+    if (!header_) return nullptr;
+    return reinterpret_cast<const meshlet*>(lods() + header_->lod_count);
+  }
+
+  const bvh_node* cache_view::bvh_nodes() const {
+    if (!header_) return nullptr;
+    return reinterpret_cast<const bvh_node*>(meshlets() + header_->meshlet_count);
+  }
+
+  const uint32_t* cache_view::bvh_triangles() const {
+    if (!header_) return nullptr;
+    return reinterpret_cast<const uint32_t*>(bvh_nodes() + header_->bvh_node_count);
+  }
+
+  const glm::vec3* cache_view::bvh_corners() const {
+    if (!header_) return nullptr;
+    return reinterpret_cast<const glm::vec3*>(bvh_triangles() + header_->bvh_triangle_count);
+  }
+
+  const uint8_t* cache_view::packed_data() const {
+    if (!header_) return nullptr;
+    return reinterpret_cast<const uint8_t*>(bvh_corners() + 3 * (size_t)header_->bvh_triangle_count);
+  }
+
+  vertex_decode cache_view::packed_decode() const {
+    vertex_decode decode;
+    if (!header_) return decode;
+    format_of(header_->packed_format, decode.format);
+    for (int i = 0; i < 3; i++) {
+      decode.position_scale[i] = header_->position_scale[i];
+      decode.position_offset[i] = header_->position_offset[i];
+    }
+    return decode;
+  }
+
+  glm::vec3 cache_view::bounds_min() const {
+    return header_ ? glm::vec3(header_->bounds_min[0], header_->bounds_min[1], header_->bounds_min[2]) : glm::vec3(0.0f);
+  }
+
+  glm::vec3 cache_view::bounds_max() const {
+    return header_ ? glm::vec3(header_->bounds_max[0], header_->bounds_max[1], header_->bounds_max[2]) : glm::vec3(0.0f);
+  }
+
+  bool write_cache(const std::string& cache_file, const std::string& source_path, float extent, const indexed_mesh& mesh,
+                   const packed_vertices& packed, uint32_t flags, const triangle_bvh* bvh) {
+    if (packed.count != mesh.vertices.size() || packed.data.size() != packed.count * packed.stride) return false;
+    cache_header h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, magic, sizeof(magic));
+    h.version = cache_version;
+    h.vertex_stride = sizeof(vertex);
+    h.vertex_count = (uint32_t)mesh.vertices.size();
+    h.index_count = (uint32_t)mesh.indices.size();
+    h.extent = extent;
+    h.flags = flags;
+    h.lod_count = (uint32_t)mesh.lods.size();
+    h.meshlet_count = (uint32_t)mesh.meshlets.size();
+    if (bvh) {
+      h.bvh_node_count = (uint32_t)bvh->node_count;
+      h.bvh_triangle_count = (uint32_t)bvh->triangle_count;
+    }
+    h.packed_format = format_code(packed.decode.format);
+    h.packed_stride = (uint32_t)packed.stride;
+    if (!source_stamp(source_path, h.source_size, h.source_mtime)) return false;
+    for (int i = 0; i < 3; i++) {
+      h.bounds_min[i] = mesh.bounds_min[i];
+      h.bounds_max[i] = mesh.bounds_max[i];
+      h.position_scale[i] = packed.decode.position_scale[i];
+      h.position_offset[i] = packed.decode.position_offset[i];
+    }
+
+    // Unique per thread: several loads of the same source may bake at once
+    std::string tmp = cache_file + ".tmp" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+    FILE* f = fopen(tmp.c_str(), "wb");
+    if (!f) return false;
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+    if (ok && !mesh.vertices.empty())
+      ok = fwrite(mesh.vertices.data(), sizeof(vertex), mesh.vertices.size(), f) == mesh.vertices.size();
+    if (ok && !mesh.indices.empty())
+      ok = fwrite(mesh.indices.data(), sizeof(uint32_t), mesh.indices.size(), f) == mesh.indices.size();
+    if (ok && !mesh.lods.empty())
+      ok = fwrite(mesh.lods.data(), sizeof(lod_level), mesh.lods.size(), f) == mesh.lods.size();
+    if (ok && !mesh.meshlets.empty())
+      ok = fwrite(mesh.meshlets.data(), sizeof(meshlet), mesh.meshlets.size(), f) == mesh.meshlets.size();
+    if (ok && h.bvh_node_count > 0)
+      ok = fwrite(bvh->nodes, sizeof(bvh_node), bvh->node_count, f) == bvh->node_count;
+    if (ok && h.bvh_triangle_count > 0)
+      ok = fwrite(bvh->triangles, sizeof(uint32_t), bvh->triangle_count, f) == bvh->triangle_count;
+    if (ok && h.bvh_triangle_count > 0)
+      ok = fwrite(bvh->corners, sizeof(glm::vec3), 3 * bvh->triangle_count, f) == 3 * bvh->triangle_count;
+    if (ok && !packed.data.empty())
+      ok = fwrite(packed.data.data(), 1, packed.data.size(), f) == packed.data.size();
+    ok = fclose(f) == 0 && ok;
+    if (!ok) {
+      std::remove(tmp.c_str());
+      return false;
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tmp, cache_file, ec);
+    if (ec) {
+      std::remove(tmp.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  std::shared_ptr<const triangle_bvh> build_picking_bvh(const loaded_mesh& loaded) {
+    const uint32_t* indices = loaded.indices();
+    size_t index_count = loaded.index_count();
+    if (loaded.lod_count() > 0) {
+      indices += loaded.lods()[0].index_offset;
+      index_count = loaded.lods()[0].index_count;
+    }
+    std::shared_ptr<triangle_bvh> bvh = std::make_shared<triangle_bvh>();
+    build_triangle_bvh(loaded.vertices(), indices, index_count, *bvh);
+    return bvh;
+  }
+
+  bool load_stl_mesh(const std::string& stl_path, float extent, loaded_mesh& out, const vertex_format& format,
+                     bool optimize) {
+    std::string cache_file = cache_path(stl_path);
+    uint32_t flags = optimize ? cache_optimized : 0;
+    out.packed = packed_vertices();
+
+    // A baked cache that is still current is used as is, the BVH included;
+    // only a cache of another format has its vertices packed again
+    out.from_cache = out.cache.open(cache_file, stl_path, extent, flags);
+    if (out.from_cache) {
+      printf("Loading mesh cache %s\n", cache_file.c_str());
+      const cache_view& cache = out.cache;
+      out.decode = cache.packed_decode();
+      if (out.decode.format != format) {
+        pack_vertices(cache.vertices(), cache.vertex_count(), format, cache.bounds_min(), cache.bounds_max(), out.packed);
+        out.decode = out.packed.decode;
+      }
+      if (cache.bvh_node_count() > 0) {
+        std::shared_ptr<triangle_bvh> bvh = std::make_shared<triangle_bvh>();
+        restore_triangle_bvh(cache.bvh_nodes(), cache.bvh_node_count(), cache.bvh_triangles(), cache.bvh_triangle_count(),
+                             cache.bvh_corners(), cache.mapping(), *bvh);
+        out.bvh = bvh;
+      } else {
+        out.bvh = build_picking_bvh(out);
+      }
+      return true;
+    }
+
+    stl_source source;
+    if (!source.open(stl_path)) return false;
+    size_t triangles = source.size();
+
+    // Every temporary buffer of the load comes from here; one block if the
+    // estimate holds
+    arena scratch(triangles * arena_bytes_per_triangle);
+
+    // Bounds -> recentre/scale -> UVs -> smooth normals -> merge identical
+    // vertices. The triangle soup is gone once it is welded.
+    size_t soup = 3 * triangles;
+    {
+      arena::scope soup_memory(scratch);
+      bounds_stage bounds;
+      source.visit([&](auto batch, size_t count) { bounds.add(batch, count); });
+      fit_transform fit(bounds, extent);
+
+      std::pmr::vector<glm::vec3> vertices(soup, &scratch);
+      std::pmr::vector<glm::vec3> normals(soup, &scratch);
+      std::pmr::vector<glm::vec2> uvs(soup, &scratch);
+      source.visit([&](auto batch, size_t count) { fit.apply(batch, count, vertices.data()); });
+      source.close();
+      spherical_uvs(vertices.data(), soup, uvs.data());
+      smooth_normals(vertices.data(), soup, normals.data(), normal_options(), &scratch);
+      weld(vertices.data(), normals.data(), uvs.data(), soup, out.baked, &scratch);
+    }
+
+    // Reorder for the GPU, split into meshlets along that order, build the
+    // LOD chain and bake the result for the next run.
+    std::vector<uint32_t>& indices = out.baked.indices;
+    float acmr = average_cache_miss_ratio(indices.data(), indices.size(), out.baked.vertices.size(), default_cache_size, &scratch);
+    if (optimize) {
+      optimize_mesh(out.baked, &scratch);
+      build_meshlets(out.baked, meshlet_options(), &scratch);
+    }
+    printf("%s: %zu -> %zu vertices, %.2f -> %.2f vertex shader runs per triangle\n", stl_path.c_str(), soup,
+           out.baked.vertices.size(), acmr,
+           average_cache_miss_ratio(indices.data(), indices.size(), out.baked.vertices.size(), default_cache_size, &scratch));
+    if (optimize) {
+      build_lod_chain(out.baked, lod_options(), &scratch);
+      const lod_level& coarsest = out.baked.lods.back();
+      printf("%s: %zu LOD levels, %u -> %u triangles (error %.3f)\n", stl_path.c_str(), out.baked.lods.size(),
+             out.baked.lods[0].index_count / 3, coarsest.index_count / 3, coarsest.error);
+      printf("%s: %zu meshlets of %.1f triangles on average\n", stl_path.c_str(), out.baked.meshlets.size(),
+             out.baked.lods[0].index_count / 3.0 / std::max<size_t>(1, out.baked.meshlets.size()));
+    }
+    out.bvh = build_picking_bvh(out);
+    pack_vertices(out.baked.vertices.data(), out.baked.vertices.size(), format, out.baked.bounds_min, out.baked.bounds_max,
+                  out.packed);
+    out.decode = out.packed.decode;
+    if (!write_cache(cache_file, stl_path, extent, out.baked, out.packed, flags, out.bvh.get()))
+      printf("Could not write mesh cache %s\n", cache_file.c_str());
+
+    out.memory = scratch.stats();
+    printf("%s: %zu scratch allocations from %zu heap blocks, peak %.1f MB of %.1f MB\n", stl_path.c_str(),
+           out.memory.requests, out.memory.heap_blocks, out.memory.peak_bytes / 1048576.0, out.memory.capacity / 1048576.0);
+    return true;
+  }
+
+}
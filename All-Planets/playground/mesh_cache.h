@@ -0,0 +1,167 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include <glm/glm.hpp>
+
+#include <common/mapped_file.hpp>
+#include "playground/mesh_bvh.h"
+#include "playground/mesh_pipeline.h"
+#include "playground/vertex_format.h"
+
+// Baked mesh cache (.pmesh). Holds the indexed, interleaved result of the
+// STL load path, its vertices already packed in the upload format and its
+// picking BVH, so that later runs map the file and hand the packed vertices
+// and the indices to glBufferData as they are; the BVH points into the
+// mapping too. What a hit still does is check that every index and range in
+// the file is in bounds: about 18 ms on one core for 1.3M triangles and 656k
+// vertices, against 19 s to bake.
+//
+// Layout (little endian):
+//   cache_header
+//   vertex_count * mesh::vertex
+//   index_count  * uint32_t      every LOD level, finest first
+//   lod_count    * mesh::lod_level
+//   meshlet_count * mesh::meshlet  tiling LOD level 0
+//   bvh_node_count * mesh::bvh_node   picking BVH over LOD level 0
+//   bvh_triangle_count * uint32_t     its triangles in leaf order
+//   3 * bvh_triangle_count * glm::vec3  and their corners
+//   vertex_count * packed_stride bytes  the vertices in packed_format
+namespace mesh {
+
+  const uint32_t cache_version = 8;
+
+  // cache_header::flags
+  const uint32_t cache_optimized = 1;   // reordered by optimize_mesh, with meshlets and a LOD chain
+
+  struct cache_header {
+    char magic[4];            // "PMSH"
+    uint32_t version;         // cache_version
+    uint32_t vertex_stride;   // sizeof(mesh::vertex)
+    uint32_t vertex_count;
+    uint32_t index_count;
+    float extent;             // load parameter the mesh was baked with
+    uint32_t flags;           // cache_optimized, ...
+    uint32_t lod_count;       // 0: indices are a single level
+    uint64_t source_size;     // size of the source file in bytes
+    int64_t source_mtime;     // last write time of the source file
+    float bounds_min[3];
+    float bounds_max[3];
+    uint32_t meshlet_count;   // 0: no meshlets
+    uint32_t bvh_node_count;  // 0: no BVH, built on load
+    uint32_t bvh_triangle_count;
+    uint32_t packed_format;   // position | normal << 8 | uv << 16 encodings
+    uint32_t packed_stride;
+    float position_scale[3];  // vertex_decode of the packed vertices
+    float position_offset[3];
+    uint32_t reserved;
+  };
+  static_assert(sizeof(cache_header) % 8 == 0, "payload after the header must stay aligned");
+
+  // Default cache location: next to the source, "<source>.pmesh".
+  std::string cache_path(const std::string& source_path);
+
+  // A .pmesh file mapped read-only. vertices(), indices() and the other
+  // arrays point into the mapping and stay valid as long as the view is open.
+  class cache_view {
+  public:
+    cache_view() : header_(nullptr) {}
+    cache_view(cache_view&& other);
+    cache_view& operator=(cache_view&& other);
+
+    // Maps cache_file and checks it is complete, of the current version and
+    // baked from the current state of source_path with the same extent and
+    // flags, and that every range and index in it stays inside its array.
+    // Returns false if the cache is missing, stale or corrupt.
+    bool open(const std::string& cache_file, const std::string& source_path, float extent, uint32_t flags = cache_optimized);
+    void close();
+
+    const vertex* vertices() const;
+    size_t vertex_count() const { return header_ ? header_->vertex_count : 0; }
+    const uint32_t* indices() const;
+    size_t index_count() const { return header_ ? header_->index_count : 0; }
+    const lod_level* lods() const;
+    size_t lod_count() const { return header_ ? header_->lod_count : 0; }
+    const meshlet* meshlets() const;
+    size_t meshlet_count() const { return header_ ? header_->meshlet_count : 0; }
+    const bvh_node* bvh_nodes() const;
+    size_t bvh_node_count() const { return header_ ? header_->bvh_node_count : 0; }
+    const uint32_t* bvh_triangles() const;
+    size_t bvh_triangle_count() const { return header_ ? header_->bvh_triangle_count : 0; }
+    const glm::vec3* bvh_corners() const;
+    const uint8_t* packed_data() const;
+    size_t packed_size() const { return header_ ? (size_t)header_->vertex_count * header_->packed_stride : 0; }
+    vertex_decode packed_decode() const;
+    // Keeps the file mapped for as long as it is held, e.g. by a BVH that
+    // points into it
+    std::shared_ptr<const void> mapping() const { return file_; }
+    glm::vec3 bounds_min() const;
+    glm::vec3 bounds_max() const;
+
+  private:
+    bool payload_valid() const;
+
+    std::shared_ptr<MappedFile> file_;
+    const cache_header* header_;
+  };
+
+  // Result of the CPU half of the STL load path: either a mapped, current
+  // cache or a freshly baked mesh. Upload packed_data()/indices() as they
+  // are. Move only: the buffers are handed on, never copied.
+  struct loaded_mesh {
+    cache_view cache;
+    indexed_mesh baked;
+    bool from_cache = false;
+    arena_stats memory = arena_stats(); //<<< scratch use of the bake, zero when loaded from the cache
+    std::shared_ptr<const triangle_bvh> bvh; //<<< picking BVH over LOD level 0, baked or restored from the cache
+    packed_vertices packed; //<<< the vertices in the upload format, unless they are mapped from the cache
+    vertex_decode decode; //<<< format of packed_data() and how to decode it
+
+    const vertex* vertices() const { return from_cache ? cache.vertices() : baked.vertices.data(); }
+    size_t vertex_count() const { return from_cache ? cache.vertex_count() : baked.vertices.size(); }
+    const uint32_t* indices() const { return from_cache ? cache.indices() : baked.indices.data(); }
+    size_t index_count() const { return from_cache ? cache.index_count() : baked.indices.size(); }
+    const lod_level* lods() const { return from_cache ? cache.lods() : baked.lods.data(); }
+    size_t lod_count() const { return from_cache ? cache.lod_count() : baked.lods.size(); }
+    const meshlet* meshlets() const { return from_cache ? cache.meshlets() : baked.meshlets.data(); }
+    size_t meshlet_count() const { return from_cache ? cache.meshlet_count() : baked.meshlets.size(); }
+    glm::vec3 bounds_min() const { return from_cache ? cache.bounds_min() : baked.bounds_min; }
+    glm::vec3 bounds_max() const { return from_cache ? cache.bounds_max() : baked.bounds_max; }
+    const uint8_t* packed_data() const { return from_cache && packed.data.empty() ? cache.packed_data() : packed.data.data(); }
+    size_t packed_size() const { return from_cache && packed.data.empty() ? cache.packed_size() : packed.data.size(); }
+    // True if packed_data() holds every vertex in format
+    bool packed_as(const vertex_format& format) const { return packed_size() > 0 && decode.format == format; }
+  };
+
+  // Loads an STL file recentred and scaled to `extent`, with spherical UVs
+  // and smooth normals, as an indexed mesh whose vertices are also packed in
+  // format. With optimize the triangles and vertices are reordered for the
+  // vertex cache, overdraw and vertex fetch (see optimize_mesh), split into
+  // meshlets (see build_meshlets) and a LOD chain is built (see
+  // build_lod_chain), and out.bvh is set. Uses the .pmesh cache when it is
+  // current, packing its vertices again if it holds another format, and
+  // writes it otherwise. Binary STL records are read in place from the mapped
+  // file, and every temporary buffer comes from one arena sized from the
+  // triangle count, so a bake makes a constant number of heap allocations;
+  // out.memory reports its use. Makes no OpenGL calls, so it is safe to run
+  // on a worker thread. Returns false if the STL cannot be read.
+  bool load_stl_mesh(const std::string& stl_path, float extent, loaded_mesh& out,
+                     const vertex_format& format = compact_format(), bool optimize = true);
+
+  // Picking BVH over LOD level 0 of loaded (all of it without a LOD chain).
+  std::shared_ptr<const triangle_bvh> build_picking_bvh(const loaded_mesh& loaded);
+
+  // Writes mesh, its vertices packed for upload and, if given, its picking
+  // BVH to cache_file, stamped with the current size and mtime of
+  // source_path. The file is written under a temporary name and renamed so a
+  // crash never leaves a half written cache behind.
+  bool write_cache(const std::string& cache_file, const std::string& source_path, float extent, const indexed_mesh& mesh,
+                   const packed_vertices& packed, uint32_t flags = cache_optimized, const triangle_bvh* bvh = nullptr);
+
+}
+
+#endif
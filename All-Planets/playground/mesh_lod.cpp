@@ -0,0 +1,438 @@
+#include "mesh_lod.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "playground/mesh_optimize.h"
+
+namespace mesh {
+
+  namespace {
+
+    // openout/openinc: no open edge, or more than one
+    const uint32_t none = ~0u;
+    const uint32_t many = ~1u;
+
+    // How a vertex may move. Manifold vertices collapse into any neighbour;
+    // border and seam vertices only along their open edges into another
+    // vertex of the same kind; locked ones stay put.
+    enum vertex_kind : uint8_t { kind_manifold, kind_border, kind_seam, kind_locked };
+
+    // Open edges weigh more than the faces next to them so borders and seams
+    // keep their shape
+    const float boundary_weight = 2.0f;
+
+    // A collapse may turn a face by no more than ~75 degrees, nor squash it
+    // to a line, nor leave it facing ~75 degrees away from its vertex
+    // normals; the last catches slivers turned on edge over several passes
+    const float min_normal_cos = 0.25f;
+
+    // Sum of squared distances to a set of planes, as a symmetric 4x4 matrix,
+    // and the summed weight (area) of the planes
+    struct quadric {
+      float a00, a11, a22, a01, a02, a12;
+      float b0, b1, b2;
+      float c;
+      float w;
+    };
+
+    void add_plane(quadric& q, const glm::vec3& n, float d, float w) {
+      q.a00 += w * n.x * n.x;
+      q.a11 += w * n.y * n.y;
+      q.a22 += w * n.z * n.z;
+      q.a01 += w * n.x * n.y;
+      q.a02 += w * n.x * n.z;
+      q.a12 += w * n.y * n.z;
+      q.b0 += w * n.x * d;
+      q.b1 += w * n.y * d;
+      q.b2 += w * n.z * d;
+      q.c += w * d * d;
+      q.w += w;
+    }
+
+    void add_quadric(quadric& q, const quadric& r) {
+      q.a00 += r.a00; q.a11 += r.a11; q.a22 += r.a22;
+      q.a01 += r.a01; q.a02 += r.a02; q.a12 += r.a12;
+      q.b0 += r.b0; q.b1 += r.b1; q.b2 += r.b2;
+      q.c += r.c;
+      q.w += r.w;
+    }
+
+    // Weighted sum of squared distances of p to the planes of q
+    float evaluate(const quadric& q, const glm::vec3& p) {
+      return q.a00 * p.x * p.x + q.a11 * p.y * p.y + q.a22 * p.z * p.z
+        + 2.0f * (q.a01 * p.x * p.y + q.a02 * p.x * p.z + q.a12 * p.y * p.z)
+        + 2.0f * (q.b0 * p.x + q.b1 * p.y + q.b2 * p.z) + q.c;
+    }
+
+    uint64_t hash_position(const glm::vec3& p) {
+      uint32_t bits[3];
+      std::memcpy(bits, &p, sizeof(bits));
+      uint64_t h = bits[0] * 0x9E3779B97F4A7C15ull;
+      h ^= (h >> 29) ^ bits[1] * 0xBF58476D1CE4E5B9ull;
+      h ^= (h >> 31) ^ bits[2] * 0x94D049BB133111EBull;
+      return h ^ (h >> 32);
+    }
+
+    // Half edges a -> b of every triangle corner a, in compressed rows
+    // Rebuilt every pass into the same buffers
+    struct edge_adjacency {
+      std::pmr::vector<uint32_t> offsets;
+      std::pmr::vector<uint32_t> targets;
+      std::pmr::vector<uint32_t> fill;
+
+      explicit edge_adjacency(std::pmr::memory_resource* memory) : offsets(memory), targets(memory), fill(memory) {}
+
+      void build(const std::vector<uint32_t>& indices, size_t vertex_count) {
+        offsets.assign(vertex_count + 1, 0);
+        targets.resize(indices.size());
+        for (uint32_t index : indices) offsets[index + 1]++;
+        for (size_t v = 0; v < vertex_count; v++) offsets[v + 1] += offsets[v];
+        fill.assign(offsets.begin(), offsets.end() - 1);
+        for (size_t t = 0; t < indices.size(); t += 3)
+          for (int k = 0; k < 3; k++) targets[fill[indices[t + k]]++] = indices[t + (k + 1) % 3];
+      }
+
+      bool has_edge(uint32_t a, uint32_t b) const {
+        for (uint32_t e = offsets[a]; e < offsets[a + 1]; e++)
+          if (targets[e] == b) return true;
+        return false;
+      }
+    };
+
+    // Triangles around every position, in compressed rows
+    struct position_triangles {
+      std::pmr::vector<uint32_t> offsets;
+      std::pmr::vector<uint32_t> triangles;
+      std::pmr::vector<uint32_t> fill;
+
+      explicit position_triangles(std::pmr::memory_resource* memory) : offsets(memory), triangles(memory), fill(memory) {}
+
+      void build(const std::vector<uint32_t>& indices, const std::pmr::vector<uint32_t>& group, size_t vertex_count) {
+        offsets.assign(vertex_count + 1, 0);
+        triangles.resize(indices.size());
+        for (uint32_t index : indices) offsets[group[index] + 1]++;
+        for (size_t v = 0; v < vertex_count; v++) offsets[v + 1] += offsets[v];
+        fill.assign(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < indices.size(); i++) triangles[fill[group[indices[i]]]++] = (uint32_t)(i / 3);
+      }
+    };
+
+    struct collapse {
+      uint32_t from;
+      uint32_t to;
+      float cost;
+    };
+
+    // For every vertex the single other end of its outgoing / incoming open
+    // half edges, or none / many
+    void find_open_edges(const std::vector<uint32_t>& indices, const edge_adjacency& adjacency,
+                         std::pmr::vector<uint32_t>& openout, std::pmr::vector<uint32_t>& openinc) {
+      std::fill(openout.begin(), openout.end(), none);
+      std::fill(openinc.begin(), openinc.end(), none);
+      for (size_t t = 0; t < indices.size(); t += 3) {
+        for (int k = 0; k < 3; k++) {
+          uint32_t a = indices[t + k], b = indices[t + (k + 1) % 3];
+          if (adjacency.has_edge(b, a)) continue;
+          openout[a] = openout[a] == none ? b : many;
+          openinc[b] = openinc[b] == none ? a : many;
+        }
+      }
+    }
+
+    bool single(uint32_t v) { return v != none && v != many; }
+
+    glm::vec3 face_normal(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2) {
+      return glm::cross(p1 - p0, p2 - p0);
+    }
+
+  }
+
+  float simplify(const vertex* vertices, size_t vertex_count, const uint32_t* indices, size_t index_count,
+                 size_t target_index_count, float max_error, std::vector<uint32_t>& out, arena* scratch) {
+    index_count -= index_count % 3;
+    out.assign(indices, indices + index_count);
+    if (index_count <= target_index_count || vertex_count == 0) return 0.0f;
+
+    // Positions in the unit cube keep the quadrics well conditioned in float
+    glm::vec3 lo = vertices[0].position, hi = lo;
+    for (size_t v = 1; v < vertex_count; v++) {
+      for (int c = 0; c < 3; c++) {
+        float x = vertices[v].position[c];
+        if (x < lo[c]) lo[c] = x;
+        if (x > hi[c]) hi[c] = x;
+      }
+    }
+    float extent = std::max(hi.x - lo.x, std::max(hi.y - lo.y, hi.z - lo.z));
+    if (!(extent > 0.0f)) return 0.0f;
+    float inverse_extent = 1.0f / extent;
+    scratch_scope memory(scratch);
+    std::pmr::vector<glm::vec3> position(vertex_count, memory);
+    for (size_t v = 0; v < vertex_count; v++) position[v] = (vertices[v].position - lo) * inverse_extent;
+    float error_limit = max_error < FLT_MAX ? (max_error * inverse_extent) * (max_error * inverse_extent) : FLT_MAX;
+
+    // Vertices at the same position (differing in normal or UV) form a group,
+    // named after its first vertex; wedge links the group in a ring
+    std::pmr::vector<uint32_t> group(vertex_count, memory);
+    std::pmr::vector<uint32_t> wedge(vertex_count, memory);
+    std::pmr::vector<uint32_t> wedges(vertex_count, 0, memory);
+    {
+      // Open addressing over the first vertex of each position, at most half full
+      arena::scope table_memory(memory.get());
+      size_t slots = 16;
+      while (slots < 2 * vertex_count) slots *= 2;
+      std::pmr::vector<uint32_t> first(slots, none, memory);
+      for (uint32_t v = 0; v < vertex_count; v++) {
+        const glm::vec3& p = vertices[v].position;
+        size_t slot = hash_position(p) & (slots - 1);
+        while (first[slot] != none && std::memcmp(&vertices[first[slot]].position, &p, sizeof(p)) != 0)
+          slot = (slot + 1) & (slots - 1);
+        if (first[slot] == none) first[slot] = v;
+        uint32_t g = first[slot];
+        group[v] = g;
+        wedge[v] = v;
+        if (g != v) std::swap(wedge[v], wedge[g]);
+        wedges[g]++;
+      }
+    }
+
+    // Degenerate input triangles would never go away
+    size_t kept = 0;
+    for (size_t t = 0; t < index_count; t += 3) {
+      uint32_t g0 = group[out[t]], g1 = group[out[t + 1]], g2 = group[out[t + 2]];
+      if (g0 == g1 || g1 == g2 || g0 == g2) continue;
+      for (int k = 0; k < 3; k++) out[kept + k] = out[t + k];
+      kept += 3;
+    }
+    out.resize(kept);
+
+    edge_adjacency adjacency(memory);
+    adjacency.build(out, vertex_count);
+    std::pmr::vector<uint32_t> openout(vertex_count, memory), openinc(vertex_count, memory);
+    find_open_edges(out, adjacency, openout, openinc);
+
+    // Vertex kinds, decided once on the input. A group is named after its
+    // lowest vertex, so it is classified before its other wedges copy it.
+    std::pmr::vector<uint8_t> kind(vertex_count, kind_locked, memory);
+    for (uint32_t v = 0; v < vertex_count; v++) {
+      uint32_t g = group[v];
+      if (g != v) {
+        kind[v] = kind[g];
+        continue;
+      }
+      if (wedges[g] == 1) {
+        if (openout[g] == none && openinc[g] == none) kind[g] = kind_manifold;
+        else if (single(openout[g]) && single(openinc[g])) kind[g] = kind_border;
+      } else if (wedges[g] == 2) {
+        // Two charts meeting along one seam: each side's open edges lead to
+        // the positions the other side's come from
+        uint32_t w = wedge[g];
+        if (single(openout[g]) && single(openinc[g]) && single(openout[w]) && single(openinc[w])
+            && group[openout[g]] == group[openinc[w]] && group[openinc[g]] == group[openout[w]])
+          kind[g] = kind_seam;
+      }
+    }
+
+    // Plane quadrics of the faces, plus planes through the open edges at
+    // right angles to their face
+    std::pmr::vector<quadric> quadrics(vertex_count, memory);
+    std::memset(quadrics.data(), 0, quadrics.size() * sizeof(quadric));
+    for (size_t t = 0; t < out.size(); t += 3) {
+      const uint32_t* tri = &out[t];
+      glm::vec3 n = face_normal(position[tri[0]], position[tri[1]], position[tri[2]]);
+      float length = glm::length(n);
+      if (!(length > 0.0f)) continue;
+      n /= length;
+      float d = -glm::dot(n, position[tri[0]]);
+      for (int k = 0; k < 3; k++) add_plane(quadrics[group[tri[k]]], n, d, 0.5f * length);
+
+      for (int k = 0; k < 3; k++) {
+        uint32_t a = tri[k], b = tri[(k + 1) % 3];
+        if (adjacency.has_edge(b, a)) continue;
+        glm::vec3 edge = position[b] - position[a];
+        glm::vec3 en = glm::cross(edge, n);
+        float en_length = glm::length(en);
+        if (!(en_length > 0.0f)) continue;
+        en /= en_length;
+        float ed = -glm::dot(en, position[a]);
+        float w = boundary_weight * glm::dot(edge, edge);
+        add_plane(quadrics[group[a]], en, ed, w);
+        add_plane(quadrics[group[b]], en, ed, w);
+      }
+    }
+
+    size_t target_triangles = target_index_count / 3;
+    size_t triangles = out.size() / 3;
+    float result_error = 0.0f;
+
+    position_triangles around(memory);
+    std::pmr::vector<collapse> candidates(memory);
+    candidates.reserve(out.size());
+    std::pmr::vector<uint32_t> remap(vertex_count, memory);
+    std::pmr::vector<uint8_t> touched(vertex_count, memory);
+
+    // Each pass collapses a set of edges far enough apart not to interfere,
+    // then rewrites the indices and starts over
+    while (triangles > target_triangles) {
+      around.build(out, group, vertex_count);
+
+      candidates.clear();
+      for (size_t t = 0; t < out.size(); t += 3) {
+        for (int k = 0; k < 3; k++) {
+          uint32_t a = out[t + k], b = out[t + (k + 1) % 3];
+          bool open = !adjacency.has_edge(b, a);
+          // An interior edge is seen from both its triangles
+          if (!open && a > b) continue;
+
+          const quadric& qa = quadrics[group[a]];
+          const quadric& qb = quadrics[group[b]];
+          float weight = qa.w + qb.w;
+          for (int dir = 0; dir < 2; dir++) {
+            uint32_t from = dir ? b : a, to = dir ? a : b;
+            uint8_t kf = kind[from];
+            bool allowed = kf == kind_manifold || ((kf == kind_border || kf == kind_seam) && open && kind[to] == kf);
+            if (!allowed) continue;
+            const glm::vec3& p = position[to];
+            float cost = weight > 0.0f ? std::fabs(evaluate(qa, p) + evaluate(qb, p)) / weight : 0.0f;
+            if (cost <= error_limit) candidates.push_back({ from, to, cost });
+          }
+        }
+      }
+      if (candidates.empty()) break;
+
+      // Each collapse removes about two triangles. Collapses far more
+      // expensive than the ones this pass needs wait for the next pass, by
+      // then cheaper ones may have freed up; only the rest gets sorted.
+      auto cheaper = [](const collapse& x, const collapse& y) { return x.cost < y.cost; };
+      size_t goal = (triangles - target_triangles + 1) / 2;
+      auto limit = candidates.begin() + std::min(candidates.size() - 1, goal + goal / 2);
+      std::nth_element(candidates.begin(), limit, candidates.end(), cheaper);
+      float pass_limit = limit->cost;
+      candidates.erase(limit + 1, candidates.end());
+      std::sort(candidates.begin(), candidates.end(), cheaper);
+
+      for (uint32_t v = 0; v < vertex_count; v++) remap[v] = v;
+      std::fill(touched.begin(), touched.end(), 0);
+      size_t collapsed = 0;
+
+      for (const collapse& c : candidates) {
+        if (c.cost > pass_limit || triangles <= target_triangles) break;
+        uint32_t gu = group[c.from], gv = group[c.to];
+        if (touched[gu] || touched[gv]) continue;
+
+        // A seam vertex moves both its wedges, each to the wedge on its side
+        uint32_t from2 = none, to2 = none;
+        if (kind[c.from] == kind_seam) {
+          from2 = wedge[c.from];
+          uint32_t o = openout[from2], i = openinc[from2];
+          if (single(o) && group[o] == gv) to2 = o;
+          else if (single(i) && group[i] == gv) to2 = i;
+          else continue;
+        }
+
+        // Reject collapses that would fold a face over
+        size_t removed = 0;
+        bool flips = false;
+        const glm::vec3& target = position[gv];
+        for (uint32_t e = around.offsets[gu]; e < around.offsets[gu + 1] && !flips; e++) {
+          const uint32_t* tri = &out[3 * around.triangles[e]];
+          uint32_t g[3] = { group[tri[0]], group[tri[1]], group[tri[2]] };
+          if (g[0] == gv || g[1] == gv || g[2] == gv) {
+            removed++;
+            continue;
+          }
+          glm::vec3 p[3] = { position[g[0]], position[g[1]], position[g[2]] };
+          glm::vec3 smooth = vertices[tri[0]].normal + vertices[tri[1]].normal + vertices[tri[2]].normal;
+          glm::vec3 before = face_normal(p[0], p[1], p[2]);
+          for (int k = 0; k < 3; k++) {
+            if (g[k] != gu) continue;
+            p[k] = target;
+            smooth += vertices[c.to].normal - vertices[tri[k]].normal;
+          }
+          glm::vec3 after = face_normal(p[0], p[1], p[2]);
+          float after_length = glm::length(after);
+          flips = glm::dot(before, after) <= min_normal_cos * glm::length(before) * after_length
+            || glm::dot(smooth, after) <= min_normal_cos * glm::length(smooth) * after_length;
+        }
+        if (flips) continue;
+
+        remap[c.from] = c.to;
+        if (from2 != none) remap[from2] = to2;
+        add_quadric(quadrics[gv], quadrics[gu]);
+        // Positions around gu see it move; keep them out of this pass
+        for (uint32_t e = around.offsets[gu]; e < around.offsets[gu + 1]; e++) {
+          const uint32_t* tri = &out[3 * around.triangles[e]];
+          for (int k = 0; k < 3; k++) touched[group[tri[k]]] = 1;
+        }
+        triangles -= removed;
+        result_error = std::max(result_error, c.cost);
+        collapsed++;
+      }
+      if (collapsed == 0) break;
+
+      kept = 0;
+      for (size_t t = 0; t < out.size(); t += 3) {
+        uint32_t i0 = remap[out[t]], i1 = remap[out[t + 1]], i2 = remap[out[t + 2]];
+        uint32_t g0 = group[i0], g1 = group[i1], g2 = group[i2];
+        if (g0 == g1 || g1 == g2 || g0 == g2) continue;
+        out[kept] = i0;
+        out[kept + 1] = i1;
+        out[kept + 2] = i2;
+        kept += 3;
+      }
+      out.resize(kept);
+      triangles = kept / 3;
+      adjacency.build(out, vertex_count);
+      find_open_edges(out, adjacency, openout, openinc);
+    }
+
+    return std::sqrt(result_error) * extent;
+  }
+
+  void build_lod_chain(indexed_mesh& mesh, const lod_options& options, arena* scratch) {
+    mesh.lods.clear();
+    size_t level0 = mesh.indices.size() - mesh.indices.size() % 3;
+    mesh.indices.resize(level0);
+    mesh.lods.push_back({ 0, (uint32_t)level0, 0.0f });
+
+    std::vector<uint32_t> previous(mesh.indices.begin(), mesh.indices.end());
+    std::vector<uint32_t> next;
+    float error = 0.0f;
+    while (mesh.lods.size() < options.max_levels) {
+      size_t target = (size_t)(previous.size() / 3 * options.reduction);
+      if (target < options.min_triangles || error >= options.max_error) break;
+
+      float step = simplify(mesh.vertices.data(), mesh.vertices.size(), previous.data(), previous.size(),
+                            3 * target, options.max_error - error, next, scratch);
+      // Stuck on locked vertices or the error limit: a level barely smaller
+      // than the previous one is not worth its memory
+      if (next.empty() || next.size() > previous.size() * 9 / 10) break;
+      error += step;
+
+      optimize_vertex_cache(next.data(), next.size(), mesh.vertices.size(), default_cache_size, scratch);
+      mesh.lods.push_back({ (uint32_t)mesh.indices.size(), (uint32_t)next.size(), error });
+      mesh.indices.insert(mesh.indices.end(), next.begin(), next.end());
+      previous.swap(next);
+    }
+  }
+
+  int select_lod(const lod_level* lods, size_t count, float pixels_per_unit, float max_pixel_error,
+                 int current, float hysteresis) {
+    if (count == 0) return 0;
+    auto fits = [&](int level, float limit) { return lods[level].error * pixels_per_unit <= limit; };
+
+    int coarsest = 0;
+    for (int level = 1; level < (int)count && fits(level, max_pixel_error); level++) coarsest = level;
+    if (current < 0 || current >= (int)count || hysteresis <= 0.0f) return coarsest;
+
+    if (coarsest > current) {
+      int level = current;
+      while (level < coarsest && fits(level + 1, max_pixel_error * (1.0f - hysteresis))) level++;
+      return level;
+    }
+    if (coarsest < current && fits(current, max_pixel_error * (1.0f + hysteresis))) return current;
+    return coarsest;
+  }
+
+}
@@ -0,0 +1,59 @@
+#ifndef MESH_LOD_H
+#define MESH_LOD_H
+
+#include <cfloat>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "playground/mesh_pipeline.h"
+
+// Levels of detail: quadric error metric simplification (Garland and
+// Heckbert 1997), LOD chains built from it at bake time, and the per frame
+// choice of a level from its projected error in pixels.
+namespace mesh {
+
+  // Collapses edges of the triangles in indices, cheapest first, until at
+  // most target_index_count indices are left or the next collapse would cost
+  // more than max_error (model units). Vertices only ever merge into a
+  // neighbour, so out indexes the same vertex array. Open borders and UV
+  // seams are kept: vertices on them only slide along them, and vertices
+  // where more than two UV charts meet never move. Returns the error of the
+  // result, roughly how far its surface strays from the input. Working
+  // buffers come from scratch (a private arena if null).
+  float simplify(const vertex* vertices, size_t vertex_count, const uint32_t* indices, size_t index_count,
+                 size_t target_index_count, float max_error, std::vector<uint32_t>& out, arena* scratch = nullptr);
+
+  struct lod_options {
+    float reduction;       // fraction of the triangles one level keeps of the previous one
+    size_t min_triangles;  // no level is built below this
+    size_t max_levels;     // level 0 included
+    float max_error;       // model units; coarser levels are not built
+
+    lod_options() : reduction(0.25f), min_triangles(64), max_levels(8), max_error(FLT_MAX) {}
+  };
+
+  // Fills mesh.lods, level 0 being the current indices, and appends each
+  // coarser level to mesh.indices. A level is simplified from the previous
+  // one, so its error is the sum of the steps leading to it. Vertices are
+  // left alone; each new level is reordered for the vertex cache. Stops
+  // early when simplification no longer makes progress.
+  void build_lod_chain(indexed_mesh& mesh, const lod_options& options = lod_options(), arena* scratch = nullptr);
+
+  // Pixels per model unit of error at distance 1 from the eye:
+  // viewport_height / (2 tan(fovy / 2)). p11 is projection[1][1], which is
+  // 1 / tan(fovy / 2) for glm::perspective.
+  inline float lod_projection_scale(float viewport_height, float p11) { return 0.5f * viewport_height * p11; }
+
+  // Picks the coarsest level whose error, times pixels_per_unit, stays within
+  // max_pixel_error. lods must be ordered finest first with growing errors.
+  // With current >= 0 the choice is damped: the object only goes coarser
+  // once the error would be below max_pixel_error * (1 - hysteresis) and
+  // only goes finer once the current one exceeds max_pixel_error *
+  // (1 + hysteresis), so a level does not flicker at the boundary.
+  int select_lod(const lod_level* lods, size_t count, float pixels_per_unit, float max_pixel_error,
+                 int current = -1, float hysteresis = 0.0f);
+
+}
+
+#endif
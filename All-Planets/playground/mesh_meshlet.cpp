@@ -0,0 +1,133 @@
+#include "mesh_meshlet.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace mesh {
+
+  namespace {
+
+    const uint32_t unused = ~0u;
+
+    glm::vec3 normalize_or_zero(const glm::vec3& v) {
+      float len = glm::length(v);
+      return len > 0.0f ? v / len : glm::vec3(0.0f);
+    }
+
+    // Sphere around the box of the cluster's corners, and the narrowest cone
+    // around the mean face normal that holds every face normal
+    meshlet cluster_bounds(const vertex* vertices, const uint32_t* indices, uint32_t index_offset, uint32_t index_count,
+                           const glm::vec3* normals) {
+      meshlet m;
+      m.index_offset = index_offset;
+      m.index_count = index_count;
+
+      glm::vec3 lo(vertices[indices[index_offset]].position), hi(lo);
+      for (uint32_t i = index_offset; i < index_offset + index_count; i++) {
+        lo = glm::min(lo, vertices[indices[i]].position);
+        hi = glm::max(hi, vertices[indices[i]].position);
+      }
+      m.center = 0.5f * (lo + hi);
+      float radius2 = 0.0f;
+      for (uint32_t i = index_offset; i < index_offset + index_count; i++) {
+        glm::vec3 d = vertices[indices[i]].position - m.center;
+        radius2 = std::max(radius2, glm::dot(d, d));
+      }
+      m.radius = std::sqrt(radius2);
+
+      glm::vec3 sum(0.0f);
+      for (uint32_t t = 0; t < index_count / 3; t++) sum += normals[t];
+      m.cone_axis = normalize_or_zero(sum);
+      float min_dot = 1.0f;
+      for (uint32_t t = 0; t < index_count / 3; t++)
+        if (normals[t] != glm::vec3(0.0f)) min_dot = std::min(min_dot, glm::dot(normals[t], m.cone_axis));
+      // A cone of about 85 degrees or more culls next to nothing; mark it so
+      // the test never passes
+      m.cone_cutoff = min_dot <= 0.1f ? 1.0f : std::sqrt(1.0f - min_dot * min_dot);
+      return m;
+    }
+
+  }
+
+  void build_meshlets(indexed_mesh& mesh, const meshlet_options& options, arena* scratch) {
+    mesh.meshlets.clear();
+    size_t index_count = mesh.lods.empty() ? mesh.indices.size() : mesh.lods[0].index_count;
+    index_count -= index_count % 3;
+    size_t triangles = index_count / 3;
+    if (triangles == 0) return;
+    scratch_scope memory(scratch);
+    const uint32_t* indices = mesh.indices.data();
+    size_t max_triangles = std::max<size_t>(1, options.max_triangles);
+    float min_dot = std::cos(glm::radians(options.cone_angle));
+
+    std::pmr::vector<glm::vec3> normals(triangles, memory);
+    for (size_t t = 0; t < triangles; t++) {
+      const glm::vec3& a = mesh.vertices[indices[3 * t + 0]].position;
+      const glm::vec3& b = mesh.vertices[indices[3 * t + 1]].position;
+      const glm::vec3& c = mesh.vertices[indices[3 * t + 2]].position;
+      normals[t] = normalize_or_zero(glm::cross(b - a, c - a));
+    }
+
+    // Cut the level into runs of consecutive triangles. A run ends where the
+    // next triangle shares no vertex with it (the cache optimizer jumped, or
+    // the overdraw order starts another cluster), at max_triangles, and past
+    // min_triangles where the next normal leaves the cone. vertex_in holds
+    // the run a vertex was last used by.
+    std::pmr::vector<uint32_t> vertex_in(mesh.vertices.size(), unused, memory);
+    uint32_t run = 0;
+    size_t start = 0;
+    glm::vec3 normal_sum(0.0f);
+    auto close = [&](size_t end) {
+      mesh.meshlets.push_back(cluster_bounds(mesh.vertices.data(), indices, (uint32_t)(3 * start), (uint32_t)(3 * (end - start)),
+                                             normals.data() + start));
+      run++;
+      start = end;
+      normal_sum = glm::vec3(0.0f);
+    };
+    for (size_t t = 0; t < triangles; t++) {
+      size_t size = t - start;
+      bool shared = false;
+      for (int k = 0; k < 3; k++) shared |= vertex_in[indices[3 * t + k]] == run;
+      if (size >= max_triangles || (size > 0 && !shared) ||
+          (size >= options.min_triangles && glm::dot(normals[t], normalize_or_zero(normal_sum)) < min_dot))
+        close(t);
+      normal_sum += normals[t];
+      for (int k = 0; k < 3; k++) vertex_in[indices[3 * t + k]] = run;
+    }
+    close(triangles);
+  }
+
+  frustum frustum_planes(const glm::mat4& clip_from_model) {
+    // Gribb and Hartmann: each plane is the w row plus or minus the x, y or
+    // z row of the matrix (glm stores columns, so m[c][r])
+    const glm::mat4& m = clip_from_model;
+    glm::vec4 rows[4];
+    for (int r = 0; r < 4; r++) rows[r] = glm::vec4(m[0][r], m[1][r], m[2][r], m[3][r]);
+    frustum f;
+    for (int axis = 0; axis < 3; axis++) {
+      f.planes[2 * axis + 0] = rows[3] + rows[axis];
+      f.planes[2 * axis + 1] = rows[3] - rows[axis];
+    }
+    for (glm::vec4& p : f.planes) {
+      float len = glm::length(glm::vec3(p));
+      if (len > 0.0f) p /= len;
+    }
+    return f;
+  }
+
+  size_t cull_meshlets(const meshlet* meshlets, size_t count, const glm::vec3& eye, const frustum& f,
+                       std::vector<draw_range>& ranges) {
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++) {
+      const meshlet& m = meshlets[i];
+      if (!meshlet_visible(m, eye, f)) continue;
+      kept += m.index_count;
+      if (!ranges.empty() && ranges.back().index_offset + ranges.back().index_count == m.index_offset)
+        ranges.back().index_count += m.index_count;
+      else
+        ranges.push_back({ m.index_offset, m.index_count });
+    }
+    return kept;
+  }
+
+}
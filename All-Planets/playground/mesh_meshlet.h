@@ -0,0 +1,70 @@
+#ifndef MESH_MESHLET_H
+#define MESH_MESHLET_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "playground/mesh_pipeline.h"
+
+// Meshlets: level 0 split into clusters of neighbouring triangles, each with
+// a bounding sphere and a normal cone, so that a per frame pass can skip the
+// clusters that face away from the eye or lie outside the view frustum and
+// draw only the index ranges that survive.
+namespace mesh {
+
+  struct meshlet_options {
+    size_t max_triangles;  // a cluster never grows beyond this
+    size_t min_triangles;  // nor is cut short of it for its normals alone
+    float cone_angle;      // degrees; past min_triangles, a normal further than this from the cluster's ends it
+
+    meshlet_options() : max_triangles(128), min_triangles(64), cone_angle(45.0f) {}
+  };
+
+  // Splits level 0 of mesh (all indices without a LOD chain) into clusters
+  // and fills mesh.meshlets. Clusters are runs of consecutive triangles,
+  // cut where the next triangle shares no vertex with the run or turns too
+  // far from its normals, so the index buffer is left exactly as it was: run
+  // this after optimize_mesh, whose vertex cache and overdraw order the
+  // runs then follow. Working buffers come from scratch (a private arena if
+  // null).
+  void build_meshlets(indexed_mesh& mesh, const meshlet_options& options = meshlet_options(), arena* scratch = nullptr);
+
+  // The six planes of the view frustum of clip_from_model (projection *
+  // view * model), in model space, normalised and pointing inwards.
+  struct frustum {
+    glm::vec4 planes[6];
+  };
+  frustum frustum_planes(const glm::mat4& clip_from_model);
+
+  // False if every triangle of m faces away from eye (model space), or m
+  // lies entirely outside the frustum. Conservative: a false true is only a
+  // wasted draw. Back facing means every direction from the eye into the
+  // bounding sphere is within 90 degrees minus the cone angle of the axis;
+  // a point of the sphere can lower the dot product by radius and raise
+  // the length by radius, hence the (1 + cutoff) * radius margin.
+  inline bool meshlet_visible(const meshlet& m, const glm::vec3& eye, const frustum& f) {
+    glm::vec3 to_center = m.center - eye;
+    if (glm::dot(to_center, m.cone_axis) >= m.cone_cutoff * glm::length(to_center) + (1.0f + m.cone_cutoff) * m.radius)
+      return false;
+    for (const glm::vec4& p : f.planes)
+      if (glm::dot(glm::vec3(p), m.center) + p.w < -m.radius) return false;
+    return true;
+  }
+
+  // Index range of a draw call, in indices from the start of the buffer
+  struct draw_range {
+    uint32_t index_offset;
+    uint32_t index_count;
+  };
+
+  // Appends the visible meshlets to ranges, merging neighbours in the index
+  // buffer into one range. Returns the number of indices kept.
+  size_t cull_meshlets(const meshlet* meshlets, size_t count, const glm::vec3& eye, const frustum& f,
+                       std::vector<draw_range>& ranges);
+
+}
+
+#endif
@@ -0,0 +1,241 @@
+#include "mesh_optimize.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace mesh {
+
+  namespace {
+
+    // FIFO post-transform cache simulated with timestamps: a vertex is
+    // resident while fewer than cache_size misses happened since it was
+    // loaded.
+    struct fifo_cache {
+      std::pmr::vector<uint32_t> loaded;
+      uint32_t time;
+      uint32_t size;
+
+      fifo_cache(size_t vertex_count, size_t cache_size, std::pmr::memory_resource* memory)
+        : loaded(vertex_count, 0, memory), time((uint32_t)cache_size + 1), size((uint32_t)cache_size) {}
+
+      // Returns the number of misses for one triangle
+      int add(const uint32_t* tri) {
+        int misses = 0;
+        for (int k = 0; k < 3; k++) {
+          if (time - loaded[tri[k]] > size) {
+            loaded[tri[k]] = time++;
+            misses++;
+          }
+        }
+        return misses;
+      }
+
+      void flush() { time += size + 1; }
+    };
+
+    // Triangles around every vertex, in compressed rows
+    struct vertex_adjacency {
+      std::pmr::vector<uint32_t> offsets;
+      std::pmr::vector<uint32_t> triangles;
+
+      vertex_adjacency(const uint32_t* indices, size_t index_count, size_t vertex_count, std::pmr::memory_resource* memory)
+        : offsets(vertex_count + 1, 0, memory), triangles(index_count, memory) {
+        for (size_t i = 0; i < index_count; i++) offsets[indices[i] + 1]++;
+        for (size_t v = 0; v < vertex_count; v++) offsets[v + 1] += offsets[v];
+        std::pmr::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1, memory);
+        for (size_t i = 0; i < index_count; i++) triangles[fill[indices[i]]++] = (uint32_t)(i / 3);
+      }
+    };
+
+  }
+
+  float average_cache_miss_ratio(const uint32_t* indices, size_t index_count, size_t vertex_count, size_t cache_size,
+                                 arena* scratch) {
+    size_t triangles = index_count / 3;
+    if (triangles == 0) return 0.0f;
+    scratch_scope memory(scratch);
+    fifo_cache cache(vertex_count, cache_size, memory);
+    size_t misses = 0;
+    for (size_t t = 0; t < triangles; t++) misses += cache.add(indices + 3 * t);
+    return (float)misses / triangles;
+  }
+
+  void optimize_vertex_cache(uint32_t* indices, size_t index_count, size_t vertex_count, size_t cache_size,
+                             arena* scratch) {
+    size_t triangles = index_count / 3;
+    if (triangles == 0) return;
+    scratch_scope memory(scratch);
+    vertex_adjacency adjacency(indices, index_count, vertex_count, memory);
+
+    std::pmr::vector<uint32_t> live(vertex_count, memory);
+    for (size_t v = 0; v < vertex_count; v++) live[v] = adjacency.offsets[v + 1] - adjacency.offsets[v];
+    std::pmr::vector<uint32_t> cache_time(vertex_count, 0, memory);
+    std::pmr::vector<bool> emitted(triangles, false, memory);
+    // Every emitted vertex is pushed once, so the stack never reallocates
+    std::pmr::vector<uint32_t> dead_end(memory);
+    dead_end.reserve(triangles * 3);
+    std::pmr::vector<uint32_t> candidates(memory);
+    std::pmr::vector<uint32_t> result(memory);
+    result.reserve(triangles * 3);
+
+    uint32_t k = (uint32_t)cache_size;
+    uint32_t time = k + 1;
+    size_t cursor = 0;   // next vertex to try once the dead-end stack runs dry
+    int64_t fan = 0;     // vertex whose remaining triangles are emitted next
+    while (fan >= 0) {
+      // Emit every remaining triangle around the fanning vertex
+      candidates.clear();
+      for (uint32_t a = adjacency.offsets[fan]; a < adjacency.offsets[fan + 1]; a++) {
+        uint32_t t = adjacency.triangles[a];
+        if (emitted[t]) continue;
+        emitted[t] = true;
+        for (int c = 0; c < 3; c++) {
+          uint32_t v = indices[3 * t + c];
+          result.push_back(v);
+          dead_end.push_back(v);
+          candidates.push_back(v);
+          live[v]--;
+          if (time - cache_time[v] > k) cache_time[v] = time++;
+        }
+      }
+
+      // Next fan: the candidate still in cache with the most triangles left
+      // that will not be evicted before they are emitted
+      fan = -1;
+      int64_t best = -1;
+      for (uint32_t v : candidates) {
+        if (live[v] == 0) continue;
+        int64_t priority = 0;
+        if (time - cache_time[v] + 2 * live[v] <= k) priority = time - cache_time[v];
+        if (priority > best) {
+          best = priority;
+          fan = v;
+        }
+      }
+
+      // Dead end: go back to a recently used vertex, else the next unused one
+      while (fan < 0 && !dead_end.empty()) {
+        uint32_t v = dead_end.back();
+        dead_end.pop_back();
+        if (live[v] > 0) fan = v;
+      }
+      while (fan < 0 && cursor < vertex_count) {
+        if (live[cursor] > 0) fan = (int64_t)cursor;
+        cursor++;
+      }
+    }
+
+    std::copy(result.begin(), result.end(), indices);
+  }
+
+  void optimize_overdraw(uint32_t* indices, size_t index_count, const vertex* vertices, size_t vertex_count,
+                         float threshold, size_t cache_size, arena* scratch) {
+    size_t triangles = index_count / 3;
+    if (triangles == 0) return;
+    scratch_scope memory(scratch);
+
+    // Hard boundaries: triangles that miss on all three vertices, i.e. where
+    // the cache optimizer had to jump to a new region
+    std::pmr::vector<uint32_t> hard(memory);
+    hard.reserve(triangles + 1);
+    {
+      fifo_cache cache(vertex_count, cache_size, memory);
+      for (size_t t = 0; t < triangles; t++)
+        if (cache.add(indices + 3 * t) == 3 || t == 0) hard.push_back((uint32_t)t);
+    }
+    hard.push_back((uint32_t)triangles);
+
+    // Soft boundaries: split a hard cluster wherever the part so far is no
+    // worse for the cache than threshold times the whole cluster
+    std::pmr::vector<uint32_t> clusters(memory);
+    clusters.reserve(triangles + 1);
+    fifo_cache cache(vertex_count, cache_size, memory);
+    for (size_t h = 0; h + 1 < hard.size(); h++) {
+      uint32_t start = hard[h], end = hard[h + 1];
+      cache.flush();
+      size_t misses = 0;
+      for (uint32_t t = start; t < end; t++) misses += cache.add(indices + 3 * t);
+      float limit = (float)misses / (end - start) * threshold;
+
+      cache.flush();
+      clusters.push_back(start);
+      uint32_t cluster_start = start;
+      misses = 0;
+      for (uint32_t t = start; t + 1 < end; t++) {
+        misses += cache.add(indices + 3 * t);
+        if ((float)misses / (t + 1 - cluster_start) <= limit) {
+          clusters.push_back(t + 1);
+          cluster_start = t + 1;
+          misses = 0;
+          cache.flush();
+        }
+      }
+    }
+    clusters.push_back((uint32_t)triangles);
+    size_t cluster_count = clusters.size() - 1;
+
+    // Sort key: how far the cluster lies out along its own normal, seen from
+    // the area weighted centroid of the mesh
+    std::pmr::vector<glm::vec3> centroid(cluster_count, glm::vec3(0.0f), memory);
+    std::pmr::vector<glm::vec3> normal(cluster_count, glm::vec3(0.0f), memory);
+    glm::vec3 mesh_centroid(0.0f);
+    float mesh_area = 0.0f;
+    for (size_t c = 0; c < cluster_count; c++) {
+      float area = 0.0f;
+      for (uint32_t t = clusters[c]; t < clusters[c + 1]; t++) {
+        const glm::vec3& a = vertices[indices[3 * t + 0]].position;
+        const glm::vec3& b = vertices[indices[3 * t + 1]].position;
+        const glm::vec3& d = vertices[indices[3 * t + 2]].position;
+        glm::vec3 n = glm::cross(b - a, d - a);
+        float w = glm::length(n);
+        centroid[c] += (a + b + d) * (w / 3.0f);
+        normal[c] += n;
+        area += w;
+      }
+      mesh_centroid += centroid[c];
+      mesh_area += area;
+      centroid[c] = area > 0.0f ? centroid[c] / area : vertices[indices[3 * clusters[c]]].position;
+    }
+    if (mesh_area > 0.0f) mesh_centroid /= mesh_area;
+
+    std::pmr::vector<float> key(cluster_count, memory);
+    for (size_t c = 0; c < cluster_count; c++) {
+      float len = glm::length(normal[c]);
+      key[c] = len > 0.0f ? glm::dot(centroid[c] - mesh_centroid, normal[c] / len) : 0.0f;
+    }
+    std::pmr::vector<uint32_t> order(cluster_count, memory);
+    for (size_t c = 0; c < cluster_count; c++) order[c] = (uint32_t)c;
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t x, uint32_t y) { return key[x] > key[y]; });
+
+    std::pmr::vector<uint32_t> result(memory);
+    result.reserve(index_count);
+    for (uint32_t c : order)
+      result.insert(result.end(), indices + 3 * clusters[c], indices + 3 * clusters[c + 1]);
+    std::copy(result.begin(), result.end(), indices);
+  }
+
+  void optimize_vertex_fetch(indexed_mesh& mesh, arena* scratch) {
+    scratch_scope memory(scratch);
+    const uint32_t unused = ~0u;
+    std::pmr::vector<uint32_t> remap(mesh.vertices.size(), unused, memory);
+    std::vector<vertex> vertices;
+    vertices.reserve(mesh.vertices.size());
+    for (uint32_t& index : mesh.indices) {
+      if (remap[index] == unused) {
+        remap[index] = (uint32_t)vertices.size();
+        vertices.push_back(mesh.vertices[index]);
+      }
+      index = remap[index];
+    }
+    mesh.vertices.swap(vertices);
+  }
+
+  void optimize_mesh(indexed_mesh& mesh, arena* scratch) {
+    size_t index_count = mesh.indices.size() - mesh.indices.size() % 3;
+    optimize_vertex_cache(mesh.indices.data(), index_count, mesh.vertices.size(), default_cache_size, scratch);
+    optimize_overdraw(mesh.indices.data(), index_count, mesh.vertices.data(), mesh.vertices.size(), 1.05f,
+                      default_cache_size, scratch);
+    optimize_vertex_fetch(mesh, scratch);
+  }
+
+}
@@ -0,0 +1,44 @@
+#ifndef MESH_OPTIMIZE_H
+#define MESH_OPTIMIZE_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "playground/mesh_pipeline.h"
+
+// Reordering passes for indexed triangle meshes. None of them change the
+// rendered result, only the order in which the GPU sees triangles and
+// vertices. Working buffers come from the scratch arena if one is passed,
+// from a private one otherwise.
+namespace mesh {
+
+  // Typical size of the post-transform vertex cache the passes plan for.
+  const size_t default_cache_size = 16;
+
+  // Average cache miss ratio: vertex shader invocations per triangle for a
+  // FIFO cache of cache_size entries. 3 is an unindexed soup, ~0.5 is ideal.
+  float average_cache_miss_ratio(const uint32_t* indices, size_t index_count, size_t vertex_count,
+                                 size_t cache_size = default_cache_size, arena* scratch = nullptr);
+
+  // Reorders triangles for post-transform cache locality (Tipsify, Sander et
+  // al. 2007). Linear in the number of triangles.
+  void optimize_vertex_cache(uint32_t* indices, size_t index_count, size_t vertex_count,
+                             size_t cache_size = default_cache_size, arena* scratch = nullptr);
+
+  // Reorders clusters of an already cache optimized index buffer so that
+  // triangles facing away from the mesh centre come first, which lets the
+  // depth test reject more of what follows. Clusters are only split where
+  // the cache miss ratio stays within threshold times the original.
+  void optimize_overdraw(uint32_t* indices, size_t index_count, const vertex* vertices, size_t vertex_count,
+                         float threshold = 1.05f, size_t cache_size = default_cache_size, arena* scratch = nullptr);
+
+  // Renumbers vertices in order of first use so vertex fetches walk through
+  // the vertex buffer linearly. Rewrites both arrays of the mesh.
+  void optimize_vertex_fetch(indexed_mesh& mesh, arena* scratch = nullptr);
+
+  // All of the above, in the order they need to run.
+  void optimize_mesh(indexed_mesh& mesh, arena* scratch = nullptr);
+
+}
+
+#endif
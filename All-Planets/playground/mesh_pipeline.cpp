@@ -0,0 +1,310 @@
+#include "mesh_pipeline.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include "playground/mesh_simd.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+namespace mesh {
+
+  namespace {
+
+    // Triangles per round trip through the SoA kernels; small enough for the
+    // staging arrays to live on the stack and in L1
+    const size_t soa_triangles = 512;
+
+    // Vertex positions of up to soa_triangles triangles, one array per axis
+    struct soa_chunk {
+      float x[3 * soa_triangles];
+      float y[3 * soa_triangles];
+      float z[3 * soa_triangles];
+
+      // stl::triangle or stl::record
+      template <typename T>
+      void load(const T* batch, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+          // Copied out: a packed record's members are not aligned
+          const stl::point v[3] = { batch[i].v1, batch[i].v2, batch[i].v3 };
+          for (int k = 0; k < 3; k++) {
+            x[3 * i + k] = v[k].x;
+            y[3 * i + k] = v[k].y;
+            z[3 * i + k] = v[k].z;
+          }
+        }
+      }
+
+      void load(const glm::vec3* vertices, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+          x[i] = vertices[i].x;
+          y[i] = vertices[i].y;
+          z[i] = vertices[i].z;
+        }
+      }
+    };
+
+    template <typename T>
+    void chunked_bounds(const T* batch, size_t count, glm::vec3& min, glm::vec3& max) {
+      soa_chunk chunk;
+      for (size_t first = 0; first < count; first += soa_triangles) {
+        size_t n = std::min(soa_triangles, count - first);
+        chunk.load(batch + first, n);
+        soa_bounds(chunk.x, chunk.y, chunk.z, 3 * n, min, max);
+      }
+    }
+
+    template <typename T>
+    void chunked_affine(const T* batch, size_t count, const glm::vec3& center, float scale, glm::vec3* out) {
+      soa_chunk chunk;
+      for (size_t first = 0; first < count; first += soa_triangles) {
+        size_t n = 3 * std::min(soa_triangles, count - first);
+        chunk.load(batch + first, n / 3);
+        soa_affine(chunk.x, chunk.y, chunk.z, n, center, scale);
+        for (size_t i = 0; i < n; i++) out[i] = glm::vec3(chunk.x[i], chunk.y[i], chunk.z[i]);
+        out += n;
+      }
+    }
+
+  }
+
+  bounds_stage::bounds_stage() :
+    min(std::numeric_limits<float>::max()),
+    max(std::numeric_limits<float>::lowest()),
+    triangles(0) {}
+
+  void bounds_stage::add(const stl::triangle* batch, size_t count) {
+    chunked_bounds(batch, count, min, max);
+    triangles += count;
+  }
+
+  void bounds_stage::add(const stl::record* batch, size_t count) {
+    chunked_bounds(batch, count, min, max);
+    triangles += count;
+  }
+
+  fit_transform::fit_transform(const bounds_stage& bounds, float extent) {
+    glm::vec3 size = bounds.max - bounds.min;
+    float max_scale = std::max({ size.x, size.y, size.z });
+    scale = extent / max_scale;
+    center = (bounds.min + bounds.max) / 2.0f;
+  }
+
+  void fit_transform::apply(const stl::triangle* batch, size_t count, std::vector<glm::vec3>& vertices) const {
+    size_t out = vertices.size();
+    vertices.resize(out + 3 * count);
+    apply(batch, count, vertices.data() + out);
+  }
+
+  void fit_transform::apply(const stl::triangle* batch, size_t count, glm::vec3* out) const {
+    chunked_affine(batch, count, center, scale, out);
+  }
+
+  void fit_transform::apply(const stl::record* batch, size_t count, glm::vec3* out) const {
+    chunked_affine(batch, count, center, scale, out);
+  }
+
+  glm::vec2 spherical_uv(const glm::vec3& vertex) {
+    glm::vec3 normalized = glm::normalize(vertex);
+
+    // Calculate spherical coordinates
+    float u = 0.5f + (atan2(normalized.z, normalized.x) / (2.0f * M_PI));
+    float v = 0.5f + (asin(normalized.y) / M_PI);
+
+    // Flip the U coordinate to fix the mirroring
+    u = 1.0f - u;
+
+    if (u > 1.0f) u -= floor(u);
+    if (u < 0.0f) u += ceil(-u);
+
+    v = glm::clamp(v, 0.0f, 1.0f);
+
+    return glm::vec2(u, v);
+  }
+
+  bool is_seam_vertex(const glm::vec3& normalized) {
+    float angle = atan2(normalized.z, normalized.x);
+    float threshold = 0.005f;
+    return std::abs(std::abs(angle) - M_PI) < threshold;
+  }
+
+  void spherical_uvs(const glm::vec3* vertices, size_t count, std::vector<glm::vec2>& uvs) {
+    size_t out = uvs.size();
+    uvs.resize(out + count - count % 3);
+    spherical_uvs(vertices, count, uvs.data() + out);
+  }
+
+  void spherical_uvs(const glm::vec3* vertices, size_t count, glm::vec2* uvs) {
+    count -= count % 3;
+
+    // is_seam_vertex's 0.005 radians either side of the seam, in u
+    const float seam_u = 0.005f / (2.0f * (float)M_PI);
+
+    soa_chunk chunk;
+    float u[3 * soa_triangles];
+    float v[3 * soa_triangles];
+    for (size_t first = 0; first < count; first += 3 * soa_triangles) {
+      size_t n = std::min(3 * soa_triangles, count - first);
+      chunk.load(vertices + first, n);
+      soa_spherical_uv(chunk.x, chunk.y, chunk.z, n, u, v);
+
+      for (size_t i = 0; i < n; i += 3) {
+        float u1 = u[i], u2 = u[i + 1], u3 = u[i + 2];
+        bool seam = false;
+        for (int k = 0; k < 3; k++) seam = seam || u[i + k] < seam_u || u[i + k] > 1.0f - seam_u;
+        if (seam) {
+          if (std::abs(u1 - u2) > 0.5f) {
+            if (u1 < u2) u1 += 1.0f;
+            else u2 += 1.0f;
+          }
+          if (std::abs(u2 - u3) > 0.5f) {
+            if (u2 < u3) u2 += 1.0f;
+            else u3 += 1.0f;
+          }
+          if (std::abs(u3 - u1) > 0.5f) {
+            if (u3 < u1) u3 += 1.0f;
+            else u1 += 1.0f;
+          }
+        }
+        uvs[first + i] = glm::vec2(u1, v[i]);
+        uvs[first + i + 1] = glm::vec2(u2, v[i + 1]);
+        uvs[first + i + 2] = glm::vec2(u3, v[i + 2]);
+      }
+    }
+  }
+
+  normal_accumulator::position_key::position_key(const glm::vec3& p) {
+    // +0.0f and -0.0f compare equal, so they must share a key.
+    float c[3] = { p.x + 0.0f, p.y + 0.0f, p.z + 0.0f };
+    std::memcpy(bits, c, sizeof(bits));
+  }
+
+  bool normal_accumulator::position_key::operator==(const position_key& o) const {
+    return bits[0] == o.bits[0] && bits[1] == o.bits[1] && bits[2] == o.bits[2];
+  }
+
+  size_t normal_accumulator::position_hash::operator()(const position_key& k) const {
+    uint64_t h = k.bits[0] * 0x9E3779B97F4A7C15ull;
+    h ^= k.bits[1] * 0xC2B2AE3D27D4EB4Full + (h << 6) + (h >> 2);
+    h ^= k.bits[2] * 0x165667B19E3779F9ull + (h << 6) + (h >> 2);
+    return (size_t)h;
+  }
+
+  normal_accumulator::normal_accumulator()
+      : axis_(0), lo_(-std::numeric_limits<float>::infinity()), hi_(std::numeric_limits<float>::infinity()) {}
+
+  void normal_accumulator::set_slab(int axis, float lo, float hi) {
+    std::unordered_map<position_key, glm::vec3, position_hash>().swap(sums_);
+    axis_ = axis;
+    lo_ = lo;
+    hi_ = hi;
+  }
+
+  void normal_accumulator::add(const glm::vec3* vertices, size_t count) {
+    for (size_t i = 0; i + 2 < count; i += 3) {
+      glm::vec3 face = glm::normalize(glm::cross(vertices[i + 1] - vertices[i], vertices[i + 2] - vertices[i]));
+      if (face != face) continue; // degenerate triangle, its normal is NaN
+      for (int k = 0; k < 3; k++) {
+        if (!in_slab(vertices[i + k])) continue;
+        auto it = sums_.emplace(position_key(vertices[i + k]), glm::vec3(0.0f)).first;
+        it->second += face;
+      }
+    }
+  }
+
+  void normal_accumulator::resolve(const glm::vec3* vertices, size_t count, glm::vec3* normals) const {
+    for (size_t i = 0; i < count; i++) {
+      if (!in_slab(vertices[i])) continue;
+      auto it = sums_.find(position_key(vertices[i]));
+      glm::vec3 sum = it == sums_.end() ? glm::vec3(0.0f) : it->second;
+      float len = glm::length(sum);
+      normals[i] = len > 0.0f ? sum / len : sum;
+    }
+  }
+
+  namespace {
+
+    const size_t slab_bins = 4096;
+
+  }
+
+  slab_plan::slab_plan(const glm::vec3& min, const glm::vec3& max) : bins_(slab_bins, 0) {
+    glm::vec3 extent = max - min;
+    axis_ = extent.x >= extent.y && extent.x >= extent.z ? 0 : extent.y >= extent.z ? 1 : 2;
+    lo_ = min[axis_];
+    scale_ = extent[axis_] > 0.0f ? slab_bins / extent[axis_] : 0.0f;
+  }
+
+  void slab_plan::add(const glm::vec3* vertices, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+      float bin = (vertices[i][axis_] - lo_) * scale_;
+      // Also catches NaN, which no slab holds anyway
+      if (!(bin >= 0.0f)) bin = 0.0f;
+      bins_[std::min((size_t)bin, slab_bins - 1)]++;
+    }
+  }
+
+  std::vector<float> slab_plan::split(size_t max_corners) const {
+    std::vector<float> edges(1, -std::numeric_limits<float>::infinity());
+    size_t corners = 0;
+    for (size_t b = 0; b < slab_bins; b++) {
+      if (corners > 0 && bins_[b] > 0 && corners + bins_[b] > max_corners) {
+        edges.push_back(lo_ + b / scale_);
+        corners = 0;
+      }
+      corners += bins_[b];
+    }
+    edges.push_back(std::numeric_limits<float>::infinity());
+    return edges;
+  }
+
+  namespace {
+
+    uint64_t hash_vertex(const vertex& v) {
+      uint32_t bits[8];
+      std::memcpy(bits, &v, sizeof(bits));
+      uint64_t h = 0xCBF29CE484222325ull;
+      for (uint32_t b : bits) h = (h ^ b) * 0x100000001B3ull;
+      return h ^ (h >> 29);
+    }
+
+  }
+
+  void weld(const glm::vec3* positions, const glm::vec3* normals, const glm::vec2* uvs, size_t count, indexed_mesh& out,
+            arena* scratch) {
+    scratch_scope memory(scratch);
+    out.lods.clear();
+    out.meshlets.clear();
+    out.indices.resize(count);
+    out.bounds_min = glm::vec3(std::numeric_limits<float>::max());
+    out.bounds_max = glm::vec3(std::numeric_limits<float>::lowest());
+
+    // Open addressing over indices into unique, at most half full
+    const uint32_t empty = 0xFFFFFFFFu;
+    size_t slots = 16;
+    while (slots < 2 * count) slots *= 2;
+    std::pmr::vector<uint32_t> table(slots, empty, memory);
+    std::pmr::vector<vertex> unique(memory);
+    unique.reserve(count);
+
+    for (size_t i = 0; i < count; i++) {
+      vertex v = { positions[i], normals[i], uvs[i] };
+      size_t slot = hash_vertex(v) & (slots - 1);
+      while (table[slot] != empty && std::memcmp(&unique[table[slot]], &v, sizeof(vertex)) != 0)
+        slot = (slot + 1) & (slots - 1);
+      if (table[slot] == empty) {
+        table[slot] = (uint32_t)unique.size();
+        unique.push_back(v);
+        out.bounds_min = glm::min(out.bounds_min, v.position);
+        out.bounds_max = glm::max(out.bounds_max, v.position);
+      }
+      out.indices[i] = table[slot];
+    }
+    out.vertices.assign(unique.begin(), unique.end());
+  }
+
+}
@@ -0,0 +1,180 @@
+#ifndef MESH_PIPELINE_H
+#define MESH_PIPELINE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "playground/parse_stl.h"
+#include "playground/mesh_arena.h"
+
+// Stages of the STL mesh load path. Each stage works on one batch of
+// triangles at a time, so the same code serves a whole mesh held in memory
+// (one big batch) and a file streamed through in fixed-size batches.
+namespace mesh {
+
+  // 64k triangles keep each per-batch buffer at a few MB.
+  const size_t default_batch_triangles = 65536;
+
+  // Interleaved vertex as uploaded to the GPU: attribute 0 position,
+  // 1 normal, 2 UV.
+  struct vertex {
+    glm::vec3 position;
+    glm::vec3 normal;
+    glm::vec2 uv;
+  };
+  static_assert(sizeof(vertex) == 32, "vertex must stay tightly packed");
+
+  // One level of detail: a range of the index buffer drawn instead of the
+  // full mesh, and how far (in model units) its surface may stray from the
+  // full detail one.
+  struct lod_level {
+    uint32_t index_offset;
+    uint32_t index_count;
+    float error;
+  };
+  static_assert(sizeof(lod_level) == 12, "lod_level is stored as is in the mesh cache");
+
+  // A cluster of neighbouring level 0 triangles, drawn as one index range,
+  // with the bounds the per frame culling tests: a bounding sphere, and a
+  // cone holding every triangle normal (see build_meshlets).
+  struct meshlet {
+    uint32_t index_offset;
+    uint32_t index_count;
+    glm::vec3 center;
+    float radius;
+    glm::vec3 cone_axis;
+    float cone_cutoff;  // sine of the cone's half angle; 1 if it cannot be culled
+  };
+  static_assert(sizeof(meshlet) == 40, "meshlet is stored as is in the mesh cache");
+
+  // Indexed triangle mesh ready for glBufferData / glDrawElements. With a
+  // LOD chain, indices holds every level back to back, finest first, and
+  // lods says where each one starts; without one, all indices are level 0.
+  // meshlets, if any, tile level 0.
+  struct indexed_mesh {
+    std::vector<vertex> vertices;
+    std::vector<uint32_t> indices;
+    glm::vec3 bounds_min;
+    glm::vec3 bounds_max;
+    std::vector<lod_level> lods;
+    std::vector<meshlet> meshlets;
+  };
+
+  // Axis aligned bounds of every triangle fed to it.
+  struct bounds_stage {
+    glm::vec3 min;
+    glm::vec3 max;
+    size_t triangles;
+
+    bounds_stage();
+    void add(const stl::triangle* batch, size_t count);
+    void add(const stl::record* batch, size_t count); //<<< binary STL records, in place
+  };
+
+  // Moves the bounds centre to the origin and scales the largest extent of
+  // the bounds to `extent`.
+  struct fit_transform {
+    glm::vec3 center;
+    float scale;
+
+    fit_transform(const bounds_stage& bounds, float extent);
+
+    // Appends three transformed vertices per triangle to vertices.
+    void apply(const stl::triangle* batch, size_t count, std::vector<glm::vec3>& vertices) const;
+    // Writes three transformed vertices per triangle to out.
+    void apply(const stl::triangle* batch, size_t count, glm::vec3* out) const;
+    void apply(const stl::record* batch, size_t count, glm::vec3* out) const;
+  };
+
+  // Spherical (equirectangular) UV of a direction from the mesh centre.
+  // Exact reference for the approximated SIMD path spherical_uvs uses.
+  glm::vec2 spherical_uv(const glm::vec3& vertex);
+
+  // True if a normalized direction lies on the u = 0 / u = 1 texture seam.
+  bool is_seam_vertex(const glm::vec3& normalized);
+
+  // Appends one UV per vertex (vertices come in triangles) to uvs. Triangles
+  // touching the seam get their u coordinates unwrapped so they do not
+  // stretch across the whole texture. UVs come from soa_spherical_uv and agree
+  // with spherical_uv to about 1e-5.
+  void spherical_uvs(const glm::vec3* vertices, size_t count, std::vector<glm::vec2>& uvs);
+  // Same, writing count - count % 3 UVs to uvs.
+  void spherical_uvs(const glm::vec3* vertices, size_t count, glm::vec2* uvs);
+
+  // Turns a triangle soup (three entries per triangle in each array) into an
+  // indexed mesh, merging vertices whose position, normal and UV are bit
+  // identical, and records the bounds of the result. The lookup table lives
+  // in scratch (a private arena if null); out gets exactly sized buffers.
+  void weld(const glm::vec3* positions, const glm::vec3* normals, const glm::vec2* uvs, size_t count, indexed_mesh& out,
+            arena* scratch = nullptr);
+
+  // Triangle corners whose normal sums one normal_accumulator slab may hold
+  // in a streamed load; at most a few tens of MB of table.
+  const size_t default_slab_corners = size_t(1) << 21;
+
+  // Smooth vertex normals for a triangle soup that arrives in batches.
+  // add() sums the face normal of every triangle into each of its corner
+  // positions, resolve() then looks the sums up for the same vertices.
+  // Only positions inside the current slab (a range of one coordinate, all
+  // of space by default) are summed and resolved, so a mesh too large for
+  // one table is smoothed slab by slab (see slab_plan), each slab over its
+  // own passes of the file. Memory grows with the distinct positions of the
+  // slab, not with the number of triangles.
+  class normal_accumulator {
+  public:
+    normal_accumulator();
+
+    // Empties the table and restricts it to positions p with lo <= p[axis] < hi.
+    void set_slab(int axis, float lo, float hi);
+    bool in_slab(const glm::vec3& p) const { return p[axis_] >= lo_ && p[axis_] < hi_; }
+
+    void add(const glm::vec3* vertices, size_t count);
+    // Writes the normal of every vertex inside the slab to normals[i] and
+    // leaves the others alone.
+    void resolve(const glm::vec3* vertices, size_t count, glm::vec3* normals) const;
+    size_t size() const { return sums_.size(); }
+
+  private:
+    struct position_key {
+      uint32_t bits[3];
+      explicit position_key(const glm::vec3& p);
+      bool operator==(const position_key& o) const;
+    };
+    struct position_hash {
+      size_t operator()(const position_key& k) const;
+    };
+
+    int axis_;
+    float lo_;
+    float hi_;
+    std::unordered_map<position_key, glm::vec3, position_hash> sums_;
+  };
+
+  // Cuts a fitted mesh into normal_accumulator slabs along the longest axis
+  // of its bounds, from a fixed size histogram of corner coordinates filled
+  // batch by batch. A slab is never narrower than one histogram bin, so only
+  // a bin that alone holds more than max_corners makes a larger slab.
+  class slab_plan {
+  public:
+    slab_plan(const glm::vec3& min, const glm::vec3& max);
+
+    void add(const glm::vec3* vertices, size_t count);
+    // Slab k covers [edges[k], edges[k + 1]) on axis(); the outer edges are
+    // infinite, so one slab means no split.
+    std::vector<float> split(size_t max_corners) const;
+    int axis() const { return axis_; }
+
+  private:
+    int axis_;
+    float lo_;
+    float scale_;  // histogram bins per unit
+    std::vector<size_t> bins_;
+  };
+
+}
+
+#endif
@@ -0,0 +1,148 @@
+#include "mesh_simd.h"
+
+#include <atomic>
+
+#include "mesh_simd_kernels.h"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
+namespace mesh {
+
+  namespace {
+
+    using simd_detail::kernel_table;
+
+    const kernel_table& scalar_kernels() {
+      static const kernel_table table = simd_detail::make_kernel_table<simd_detail::f32x1>();
+      return table;
+    }
+
+#ifdef MESH_SIMD_SSE2
+    const kernel_table& sse2_kernels() {
+      static const kernel_table table = simd_detail::make_kernel_table<simd_detail::f32x4>();
+      return table;
+    }
+#endif
+
+    bool cpu_has_avx2_fma() {
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+      int info[4];
+      __cpuid(info, 0);
+      if (info[0] < 7) return false;
+      __cpuid(info, 1);
+      bool fma = (info[2] & (1 << 12)) != 0;
+      bool osxsave = (info[2] & (1 << 27)) != 0;
+      // The OS must save the YMM registers on context switches
+      if (!fma || !osxsave || (_xgetbv(0) & 6) != 6) return false;
+      __cpuidex(info, 7, 0);
+      return (info[1] & (1 << 5)) != 0;
+#else
+      return false;
+#endif
+    }
+
+    simd_level detect() {
+      if (simd_detail::avx2_kernels() && cpu_has_avx2_fma()) return simd_level::avx2;
+#ifdef MESH_SIMD_SSE2
+      return simd_level::sse2;
+#else
+      return simd_level::scalar;
+#endif
+    }
+
+    std::atomic<int> active_level(-1);
+
+    const kernel_table& kernels_for(simd_level level) {
+      switch (level) {
+      case simd_level::avx2: return *simd_detail::avx2_kernels();
+#ifdef MESH_SIMD_SSE2
+      case simd_level::sse2: return sse2_kernels();
+#endif
+      default: return scalar_kernels();
+      }
+    }
+
+    const kernel_table& active() {
+      int level = active_level.load(std::memory_order_relaxed);
+      if (level < 0) {
+        level = (int)simd_supported();
+        active_level.store(level, std::memory_order_relaxed);
+      }
+      return kernels_for((simd_level)level);
+    }
+
+    // Whole vectors with the active kernels, the remainder with the scalar ones
+    size_t vector_part(const kernel_table& k, size_t n) { return n - n % k.width; }
+
+  }
+
+  simd_level simd_supported() {
+    static const simd_level supported = detect();
+    return supported;
+  }
+
+  simd_level simd_active() {
+    active();
+    return (simd_level)active_level.load(std::memory_order_relaxed);
+  }
+
+  void set_simd_level(simd_level level) {
+    if ((int)level > (int)simd_supported()) level = simd_supported();
+    active_level.store((int)level, std::memory_order_relaxed);
+  }
+
+  const char* simd_level_name(simd_level level) {
+    switch (level) {
+    case simd_level::avx2: return "avx2";
+    case simd_level::sse2: return "sse2";
+    default: return "scalar";
+    }
+  }
+
+  void soa_bounds(const float* x, const float* y, const float* z, size_t n, glm::vec3& min, glm::vec3& max) {
+    const kernel_table& k = active();
+    size_t body = vector_part(k, n);
+    float lo[3] = { min.x, min.y, min.z };
+    float hi[3] = { max.x, max.y, max.z };
+    k.bounds(x, y, z, body, lo, hi);
+    scalar_kernels().bounds(x + body, y + body, z + body, n - body, lo, hi);
+    min = glm::vec3(lo[0], lo[1], lo[2]);
+    max = glm::vec3(hi[0], hi[1], hi[2]);
+  }
+
+  void soa_affine(float* x, float* y, float* z, size_t n, const glm::vec3& center, float scale) {
+    const kernel_table& k = active();
+    size_t body = vector_part(k, n);
+    float c[3] = { center.x, center.y, center.z };
+    k.affine(x, y, z, body, c, scale);
+    scalar_kernels().affine(x + body, y + body, z + body, n - body, c, scale);
+  }
+
+  void soa_normalize(const float* x, const float* y, const float* z, size_t n, float* nx, float* ny, float* nz) {
+    const kernel_table& k = active();
+    size_t body = vector_part(k, n);
+    k.normalize(x, y, z, body, nx, ny, nz);
+    scalar_kernels().normalize(x + body, y + body, z + body, n - body, nx + body, ny + body, nz + body);
+  }
+
+  void soa_spherical_uv(const float* x, const float* y, const float* z, size_t n, float* u, float* v) {
+    const kernel_table& k = active();
+    size_t body = vector_part(k, n);
+    k.spherical_uv(x, y, z, body, u, v);
+    scalar_kernels().spherical_uv(x + body, y + body, z + body, n - body, u + body, v + body);
+  }
+
+  float fast_atan2(float y, float x) {
+    return simd_detail::atan2_approx<simd_detail::f32x1>(y, x);
+  }
+
+  float fast_asin(float x) {
+    return simd_detail::asin_approx<simd_detail::f32x1>(x);
+  }
+
+}
@@ -0,0 +1,63 @@
+#ifndef MESH_SIMD_H
+#define MESH_SIMD_H
+
+#include <cstddef>
+
+#include <glm/glm.hpp>
+
+// Data parallel kernels of the STL load path, on structure-of-arrays input:
+// x, y and z are separate arrays of n floats. Each kernel has a scalar, an
+// SSE2 and an AVX2/FMA implementation; the best one the CPU supports is
+// picked on first use. Results of the vector paths match the scalar one up
+// to float rounding, except for the documented error of the fast
+// atan2/asin approximations used for UVs.
+namespace mesh {
+
+  enum class simd_level { scalar, sse2, avx2 };
+
+  // Best level this build and CPU support.
+  simd_level simd_supported();
+  // Level the kernels currently run at.
+  simd_level simd_active();
+  // Forces a level, clamped to simd_supported(); for benchmarks and for
+  // comparing the paths against each other.
+  void set_simd_level(simd_level level);
+  const char* simd_level_name(simd_level level);
+
+  // Picks one of a module's kernel tables (orbit, nbody, ...) for the level
+  // the mesh kernels run at, so that set_simd_level switches every module
+  // together. sse2 and avx2 are null when the build has no such table; the
+  // next level down is used then.
+  template <typename Table>
+  const Table& simd_select(const Table& scalar, const Table* sse2, const Table* avx2) {
+    simd_level level = simd_active();
+    if (level == simd_level::avx2 && avx2) return *avx2;
+    if (level != simd_level::scalar && sse2) return *sse2;
+    return scalar;
+  }
+
+  // Widens min/max to include every point.
+  void soa_bounds(const float* x, const float* y, const float* z, size_t n, glm::vec3& min, glm::vec3& max);
+
+  // p = (p - center) * scale, in place.
+  void soa_affine(float* x, float* y, float* z, size_t n, const glm::vec3& center, float scale);
+
+  // Unit length copies of the vectors; zero vectors stay zero.
+  void soa_normalize(const float* x, const float* y, const float* z, size_t n, float* nx, float* ny, float* nz);
+
+  // Equirectangular UVs of the directions (need not be normalized), same
+  // convention as spherical_uv: u = 0.5 - atan2(z, x) / 2pi, v = 0.5 +
+  // asin(y) / pi, both clamped to [0, 1]. A zero direction maps to (0.5, 0.5).
+  void soa_spherical_uv(const float* x, const float* y, const float* z, size_t n, float* u, float* v);
+
+  // The approximations behind soa_spherical_uv, as plain functions: minimax
+  // polynomials evaluated in float, good to the bounds below (radians,
+  // measured over the whole input range including float rounding).
+  const float fast_atan2_max_error = 2e-6f;
+  const float fast_asin_max_error = 3e-7f;
+  float fast_atan2(float y, float x);
+  float fast_asin(float x);
+
+}
+
+#endif
@@ -0,0 +1,21 @@
+// AVX2/FMA instantiation of the mesh kernels. This unit is compiled with
+// -mavx2 -mfma (/arch:AVX2), and mesh_simd.cpp only calls into it after
+// checking the CPU supports both.
+#include "mesh_simd_kernels.h"
+
+namespace mesh {
+  namespace simd_detail {
+
+#ifdef MESH_SIMD_AVX2
+    const kernel_table* avx2_kernels() {
+      static const kernel_table table = make_kernel_table<f32x8>();
+      return &table;
+    }
+#else
+    const kernel_table* avx2_kernels() {
+      return nullptr;
+    }
+#endif
+
+  }
+}
@@ -0,0 +1,288 @@
+#ifndef MESH_SIMD_KERNELS_H
+#define MESH_SIMD_KERNELS_H
+
+// Implementation of mesh_simd.h, shared by the translation units that
+// instantiate it for one instruction set each. Only mesh_simd.cpp and
+// mesh_simd_avx2.cpp include this, and orbit_kernels.h, nbody_kernels.h and
+// common/texture_bake_kernels.h for the vector types.
+//
+// The kernels are written once against a small vector interface (f32x1,
+// f32x4, f32x8 below). Everything lives in an anonymous namespace: the AVX2
+// unit is compiled with -mavx2, and a shared inline copy built there could
+// otherwise be picked by the linker for the scalar or SSE2 paths too.
+
+#include <cstddef>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MESH_SIMD_SSE2 1
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#define MESH_SIMD_AVX2 1
+#include <immintrin.h>
+#endif
+
+namespace mesh {
+  namespace simd_detail {
+
+    // One instruction set's kernels. They only process whole vectors, n must
+    // be a multiple of width; the caller finishes the rest with the scalar
+    // table.
+    struct kernel_table {
+      size_t width;
+      void (*bounds)(const float* x, const float* y, const float* z, size_t n, float* lo, float* hi);
+      void (*affine)(float* x, float* y, float* z, size_t n, const float* center, float scale);
+      void (*normalize)(const float* x, const float* y, const float* z, size_t n, float* nx, float* ny, float* nz);
+      void (*spherical_uv)(const float* x, const float* y, const float* z, size_t n, float* u, float* v);
+    };
+
+    // Defined in mesh_simd_avx2.cpp; null when that unit was built without AVX2.
+    const kernel_table* avx2_kernels();
+
+  }
+}
+
+namespace mesh {
+  namespace simd_detail {
+    namespace {
+
+      const float pi = 3.14159265358979f;
+      const float half_pi = 1.57079632679490f;
+      const float inverse_two_pi = 0.159154943091895f;
+      const float inverse_pi = 0.318309886183791f;
+
+      // atan(t) = t * p(t^2) on [0, 1], minimax
+      const float atan_c0 = 0.99997726f;
+      const float atan_c1 = -0.33262347f;
+      const float atan_c2 = 0.19354346f;
+      const float atan_c3 = -0.11643287f;
+      const float atan_c4 = 0.05265332f;
+      const float atan_c5 = -0.01172120f;
+
+      // asin(a) = pi/2 - sqrt(1 - a) * q(a) on [0, 1] (Abramowitz and Stegun 4.4.46)
+      const float asin_c0 = 1.5707963050f;
+      const float asin_c1 = -0.2145988016f;
+      const float asin_c2 = 0.0889789874f;
+      const float asin_c3 = -0.0501743046f;
+      const float asin_c4 = 0.0308918810f;
+      const float asin_c5 = -0.0170881256f;
+      const float asin_c6 = 0.0066700901f;
+      const float asin_c7 = -0.0012624911f;
+
+      struct f32x1 {
+        typedef float reg;
+        typedef bool mask;
+        static const size_t width = 1;
+
+        static reg load(const float* p) { return *p; }
+        static void store(float* p, reg a) { *p = a; }
+        static reg splat(float a) { return a; }
+        static reg add(reg a, reg b) { return a + b; }
+        static reg sub(reg a, reg b) { return a - b; }
+        static reg mul(reg a, reg b) { return a * b; }
+        static reg div(reg a, reg b) { return a / b; }
+        static reg madd(reg a, reg b, reg c) { return a * b + c; }
+        // min/max keep b when a is NaN, so a NaN input never spreads
+        static reg min(reg a, reg b) { return a < b ? a : b; }
+        static reg max(reg a, reg b) { return a > b ? a : b; }
+        static reg sqrt(reg a) { return std::sqrt(a); }
+        static reg abs(reg a) { return std::fabs(a); }
+        static mask less(reg a, reg b) { return a < b; }
+        static mask greater(reg a, reg b) { return a > b; }
+        static reg select(mask m, reg a, reg b) { return m ? a : b; }
+        // mag must not be negative
+        static reg copy_sign(reg mag, reg sign) { return std::signbit(sign) ? -mag : mag; }
+        static void reduce(reg a, float& lo, float& hi) {
+          if (a < lo) lo = a;
+          if (a > hi) hi = a;
+        }
+      };
+
+#ifdef MESH_SIMD_SSE2
+      struct f32x4 {
+        typedef __m128 reg;
+        typedef __m128 mask;
+        static const size_t width = 4;
+
+        static reg load(const float* p) { return _mm_loadu_ps(p); }
+        static void store(float* p, reg a) { _mm_storeu_ps(p, a); }
+        static reg splat(float a) { return _mm_set1_ps(a); }
+        static reg add(reg a, reg b) { return _mm_add_ps(a, b); }
+        static reg sub(reg a, reg b) { return _mm_sub_ps(a, b); }
+        static reg mul(reg a, reg b) { return _mm_mul_ps(a, b); }
+        static reg div(reg a, reg b) { return _mm_div_ps(a, b); }
+        static reg madd(reg a, reg b, reg c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+        // minps/maxps return the second operand when either is NaN
+        static reg min(reg a, reg b) { return _mm_min_ps(a, b); }
+        static reg max(reg a, reg b) { return _mm_max_ps(a, b); }
+        static reg sqrt(reg a) { return _mm_sqrt_ps(a); }
+        static reg abs(reg a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+        static mask less(reg a, reg b) { return _mm_cmplt_ps(a, b); }
+        static mask greater(reg a, reg b) { return _mm_cmpgt_ps(a, b); }
+        static reg select(mask m, reg a, reg b) { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+        static reg copy_sign(reg mag, reg sign) { return _mm_or_ps(mag, _mm_and_ps(sign, _mm_set1_ps(-0.0f))); }
+        static void reduce(reg a, float& lo, float& hi) {
+          float lanes[4];
+          _mm_storeu_ps(lanes, a);
+          for (int k = 0; k < 4; k++) f32x1::reduce(lanes[k], lo, hi);
+        }
+      };
+#endif
+
+#ifdef MESH_SIMD_AVX2
+      struct f32x8 {
+        typedef __m256 reg;
+        typedef __m256 mask;
+        static const size_t width = 8;
+
+        static reg load(const float* p) { return _mm256_loadu_ps(p); }
+        static void store(float* p, reg a) { _mm256_storeu_ps(p, a); }
+        static reg splat(float a) { return _mm256_set1_ps(a); }
+        static reg add(reg a, reg b) { return _mm256_add_ps(a, b); }
+        static reg sub(reg a, reg b) { return _mm256_sub_ps(a, b); }
+        static reg mul(reg a, reg b) { return _mm256_mul_ps(a, b); }
+        static reg div(reg a, reg b) { return _mm256_div_ps(a, b); }
+        static reg madd(reg a, reg b, reg c) { return _mm256_fmadd_ps(a, b, c); }
+        static reg min(reg a, reg b) { return _mm256_min_ps(a, b); }
+        static reg max(reg a, reg b) { return _mm256_max_ps(a, b); }
+        static reg sqrt(reg a) { return _mm256_sqrt_ps(a); }
+        static reg abs(reg a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+        static mask less(reg a, reg b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+        static mask greater(reg a, reg b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+        static reg select(mask m, reg a, reg b) { return _mm256_blendv_ps(b, a, m); }
+        static reg copy_sign(reg mag, reg sign) { return _mm256_or_ps(mag, _mm256_and_ps(sign, _mm256_set1_ps(-0.0f))); }
+        static void reduce(reg a, float& lo, float& hi) {
+          float lanes[8];
+          _mm256_storeu_ps(lanes, a);
+          for (int k = 0; k < 8; k++) {
+            if (lanes[k] < lo) lo = lanes[k];
+            if (lanes[k] > hi) hi = lanes[k];
+          }
+        }
+      };
+#endif
+
+      template <typename V>
+      typename V::reg atan2_approx(typename V::reg y, typename V::reg x) {
+        typedef typename V::reg reg;
+        reg zero = V::splat(0.0f);
+        reg ax = V::abs(x), ay = V::abs(y);
+        reg hi = V::max(ax, ay), lo = V::min(ax, ay);
+        // t = min / max in [0, 1]; 0 / 0 (the origin) gives 0
+        reg t = V::select(V::greater(hi, zero), V::div(lo, hi), zero);
+        reg s = V::mul(t, t);
+        reg p = V::madd(V::splat(atan_c5), s, V::splat(atan_c4));
+        p = V::madd(p, s, V::splat(atan_c3));
+        p = V::madd(p, s, V::splat(atan_c2));
+        p = V::madd(p, s, V::splat(atan_c1));
+        p = V::madd(p, s, V::splat(atan_c0));
+        reg r = V::mul(t, p);
+        r = V::select(V::greater(ay, ax), V::sub(V::splat(half_pi), r), r);
+        r = V::select(V::less(x, zero), V::sub(V::splat(pi), r), r);
+        return V::copy_sign(r, y);
+      }
+
+      template <typename V>
+      typename V::reg asin_approx(typename V::reg a) {
+        typedef typename V::reg reg;
+        reg one = V::splat(1.0f);
+        reg x = V::min(V::abs(a), one);
+        reg q = V::madd(V::splat(asin_c7), x, V::splat(asin_c6));
+        q = V::madd(q, x, V::splat(asin_c5));
+        q = V::madd(q, x, V::splat(asin_c4));
+        q = V::madd(q, x, V::splat(asin_c3));
+        q = V::madd(q, x, V::splat(asin_c2));
+        q = V::madd(q, x, V::splat(asin_c1));
+        q = V::madd(q, x, V::splat(asin_c0));
+        reg r = V::sub(V::splat(half_pi), V::mul(V::sqrt(V::sub(one, x)), q));
+        return V::copy_sign(r, a);
+      }
+
+      // 1 / |(x, y, z)|, or 0 for the zero vector
+      template <typename V>
+      typename V::reg inverse_length(typename V::reg x, typename V::reg y, typename V::reg z) {
+        typedef typename V::reg reg;
+        reg zero = V::splat(0.0f);
+        reg length2 = V::madd(x, x, V::madd(y, y, V::mul(z, z)));
+        return V::select(V::greater(length2, zero), V::div(V::splat(1.0f), V::sqrt(length2)), zero);
+      }
+
+      template <typename V>
+      void bounds_kernel(const float* x, const float* y, const float* z, size_t n, float* lo, float* hi) {
+        if (n == 0) return;
+        typedef typename V::reg reg;
+        reg lx = V::load(x), hx = lx;
+        reg ly = V::load(y), hy = ly;
+        reg lz = V::load(z), hz = lz;
+        for (size_t i = V::width; i < n; i += V::width) {
+          reg a = V::load(x + i), b = V::load(y + i), c = V::load(z + i);
+          lx = V::min(a, lx); hx = V::max(a, hx);
+          ly = V::min(b, ly); hy = V::max(b, hy);
+          lz = V::min(c, lz); hz = V::max(c, hz);
+        }
+        V::reduce(lx, lo[0], hi[0]);
+        V::reduce(hx, lo[0], hi[0]);
+        V::reduce(ly, lo[1], hi[1]);
+        V::reduce(hy, lo[1], hi[1]);
+        V::reduce(lz, lo[2], hi[2]);
+        V::reduce(hz, lo[2], hi[2]);
+      }
+
+      template <typename V>
+      void affine_kernel(float* x, float* y, float* z, size_t n, const float* center, float scale) {
+        typedef typename V::reg reg;
+        reg s = V::splat(scale);
+        reg cx = V::splat(center[0]), cy = V::splat(center[1]), cz = V::splat(center[2]);
+        for (size_t i = 0; i < n; i += V::width) {
+          V::store(x + i, V::mul(V::sub(V::load(x + i), cx), s));
+          V::store(y + i, V::mul(V::sub(V::load(y + i), cy), s));
+          V::store(z + i, V::mul(V::sub(V::load(z + i), cz), s));
+        }
+      }
+
+      template <typename V>
+      void normalize_kernel(const float* x, const float* y, const float* z, size_t n, float* nx, float* ny, float* nz) {
+        typedef typename V::reg reg;
+        for (size_t i = 0; i < n; i += V::width) {
+          reg a = V::load(x + i), b = V::load(y + i), c = V::load(z + i);
+          reg inverse = inverse_length<V>(a, b, c);
+          V::store(nx + i, V::mul(a, inverse));
+          V::store(ny + i, V::mul(b, inverse));
+          V::store(nz + i, V::mul(c, inverse));
+        }
+      }
+
+      template <typename V>
+      void spherical_uv_kernel(const float* x, const float* y, const float* z, size_t n, float* u, float* v) {
+        typedef typename V::reg reg;
+        reg zero = V::splat(0.0f), half = V::splat(0.5f), one = V::splat(1.0f);
+        for (size_t i = 0; i < n; i += V::width) {
+          reg a = V::load(x + i), b = V::load(y + i), c = V::load(z + i);
+          reg ny = V::mul(b, inverse_length<V>(a, b, c));
+          // u = 1 - (0.5 + atan2 / 2pi), with the mirror flip of spherical_uv folded in
+          reg uu = V::sub(half, V::mul(atan2_approx<V>(c, a), V::splat(inverse_two_pi)));
+          // (asin + pi/2) / pi rather than 0.5 + asin / pi: nothing for FMA to
+          // fuse, so v lands exactly on 0 and 1 at the poles at every level
+          reg vv = V::mul(V::add(asin_approx<V>(ny), V::splat(half_pi)), V::splat(inverse_pi));
+          V::store(u + i, V::min(V::max(uu, zero), one));
+          V::store(v + i, V::min(V::max(vv, zero), one));
+        }
+      }
+
+      template <typename V>
+      kernel_table make_kernel_table() {
+        kernel_table table;
+        table.width = V::width;
+        table.bounds = bounds_kernel<V>;
+        table.affine = affine_kernel<V>;
+        table.normalize = normalize_kernel<V>;
+        table.spherical_uv = spherical_uv_kernel<V>;
+        return table;
+      }
+
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,530 @@
+#include "nbody.h"
+
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+
+#include <common/parallel.hpp>
+
+#include "mesh_simd.h"
+#include "nbody_kernels.h"
+
+namespace nbody {
+
+  namespace {
+
+    using kernel_detail::kernel_table;
+    using kernel_detail::source_list;
+    using kernel_detail::source_padding;
+
+    // Morton codes interleave this many bits per axis, which also bounds the tree depth
+    const int max_level = 21;
+    // Deepest possible traversal: every level leaves at most seven siblings on the stack
+    const int stack_size = 7 * max_level + 8;
+    // Particle loops run on several threads from two chunks of this size up
+    const size_t parallel_chunk = 1 << 14;
+    // Runs sorted on threads of their own
+    const size_t parallel_sort = 1 << 16;
+    // Trees this large build their lower levels through parallelFor, in
+    // subtrees of at most a sixteenth of a thread's share of the particles
+    // and at least this many, so that the threads finish close together
+    const size_t parallel_subtree = 1 << 12;
+    // Groups (tree) or targets (direct) per chunk of the force loop
+    const size_t parallel_groups = 16;
+    const size_t direct_group = 64;
+    // Padding sources sit this far away with no mass, so they pull with exactly 0
+    const float pad_distance = 1e18f;
+
+    const kernel_table& scalar_kernels() {
+      static const kernel_table table = kernel_detail::make_kernel_table<mesh::simd_detail::f32x1>();
+      return table;
+    }
+
+    const kernel_table* sse2_kernels() {
+#ifdef MESH_SIMD_SSE2
+      static const kernel_table table = kernel_detail::make_kernel_table<mesh::simd_detail::f32x4>();
+      return &table;
+#else
+      return nullptr;
+#endif
+    }
+
+    // Follows the level the mesh kernels run at (mesh::set_simd_level)
+    const kernel_table& active() {
+      return mesh::simd_select(scalar_kernels(), sse2_kernels(), kernel_detail::avx2_kernels());
+    }
+
+    // f(begin, end) over [0, count), on several threads if there is enough
+    // work; small counts skip parallelFor, which asks the system for the
+    // thread count every time.
+    template <typename F>
+    void for_chunks(size_t count, size_t chunk, F f) {
+      if (count >= 2 * chunk) parallelFor(count, chunk, f);
+      else f(size_t(0), count);
+    }
+
+    // The 21 low bits of v, spread to every third bit
+    uint64_t spread_bits(uint32_t v) {
+      uint64_t x = v & 0x1fffff;
+      x = (x | x << 32) & 0x1f00000000ffffull;
+      x = (x | x << 16) & 0x1f0000ff0000ffull;
+      x = (x | x << 8) & 0x100f00f00f00f00full;
+      x = (x | x << 4) & 0x10c30c30c30c30c3ull;
+      x = (x | x << 2) & 0x1249249249249249ull;
+      return x;
+    }
+
+    struct keyed {
+      uint64_t code;
+      uint32_t index;
+
+      bool operator<(const keyed& other) const {
+        return code < other.code || (code == other.code && index < other.index);
+      }
+    };
+
+    // Sorts runs of keys on their own threads, then merges pairs of runs
+    // in rounds, every merge of a round on its own thread
+    void sort_keys(std::vector<keyed>& keys, std::vector<keyed>& scratch) {
+      size_t n = keys.size();
+      size_t runs = n >= 2 * parallel_sort ? std::min<size_t>(workerThreadCount(), n / parallel_sort) : 1;
+      if (runs <= 1) {
+        std::sort(keys.begin(), keys.end());
+        return;
+      }
+      auto bound = [&](size_t run) { return n * std::min(run, runs) / runs; };
+      parallelFor(runs, 1, [&](size_t begin, size_t end) {
+        for (size_t r = begin; r < end; r++) std::sort(keys.begin() + bound(r), keys.begin() + bound(r + 1));
+      });
+      scratch.resize(n);
+      for (size_t width = 1; width < runs; width *= 2) {
+        size_t merges = (runs + 2 * width - 1) / (2 * width);
+        parallelFor(merges, 1, [&](size_t begin, size_t end) {
+          for (size_t m = begin; m < end; m++) {
+            size_t lo = bound(2 * m * width), mid = bound((2 * m + 1) * width), hi = bound((2 * m + 2) * width);
+            std::merge(keys.begin() + lo, keys.begin() + mid, keys.begin() + mid, keys.begin() + hi,
+                       scratch.begin() + lo);
+          }
+        });
+        keys.swap(scratch);
+      }
+    }
+
+    // Octree over particles sorted by Morton code: the particles of a cell
+    // are a contiguous range, and its children split that range where the
+    // next three bits of the code change.
+    class tree_builder {
+    public:
+      tree_builder(const std::vector<keyed>& keys, const float* x, const float* y, const float* z, const float* m,
+                   size_t leaf_size, float theta)
+        : keys_(keys), x_(x), y_(y), z_(z), m_(m), leaf_size_(std::max<size_t>(leaf_size, 1)),
+          // A cell is opened within size / theta of its centre of mass, and at
+          // least within its diagonal, so that it never stands in for a
+          // group of particles inside it
+          open_factor_(std::max(1.0f / std::max(theta, 1e-6f), 1.7320508f)), deferred_size_(0) {}
+
+      // Builds the tree over [0, count) with a root cell of side size into
+      // nodes. Large trees are built top down on this thread until cells are
+      // small enough, then those subtrees go through parallelFor, each into a
+      // vector of its own, and are spliced in after the top.
+      void build(std::vector<octree_node>& nodes, uint32_t count, float size) {
+        nodes.assign(1, octree_node());
+        size_t threads = workerThreadCount();
+        if (threads == 1 || count < 2 * parallel_subtree) {
+          build(nodes, 0, 0, count, 0, size, nullptr);
+          return;
+        }
+        std::vector<subtree> deferred;
+        deferred_size_ = std::max<size_t>(count / (16 * threads), parallel_subtree);
+        build(nodes, 0, 0, count, 0, size, &deferred);
+
+        // Subtrees are whole particle ranges in Morton order; split the
+        // particles evenly and let each thread build the subtrees that start
+        // in its part
+        std::vector<std::vector<octree_node>> built(deferred.size());
+        parallelFor(count, deferred_size_, [&](size_t begin, size_t end) {
+          auto t = std::lower_bound(deferred.begin(), deferred.end(), begin,
+                                    [](const subtree& s, size_t first) { return s.begin < first; });
+          for (; t != deferred.end() && t->begin < end; ++t) {
+            std::vector<octree_node>& tree = built[t - deferred.begin()];
+            tree.resize(1);
+            build(tree, 0, t->begin, t->end, t->level, t->size, nullptr);
+          }
+        });
+
+        size_t top = nodes.size();
+        for (size_t t = 0; t < deferred.size(); t++) {
+          // The subtree's root takes its slot, its other nodes move to the end
+          uint32_t base = (uint32_t)nodes.size() - 1;
+          for (octree_node& node : built[t])
+            if (node.children) node.first += base;
+          nodes[deferred[t].node] = built[t][0];
+          nodes.insert(nodes.end(), built[t].begin() + 1, built[t].end());
+        }
+        // Children come after their parent, so the top's centres of mass
+        // can be redone back to front
+        for (size_t i = top; i-- > 0;)
+          if (nodes[i].children) summarize(nodes, (uint32_t)i);
+      }
+
+    private:
+      // A cell whose subtree is left to the parallel part of build(); its
+      // node is filled in when the subtree is spliced in
+      struct subtree {
+        uint32_t node;
+        uint32_t begin;
+        uint32_t end;
+        int level;
+        float size;
+      };
+
+      // Builds the cell of side size over [begin, end) into nodes[node]; its descendants are appended to nodes.
+      // With deferred, children of at most deferred_size_ particles are only recorded there.
+      void build(std::vector<octree_node>& nodes, uint32_t node, uint32_t begin, uint32_t end, int level, float size,
+                 std::vector<subtree>* deferred) {
+        float open = open_factor_ * size;
+        if (end - begin <= leaf_size_ || level == max_level) {
+          glm::vec3 weighted(0.0f), sum(0.0f);
+          float mass = 0.0f;
+          for (uint32_t i = begin; i < end; i++) {
+            glm::vec3 p(x_[i], y_[i], z_[i]);
+            weighted += m_[i] * p;
+            sum += p;
+            mass += m_[i];
+          }
+          // Massless test particles still need a place for the opening test
+          glm::vec3 center = mass > 0.0f ? weighted / mass : sum / (float)(end - begin);
+          nodes[node] = octree_node{ center, mass, open * open, begin, end - begin, 0 };
+          return;
+        }
+
+        // Children: where the code's three bits below this level change
+        int shift = 3 * (max_level - 1 - level);
+        uint32_t bounds[9];
+        bounds[0] = begin;
+        for (uint32_t octant = 0; octant < 8; octant++) {
+          bounds[octant + 1] = (uint32_t)(std::partition_point(keys_.begin() + bounds[octant], keys_.begin() + end,
+                                                               [&](const keyed& k) {
+                                                                 return ((k.code >> shift) & 7) <= octant;
+                                                               }) -
+                                          keys_.begin());
+        }
+        uint32_t ranges[8][2];
+        uint32_t children = 0;
+        for (int octant = 0; octant < 8; octant++) {
+          if (bounds[octant] == bounds[octant + 1]) continue;
+          ranges[children][0] = bounds[octant];
+          ranges[children][1] = bounds[octant + 1];
+          children++;
+        }
+
+        uint32_t first = (uint32_t)nodes.size();
+        nodes.resize(nodes.size() + children);
+        nodes[node] = octree_node{ glm::vec3(0.0f), 0.0f, open * open, first, end - begin, children };
+        for (uint32_t c = 0; c < children; c++) {
+          uint32_t b = ranges[c][0], e = ranges[c][1];
+          if (deferred && e - b <= deferred_size_) deferred->push_back(subtree{ first + c, b, e, level + 1, 0.5f * size });
+          else build(nodes, first + c, b, e, level + 1, 0.5f * size, deferred);
+        }
+        // With deferred children this is redone once they are built
+        summarize(nodes, node);
+      }
+
+      // Centre of mass and mass of an inner node from its children
+      void summarize(std::vector<octree_node>& nodes, uint32_t node) const {
+        octree_node& cell = nodes[node];
+        glm::vec3 weighted(0.0f), sum(0.0f);
+        float mass = 0.0f;
+        for (uint32_t c = 0; c < cell.children; c++) {
+          const octree_node& child = nodes[cell.first + c];
+          weighted += child.mass * child.center_of_mass;
+          sum += (float)child.count * child.center_of_mass;
+          mass += child.mass;
+        }
+        cell.center_of_mass = mass > 0.0f ? weighted / mass : sum / (float)cell.count;
+        cell.mass = mass;
+      }
+
+      const std::vector<keyed>& keys_;
+      const float* x_;
+      const float* y_;
+      const float* z_;
+      const float* m_;
+      size_t leaf_size_;
+      float open_factor_;
+      size_t deferred_size_;
+    };
+
+    // Sources of one group, padded for the kernels. Grows by hand: the
+    // traversal adds to it in its innermost loop.
+    class interaction_list {
+    public:
+      interaction_list() : count_(0) {}
+
+      void clear() { count_ = 0; }
+      void add(float px, float py, float pz, float pm) {
+        make_room(1);
+        x_[count_] = px;
+        y_[count_] = py;
+        z_[count_] = pz;
+        m_[count_] = pm;
+        count_++;
+      }
+      void add(const float* px, const float* py, const float* pz, const float* pm, size_t n) {
+        make_room(n);
+        std::copy(px, px + n, &x_[count_]);
+        std::copy(py, py + n, &y_[count_]);
+        std::copy(pz, pz + n, &z_[count_]);
+        std::copy(pm, pm + n, &m_[count_]);
+        count_ += n;
+      }
+      size_t pad() {
+        while (count_ % source_padding) add(pad_distance, pad_distance, pad_distance, 0.0f);
+        return count_;
+      }
+      source_list sources() const { return source_list{ x_.data(), y_.data(), z_.data(), m_.data() }; }
+
+    private:
+      void make_room(size_t n) {
+        if (count_ + n <= m_.size()) return;
+        size_t capacity = std::max<size_t>(2 * (count_ + n), 1024);
+        x_.resize(capacity);
+        y_.resize(capacity);
+        z_.resize(capacity);
+        m_.resize(capacity);
+      }
+
+      std::vector<float> x_, y_, z_, m_;
+      size_t count_;
+    };
+
+  }
+
+  particle_system::particle_system(const options& settings) : options_(settings), accelerations_valid_(false) {}
+
+  size_t particle_system::add(const glm::dvec3& position, const glm::dvec3& velocity, float mass) {
+    size_t index = size();
+    x_.push_back(position.x);
+    y_.push_back(position.y);
+    z_.push_back(position.z);
+    vx_.push_back(velocity.x);
+    vy_.push_back(velocity.y);
+    vz_.push_back(velocity.z);
+    ax_.push_back(0.0f);
+    ay_.push_back(0.0f);
+    az_.push_back(0.0f);
+    m_.push_back(mass);
+    accelerations_valid_ = false;
+    return index;
+  }
+
+  void particle_system::clear() {
+    *this = particle_system(options_);
+  }
+
+  void particle_system::set_options(const options& settings) {
+    options_ = settings;
+    accelerations_valid_ = false;
+  }
+
+  void particle_system::step(double dt) {
+    if (!accelerations_valid_) compute_accelerations();
+    double half = 0.5 * dt;
+    for_chunks(size(), parallel_chunk, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) {
+        vx_[i] += half * ax_[i];
+        vy_[i] += half * ay_[i];
+        vz_[i] += half * az_[i];
+        x_[i] += dt * vx_[i];
+        y_[i] += dt * vy_[i];
+        z_[i] += dt * vz_[i];
+      }
+    });
+    compute_accelerations();
+    for_chunks(size(), parallel_chunk, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) {
+        vx_[i] += half * ax_[i];
+        vy_[i] += half * ay_[i];
+        vz_[i] += half * az_[i];
+      }
+    });
+  }
+
+  void particle_system::compute_accelerations() {
+    if (size() > 0) {
+      if (options_.direct) {
+        nodes_.clear();
+        order_.clear();
+        direct_accelerations();
+      } else {
+        build_tree();
+        tree_accelerations();
+      }
+    }
+    accelerations_valid_ = true;
+  }
+
+  void particle_system::build_tree() {
+    size_t n = size();
+
+    // Bounding cube
+    glm::dvec3 lo(INFINITY), hi(-INFINITY);
+    std::mutex merge;
+    for_chunks(n, parallel_chunk, [&](size_t begin, size_t end) {
+      glm::dvec3 l(INFINITY), h(-INFINITY);
+      for (size_t i = begin; i < end; i++) {
+        l.x = std::min(l.x, x_[i]); h.x = std::max(h.x, x_[i]);
+        l.y = std::min(l.y, y_[i]); h.y = std::max(h.y, y_[i]);
+        l.z = std::min(l.z, z_[i]); h.z = std::max(h.z, z_[i]);
+      }
+      std::lock_guard<std::mutex> lock(merge);
+      lo = glm::dvec3(std::min(lo.x, l.x), std::min(lo.y, l.y), std::min(lo.z, l.z));
+      hi = glm::dvec3(std::max(hi.x, h.x), std::max(hi.y, h.y), std::max(hi.z, h.z));
+    });
+    double size = std::max(std::max(hi.x - lo.x, hi.y - lo.y), hi.z - lo.z);
+    size = size > 0.0 ? size * 1.000001 : 1.0;
+    origin_ = lo;
+
+    // Morton order
+    const uint32_t cells = 1u << max_level;
+    double scale = cells / size;
+    std::vector<keyed> keys(n), scratch;
+    for_chunks(n, parallel_chunk, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) {
+        uint32_t qx = std::min((uint32_t)((x_[i] - lo.x) * scale), cells - 1);
+        uint32_t qy = std::min((uint32_t)((y_[i] - lo.y) * scale), cells - 1);
+        uint32_t qz = std::min((uint32_t)((z_[i] - lo.z) * scale), cells - 1);
+        keys[i] = keyed{ spread_bits(qx) << 2 | spread_bits(qy) << 1 | spread_bits(qz), (uint32_t)i };
+      }
+    });
+    sort_keys(keys, scratch);
+
+    order_.resize(n);
+    sx_.resize(n);
+    sy_.resize(n);
+    sz_.resize(n);
+    sm_.resize(n);
+    for_chunks(n, parallel_chunk, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) {
+        uint32_t p = keys[i].index;
+        order_[i] = p;
+        sx_[i] = (float)(x_[p] - lo.x);
+        sy_[i] = (float)(y_[p] - lo.y);
+        sz_[i] = (float)(z_[p] - lo.z);
+        sm_[i] = m_[p];
+      }
+    });
+
+    tree_builder builder(keys, sx_.data(), sy_.data(), sz_.data(), sm_.data(), options_.leaf_size, options_.theta);
+    builder.build(nodes_, (uint32_t)n, (float)size);
+
+    groups_.clear();
+    collect_groups(0, 0);
+  }
+
+  void particle_system::collect_groups(uint32_t node, uint32_t first) {
+    const octree_node& cell = nodes_[node];
+    if (cell.children == 0 || cell.count <= options_.group_size) {
+      groups_.push_back(particle_range{ first, cell.count });
+      return;
+    }
+    // Children hold consecutive ranges of their parent's particles
+    for (uint32_t child = cell.first; child < cell.first + cell.children; child++) {
+      collect_groups(child, first);
+      first += nodes_[child].count;
+    }
+  }
+
+  void particle_system::tree_accelerations() {
+    const kernel_table& k = active();
+    float softening2 = options_.softening * options_.softening;
+    float g = options_.gravity;
+
+    // Per group, the cells far enough from all of its particles count as
+    // point masses; the particles of the leaves that are not are summed one
+    // by one
+    for_chunks(groups_.size(), parallel_groups, [&](size_t begin, size_t end) {
+      interaction_list list;
+      std::vector<float> gx, gy, gz;
+      uint32_t stack[stack_size];
+      for (size_t group = begin; group < end; group++) {
+        uint32_t first = groups_[group].first, count = groups_[group].count;
+        glm::vec3 lo(INFINITY), hi(-INFINITY);
+        for (uint32_t i = first; i < first + count; i++) {
+          lo = glm::vec3(std::min(lo.x, sx_[i]), std::min(lo.y, sy_[i]), std::min(lo.z, sz_[i]));
+          hi = glm::vec3(std::max(hi.x, sx_[i]), std::max(hi.y, sy_[i]), std::max(hi.z, sz_[i]));
+        }
+
+        list.clear();
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+          const octree_node& cell = nodes_[stack[--top]];
+          const glm::vec3& c = cell.center_of_mass;
+          // Squared distance from the centre of mass to the group's box
+          float dx = std::max(std::max(lo.x - c.x, c.x - hi.x), 0.0f);
+          float dy = std::max(std::max(lo.y - c.y, c.y - hi.y), 0.0f);
+          float dz = std::max(std::max(lo.z - c.z, c.z - hi.z), 0.0f);
+          if (dx * dx + dy * dy + dz * dz > cell.open_distance2) {
+            list.add(c.x, c.y, c.z, cell.mass);
+          } else if (cell.children == 0) {
+            list.add(&sx_[cell.first], &sy_[cell.first], &sz_[cell.first], &sm_[cell.first], cell.count);
+          } else {
+            for (uint32_t child = 0; child < cell.children; child++) stack[top++] = cell.first + child;
+          }
+        }
+
+        size_t sources = list.pad();
+        gx.resize(count);
+        gy.resize(count);
+        gz.resize(count);
+        k.accelerate(list.sources(), sources, &sx_[first], &sy_[first], &sz_[first], count, softening2, gx.data(),
+                     gy.data(), gz.data());
+        for (uint32_t i = 0; i < count; i++) {
+          uint32_t p = order_[first + i];
+          ax_[p] = g * gx[i];
+          ay_[p] = g * gy[i];
+          az_[p] = g * gz[i];
+        }
+      }
+    });
+  }
+
+  void particle_system::direct_accelerations() {
+    const kernel_table& k = active();
+    size_t n = size();
+    size_t padded = (n + source_padding - 1) / source_padding * source_padding;
+    origin_ = position(0);
+    sx_.resize(n);
+    sy_.resize(n);
+    sz_.resize(n);
+    for (size_t i = 0; i < n; i++) {
+      sx_[i] = (float)(x_[i] - origin_.x);
+      sy_[i] = (float)(y_[i] - origin_.y);
+      sz_[i] = (float)(z_[i] - origin_.z);
+    }
+    sm_.assign(m_.begin(), m_.end());
+    sx_.resize(padded, pad_distance);
+    sy_.resize(padded, pad_distance);
+    sz_.resize(padded, pad_distance);
+    sm_.resize(padded, 0.0f);
+
+    source_list all = { sx_.data(), sy_.data(), sz_.data(), sm_.data() };
+    float softening2 = options_.softening * options_.softening;
+    float g = options_.gravity;
+    size_t groups = (n + direct_group - 1) / direct_group;
+    for_chunks(groups, 1, [&](size_t begin, size_t end) {
+      for (size_t group = begin; group < end; group++) {
+        size_t first = group * direct_group, count = std::min(direct_group, n - first);
+        k.accelerate(all, padded, &sx_[first], &sy_[first], &sz_[first], count, softening2, &ax_[first], &ay_[first],
+                     &az_[first]);
+        for (size_t i = first; i < first + count; i++) {
+          ax_[i] *= g;
+          ay_[i] *= g;
+          az_[i] *= g;
+        }
+      }
+    });
+  }
+
+}
@@ -0,0 +1,104 @@
+#ifndef NBODY_H
+#define NBODY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Gravitational N-body simulation with a Barnes-Hut octree. Particles are
+// stored as structure of arrays, integrated with kick-drift-kick leapfrog
+// (symplectic, so energy errors stay bounded over long runs) and pulled by
+// forces from the SIMD kernels of mesh_simd.h (same level selection).
+// Positions and velocities are double, so that a system can sit anywhere in
+// a real-scale scene; forces are summed in float, relative to an origin near
+// the particles. Needs no OpenGL; the playground only reads the positions back.
+namespace nbody {
+
+  struct options {
+    float theta;       // opening angle: a cell of side s seen from distance d counts as one mass when s / d < theta
+    float softening;   // Plummer softening length, keeps close encounters finite; 0 for none
+    float gravity;     // gravitational constant in the caller's units
+    size_t leaf_size;  // most particles in an octree leaf
+    size_t group_size; // particles of a cell up to this size share one walk of the tree and one interaction list
+    bool direct;       // sum over all pairs instead of the tree, O(n^2); the reference for validation
+
+    options() : theta(0.5f), softening(0.0f), gravity(1.0f), leaf_size(16), group_size(128), direct(false) {}
+  };
+
+  // Octree node over a range of particles in Morton order. The children of
+  // an inner node are adjacent.
+  struct octree_node {
+    glm::vec3 center_of_mass;
+    float mass;
+    float open_distance2;  // squared distance to the centre of mass within which the cell must be opened
+    uint32_t first;        // leaf: first particle in Morton order; inner node: first child
+    uint32_t count;        // particles under the node
+    uint32_t children;     // 0 for a leaf
+  };
+  static_assert(sizeof(octree_node) == 32, "two nodes per 64 byte cache line");
+
+  class particle_system {
+  public:
+    explicit particle_system(const options& settings = options());
+
+    // Appends a particle and returns its index, which never changes.
+    size_t add(const glm::dvec3& position, const glm::dvec3& velocity, float mass);
+    size_t size() const { return m_.size(); }
+    void clear();
+
+    const options& settings() const { return options_; }
+    void set_options(const options& settings);
+
+    // Advances by dt: half a kick, a drift, new accelerations, half a kick.
+    void step(double dt);
+    // Accelerations at the current positions; step() calls this when needed.
+    // Builds the octree from scratch unless options().direct is set.
+    void compute_accelerations();
+
+    glm::dvec3 position(size_t i) const { return glm::dvec3(x_[i], y_[i], z_[i]); }
+    glm::dvec3 velocity(size_t i) const { return glm::dvec3(vx_[i], vy_[i], vz_[i]); }
+    glm::vec3 acceleration(size_t i) const { return glm::vec3(ax_[i], ay_[i], az_[i]); }
+    float mass(size_t i) const { return m_[i]; }
+    const double* x() const { return x_.data(); }
+    const double* y() const { return y_.data(); }
+    const double* z() const { return z_.data(); }
+
+    // Tree of the last compute_accelerations(), empty in direct mode, with
+    // the particle index of each Morton order slot. Centres of mass are
+    // relative to tree_origin().
+    const std::vector<octree_node>& tree() const { return nodes_; }
+    const glm::dvec3& tree_origin() const { return origin_; }
+    const std::vector<uint32_t>& tree_order() const { return order_; }
+
+  private:
+    struct particle_range {
+      uint32_t first;
+      uint32_t count;
+    };
+
+    void build_tree();
+    void collect_groups(uint32_t node, uint32_t first);
+    void tree_accelerations();
+    void direct_accelerations();
+
+    options options_;
+    bool accelerations_valid_;
+    std::vector<double> x_, y_, z_;
+    std::vector<double> vx_, vy_, vz_;
+    std::vector<float> ax_, ay_, az_;
+    std::vector<float> m_;
+
+    // Positions relative to origin_ and masses, copied out for the kernels:
+    // in Morton order for the tree, padded in direct mode
+    glm::dvec3 origin_;
+    std::vector<float> sx_, sy_, sz_, sm_;
+    std::vector<uint32_t> order_;
+    std::vector<octree_node> nodes_;
+    std::vector<particle_range> groups_;  // in Morton order
+  };
+
+}
+
+#endif
@@ -0,0 +1,21 @@
+// AVX2/FMA instantiation of the gravity kernel. This unit is compiled with
+// -mavx2 -mfma (/arch:AVX2), and nbody.cpp only calls into it when the mesh
+// kernels run at the AVX2 level, which checks the CPU supports both.
+#include "nbody_kernels.h"
+
+namespace nbody {
+  namespace kernel_detail {
+
+#ifdef MESH_SIMD_AVX2
+    const kernel_table* avx2_kernels() {
+      static const kernel_table table = make_kernel_table<mesh::simd_detail::f32x8>();
+      return &table;
+    }
+#else
+    const kernel_table* avx2_kernels() {
+      return nullptr;
+    }
+#endif
+
+  }
+}
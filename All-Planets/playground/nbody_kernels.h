@@ -0,0 +1,103 @@
+#ifndef NBODY_KERNELS_H
+#define NBODY_KERNELS_H
+
+// Gravity kernel, written against the vector interface of
+// mesh_simd_kernels.h and instantiated per instruction set the same way.
+// Only nbody.cpp and nbody_avx2.cpp include this.
+
+#include <algorithm>
+
+#include "mesh_simd_kernels.h"
+
+namespace nbody {
+  namespace kernel_detail {
+
+    // Source lists are padded to a multiple of this with massless entries
+    const size_t source_padding = 8;
+
+    // Point masses pulling on a group of particles: tree cells and particles
+    struct source_list {
+      const float* x;
+      const float* y;
+      const float* z;
+      const float* m;
+    };
+
+    // Accelerations (without the gravitational constant) of targets points
+    // from the first count sources, count a multiple of source_padding.
+    // Coincident points, the target itself among them, add nothing when
+    // there is no softening.
+    struct kernel_table {
+      size_t width;
+      void (*accelerate)(const source_list& sources, size_t count, const float* tx, const float* ty, const float* tz,
+                         size_t targets, float softening2, float* ax, float* ay, float* az);
+    };
+
+    // Defined in nbody_avx2.cpp; null when that unit was built without AVX2.
+    const kernel_table* avx2_kernels();
+
+    namespace {
+
+      template <typename V>
+      float sum_lanes(typename V::reg a) {
+        float lanes[source_padding];
+        V::store(lanes, a);
+        float sum = 0.0f;
+        for (size_t k = 0; k < V::width; k++) sum += lanes[k];
+        return sum;
+      }
+
+      template <typename V>
+      void pull(typename V::reg sx, typename V::reg sy, typename V::reg sz, typename V::reg sm, typename V::reg x,
+                typename V::reg y, typename V::reg z, typename V::reg softening2, typename V::reg& ax,
+                typename V::reg& ay, typename V::reg& az) {
+        typedef typename V::reg reg;
+        reg zero = V::splat(0.0f);
+        reg dx = V::sub(sx, x), dy = V::sub(sy, y), dz = V::sub(sz, z);
+        reg r2 = V::madd(dx, dx, V::madd(dy, dy, V::madd(dz, dz, softening2)));
+        // m / r^3, or nothing at r = 0
+        reg w = V::select(V::greater(r2, zero), V::div(sm, V::mul(r2, V::sqrt(r2))), zero);
+        ax = V::madd(dx, w, ax);
+        ay = V::madd(dy, w, ay);
+        az = V::madd(dz, w, az);
+      }
+
+      template <typename V>
+      void accelerate_kernel(const source_list& sources, size_t count, const float* tx, const float* ty, const float* tz,
+                             size_t targets, float softening2, float* ax, float* ay, float* az) {
+        typedef typename V::reg reg;
+        reg eps2 = V::splat(softening2);
+        // Two targets per pass share the source loads; an odd last one is done twice
+        for (size_t t = 0; t < targets; t += 2) {
+          size_t u = std::min(t + 1, targets - 1);
+          reg x0 = V::splat(tx[t]), y0 = V::splat(ty[t]), z0 = V::splat(tz[t]);
+          reg x1 = V::splat(tx[u]), y1 = V::splat(ty[u]), z1 = V::splat(tz[u]);
+          reg a0x = V::splat(0.0f), a0y = a0x, a0z = a0x, a1x = a0x, a1y = a0x, a1z = a0x;
+          for (size_t j = 0; j < count; j += V::width) {
+            reg sx = V::load(sources.x + j), sy = V::load(sources.y + j), sz = V::load(sources.z + j);
+            reg sm = V::load(sources.m + j);
+            pull<V>(sx, sy, sz, sm, x0, y0, z0, eps2, a0x, a0y, a0z);
+            pull<V>(sx, sy, sz, sm, x1, y1, z1, eps2, a1x, a1y, a1z);
+          }
+          ax[t] = sum_lanes<V>(a0x);
+          ay[t] = sum_lanes<V>(a0y);
+          az[t] = sum_lanes<V>(a0z);
+          ax[u] = sum_lanes<V>(a1x);
+          ay[u] = sum_lanes<V>(a1y);
+          az[u] = sum_lanes<V>(a1z);
+        }
+      }
+
+      template <typename V>
+      kernel_table make_kernel_table() {
+        kernel_table table;
+        table.width = V::width;
+        table.accelerate = accelerate_kernel<V>;
+        return table;
+      }
+
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,155 @@
+#include "orbit.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <common/parallel.hpp>
+
+#include "mesh_simd.h"
+#include "orbit_kernels.h"
+
+namespace orbit {
+
+  namespace {
+
+    using kernel_detail::kernel_table;
+
+    const double two_pi = 6.283185307179586;
+    // The kernels take float days since the epoch; past this many the
+    // phases move to a new epoch, before float rounding of dt shows
+    const double rebase_days = 256.0;
+    // Bodies per thread; fewer than two chunks run on the calling thread
+    const size_t parallel_chunk = 1 << 15;
+
+    const kernel_table& scalar_kernels() {
+      static const kernel_table table = kernel_detail::make_kernel_table<mesh::simd_detail::f32x1>();
+      return table;
+    }
+
+    const kernel_table* sse2_kernels() {
+#ifdef MESH_SIMD_SSE2
+      static const kernel_table table = kernel_detail::make_kernel_table<mesh::simd_detail::f32x4>();
+      return &table;
+#else
+      return nullptr;
+#endif
+    }
+
+    // Follows the level the mesh kernels run at (mesh::set_simd_level)
+    const kernel_table& active() {
+      return mesh::simd_select(scalar_kernels(), sse2_kernels(), kernel_detail::avx2_kernels());
+    }
+
+    // Revolutions to [-0.5, 0.5)
+    float wrap(double turns) {
+      return (float)(turns - std::floor(turns + 0.5));
+    }
+
+  }
+
+  size_t body_table::add(const elements& body) {
+    size_t index = size();
+    parent_.push_back(body.parent >= 0 && (size_t)body.parent < index ? body.parent : -1);
+
+    double rate = body.period > 0.0f ? 1.0 / body.period : 0.0;
+    turns_.push_back(body.mean_anomaly / two_pi);
+    exact_rate_.push_back(rate);
+    phase_.push_back(wrap(turns_.back() + rate * epoch_));
+    rate_.push_back((float)rate);
+
+    float e = std::min(std::max(body.eccentricity, 0.0f), max_eccentricity);
+    e_.push_back(e);
+    a_.push_back(body.semi_major_axis);
+    b_.push_back(body.semi_major_axis * std::sqrt(1.0f - e * e));
+
+    // Perifocal basis in the usual frame, with z the reference normal,
+    // then turned so that z becomes the scene's y: (x, y, z) -> (x, z, -y)
+    double ci = std::cos(body.inclination), si = std::sin(body.inclination);
+    double cn = std::cos(body.ascending_node), sn = std::sin(body.ascending_node);
+    double cw = std::cos(body.argument_of_periapsis), sw = std::sin(body.argument_of_periapsis);
+    glm::dvec3 p(cn * cw - sn * sw * ci, sn * cw + cn * sw * ci, sw * si);
+    glm::dvec3 q(-cn * sw - sn * cw * ci, -sn * sw + cn * cw * ci, cw * si);
+    px_.push_back((float)p.x); py_.push_back((float)p.z); pz_.push_back((float)-p.y);
+    qx_.push_back((float)q.x); qy_.push_back((float)q.z); qz_.push_back((float)-q.y);
+
+    x_.push_back(0.0f);
+    y_.push_back(0.0f);
+    z_.push_back(0.0f);
+    wx_.push_back(0.0);
+    wy_.push_back(0.0);
+    wz_.push_back(0.0);
+    return index;
+  }
+
+  void body_table::clear() {
+    *this = body_table();
+  }
+
+  void body_table::rebase(double t) {
+    for (size_t i = 0; i < size(); i++)
+      phase_[i] = wrap(turns_[i] + exact_rate_[i] * t);
+    epoch_ = t;
+  }
+
+  void body_table::propagate(double t) {
+    if (std::abs(t - epoch_) > rebase_days) rebase(t);
+    float dt = (float)(t - epoch_);
+
+    kernel_detail::orbit_arrays in = { phase_.data(), rate_.data(), e_.data(), a_.data(), b_.data(),
+                                       px_.data(), py_.data(), pz_.data(), qx_.data(), qy_.data(), qz_.data() };
+    const kernel_table& k = active();
+    size_t n = size();
+    size_t body = n - n % k.width;
+    if (body >= 2 * parallel_chunk) {
+      parallelFor(body / k.width, parallel_chunk / k.width, [&](size_t begin, size_t end) {
+        k.propagate(in, begin * k.width, end * k.width, dt, x_.data(), y_.data(), z_.data());
+      });
+    } else {
+      k.propagate(in, 0, body, dt, x_.data(), y_.data(), z_.data());
+    }
+    scalar_kernels().propagate(in, body, n, dt, x_.data(), y_.data(), z_.data());
+    wx_.assign(x_.begin(), x_.end());
+    wy_.assign(y_.begin(), y_.end());
+    wz_.assign(z_.begin(), z_.end());
+    add_parents();
+  }
+
+  void body_table::propagate_exact(double t) {
+    for (size_t i = 0; i < size(); i++) {
+      double e = e_[i];
+      double big_e = solve_kepler(two_pi * (turns_[i] + exact_rate_[i] * t), e);
+      double u = a_[i] * (std::cos(big_e) - e);
+      double v = b_[i] * std::sin(big_e);
+      wx_[i] = px_[i] * u + qx_[i] * v;
+      wy_[i] = py_[i] * u + qy_[i] * v;
+      wz_[i] = pz_[i] * u + qz_[i] * v;
+      x_[i] = (float)wx_[i];
+      y_[i] = (float)wy_[i];
+      z_[i] = (float)wz_[i];
+    }
+    add_parents();
+  }
+
+  // Parents come first, so one pass in order turns offsets into positions
+  void body_table::add_parents() {
+    for (size_t i = 0; i < size(); i++) {
+      int32_t parent = parent_[i];
+      if (parent < 0) continue;
+      wx_[i] += wx_[parent];
+      wy_[i] += wy_[parent];
+      wz_[i] += wz_[parent];
+    }
+  }
+
+  double solve_kepler(double mean_anomaly, double e) {
+    double m = mean_anomaly - two_pi * std::floor(mean_anomaly / two_pi + 0.5);
+    double big_e = e < 0.8 ? m : (m < 0.0 ? -3.141592653589793 : 3.141592653589793);
+    for (int i = 0; i < 64; i++) {
+      double d = (big_e - e * std::sin(big_e) - m) / (1.0 - e * std::cos(big_e));
+      big_e -= d;
+      if (std::abs(d) < 1e-15) break;
+    }
+    return big_e;
+  }
+
+}
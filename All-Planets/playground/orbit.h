@@ -0,0 +1,86 @@
+#ifndef ORBIT_H
+#define ORBIT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Keplerian orbits for any number of bodies, stored as structure of arrays
+// and propagated with the SIMD kernels of mesh_simd.h (same level
+// selection). Every body moves on a fixed ellipse around its parent; there
+// is no interaction between bodies.
+namespace orbit {
+
+  // Classical orbital elements. Lengths are in scene units, angles in
+  // radians, times in days. The scene's y axis is the normal of an orbit of
+  // inclination 0, and the ascending node is measured from +x; prograde
+  // orbits run from +x towards -z.
+  struct elements {
+    int parent;                   // body orbited, -1 for the origin
+    float semi_major_axis;        // a
+    float eccentricity;           // e, in [0, 1)
+    float inclination;            // i
+    float ascending_node;         // longitude of the ascending node
+    float argument_of_periapsis;  // from the ascending node
+    float mean_anomaly;           // at day 0
+    float period;                 // days per revolution; <= 0 for a body that stays at its periapsis
+  };
+
+  // Eccentricities at or above this are clamped; Kepler's equation turns
+  // ill-conditioned near 1 and float cannot resolve the solution any more.
+  const float max_eccentricity = 0.98f;
+
+  class body_table {
+  public:
+    body_table() : epoch_(0.0) {}
+
+    // Appends a body and returns its index. Its parent must already be in the table.
+    size_t add(const elements& body);
+    size_t size() const { return parent_.size(); }
+    void clear();
+
+    // Positions of every body at day t, solved in float by the SIMD
+    // kernels to about 1e-6 of each orbit's size. Not const: the phases are
+    // rebased to t now and then, which keeps the float arithmetic precise
+    // however long the simulation runs.
+    void propagate(double t);
+    // The same, solved in double on one thread: for the few bodies of a
+    // real-scale scene, where 1e-6 of an orbit is visible up close.
+    void propagate_exact(double t);
+
+    // Scene space position: the offsets of the parent chain added up in double
+    glm::dvec3 position(size_t body) const { return glm::dvec3(wx_[body], wy_[body], wz_[body]); }
+    // Offsets from the parent
+    const float* x() const { return x_.data(); }
+    const float* y() const { return y_.data(); }
+    const float* z() const { return z_.data(); }
+
+  private:
+    void rebase(double t);
+    void add_parents();  // wx_, wy_, wz_ from offsets to positions
+
+    double epoch_;                // day the phases refer to
+    std::vector<int32_t> parent_;
+    std::vector<double> turns_;   // mean anomaly at day 0, in revolutions
+    std::vector<double> exact_rate_;  // revolutions per day
+    std::vector<float> phase_;    // mean anomaly at epoch_, wrapped to [-0.5, 0.5), for the kernels
+    std::vector<float> rate_;
+    std::vector<float> e_;
+    std::vector<float> a_;
+    std::vector<float> b_;        // semi-minor axis
+    std::vector<float> px_, py_, pz_;  // unit vector towards periapsis
+    std::vector<float> qx_, qy_, qz_;  // in the orbit plane, 90 degrees ahead of it
+    std::vector<float> x_, y_, z_;
+    std::vector<double> wx_, wy_, wz_;
+  };
+
+  // Eccentric anomaly E of mean anomaly M (radians) and eccentricity e, by
+  // Newton's method in double precision; the reference the kernels are
+  // checked against.
+  double solve_kepler(double mean_anomaly, double e);
+
+}
+
+#endif
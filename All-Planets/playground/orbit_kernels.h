@@ -0,0 +1,144 @@
+#ifndef ORBIT_KERNELS_H
+#define ORBIT_KERNELS_H
+
+// Kepler propagation kernel, written against the vector interface of
+// mesh_simd_kernels.h and instantiated per instruction set the same way.
+// Only orbit.cpp and orbit_avx2.cpp include this.
+
+#include "mesh_simd_kernels.h"
+
+namespace orbit {
+  namespace kernel_detail {
+
+    // The body_table arrays one call works on
+    struct orbit_arrays {
+      const float* phase;
+      const float* rate;
+      const float* e;
+      const float* a;
+      const float* b;
+      const float* px;
+      const float* py;
+      const float* pz;
+      const float* qx;
+      const float* qy;
+      const float* qz;
+    };
+
+    // Positions relative to the parent of bodies [begin, end) at dt days
+    // after the epoch; end - begin must be a multiple of width.
+    struct kernel_table {
+      size_t width;
+      void (*propagate)(const orbit_arrays& in, size_t begin, size_t end, float dt, float* x, float* y, float* z);
+    };
+
+    // Defined in orbit_avx2.cpp; null when that unit was built without AVX2.
+    const kernel_table* avx2_kernels();
+
+    namespace {
+
+      const float two_pi = 6.28318530717959f;
+      const float two_over_pi = 0.636619772367581f;
+      // pi / 2 split in two, so that x - q * pi / 2 loses no bits (Cody-Waite)
+      const float half_pi_hi = 1.57079637050628662f;
+      const float half_pi_lo = -4.37113900018624283e-8f;
+      // Adding and subtracting this rounds to the nearest integer, for |x| < 2^22
+      const float round_magic = 12582912.0f;
+
+      // sin/cos on [-pi/4, pi/4], minimax (Cephes sinf/cosf)
+      const float sin_c1 = -1.6666654611e-1f;
+      const float sin_c2 = 8.3321608736e-3f;
+      const float sin_c3 = -1.9515295891e-4f;
+      const float cos_c1 = 4.166664568298827e-2f;
+      const float cos_c2 = -1.388731625493765e-3f;
+      const float cos_c3 = 2.443315711809948e-5f;
+
+      template <typename V>
+      typename V::reg round_nearest(typename V::reg x) {
+        return V::sub(V::add(x, V::splat(round_magic)), V::splat(round_magic));
+      }
+
+      // sin and cos of x, |x| up to a few thousand, to about 1e-7
+      template <typename V>
+      void sincos_approx(typename V::reg x, typename V::reg& s, typename V::reg& c) {
+        typedef typename V::reg reg;
+        reg zero = V::splat(0.0f);
+        reg q = round_nearest<V>(V::mul(x, V::splat(two_over_pi)));
+        reg r = V::sub(V::sub(x, V::mul(q, V::splat(half_pi_hi))), V::mul(q, V::splat(half_pi_lo)));
+        reg r2 = V::mul(r, r);
+        reg sin_r = V::madd(V::mul(r, r2), V::madd(V::madd(V::splat(sin_c3), r2, V::splat(sin_c2)), r2, V::splat(sin_c1)), r);
+        reg cos_r = V::madd(V::mul(r2, r2), V::madd(V::madd(V::splat(cos_c3), r2, V::splat(cos_c2)), r2, V::splat(cos_c1)),
+                            V::madd(V::splat(-0.5f), r2, V::splat(1.0f)));
+        // Quadrant k = q mod 4 in [0, 4), as a float
+        reg k = V::sub(q, V::mul(V::splat(4.0f), round_nearest<V>(V::mul(q, V::splat(0.25f)))));
+        k = V::select(V::less(k, zero), V::add(k, V::splat(4.0f)), k);
+        // Odd quadrants swap sin and cos; sin is negative in 2 and 3, cos in 1 and 2
+        typename V::mask odd = V::less(V::abs(V::sub(V::abs(V::sub(k, V::splat(2.0f))), V::splat(1.0f))), V::splat(0.5f));
+        reg sv = V::select(odd, cos_r, sin_r);
+        reg cv = V::select(odd, sin_r, cos_r);
+        s = V::select(V::greater(k, V::splat(1.5f)), V::sub(zero, sv), sv);
+        c = V::select(V::less(V::abs(V::sub(k, V::splat(1.5f))), V::splat(1.0f)), V::sub(zero, cv), cv);
+      }
+
+      // Halley steps from E = M that solve Kepler's equation to float
+      // precision, by the largest eccentricity in a vector
+      inline int halley_steps(float e) {
+        return e < 0.5f ? 2 : e < 0.9f ? 3 : 4;
+      }
+
+      template <typename V>
+      void propagate_kernel(const orbit_arrays& in, size_t begin, size_t end, float dt, float* x, float* y, float* z) {
+        typedef typename V::reg reg;
+        reg one = V::splat(1.0f), half = V::splat(0.5f);
+        for (size_t i = begin; i < end; i += V::width) {
+          reg e = V::load(in.e + i);
+          // Mean anomaly in [-pi, pi]
+          reg turns = V::madd(V::splat(dt), V::load(in.rate + i), V::load(in.phase + i));
+          reg m = V::mul(V::sub(turns, round_nearest<V>(turns)), V::splat(two_pi));
+
+          // Halley's method on f(E) = E - e sin E - M, starting at E = M
+          float e_lo = 1.0f, e_hi = 0.0f;
+          V::reduce(e, e_lo, e_hi);
+          reg big_e = m, s, c;
+          sincos_approx<V>(m, s, c);
+          for (int step = halley_steps(e_hi);;) {
+            reg f = V::sub(V::sub(big_e, V::mul(e, s)), m);
+            reg f1 = V::sub(one, V::mul(e, c));
+            reg d = V::div(f, V::sub(f1, V::div(V::mul(V::mul(half, f), V::mul(e, s)), f1)));
+            big_e = V::sub(big_e, d);
+            if (--step > 0) {
+              sincos_approx<V>(big_e, s, c);
+              continue;
+            }
+            // The last correction is small: turn sin and cos by it instead of evaluating them again
+            reg d2 = V::mul(d, d);
+            reg sd = V::mul(d, V::madd(d2, V::splat(-1.0f / 6.0f), one));
+            reg cd = V::madd(d2, V::madd(d2, V::splat(1.0f / 24.0f), V::splat(-0.5f)), one);
+            reg turned = V::sub(V::mul(s, cd), V::mul(c, sd));
+            c = V::madd(c, cd, V::mul(s, sd));
+            s = turned;
+            break;
+          }
+
+          // In the orbit plane, then along the periapsis and the 90 degrees ahead directions
+          reg u = V::mul(V::load(in.a + i), V::sub(c, e));
+          reg v = V::mul(V::load(in.b + i), s);
+          V::store(x + i, V::madd(V::load(in.px + i), u, V::mul(V::load(in.qx + i), v)));
+          V::store(y + i, V::madd(V::load(in.py + i), u, V::mul(V::load(in.qy + i), v)));
+          V::store(z + i, V::madd(V::load(in.pz + i), u, V::mul(V::load(in.qz + i), v)));
+        }
+      }
+
+      template <typename V>
+      kernel_table make_kernel_table() {
+        kernel_table table;
+        table.width = V::width;
+        table.propagate = propagate_kernel<V>;
+        return table;
+      }
+
+    }
+  }
+}
+
+#endif
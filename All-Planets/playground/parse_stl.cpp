@@ -1,8 +1,12 @@
+#include <algorithm>
 #include <cassert>
-#include <fstream>
+#include <cctype>
+#include <cstring>
 #include <iostream>
-#include <sstream>
-#include <streambuf>
+#include <utility>
+
+#include <common/parallel.hpp>
+#include <common/text_parse.hpp>
 
 #include "parse_stl.h"
 
@@ -22,45 +26,308 @@ namespace stl {
     return out;
   }
   
-  float parse_float(std::ifstream& s) {
-    char f_buf[sizeof(float)];
-    s.read(f_buf, 4);
-    float* fptr = (float*) f_buf;
-    return *fptr;
+  bool binary_stl_view::open(const std::string& stl_path) {
+    MappedFile file;
+    if (!file.open(stl_path.c_str())) {
+      close();
+      error_ = "could not open " + stl_path;
+      return false;
+    }
+    return open(std::move(file), stl_path);
+  }
+
+  bool binary_stl_view::open(MappedFile&& file, const std::string& stl_path) {
+    close();
+    file_ = std::move(file);
+
+    const size_t header_size = 80 + sizeof(uint32_t);
+    if (file_.size() < header_size) {
+      error_ = stl_path + " is too small to be a binary STL file";
+      file_.close();
+      return false;
+    }
+
+    uint32_t n_triangles;
+    std::memcpy(&n_triangles, file_.data() + 80, sizeof(n_triangles));
+    if ((file_.size() - header_size) / sizeof(record) < n_triangles) {
+      error_ = stl_path + " is truncated: header announces " + std::to_string(n_triangles) +
+        " triangles but the file only holds " + std::to_string((file_.size() - header_size) / sizeof(record));
+      file_.close();
+      return false;
+    }
+
+    records_ = reinterpret_cast<const record*>(file_.data() + header_size);
+    count_ = n_triangles;
+    return true;
+  }
+
+  void binary_stl_view::close() {
+    file_.close();
+    records_ = nullptr;
+    count_ = 0;
+    error_.clear();
+  }
+
+  std::string binary_stl_view::header() const {
+    if (!file_.isOpen()) return std::string();
+    const char* h = reinterpret_cast<const char*>(file_.data());
+    return std::string(h, strnlen(h, 80));
+  }
+
+  triangle binary_stl_view::get(size_t i) const {
+    const record& r = records_[i];
+    return triangle(r.normal, r.v1, r.v2, r.v3);
+  }
+
+  void binary_stl_view::extract(std::vector<triangle>& out, size_t first, size_t count) const {
+    if (first >= count_) return;
+    size_t last = first + std::min(count, count_ - first);
+    out.reserve(out.size() + (last - first));
+    for (size_t i = first; i < last; i++) {
+      const record& r = records_[i];
+      out.push_back(triangle(r.normal, r.v1, r.v2, r.v3));
+    }
+  }
+
+  void binary_stl_view::extract_soa(soa_triangles& out, size_t first, size_t count) const {
+    if (first >= count_) return;
+    size_t n = std::min(count, count_ - first);
+    size_t vbase = out.x.size();
+    size_t nbase = out.nx.size();
+    out.x.resize(vbase + 3 * n);
+    out.y.resize(vbase + 3 * n);
+    out.z.resize(vbase + 3 * n);
+    out.nx.resize(nbase + n);
+    out.ny.resize(nbase + n);
+    out.nz.resize(nbase + n);
+
+    float* x = out.x.data() + vbase;
+    float* y = out.y.data() + vbase;
+    float* z = out.z.data() + vbase;
+    float* nx = out.nx.data() + nbase;
+    float* ny = out.ny.data() + nbase;
+    float* nz = out.nz.data() + nbase;
+    const record* r = records_ + first;
+    for (size_t i = 0; i < n; i++, r++) {
+      nx[i] = r->normal.x; ny[i] = r->normal.y; nz[i] = r->normal.z;
+      x[3 * i + 0] = r->v1.x; y[3 * i + 0] = r->v1.y; z[3 * i + 0] = r->v1.z;
+      x[3 * i + 1] = r->v2.x; y[3 * i + 1] = r->v2.y; z[3 * i + 1] = r->v2.z;
+      x[3 * i + 2] = r->v3.x; y[3 * i + 2] = r->v3.y; z[3 * i + 2] = r->v3.z;
+    }
+  }
+
+  stl_format detect_format(const unsigned char* data, size_t size) {
+    const size_t header_size = 80 + sizeof(uint32_t);
+    if (size >= header_size) {
+      uint32_t n_triangles;
+      std::memcpy(&n_triangles, data + 80, sizeof(n_triangles));
+      if ((size - header_size) / sizeof(record) == n_triangles && (size - header_size) % sizeof(record) == 0)
+        return stl_format::binary;
+    }
+    size_t i = 0;
+    while (i < size && std::isspace(data[i])) i++;
+    if (size - i >= 5 && std::memcmp(data + i, "solid", 5) == 0)
+      return stl_format::ascii;
+    return stl_format::binary;
+  }
+
+  namespace {
+
+    // Minimal tokenizer over [p, end) for the ASCII STL grammar.
+    struct ascii_cursor {
+      const char* p;
+      const char* end;
+
+      void skip_space() {
+        while (p < end && isSpace(*p)) p++;
+      }
+
+      // Returns the next whitespace separated token, or an empty one at the end.
+      std::pair<const char*, size_t> token() {
+        skip_space();
+        const char* start = p;
+        while (p < end && !isSpace(*p)) p++;
+        return std::make_pair(start, (size_t)(p - start));
+      }
+
+      bool number(float& out) {
+        skip_space();
+        return parseFloat(p, end, out);
+      }
+
+      bool point(stl::point& out) {
+        return number(out.x) && number(out.y) && number(out.z);
+      }
+    };
+
+    inline bool token_is(const std::pair<const char*, size_t>& t, const char* word, size_t len) {
+      return t.second == len && std::memcmp(t.first, word, len) == 0;
+    }
+
+    // Parses every facet in [begin, end). Text outside of facets (solid /
+    // endsolid lines, blank lines) is skipped, malformed facets are dropped.
+    void parse_ascii_chunk(const char* begin, const char* end, std::vector<triangle>& out) {
+      // A facet takes about 250 bytes of text, which gives a decent first guess.
+      out.reserve((end - begin) / 200 + 1);
+      ascii_cursor c = { begin, end };
+      point normal;
+      point v[3];
+      int n_vertices = 0;
+      bool in_facet = false;
+      while (c.p < c.end) {
+        auto t = c.token();
+        if (t.second == 0) break;
+        if (token_is(t, "vertex", 6)) {
+          point p;
+          if (!c.point(p)) { in_facet = false; continue; }
+          if (in_facet && n_vertices < 3) v[n_vertices] = p;
+          n_vertices++;
+        } else if (token_is(t, "facet", 5)) {
+          in_facet = true;
+          n_vertices = 0;
+          auto keyword = c.token();
+          if (!token_is(keyword, "normal", 6) || !c.point(normal)) {
+            normal = point();
+            in_facet = false;
+          }
+        } else if (token_is(t, "endfacet", 8)) {
+          if (in_facet && n_vertices == 3)
+            out.push_back(triangle(normal, v[0], v[1], v[2]));
+          in_facet = false;
+        }
+      }
+    }
+
+    // Moves pos forward to the start of the next "facet" keyword (not the
+    // tail of "endfacet"), or to end if there is none.
+    const char* next_facet(const char* pos, const char* begin, const char* end) {
+      static const char keyword[] = "facet";
+      while (pos < end) {
+        const char* hit = std::search(pos, end, keyword, keyword + 5);
+        if (hit == end) return end;
+        bool starts_token = hit == begin || isSpace(hit[-1]);
+        bool ends_token = hit + 5 == end || isSpace(hit[5]);
+        if (starts_token && ends_token) return hit;
+        pos = hit + 5;
+      }
+      return end;
+    }
+
   }
 
-  point parse_point(std::ifstream& s) {
-    float x = parse_float(s);
-    float y = parse_float(s);
-    float z = parse_float(s);
-    return point(x, y, z);
+  stl_data parse_stl_ascii(const char* data, size_t size, unsigned int threads) {
+    const char* end = data + size;
+    ascii_cursor c = { data, end };
+    auto solid = c.token();
+    std::string name;
+    if (token_is(solid, "solid", 5)) {
+      while (c.p < end && (*c.p == ' ' || *c.p == '\t')) c.p++;
+      const char* line_end = c.p;
+      while (line_end < end && *line_end != '\n' && *line_end != '\r') line_end++;
+      name.assign(c.p, line_end);
+    }
+    stl_data info(name);
+
+    // Below a few hundred KB the thread start-up costs more than it saves.
+    const size_t min_chunk_bytes = 256 * 1024;
+    if (threads == 0) threads = workerThreadCount();
+    size_t n_chunks = std::max<size_t>(1, std::min<size_t>(threads, size / min_chunk_bytes));
+
+    std::vector<const char*> bounds(n_chunks + 1);
+    bounds[0] = data;
+    bounds[n_chunks] = end;
+    for (size_t i = 1; i < n_chunks; i++)
+      bounds[i] = next_facet(std::max(bounds[i - 1], data + size * i / n_chunks), data, end);
+
+    std::vector<std::vector<triangle>> parts(n_chunks);
+    parallelFor(n_chunks, 1, [&](size_t first, size_t last) {
+      for (size_t i = first; i < last; i++)
+        parse_ascii_chunk(bounds[i], bounds[i + 1], parts[i]);
+    });
+
+    size_t total = 0;
+    for (auto& part : parts) total += part.size();
+    info.triangles.reserve(total);
+    for (auto& part : parts) {
+      info.triangles.insert(info.triangles.end(), part.begin(), part.end());
+      std::vector<triangle>().swap(part);
+    }
+    return info;
+  }
+
+  bool parse_stl(const std::string& stl_path, stl_data& out) {
+    MappedFile file;
+    if (!file.open(stl_path.c_str())) {
+      std::cout << "ERROR: COULD NOT READ FILE (could not open " << stl_path << ")" << std::endl;
+      return false;
+    }
+
+    if (detect_format(file.data(), file.size()) == stl_format::ascii) {
+      file.adviseSequential();
+      out = parse_stl_ascii(reinterpret_cast<const char*>(file.data()), file.size());
+      return true;
+    }
+
+    binary_stl_view view;
+    if (!view.open(std::move(file), stl_path)) {
+      std::cout << "ERROR: COULD NOT READ FILE (" << view.error() << ")" << std::endl;
+      return false;
+    }
+
+    out.name = view.header();
+    out.triangles.clear();
+    view.extract(out.triangles);
+    return true;
   }
 
   stl_data parse_stl(const std::string& stl_path) {
-    std::ifstream stl_file(stl_path.c_str(), std::ios::in | std::ios::binary);
-    if (!stl_file) {
-      std::cout << "ERROR: COULD NOT READ FILE" << std::endl;
+    stl_data info("");
+    if (!parse_stl(stl_path, info))
       assert(false);
+    return info;
+  }
+
+  bool stream_stl(const std::string& stl_path, size_t batch_size, const batch_callback& on_batch) {
+    if (batch_size == 0) batch_size = 1;
+    MappedFile file;
+    if (!file.open(stl_path.c_str())) {
+      std::cout << "ERROR: COULD NOT READ FILE (could not open " << stl_path << ")" << std::endl;
+      return false;
     }
+    file.adviseSequential();
 
-    char header_info[80] = "";
-    char n_triangles[4];
-    stl_file.read(header_info, 80);
-    stl_file.read(n_triangles, 4);
-    std::string h(header_info);
-    stl_data info(h);
-    unsigned int* r = (unsigned int*) n_triangles;
-    unsigned int num_triangles = *r;
-    for (unsigned int i = 0; i < num_triangles; i++) {
-      auto normal = parse_point(stl_file);
-      auto v1 = parse_point(stl_file);
-      auto v2 = parse_point(stl_file);
-      auto v3 = parse_point(stl_file);
-      info.triangles.push_back(triangle(normal, v1, v2, v3));
-      char dummy[2];
-      stl_file.read(dummy, 2);
+    std::vector<triangle> batch;
+    batch.reserve(batch_size);
+
+    if (detect_format(file.data(), file.size()) == stl_format::ascii) {
+      const char* data = reinterpret_cast<const char*>(file.data());
+      const char* end = data + file.size();
+      // Roughly one batch worth of text per block; a facet is ~250 bytes.
+      const size_t block_bytes = batch_size * 256;
+      const char* block = data;
+      while (block < end) {
+        const char* block_end = block + std::min<size_t>(block_bytes, end - block);
+        block_end = block_end == end ? end : next_facet(block_end, data, end);
+        batch.clear();
+        parse_ascii_chunk(block, block_end, batch);
+        for (size_t i = 0; i < batch.size(); i += batch_size)
+          on_batch(batch.data() + i, std::min(batch_size, batch.size() - i));
+        block = block_end;
+      }
+      return true;
     }
-    return info;
+
+    binary_stl_view view;
+    if (!view.open(std::move(file), stl_path)) {
+      std::cout << "ERROR: COULD NOT READ FILE (" << view.error() << ")" << std::endl;
+      return false;
+    }
+    for (size_t first = 0; first < view.size(); first += batch_size) {
+      batch.clear();
+      view.extract(batch, first, batch_size);
+      on_batch(batch.data(), batch.size());
+    }
+    return true;
   }
 
 }
@@ -1,9 +1,14 @@
 #ifndef PARSE_STL_H
 #define PARSE_STL_H
 
+#include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <string>
 #include <vector>
 
+#include <common/mapped_file.hpp>
+
 namespace stl {
 
   struct point {
@@ -27,6 +32,26 @@ namespace stl {
 
   std::ostream& operator<<(std::ostream& out, const triangle& t);
 
+  // One triangle exactly as it is laid out in a binary STL file: 12 little
+  // endian floats followed by the 16 bit "attribute byte count".
+#pragma pack(push, 1)
+  struct record {
+    point normal;
+    point v1;
+    point v2;
+    point v3;
+    uint16_t attribute_bytes;
+  };
+#pragma pack(pop)
+  static_assert(sizeof(record) == 50, "binary STL records are 50 bytes");
+
+  // Triangles split into one array per component. Vertex arrays hold three
+  // entries per triangle (v1, v2, v3), normal arrays one per triangle.
+  struct soa_triangles {
+    std::vector<float> x, y, z;
+    std::vector<float> nx, ny, nz;
+  };
+
   struct stl_data {
     std::string name;
     std::vector<triangle> triangles;
@@ -34,7 +59,65 @@ namespace stl {
     stl_data(std::string namep) : name(namep) {}
   };
 
+  // Zero-copy view of a binary STL file. The file is memory mapped and the
+  // records are handed out in place; nothing is copied until the caller asks.
+  class binary_stl_view {
+  public:
+    binary_stl_view() : records_(nullptr), count_(0) {}
+
+    // Maps the file and validates the 80 byte header and the triangle count
+    // against the file size. Returns false (and fills error()) otherwise.
+    bool open(const std::string& stl_path);
+    // Same, but takes over an already mapped file.
+    bool open(MappedFile&& file, const std::string& stl_path);
+    void close();
+
+    const std::string& error() const { return error_; }
+    std::string header() const;
+
+    size_t size() const { return count_; }
+    bool empty() const { return count_ == 0; }
+    const record& operator[](size_t i) const { return records_[i]; }
+    const record* begin() const { return records_; }
+    const record* end() const { return records_ + count_; }
+
+    triangle get(size_t i) const;
+
+    // Appends count triangles starting at first to out (count is clamped).
+    void extract(std::vector<triangle>& out, size_t first = 0, size_t count = SIZE_MAX) const;
+    void extract_soa(soa_triangles& out, size_t first = 0, size_t count = SIZE_MAX) const;
+
+  private:
+    MappedFile file_;
+    const record* records_;
+    size_t count_;
+    std::string error_;
+  };
+
+  enum class stl_format { binary, ascii };
+
+  // Binary files are recognised by their size matching the announced triangle
+  // count (many binary exporters also start the header with "solid"), ASCII
+  // files by the leading "solid" keyword.
+  stl_format detect_format(const unsigned char* data, size_t size);
+
+  // Parses an ASCII STL held in memory. The text is split into one chunk per
+  // thread on facet boundaries, the chunks are parsed in parallel and merged
+  // in file order. threads == 0 uses every hardware thread.
+  stl_data parse_stl_ascii(const char* data, size_t size, unsigned int threads = 0);
+
+  // Loads a binary or ASCII STL file, detecting the format from its content.
   stl_data parse_stl(const std::string& stl_path);
+  // Same, but reports an unreadable file by returning false instead of asserting.
+  bool parse_stl(const std::string& stl_path, stl_data& out);
+
+  typedef std::function<void(const triangle* batch, size_t count)> batch_callback;
+
+  // Reads a binary or ASCII STL file front to back and hands the triangles to
+  // on_batch in file order, at most batch_size at a time. Only one batch is
+  // held in memory, so this works for files larger than RAM. Returns false
+  // if the file cannot be read.
+  bool stream_stl(const std::string& stl_path, size_t batch_size, const batch_callback& on_batch);
 
 }
 
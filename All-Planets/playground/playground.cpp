@@ -8,6 +8,8 @@ GLFWwindow* window;
 #include <stdio.h>
 #include <stdlib.h>
 #include <iostream>
+#include <chrono>
+#include <cmath>
 
 // Include GLM
 #include <glm/gtc/matrix_transform.hpp>
@@ -15,6 +17,9 @@ using namespace glm;
 
 #include <common/shader.hpp>
 #include <playground/RenderingObject.h>
+#include <playground/mesh_lod.h>
+#include <playground/nbody.h>
+#include <playground/orbit.h>
 
 // Camera variables
 float yaw = -90.0f;    // Horizontal rotation
@@ -23,18 +28,18 @@ float lastX = 1024.0f / 2.0f;   // Screen center X
 float lastY = 768.0f / 2.0f;    // Screen center Y
 bool firstMouse = true;
 
-glm::vec3 camera_position = glm::vec3(0.0f, 1000.0f, 3000.0f);  // To view the whole system
+// The camera position is double, like every position in the scene; rendering
+// is camera-relative (V has no translation), so only small offsets reach float
+glm::dvec3 camera_position = glm::dvec3(0.0, 1000.0, 3000.0);  // To view the whole system
 glm::vec3 camera_front = glm::vec3(0.0f, 0.0f, -1.0f); 
-glm::vec3 camera_target = glm::vec3(0.0f, 0.0f, 0.0f);
+glm::dvec3 camera_target = glm::dvec3(0.0, 0.0, 0.0);
 glm::vec3 camera_up = glm::vec3(0.0f, 1.0f, 0.0f);
 float camera_fov = 45.0f;
 float camera_speed = 200.0f; // This is for camera movement speed
 float mouse_sensitivity = 0.1f;
 
 // Handle Key Inputs for camera movement
-void handleKeyInput(GLFWwindow* window) {
-    float deltaTime = 1.0f / 60.0f;
-
+void handleKeyInput(GLFWwindow* window, float deltaTime) {
     // Calculate the camera's right vector 
     glm::vec3 right = glm::normalize(glm::cross(camera_front, camera_up));
 
@@ -44,33 +49,33 @@ void handleKeyInput(GLFWwindow* window) {
 
     // Forward/Backward
     if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-        camera_position += actualSpeed * camera_front;
+        camera_position += glm::dvec3(actualSpeed * camera_front);
     if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-        camera_position -= actualSpeed * camera_front;
+        camera_position -= glm::dvec3(actualSpeed * camera_front);
 
     // Left/Right
     if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
-        camera_position -= right * actualSpeed;
+        camera_position -= glm::dvec3(right * actualSpeed);
     if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
-        camera_position += right * actualSpeed;
+        camera_position += glm::dvec3(right * actualSpeed);
 
     // Up/Down
     if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS)
-        camera_position += camera_up * actualSpeed;
+        camera_position += glm::dvec3(camera_up * actualSpeed);
     if (glfwGetKey(window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS)
-        camera_position -= camera_up * actualSpeed;
+        camera_position -= glm::dvec3(camera_up * actualSpeed);
 
     // Update camera target based on position and front vector
-    camera_target = camera_position + camera_front;
+    camera_target = camera_position + glm::dvec3(camera_front);
 }
 
 // Update camera target position and view
-void updateCamera(GLFWwindow* window) {
-    handleKeyInput(window);
+void updateCamera(GLFWwindow* window, float deltaTime) {
+    handleKeyInput(window, deltaTime);
 	handleTimeControls(window);  // Time control handling for the simulation
 
-    // Update view matrix
-    V = glm::lookAt(camera_position, camera_target, camera_up);
+    // Update view matrix: rotation only, the camera sits at the origin of the space things are drawn in
+    V = glm::lookAt(glm::vec3(0.0f), camera_front, camera_up);
 }
 
 // Handle mouse movement for camera rotation
@@ -89,7 +94,7 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos) {
     xoffset *= mouse_sensitivity;
     yoffset *= mouse_sensitivity;
 
-    yaw += xoffset;
+    yaw = fmod(yaw + xoffset, 360.0f);
     pitch += yoffset;
 
     // Constrain pitch
@@ -106,7 +111,36 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos) {
     camera_front = glm::normalize(direction);
 
     // Update camera target
-    camera_target = camera_position + camera_front;
+    camera_target = camera_position + glm::dvec3(camera_front);
+}
+
+// Left click picks the body under the crosshair (the cursor is captured, so
+// the ray goes through the screen centre) and reports where it was hit
+void mouse_button_callback(GLFWwindow* /*window*/, int button, int action, int /*mods*/) {
+    if (button != GLFW_MOUSE_BUTTON_LEFT || action != GLFW_PRESS)
+        return;
+
+    RenderingObject* bodies[] = { &sun, &earth, &moon };
+    const char* names[] = { "Sun", "Earth", "Moon" };
+    mesh::bvh_instance instances[3];
+    for (int i = 0; i < 3; i++)
+        instances[i] = bodies[i]->BvhInstance();
+
+    auto start = std::chrono::steady_clock::now();
+    mesh::scene_bvh scene;
+    mesh::build_scene_bvh(instances, 3, scene);
+    mesh::ray_hit hit;
+    // Model matrices are camera-relative, so the ray starts at the origin
+    bool found = mesh::raycast(scene, glm::vec3(0.0f), camera_front, INFINITY, hit);
+    double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+    if (!found) {
+        printf("Pick: nothing (%.1f us)\n", us);
+        return;
+    }
+    glm::dvec3 point = camera_position + glm::dvec3(hit.t * camera_front);
+    printf("Pick: %s, triangle %u at (%.1f, %.1f, %.1f), distance %.1f (%.1f us)\n", names[hit.ref.instance],
+           hit.ref.triangle, point.x, point.y, point.z, hit.t, us);
 }
 // Constants for real-world time periods (in days for better readability)
 const float DAYS_PER_EARTH_ROTATION = 1.0f;         // Earth rotates once per day
@@ -119,6 +153,7 @@ const float PI = 3.14159f;
 const float SECONDS_PER_DAY = 86400.0f;             // 24 * 60 * 60
 
 // Visualization parameters
+const float EARTH_ORBIT_DISTANCE = 3000.0f;     // Not a real-data/real-scale value, just for visualization
 const float MOON_ORBIT_DISTANCE = 150.0f;       // Visible distance between Earth and Moon
 const float MOON_SCALE = 0.27f;                 // Moon's size compared to Earth
 
@@ -131,16 +166,127 @@ const float MIN_TIME_SCALE = 100.0f;            // Minimum orbital speed
 const float MAX_TIME_SCALE = 1000000.0f;        // Maximum orbital speed
 float current_time_scale = BASE_TIME_SCALE;     // Current orbital speed
 
-// Rotation and orbit angles
+// Orbits as data: parent, a, e, i, ascending node, argument of periapsis, mean anomaly at day 0, period.
+// Parents come first; more bodies (asteroids, other planets) are further entries.
+enum { SUN_BODY, EARTH_BODY, MOON_BODY };
+const orbit::elements BODY_ORBITS[] = {
+    { -1, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f },                                        // Sun stays at center
+    { SUN_BODY, EARTH_ORBIT_DISTANCE, 0.0167f, 0.0f, 0.0f, 0.0f, 0.0f, DAYS_PER_EARTH_YEAR },
+    { EARTH_BODY, MOON_ORBIT_DISTANCE, 0.0549f, 0.0898f, 0.0f, 0.0f, 0.0f, DAYS_PER_MOON_ORBIT },  // 5.1 degrees to the ecliptic
+};
+orbit::body_table orbits;
+double simulated_day = 0.0;                     // Days since the start, kept in double so orbits stay smooth for years
+
+// Fixed-step simulation: real time goes into an accumulator, and the bodies
+// advance in steps of SIM_STEP_SECONDS of it whatever the frame rate. Each
+// frame draws between the last two states.
+const double SIM_STEP_SECONDS = 1.0 / 60.0;
+const int MAX_SIM_STEPS_PER_FRAME = 8;          // After a stall, time past this is dropped rather than caught up
+const float MAX_FRAME_SECONDS = 0.25f;          // Longest frame the camera and clock account for
+struct SimulationState {
+    double day;
+    glm::dvec3 positions[3];                    // By body index
+};
+SimulationState previous_state, current_state;
+double sim_accumulator = 0.0;                   // Real seconds not yet simulated
+double frame_time = 0.0;                        // glfwGetTime() at the start of the last frame
+
+// Gravity mode (G key): the same bodies pulled by each other as an N-body system
+// instead of following fixed ellipses. With G = 1, the masses are those that
+// give the orbits above their periods: a^3 (2 pi / period)^2 = mass of both sides.
+const float MOON_EARTH_MASS_RATIO = 0.0123f;
+const float MAX_GRAVITY_STEP_DAYS = 0.05f;      // Longest leapfrog step; fast time scales split a simulation step
+nbody::particle_system gravity_bodies;
+bool gravity_mode = false;
+
+// Starts gravity mode from where the Kepler orbits are now
+void startGravity() {
+    float earth_moon_mass = 4.0f * PI * PI * pow(MOON_ORBIT_DISTANCE, 3.0f) / (DAYS_PER_MOON_ORBIT * DAYS_PER_MOON_ORBIT);
+    float total_mass = 4.0f * PI * PI * pow(EARTH_ORBIT_DISTANCE, 3.0f) / (DAYS_PER_EARTH_YEAR * DAYS_PER_EARTH_YEAR);
+    float earth_mass = earth_moon_mass / (1.0f + MOON_EARTH_MASS_RATIO);
+    const float masses[] = { total_mass - earth_moon_mass, earth_mass, earth_mass * MOON_EARTH_MASS_RATIO };
+
+    // Velocities from the orbits a little before and after now
+    const double h = 0.1;
+    glm::dvec3 ahead[3], behind[3];
+    orbits.propagate_exact(simulated_day + h);
+    for (int body = SUN_BODY; body <= MOON_BODY; body++) ahead[body] = orbits.position(body);
+    orbits.propagate_exact(simulated_day - h);
+    for (int body = SUN_BODY; body <= MOON_BODY; body++) behind[body] = orbits.position(body);
+    orbits.propagate_exact(simulated_day);
+
+    // The sun starts at rest in the orbits, which would send the whole
+    // system drifting away; velocities are taken relative to its centre of mass
+    glm::dvec3 velocities[3], momentum(0.0);
+    for (int body = SUN_BODY; body <= MOON_BODY; body++) {
+        velocities[body] = (ahead[body] - behind[body]) / (2.0 * h);
+        momentum += (double)masses[body] * velocities[body];
+    }
+    glm::dvec3 drift = momentum / (double)(masses[SUN_BODY] + masses[EARTH_BODY] + masses[MOON_BODY]);
+
+    nbody::options settings;
+    settings.direct = true;  // Three bodies: summing every pair beats building a tree
+    gravity_bodies = nbody::particle_system(settings);
+    for (int body = SUN_BODY; body <= MOON_BODY; body++)
+        gravity_bodies.add(orbits.position(body), velocities[body] - drift, masses[body]);
+}
+
+// Where a body is at simulated_day, in either mode
+glm::dvec3 bodyPosition(int body) {
+    return gravity_mode ? gravity_bodies.position(body) : orbits.position(body);
+}
+
+void captureState(SimulationState& state) {
+    state.day = simulated_day;
+    for (int body = SUN_BODY; body <= MOON_BODY; body++) state.positions[body] = bodyPosition(body);
+}
+
+// Advances the simulation by one fixed step of real time
+void stepSimulation() {
+    double step_days = SIM_STEP_SECONDS * current_time_scale / SECONDS_PER_DAY;
+    simulated_day += step_days;
+    if (gravity_mode) {
+        // Leapfrog needs short steps: high time scales split one into several
+        int substeps = (int)std::ceil(step_days / MAX_GRAVITY_STEP_DAYS);
+        for (int i = 0; i < substeps; i++) gravity_bodies.step(step_days / substeps);
+    } else {
+        // Three bodies: solving them in double costs nothing and stays exact at any scale
+        orbits.propagate_exact(simulated_day);
+    }
+}
+
+// Runs the steps that frame_seconds of real time pay for. Returns how far
+// the time left over reaches into the next step, in [0, 1), to draw the
+// bodies that far between previous_state and current_state.
+double advanceSimulation(double frame_seconds) {
+    sim_accumulator = std::min(sim_accumulator + frame_seconds, MAX_SIM_STEPS_PER_FRAME * SIM_STEP_SECONDS);
+    while (sim_accumulator >= SIM_STEP_SECONDS) {
+        previous_state = current_state;
+        stepSimulation();
+        captureState(current_state);
+        sim_accumulator -= SIM_STEP_SECONDS;
+    }
+    return sim_accumulator / SIM_STEP_SECONDS;
+}
+
+// Where a body is drawn this frame, alpha of the way from previous_state to
+// current_state, relative to the camera: the only form in which positions
+// reach float and the GPU
+glm::vec3 drawnPosition(int body, double alpha) {
+    const glm::dvec3& from = previous_state.positions[body];
+    glm::dvec3 position = from + alpha * (current_state.positions[body] - from);
+    return glm::vec3(position - camera_position);
+}
+
+// Rotation angles
 float earth_rotation_angle = 0.0f;
-float earth_orbit_angle = 0.0f;
 float moon_rotation_angle = 0.0f;
-float moon_orbit_angle = 0.0f;
 
 // Handle time control inputs for simulation speed
 void handleTimeControls(GLFWwindow* window) {
     static bool xPressed = false;
     static bool cPressed = false;
+    static bool gPressed = false;
 
     // Slow down with "X" key
     if (glfwGetKey(window, GLFW_KEY_X) == GLFW_PRESS) {
@@ -165,6 +311,19 @@ void handleTimeControls(GLFWwindow* window) {
     else {
         cPressed = false;
     }
+
+    // Toggle gravity mode with "G" key
+    if (glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS) {
+        if (!gPressed) {  // Only trigger once per press
+            gravity_mode = !gravity_mode;
+            if (gravity_mode) startGravity();
+            gPressed = true;
+            printf("Gravity: %s\n", gravity_mode ? "N-body" : "off, Kepler orbits");
+        }
+    }
+    else {
+        gPressed = false;
+    }
 }
 
 int main( void )
@@ -182,6 +341,11 @@ int main( void )
 
   initializeMVPTransformation();
 
+  for (const orbit::elements& body : BODY_ORBITS) orbits.add(body);
+  orbits.propagate_exact(simulated_day);
+  captureState(current_state);
+  previous_state = current_state;
+
   curr_x = 0;
   curr_y = 0;
 
@@ -196,8 +360,15 @@ int main( void )
   initializeMVPTransformation();
 
 	//start animation loop until escape key is pressed
+	bool assets_reported = false;
+	frame_time = glfwGetTime();
 	do{
 
+    asset_loader.ProcessUploads(UPLOAD_BUDGET_MS, STREAM_BUDGET_BYTES);
+    if (!assets_reported && asset_loader.Pending() == 0) {
+      asset_loader.Registry().PrintStats();
+      assets_reported = true;
+    }
     updateAnimationLoop();
 
 	} // Check if the ESC key was pressed or the window was closed
@@ -214,64 +385,75 @@ int main( void )
 }
 
 void updateAnimationLoop() {
-    updateCamera(window);
+    // Real time since the last frame drives both the camera and the simulation
+    double now = glfwGetTime();
+    float deltaTime = std::min((float)(now - frame_time), MAX_FRAME_SECONDS);
+    frame_time = now;
+
+    updateCamera(window, deltaTime);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     glUseProgram(programID);
 
-    // Calculate time step using current_time_scale for orbital movements
-    float deltaTime = 1.0f / 60.0f;
-    float simulatedDays = (deltaTime * current_time_scale) / SECONDS_PER_DAY;
+    // Bodies are drawn between the last two simulation states
+    double alpha = advanceSimulation(deltaTime);
+    double drawn_day = previous_state.day + alpha * (current_state.day - previous_state.day);
 
     // Set common matrices
     glUniformMatrix4fv(View_Matrix_ID, 1, GL_FALSE, &V[0][0]);
     glUniformMatrix4fv(Projection_Matrix_ID, 1, GL_FALSE, &P[0][0]);
+    glUniform1f(LogDepthScale_ID, 2.0f / log2(FAR_PLANE + 1.0f));
 
-    // Set sun position for lighting calculations
-    glm::vec3 sunPosition = glm::vec3(0.0f, 0.0f, 0.0f);
+    // Set sun position for lighting calculations; "world space" in the shaders is centred on the camera
+    glm::vec3 sunPosition = drawnPosition(SUN_BODY, alpha);
     glUniform3fv(SunPosition_worldspace_ID, 1, &sunPosition[0]);
 
+    // Pixels per unit of geometric error at distance 1, for picking each body's level of detail
+    int framebuffer_width, framebuffer_height;
+    glfwGetFramebufferSize(window, &framebuffer_width, &framebuffer_height);
+    float lod_scale = mesh::lod_projection_scale((float)framebuffer_height, P[1][1]);
+    // Meshlets facing away or off screen are skipped while a body draws its finest level.
+    // Model matrices below are camera-relative, so the eye is at the origin.
+    glm::mat4 VP = P * V;
+
     // Draw Sun
-    sun.M = glm::mat4(1.0f);
+    sun.M = glm::translate(glm::mat4(1.0f), sunPosition);
     sun.M = glm::scale(sun.M, glm::vec3(SUN_SCALE));
     glUniformMatrix4fv(Model_Matrix_ID, 1, GL_FALSE, &sun.M[0][0]);
 	glUniform1i(IsSun_ID, 1);  // This is the sun
+    sun.ApplyVertexDecode(PositionScale_ID, PositionOffset_ID, OctahedralNormals_ID);
+    sun.SelectLod(glm::vec3(0.0f), lod_scale, LOD_PIXEL_ERROR, LOD_HYSTERESIS);
+    sun.CullMeshlets(VP, glm::vec3(0.0f));
     sun.DrawObject();
 
-    // Earth's rotation and orbit
-    earth_rotation_angle += (2.0f * PI * simulatedDays) / DAYS_PER_EARTH_ROTATION;
-	earth_orbit_angle -= (2.0f * PI * simulatedDays) / DAYS_PER_EARTH_YEAR; // This is negated because earth orbits in opposite direction/counter-clockwise
-
-    // Calculate Earth's position
-	float earth_orbit_radius = 3000.0f; // This is not a real-data/real-scale value, just for visualization
-    float earth_x = earth_orbit_radius * cos(earth_orbit_angle);
-    float earth_z = earth_orbit_radius * sin(earth_orbit_angle);
+    // Earth's rotation, from the day so that it stays precise however long the simulation runs;
+    // its orbit comes from the body table or gravity
+    earth_rotation_angle = 2.0f * PI * (float)std::fmod(drawn_day / DAYS_PER_EARTH_ROTATION, 1.0);
+    glm::vec3 earth_position = drawnPosition(EARTH_BODY, alpha);
 
     // Update Earth's transformation
     earth.M = glm::mat4(1.0f);
-    earth.M = glm::translate(earth.M, glm::vec3(earth_x, 0.0f, earth_z));
+    earth.M = glm::translate(earth.M, earth_position);
     earth.M = earth.M * glm::rotate(glm::mat4(1.0f), glm::radians(23.5f), glm::vec3(1.0f, 0.0f, 0.0f));
     earth.M = earth.M * glm::rotate(glm::mat4(1.0f), earth_rotation_angle, glm::vec3(0.0f, 1.0f, 0.0f));
     earth.M = glm::scale(earth.M, glm::vec3(EARTH_SCALE));
 
-    // Draw Earth
+    // Draw Earth: terrain chunks picked for the camera in Earth's model space
     glUniformMatrix4fv(Model_Matrix_ID, 1, GL_FALSE, &earth.M[0][0]);
     glUniform1i(IsSun_ID, 0);  // This is not the sun
-    earth.DrawObject();
-
-    // Moon's orbit around Earth
-	moon_orbit_angle -= (2.0f * PI * simulatedDays) / DAYS_PER_MOON_ORBIT; // This is also negated because moon orbits in opposite direction/counter-clockwise
+    earth_terrain.Update(glm::vec3(glm::inverse(earth.M) * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f)), VP * earth.M,
+                         TERRAIN_UPLOADS_PER_FRAME);
+    earth_terrain.Draw(earth.texID, PositionScale_ID, PositionOffset_ID, OctahedralNormals_ID);
 
-    // Calculate Moon's position relative to Earth
-    float moon_x = earth_x + MOON_ORBIT_DISTANCE * cos(moon_orbit_angle);
-    float moon_z = earth_z + MOON_ORBIT_DISTANCE * sin(moon_orbit_angle);
+    // Moon's position around Earth, from the body table or gravity
+    glm::vec3 moon_position = drawnPosition(MOON_BODY, alpha);
 
     // Update Moon's transformation
     moon.M = glm::mat4(1.0f);
-    moon.M = glm::translate(moon.M, glm::vec3(moon_x, 0.0f, moon_z));
+    moon.M = glm::translate(moon.M, moon_position);
     moon.M = glm::scale(moon.M, glm::vec3(MOON_SCALE));
 
     // Calculate Moon's rotation
-    glm::vec3 moon_to_earth = glm::normalize(glm::vec3(earth_x, 0.0f, earth_z) - glm::vec3(moon_x, 0.0f, moon_z));
+    glm::vec3 moon_to_earth = glm::normalize(earth_position - moon_position);
     float moon_facing_angle = atan2(moon_to_earth.z, moon_to_earth.x) + PI / 2.0f;
 	moon_facing_angle = -moon_facing_angle;  // Negate angle to face Earth
     moon.M = moon.M * glm::rotate(glm::mat4(1.0f), moon_facing_angle, glm::vec3(0.0f, 1.0f, 0.0f));
@@ -279,6 +461,9 @@ void updateAnimationLoop() {
     // Draw Moon
     glUniformMatrix4fv(Model_Matrix_ID, 1, GL_FALSE, &moon.M[0][0]);
     glUniform1i(IsSun_ID, 0);  // This is not the sun
+    moon.ApplyVertexDecode(PositionScale_ID, PositionOffset_ID, OctahedralNormals_ID);
+    moon.SelectLod(glm::vec3(0.0f), lod_scale, LOD_PIXEL_ERROR, LOD_HYSTERESIS);
+    moon.CullMeshlets(VP, glm::vec3(0.0f));
     moon.DrawObject();
 
     glfwSwapBuffers(window);
@@ -331,6 +516,7 @@ bool initializeWindow()
   glfwSetInputMode(window, GLFW_STICKY_KEYS, GL_TRUE);
   glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);  // Hides and captures cursor
   glfwSetCursorPosCallback(window, mouse_callback);             // Set mouse callback
+  glfwSetMouseButtonCallback(window, mouse_button_callback);    // Left click picks a body
 
   glClearColor(0.0f, 0.0f, 0.0f, 0.0f);  // RGBA values for black background
   return true;
@@ -346,18 +532,22 @@ bool initializeMVPTransformation()
 
     SunPosition_worldspace_ID = glGetUniformLocation(programID, "SunPosition_worldspace");
     IsSun_ID = glGetUniformLocation(programID, "isSun");
+    PositionScale_ID = glGetUniformLocation(programID, "PositionScale");
+    PositionOffset_ID = glGetUniformLocation(programID, "PositionOffset");
+    OctahedralNormals_ID = glGetUniformLocation(programID, "OctahedralNormals");
+    LogDepthScale_ID = glGetUniformLocation(programID, "LogDepthScale");
 
     P = glm::perspective(
         glm::radians(45.0f),
         4.0f / 3.0f,
-        1.0f,        // Near plane
-        50000.0f     // Far plane increased for larger distances
+        NEAR_PLANE,
+        FAR_PLANE    // Depth is logarithmic, so this can be far
     );
 
-    // Initial camera view
+    // Initial camera view, camera-relative
     V = glm::lookAt(
-        camera_position,
-        glm::vec3(0, 0, 0),  // Look at the origin (Sun)
+        glm::vec3(0, 0, 0),
+        glm::vec3(-camera_position),  // Look at the origin (Sun)
         glm::vec3(0, 1, 0)
     );
 
@@ -366,34 +556,27 @@ bool initializeMVPTransformation()
 
 bool initializeVertexbuffer() {
 
+    // Sphere meshes are generated in place; textures start out as a
+    // placeholder and are loaded on worker threads, uploaded as they arrive
+
     // Sun object
     sun = RenderingObject();
     sun.InitializeVAO();
-    sun.LoadSTL("sphere.stl");
-    std::vector<glm::vec2> sunUV = sun.GetUVBuffer();
-    if (!sunUV.empty()) {
-        sun.SetTexture(sunUV, "2k_sun.bmp");
-    }
+    sun.SetMesh(asset_loader.Registry().LoadSphere(BODY_SPHERE));
+    asset_loader.RequestTexture(&sun, "2k_sun.bmp");
 
     // Earth object
     earth = RenderingObject();
     earth.InitializeVAO();
-    earth.LoadSTL("sphere.stl");
-
-    std::vector<glm::vec2> earthUV = earth.GetUVBuffer();
-    if (!earthUV.empty()) {
-        earth.SetTexture(earthUV, "2k_earth_daymap.bmp");
-    }
+    earth.SetMesh(asset_loader.Registry().LoadSphere(BODY_SPHERE));
+    asset_loader.RequestTexture(&earth, "2k_earth_daymap.bmp");
+    earth_terrain.Initialize(EARTH_HEIGHTMAP);
 
     // Moon object
     moon = RenderingObject();
     moon.InitializeVAO();
-    moon.LoadSTL("sphere.stl");
-
-    std::vector<glm::vec2> moonUV = moon.GetUVBuffer();
-    if (!moonUV.empty()) {
-        moon.SetTexture(moonUV, "2k_moon.bmp");
-    }
+    moon.SetMesh(asset_loader.Registry().LoadSphere(BODY_SPHERE));
+    asset_loader.RequestTexture(&moon, "2k_moon.bmp");
 
     return true;
 }
@@ -401,6 +584,10 @@ bool initializeVertexbuffer() {
 // Cleanup the vertex buffer objects
 bool cleanupVertexbuffer()
 {
+  // Workers must be gone before the GL context
+  earth_terrain.Shutdown();
+  asset_loader.Shutdown();
+
   // Cleanup VBO
   glDeleteVertexArrays(1, &sun.VertexArrayID);
   return true;
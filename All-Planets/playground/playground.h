@@ -14,10 +14,12 @@
 #include <playground/parse_stl.h>
 
 #include "RenderingObject.h"
+#include "AssetLoader.h"
+#include "PlanetTerrain.h"
 
 // Camera variables
-extern glm::vec3 camera_position;
-extern glm::vec3 camera_target;
+extern glm::dvec3 camera_position;
+extern glm::dvec3 camera_target;
 extern glm::vec3 camera_up;
 extern float camera_fov;
 extern float camera_speed;
@@ -35,12 +37,37 @@ glm::mat4 P;
 GLuint Model_Matrix_ID;
 GLuint SunPosition_worldspace_ID;
 GLuint IsSun_ID;
+//vertex decode uniforms, set per object (see RenderingObject::ApplyVertexDecode)
+GLuint PositionScale_ID;
+GLuint PositionOffset_ID;
+GLuint OctahedralNormals_ID;
+//logarithmic depth (written per fragment, see the shaders): one pass keeps depth precise from NEAR_PLANE to FAR_PLANE
+GLuint LogDepthScale_ID;
+const float NEAR_PLANE = 0.01f; //<<< a camera on a surface still sees it
+const float FAR_PLANE = 1e9f; //<<< beyond the outer planets at real scale
 
 // Rendering objects
 RenderingObject earth;
 RenderingObject moon;
 RenderingObject sun;
 
+// Background loading of meshes and textures
+AssetLoader asset_loader;
+const double UPLOAD_BUDGET_MS = 4.0; //<<< GPU upload time allowed per frame
+const size_t STREAM_BUDGET_BYTES = 4 << 20; //<<< streamed texture mip data uploaded per frame
+
+// Generated sphere shared by all bodies; radius 75 matches an STL fitted to 150 units
+const mesh::sphere_params BODY_SPHERE(mesh::sphere_kind::uv, 3, 75.0f);
+
+// Level of detail: coarser levels are drawn while their error stays below this many pixels
+const float LOD_PIXEL_ERROR = 1.0f;
+const float LOD_HYSTERESIS = 0.2f; //<<< fraction of LOD_PIXEL_ERROR a level must clear before switching
+
+// Earth is drawn as quadtree terrain on the body sphere, with earth's texture
+PlanetTerrain earth_terrain(terrain::planet_params(BODY_SPHERE.radius));
+const char* const EARTH_HEIGHTMAP = "earth_heightmap.bmp"; //<<< optional, grey levels; noise only without it
+const int TERRAIN_UPLOADS_PER_FRAME = 8; //<<< built chunks moved into the GPU pool per frame
+
 // Animation variables
 float curr_x;
 float curr_y;
@@ -60,10 +87,16 @@ bool closeWindow(); //<<< Closes the OpenGL window and terminates GLFW
 void updataMovingObjectTransformation(); //<<< updates the transformation of the moving object
 
 // Camera functions
-void updateCamera(GLFWwindow* window);
-void handleKeyInput(GLFWwindow* window);
+void updateCamera(GLFWwindow* window, float deltaTime);
+void handleKeyInput(GLFWwindow* window, float deltaTime);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
+void mouse_button_callback(GLFWwindow* window, int button, int action, int mods);
 void handleTimeControls(GLFWwindow* window);
+void startGravity(); //<<< switches the bodies to N-body gravity from their current orbits
+glm::dvec3 bodyPosition(int body); //<<< position of a body from its orbit or from gravity
+void stepSimulation(); //<<< advances the bodies by one fixed step of real time
+double advanceSimulation(double frame_seconds); //<<< runs the fixed steps a frame pays for, returns the interpolation factor
+glm::vec3 drawnPosition(int body, double alpha); //<<< camera-relative position of a body between the last two steps
 
 
 #endif
@@ -0,0 +1,312 @@
+#include "smooth_normals.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include <common/parallel.hpp>
+
+#include "playground/mesh_simd.h"
+
+namespace mesh {
+
+  namespace {
+
+    struct weld_key {
+      uint32_t k[3];
+      bool operator==(const weld_key& o) const { return k[0] == o.k[0] && k[1] == o.k[1] && k[2] == o.k[2]; }
+      bool operator<(const weld_key& o) const {
+        if (k[0] != o.k[0]) return k[0] < o.k[0];
+        if (k[1] != o.k[1]) return k[1] < o.k[1];
+        return k[2] < o.k[2];
+      }
+    };
+
+    weld_key make_key(const glm::vec3& p, float inv_cell) {
+      weld_key key;
+      if (inv_cell > 0.0f) {
+        // Unrolled: a loop over k[] goes through the stack and stalls the
+        // copy of the key that follows
+        key.k[0] = (uint32_t)(int32_t)std::floor(p.x * inv_cell);
+        key.k[1] = (uint32_t)(int32_t)std::floor(p.y * inv_cell);
+        key.k[2] = (uint32_t)(int32_t)std::floor(p.z * inv_cell);
+      } else {
+        // +0.0f and -0.0f compare equal, so they must share a key.
+        float c[3] = { p.x + 0.0f, p.y + 0.0f, p.z + 0.0f };
+        std::memcpy(key.k, c, sizeof(key.k));
+      }
+      return key;
+    }
+
+    uint64_t hash_key(const weld_key& key) {
+      uint64_t h = key.k[0] * 0x9E3779B97F4A7C15ull;
+      h ^= key.k[1] * 0xC2B2AE3D27D4EB4Full + (h << 6) + (h >> 2);
+      h ^= key.k[2] * 0x165667B19E3779F9ull + (h << 6) + (h >> 2);
+      return h ^ (h >> 31);
+    }
+
+    // A corner with its key and weighted face normal, so that grouping
+    // reads memory in order; hash is the low half of hash_key(key)
+    struct keyed_corner {
+      weld_key key;
+      uint32_t corner;
+      glm::vec3 weighted;
+      uint32_t hash;
+    };
+
+    // With a tolerance, corners are compared by distance, so they carry
+    // their position and face along
+    struct welded_corner : keyed_corner {
+      glm::vec3 position;
+      glm::vec3 face;
+    };
+
+    // Buckets are sorted in cache by a counting sort into fine buckets of
+    // about 4 corners, each then sorted by key. The fine bucket of a corner
+    // depends only on its hash and the size of its bucket.
+    uint32_t fine_buckets(size_t corners) {
+      uint32_t fine = 1;
+      while (fine < (1u << 16) && fine * 4 < corners) fine *= 2;
+      return fine;
+    }
+
+    // Sorts the n corners at first into into. fine_end has room for
+    // fine_buckets(n) + 1 entries; [f] is left at the end of fine bucket f.
+    template <class Corner>
+    void sort_bucket(const Corner* first, size_t n, Corner* into, uint32_t* fine_end) {
+      uint32_t mask = fine_buckets(n) - 1;
+      std::fill(fine_end, fine_end + mask + 2, 0);
+      for (size_t i = 0; i < n; i++) fine_end[(first[i].hash & mask) + 1]++;
+      for (uint32_t f = 0; f <= mask; f++) fine_end[f + 1] += fine_end[f];
+      for (size_t i = 0; i < n; i++) into[fine_end[first[i].hash & mask]++] = first[i];
+      // Fine buckets hold a few corners: insertion sort by key
+      for (size_t i = 1; i < n; i++) {
+        Corner c = into[i];
+        size_t j = i;
+        for (; j > 0 && (into[j - 1].hash & mask) == (c.hash & mask) && c.key < into[j - 1].key; j--)
+          into[j] = into[j - 1];
+        into[j] = c;
+      }
+    }
+
+    // Unit normal of triangle v, zero if it is degenerate
+    glm::vec3 face_normal(const glm::vec3* v) {
+      glm::vec3 n = glm::cross(v[1] - v[0], v[2] - v[0]);
+      float len = glm::length(n);
+      return len > 0.0f ? n / len : glm::vec3(0.0f);
+    }
+
+  }
+
+  void smooth_normals(const glm::vec3* vertices, size_t count, std::vector<glm::vec3>& normals,
+                      const normal_options& options) {
+    normals.resize(count - count % 3);
+    smooth_normals(vertices, count, normals.data(), options);
+  }
+
+  void smooth_normals(const glm::vec3* vertices, size_t count, glm::vec3* normals,
+                      const normal_options& options, arena* scratch) {
+    size_t triangles = count / 3;
+    count = triangles * 3;
+    if (count == 0) return;
+    scratch_scope memory(scratch);
+
+    // Pass 1: corners per bucket of weld key hash, counted per slice of
+    // triangles. Equal keys always land in the same bucket, so buckets can be
+    // resolved independently. With a tolerance the key is a grid cell four
+    // tolerances wide, so a corner's neighbours within it lie in its own cell
+    // or, near a side, the cell across it.
+    float tolerance = options.weld_tolerance;
+    float inv_cell = tolerance > 0.0f ? 0.25f / tolerance : 0.0f;
+    bool crease = options.crease_angle < 180.0f;
+    float cos_crease = std::cos(options.crease_angle * 3.14159265358979f / 180.0f);
+    size_t buckets = 1;
+    while (buckets < 4096 && buckets * 16384 < count) buckets *= 2;
+    auto bucket_of = [&](uint64_t hash) { return (uint32_t)(((hash >> 32) * buckets) >> 32); };
+
+    size_t slices = std::min<size_t>(workerThreadCount(), (triangles + 16383) / 16384);
+    auto slice_begin = [&](size_t s) { return triangles * s / slices; };
+    std::pmr::vector<uint32_t> counts(slices * buckets, 0, memory);
+    parallelFor(slices, 1, [&](size_t begin, size_t end) {
+      for (size_t s = begin; s < end; s++) {
+        uint32_t* c = &counts[s * buckets];
+        for (size_t i = 3 * slice_begin(s); i < 3 * slice_begin(s + 1); i++)
+          c[bucket_of(hash_key(make_key(vertices[i], inv_cell)))]++;
+      }
+    });
+    std::pmr::vector<uint32_t> bucket_start(buckets + 1, memory);
+    std::pmr::vector<uint32_t> fine_offset(buckets + 1, memory);
+    uint32_t offset = 0, largest = 0;
+    fine_offset[0] = 0;
+    for (size_t b = 0; b < buckets; b++) {
+      bucket_start[b] = offset;
+      for (size_t s = 0; s < slices; s++) {
+        uint32_t n = counts[s * buckets + b];
+        counts[s * buckets + b] = offset;
+        offset += n;
+      }
+      largest = std::max(largest, offset - bucket_start[b]);
+      fine_offset[b + 1] = fine_offset[b] + fine_buckets(offset - bucket_start[b]) + 1;
+    }
+    bucket_start[buckets] = offset;
+    std::pmr::vector<uint32_t> fine_end(fine_offset[buckets], memory);
+    size_t bucket_slices = std::min(slices, buckets);
+    bool by_angle = options.weighting == normal_weighting::angle;
+    std::pmr::vector<glm::vec3> faces(crease && tolerance == 0.0f ? triangles : 0, memory);
+
+    // Pass 2: face normals and corner weights, one triangle at a time, and
+    // every corner scattered to its bucket. Pass 3: every bucket sorted by
+    // fine bucket then key, which brings equal keys together, and handed to
+    // resolve while it is still in cache.
+    auto scatter_and_sort = [&](auto* entries, auto* sorted, auto&& resolve) {
+      using Corner = std::remove_pointer_t<decltype(entries)>;
+      parallelFor(slices, 1, [&](size_t begin, size_t end) {
+        for (size_t s = begin; s < end; s++) {
+          uint32_t* next = &counts[s * buckets];
+          for (size_t t = slice_begin(s); t < slice_begin(s + 1); t++) {
+            const glm::vec3* v = vertices + 3 * t;
+            glm::vec3 edge[3] = { v[1] - v[0], v[2] - v[1], v[0] - v[2] };
+            glm::vec3 n = glm::cross(edge[0], -edge[2]);
+            float len = glm::length(n);
+            glm::vec3 unit = len > 0.0f ? n / len : glm::vec3(0.0f);
+            for (int k = 0; k < 3; k++) {
+              weld_key key = make_key(v[k], inv_cell);
+              uint64_t hash = hash_key(key);
+              Corner& entry = entries[next[bucket_of(hash)]++];
+              entry.key = key;
+              entry.corner = (uint32_t)(3 * t + k);
+              entry.hash = (uint32_t)hash;
+              // The corner angle is atan2(|e1 x e2|, e1 . e2), and |e1 x e2|
+              // is the same at every corner
+              entry.weighted = by_angle ? unit * fast_atan2(len, -glm::dot(edge[k], edge[(k + 2) % 3])) : n;
+              if constexpr (std::is_same<Corner, welded_corner>::value) {
+                entry.position = v[k];
+                entry.face = unit;
+              }
+            }
+            if (!faces.empty()) faces[t] = unit;
+          }
+        }
+      });
+      parallelFor(bucket_slices, 1, [&](size_t begin, size_t end) {
+        for (size_t s = begin; s < end; s++) {
+          Corner* into = sorted + s * largest;
+          for (size_t b = buckets * s / bucket_slices; b < buckets * (s + 1) / bucket_slices; b++) {
+            Corner* first = entries + bucket_start[b];
+            size_t n = bucket_start[b + 1] - bucket_start[b];
+            sort_bucket(first, n, into, &fine_end[fine_offset[b]]);
+            resolve(first, into, n);
+          }
+        }
+      });
+    };
+
+    if (tolerance == 0.0f) {
+      // Each group of equal positions is averaged, and every corner of a
+      // group gets the same normal unless creases split it
+      std::pmr::vector<keyed_corner> order(count, memory);
+      std::pmr::vector<keyed_corner> sorted(slices * largest, memory);
+      scatter_and_sort(order.data(), sorted.data(), [&](keyed_corner*, keyed_corner* into, size_t n) {
+        keyed_corner* last = into + n;
+        for (keyed_corner* group = into; group != last;) {
+          keyed_corner* group_end = group + 1;
+          while (group_end != last && group_end->key == group->key) group_end++;
+          if (!crease) {
+            glm::vec3 sum(0.0f);
+            for (keyed_corner* c = group; c != group_end; c++) sum += c->weighted;
+            float len = glm::length(sum);
+            for (keyed_corner* c = group; c != group_end; c++)
+              normals[c->corner] = len > 0.0f ? sum / len : face_normal(vertices + (c->corner - c->corner % 3));
+          } else {
+            // Only faces within the crease angle of the corner's own face count
+            for (keyed_corner* c = group; c != group_end; c++) {
+              const glm::vec3& own = faces[c->corner / 3];
+              glm::vec3 sum(0.0f);
+              for (keyed_corner* d = group; d != group_end; d++)
+                if (glm::dot(own, faces[d->corner / 3]) >= cos_crease) sum += d->weighted;
+              float len = glm::length(sum);
+              normals[c->corner] = len > 0.0f ? sum / len : own;
+            }
+          }
+          group = group_end;
+        }
+      });
+      return;
+    }
+
+    // With a tolerance every corner within it counts, whichever cell it fell
+    // in. Buckets are sorted in place first, then the corners of one cell
+    // look up the cells next to it once, on the sides where any of them is
+    // within the tolerance of the border.
+    std::pmr::vector<welded_corner> order(count, memory);
+    {
+      std::pmr::vector<welded_corner> sorted(slices * largest, memory);
+      scatter_and_sort(order.data(), sorted.data(), [](welded_corner* first, welded_corner* into, size_t n) {
+        std::copy(into, into + n, first);
+      });
+    }
+    float tolerance_sq = tolerance * tolerance, reach = tolerance * inv_cell;
+    parallelFor(bucket_slices, 1, [&](size_t begin, size_t end) {
+      for (size_t b = buckets * begin / bucket_slices; b < buckets * end / bucket_slices; b++) {
+        const welded_corner* last = order.data() + bucket_start[b + 1];
+        for (const welded_corner* group = order.data() + bucket_start[b]; group != last;) {
+          const welded_corner* group_end = group + 1;
+          while (group_end != last && group_end->key == group->key) group_end++;
+
+          int low[3] = { 0, 0, 0 }, high[3] = { 0, 0, 0 };
+          for (const welded_corner* c = group; c != group_end; c++)
+            for (int a = 0; a < 3; a++) {
+              float f = c->position[a] * inv_cell - std::floor(c->position[a] * inv_cell);
+              if (f < reach) low[a] = -1;
+              if (f > 1.0f - reach) high[a] = 1;
+            }
+          const welded_corner* near[27][2];
+          int cells = 0;
+          weld_key cell;
+          for (int dz = low[2]; dz <= high[2]; dz++)
+            for (int dy = low[1]; dy <= high[1]; dy++)
+              for (int dx = low[0]; dx <= high[0]; dx++) {
+                if (dx == 0 && dy == 0 && dz == 0) {
+                  near[cells][0] = group;
+                  near[cells++][1] = group_end;
+                  continue;
+                }
+                cell.k[0] = group->key.k[0] + (uint32_t)dx;
+                cell.k[1] = group->key.k[1] + (uint32_t)dy;
+                cell.k[2] = group->key.k[2] + (uint32_t)dz;
+                uint64_t hash = hash_key(cell);
+                uint32_t nb = bucket_of(hash);
+                const welded_corner* first = order.data() + bucket_start[nb];
+                const uint32_t* fine_ends = &fine_end[fine_offset[nb]];
+                uint32_t f = (uint32_t)hash & (fine_buckets(bucket_start[nb + 1] - bucket_start[nb]) - 1);
+                const welded_corner* d = first + (f ? fine_ends[f - 1] : 0);
+                const welded_corner* d_end = first + fine_ends[f];
+                while (d != d_end && d->key < cell) d++;
+                const welded_corner* run = d;
+                while (run != d_end && run->key == cell) run++;
+                if (run != d) {
+                  near[cells][0] = d;
+                  near[cells++][1] = run;
+                }
+              }
+
+          for (const welded_corner* c = group; c != group_end; c++) {
+            glm::vec3 sum(0.0f);
+            for (int i = 0; i < cells; i++)
+              for (const welded_corner* d = near[i][0]; d != near[i][1]; d++) {
+                glm::vec3 offset = d->position - c->position;
+                if (glm::dot(offset, offset) > tolerance_sq) continue;
+                if (!crease || glm::dot(c->face, d->face) >= cos_crease) sum += d->weighted;
+              }
+            float len = glm::length(sum);
+            normals[c->corner] = len > 0.0f ? sum / len : crease ? c->face : face_normal(vertices + (c->corner - c->corner % 3));
+          }
+          group = group_end;
+        }
+      }
+    });
+  }
+
+}
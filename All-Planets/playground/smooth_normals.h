@@ -0,0 +1,45 @@
+#ifndef SMOOTH_NORMALS_H
+#define SMOOTH_NORMALS_H
+
+#include <cstddef>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "playground/mesh_arena.h"
+
+namespace mesh {
+
+  enum class normal_weighting {
+    area,  // face normal scaled by triangle area: big faces dominate
+    angle  // face normal scaled by the corner angle: independent of tessellation
+  };
+
+  struct normal_options {
+    normal_weighting weighting;
+    // Faces whose normals differ by more than this (degrees) are not averaged
+    // together, so hard edges stay hard. 180 smooths everything.
+    float crease_angle;
+    // 0 welds bit-identical positions only. Otherwise every position within
+    // this distance of a corner is averaged into its normal.
+    float weld_tolerance;
+
+    normal_options() : weighting(normal_weighting::angle), crease_angle(180.0f), weld_tolerance(0.0f) {}
+  };
+
+  // Smooth per-corner normals of a triangle soup (three vertices per
+  // triangle), normals is resized to count. Corners are bucketed by a hash of
+  // their position (or of their grid cell, with a tolerance), each bucket is
+  // sorted in cache and resolved on its own; every pass is spread over all
+  // hardware threads and the cost is linear in the number of triangles.
+  // A corner whose neighbourhood sums to zero gets its own face normal.
+  void smooth_normals(const glm::vec3* vertices, size_t count, std::vector<glm::vec3>& normals,
+                      const normal_options& options = normal_options());
+  // Same, writing count - count % 3 normals to normals. The working buffers
+  // come from scratch (a private arena if null).
+  void smooth_normals(const glm::vec3* vertices, size_t count, glm::vec3* normals,
+                      const normal_options& options = normal_options(), arena* scratch = nullptr);
+
+}
+
+#endif
@@ -0,0 +1,375 @@
+#include "sphere_mesh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#include "playground/mesh_meshlet.h"
+#include "playground/mesh_optimize.h"
+
+namespace mesh {
+
+  namespace {
+
+    constexpr double pi = 3.14159265358979323846;
+
+    // Taylor series, accurate to double precision on [-pi, pi]
+    constexpr double constexpr_sin(double x) {
+      double term = x, sum = x;
+      for (int k = 1; k < 24; k++) {
+        term *= -x * x / ((2.0 * k) * (2.0 * k + 1.0));
+        sum += term;
+      }
+      return sum;
+    }
+
+    constexpr double constexpr_cos(double x) {
+      double term = 1.0, sum = 1.0;
+      for (int k = 1; k < 24; k++) {
+        term *= -x * x / ((2.0 * k - 1.0) * (2.0 * k));
+        sum += term;
+      }
+      return sum;
+    }
+
+    // cos/sin of 2 pi j / N for j = 0..N
+    template <int N>
+    struct circle_table {
+      float c[N + 1];
+      float s[N + 1];
+
+      constexpr circle_table() : c(), s() {
+        for (int j = 0; j <= N; j++) {
+          double a = 2.0 * pi * j / N;
+          if (a > pi) a -= 2.0 * pi;
+          c[j] = (float)constexpr_cos(a);
+          s[j] = (float)constexpr_sin(a);
+        }
+      }
+    };
+
+    // UV sphere levels 0..5
+    constexpr circle_table<8> circle8;
+    constexpr circle_table<16> circle16;
+    constexpr circle_table<32> circle32;
+    constexpr circle_table<64> circle64;
+    constexpr circle_table<128> circle128;
+    constexpr circle_table<256> circle256;
+
+    bool tabled_circle(int n, const float*& c, const float*& s) {
+      switch (n) {
+        case 8: c = circle8.c; s = circle8.s; return true;
+        case 16: c = circle16.c; s = circle16.s; return true;
+        case 32: c = circle32.c; s = circle32.s; return true;
+        case 64: c = circle64.c; s = circle64.s; return true;
+        case 128: c = circle128.c; s = circle128.s; return true;
+        case 256: c = circle256.c; s = circle256.s; return true;
+        default: return false;
+      }
+    }
+
+    // Tangent along +u; u = 0.5 - theta / 2pi with theta = atan2(z, x)
+    glm::vec4 tangent_at_u(float u) {
+      double theta = 2.0 * pi * (0.5 - u);
+      return glm::vec4((float)std::sin(theta), 0.0f, (float)-std::cos(theta), 1.0f);
+    }
+
+    void generate_uv(int level, indexed_mesh& out, std::vector<glm::vec4>* tangents) {
+      int slices = 8 << level, stacks = 4 << level;
+
+      // phi = 2 pi i / slices covers 0..pi for i <= stacks, theta = -pi + 2 pi j / slices
+      const float* c;
+      const float* s;
+      std::vector<float> runtime_c, runtime_s;
+      if (!tabled_circle(slices, c, s)) {
+        runtime_c.resize(slices + 1);
+        runtime_s.resize(slices + 1);
+        for (int j = 0; j <= slices; j++) {
+          runtime_c[j] = (float)std::cos(2.0 * pi * j / slices);
+          runtime_s[j] = (float)std::sin(2.0 * pi * j / slices);
+        }
+        c = runtime_c.data();
+        s = runtime_s.data();
+      }
+
+      // Pole vertices get one copy per slice, at the middle of the slice
+      uint32_t row = slices + 1;
+      uint32_t first_row = slices;
+      uint32_t south = slices + (stacks - 1) * row;
+      out.vertices.resize(south + slices);
+      vertex* v = out.vertices.data();
+      for (int j = 0; j < slices; j++) {
+        float u = 1.0f - (j + 0.5f) / slices;
+        v[j] = { glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), glm::vec2(u, 1.0f) };
+        v[south + j] = { glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec2(u, 0.0f) };
+      }
+      for (int i = 1; i < stacks; i++) {
+        vertex* ring = v + first_row + (i - 1) * row;
+        for (int j = 0; j <= slices; j++) {
+          glm::vec3 n(s[i] * -c[j], c[i], s[i] * -s[j]);
+          ring[j] = { n, n, glm::vec2(1.0f - (float)j / slices, 1.0f - (float)i / stacks) };
+        }
+      }
+
+      // Counter-clockwise seen from outside; one triangle per slice at each pole
+      out.indices.resize(3 * sphere_triangle_count(sphere_kind::uv, level));
+      uint32_t* index = out.indices.data();
+      for (uint32_t j = 0; j < (uint32_t)slices; j++) {
+        uint32_t b = first_row + j;
+        *index++ = j; *index++ = b + 1; *index++ = b;
+      }
+      for (int i = 1; i < stacks - 1; i++) {
+        for (int j = 0; j < slices; j++) {
+          uint32_t a = first_row + (i - 1) * row + j;
+          uint32_t b = a + row;
+          *index++ = a; *index++ = a + 1; *index++ = b;
+          *index++ = a + 1; *index++ = b + 1; *index++ = b;
+        }
+      }
+      for (int j = 0; j < slices; j++) {
+        uint32_t a = first_row + (stacks - 2) * row + j;
+        *index++ = a; *index++ = a + 1; *index++ = south + j;
+      }
+
+      // Tangents straight from the table: (sin theta, 0, -cos theta) along +u
+      if (tangents) {
+        tangents->resize(out.vertices.size());
+        glm::vec4* t = tangents->data();
+        for (int j = 0; j < slices; j++) {
+          glm::vec3 middle = glm::normalize(glm::vec3(-(s[j] + s[j + 1]), 0.0f, c[j] + c[j + 1]));
+          t[j] = t[south + j] = glm::vec4(middle, 1.0f);
+        }
+        for (int i = 1; i < stacks; i++)
+          for (int j = 0; j <= slices; j++)
+            t[first_row + (i - 1) * row + j] = glm::vec4(-s[j], 0.0f, c[j], 1.0f);
+      }
+    }
+
+    // Midpoint of every edge, created once and shared by both triangles
+    class edge_midpoints {
+    public:
+      edge_midpoints(size_t edges, std::vector<glm::vec3>& points) : points_(points) {
+        size_t capacity = 16;
+        while (capacity < 2 * edges) capacity *= 2;
+        keys_.assign(capacity, empty);
+        values_.resize(capacity);
+      }
+
+      uint32_t get(uint32_t a, uint32_t b) {
+        uint64_t key = a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
+        size_t mask = keys_.size() - 1;
+        size_t slot = (size_t)((key * 0x9E3779B97F4A7C15ull) >> 20) & mask;
+        while (keys_[slot] != empty && keys_[slot] != key) slot = (slot + 1) & mask;
+        if (keys_[slot] == empty) {
+          keys_[slot] = key;
+          values_[slot] = (uint32_t)points_.size();
+          points_.push_back(glm::normalize(points_[a] + points_[b]));
+        }
+        return values_[slot];
+      }
+
+    private:
+      static constexpr uint64_t empty = ~0ull;
+      std::vector<glm::vec3>& points_;
+      std::vector<uint64_t> keys_;
+      std::vector<uint32_t> values_;
+    };
+
+    void generate_ico_directions(int level, std::vector<glm::vec3>& points, std::vector<uint32_t>& triangles) {
+      const float t = 1.6180339887498949f;
+      static const float base[12][3] = {
+        { -1, t, 0 }, { 1, t, 0 }, { -1, -t, 0 }, { 1, -t, 0 },
+        { 0, -1, t }, { 0, 1, t }, { 0, -1, -t }, { 0, 1, -t },
+        { t, 0, -1 }, { t, 0, 1 }, { -t, 0, -1 }, { -t, 0, 1 }
+      };
+      static const uint32_t faces[20][3] = {
+        { 0, 11, 5 }, { 0, 5, 1 }, { 0, 1, 7 }, { 0, 7, 10 }, { 0, 10, 11 },
+        { 1, 5, 9 }, { 5, 11, 4 }, { 11, 10, 2 }, { 10, 7, 6 }, { 7, 1, 8 },
+        { 3, 9, 4 }, { 3, 4, 2 }, { 3, 2, 6 }, { 3, 6, 8 }, { 3, 8, 9 },
+        { 4, 9, 5 }, { 2, 4, 11 }, { 6, 2, 10 }, { 8, 6, 7 }, { 9, 8, 1 }
+      };
+
+      // Every level adds one vertex per edge: V = 10 * 4^level + 2
+      points.reserve(((size_t)10 << (2 * level)) + 2);
+      for (const float* p : base) points.push_back(glm::normalize(glm::vec3(p[0], p[1], p[2])));
+      for (const uint32_t* f : faces) triangles.insert(triangles.end(), f, f + 3);
+
+      std::vector<uint32_t> next;
+      for (int l = 0; l < level; l++) {
+        edge_midpoints midpoints(triangles.size() / 2, points);
+        next.clear();
+        next.reserve(triangles.size() * 4);
+        for (size_t i = 0; i < triangles.size(); i += 3) {
+          uint32_t a = triangles[i], b = triangles[i + 1], c = triangles[i + 2];
+          uint32_t ab = midpoints.get(a, b), bc = midpoints.get(b, c), ca = midpoints.get(c, a);
+          next.insert(next.end(), { a, ab, ca, b, bc, ab, c, ca, bc, ab, bc, ca });
+        }
+        triangles.swap(next);
+      }
+    }
+
+    void generate_cube_directions(int level, std::vector<glm::vec3>& points, std::vector<uint32_t>& triangles) {
+      // Face normal and first grid axis; the second axis is cross(normal, first)
+      static const float faces[6][2][3] = {
+        { { 1, 0, 0 }, { 0, 0, -1 } }, { { -1, 0, 0 }, { 0, 0, 1 } },
+        { { 0, 1, 0 }, { 1, 0, 0 } },  { { 0, -1, 0 }, { 1, 0, 0 } },
+        { { 0, 0, 1 }, { 1, 0, 0 } },  { { 0, 0, -1 }, { -1, 0, 0 } }
+      };
+      int n = 1 << level;
+      uint32_t row = n + 1;
+      points.reserve(6 * row * row);
+      triangles.reserve(3 * sphere_triangle_count(sphere_kind::cube, level));
+      for (const auto& face : faces) {
+        glm::vec3 normal(face[0][0], face[0][1], face[0][2]);
+        glm::vec3 axis_u(face[1][0], face[1][1], face[1][2]);
+        glm::vec3 axis_v = glm::cross(normal, axis_u);
+        uint32_t first = (uint32_t)points.size();
+        for (int y = 0; y <= n; y++)
+          for (int x = 0; x <= n; x++)
+            points.push_back(cube_to_sphere(normal + axis_u * (2.0f * x / n - 1.0f) + axis_v * (2.0f * y / n - 1.0f)));
+        for (int y = 0; y < n; y++) {
+          for (int x = 0; x < n; x++) {
+            uint32_t a = first + y * row + x;
+            uint32_t d = a + row;
+            triangles.insert(triangles.end(), { a, a + 1, d + 1, a, d + 1, d });
+          }
+        }
+      }
+    }
+
+    // Turns unit directions + triangles into vertices with seam-correct UVs.
+    // Triangles straddling u = 0 / 1 get copies of their low-u corners
+    // shifted by +1, and every pole corner gets its own copy with the mean u
+    // of the other two corners.
+    void build_seamless(const std::vector<glm::vec3>& points, const std::vector<uint32_t>& triangles, indexed_mesh& out) {
+      out.vertices.resize(points.size());
+      for (size_t i = 0; i < points.size(); i++) {
+        const glm::vec3& p = points[i];
+        float u = 0.5f - (float)(std::atan2(p.z, p.x) / (2.0 * pi));
+        if (u >= 1.0f) u -= 1.0f;
+        float v = 0.5f + (float)(std::asin(glm::clamp(p.y, -1.0f, 1.0f)) / pi);
+        out.vertices[i] = { p, p, glm::vec2(u, v) };
+      }
+
+      const uint32_t none = ~0u;
+      std::vector<uint32_t> wrapped(points.size(), none);
+      out.indices = triangles;
+      for (size_t t = 0; t < out.indices.size(); t += 3) {
+        uint32_t* corner = &out.indices[t];
+        bool pole[3];
+        float min_u = 2.0f, max_u = -1.0f;
+        for (int k = 0; k < 3; k++) {
+          const glm::vec3& p = points[corner[k]];
+          pole[k] = p.x * p.x + p.z * p.z < 1e-10f;
+          if (pole[k]) continue;
+          min_u = std::min(min_u, out.vertices[corner[k]].uv.x);
+          max_u = std::max(max_u, out.vertices[corner[k]].uv.x);
+        }
+
+        if (max_u - min_u > 0.5f) {
+          for (int k = 0; k < 3; k++) {
+            if (pole[k] || out.vertices[corner[k]].uv.x >= 0.5f) continue;
+            if (wrapped[corner[k]] == none) {
+              vertex copy = out.vertices[corner[k]];
+              copy.uv.x += 1.0f;
+              wrapped[corner[k]] = (uint32_t)out.vertices.size();
+              out.vertices.push_back(copy);
+            }
+            corner[k] = wrapped[corner[k]];
+          }
+        }
+
+        for (int k = 0; k < 3; k++) {
+          if (!pole[k]) continue;
+          float sum = 0.0f;
+          int count = 0;
+          for (int o = 0; o < 3; o++)
+            if (!pole[o]) { sum += out.vertices[corner[o]].uv.x; count++; }
+          vertex copy = out.vertices[corner[k]];
+          copy.uv.x = count ? sum / count : 0.5f;
+          corner[k] = (uint32_t)out.vertices.size();
+          out.vertices.push_back(copy);
+        }
+      }
+
+      // Drops the unused originals of the pole vertices
+      optimize_vertex_fetch(out);
+    }
+
+    // Largest gap between a flat triangle and the sphere it approximates:
+    // radius minus the distance of the triangle's plane from the centre
+    float chord_error(const indexed_mesh& m, float radius) {
+      float error = 0.0f;
+      for (size_t t = 0; t + 2 < m.indices.size(); t += 3) {
+        const glm::vec3& a = m.vertices[m.indices[t]].position;
+        glm::vec3 n = glm::cross(m.vertices[m.indices[t + 1]].position - a, m.vertices[m.indices[t + 2]].position - a);
+        float length = glm::length(n);
+        if (length > 0.0f) error = std::max(error, radius - std::fabs(glm::dot(n, a)) / length);
+      }
+      return error;
+    }
+
+  }
+
+  glm::vec3 cube_to_sphere(const glm::vec3& p) {
+    glm::vec3 q = p * p;
+    return glm::vec3(
+      p.x * std::sqrt(std::max(0.0f, 1.0f - q.y / 2.0f - q.z / 2.0f + q.y * q.z / 3.0f)),
+      p.y * std::sqrt(std::max(0.0f, 1.0f - q.z / 2.0f - q.x / 2.0f + q.z * q.x / 3.0f)),
+      p.z * std::sqrt(std::max(0.0f, 1.0f - q.x / 2.0f - q.y / 2.0f + q.x * q.y / 3.0f)));
+  }
+
+  void generate_sphere(const sphere_params& params, indexed_mesh& out, std::vector<glm::vec4>* tangents) {
+    out.vertices.clear();
+    out.indices.clear();
+    out.lods.clear();
+    out.meshlets.clear();
+    int level = std::max(0, params.level);
+
+    if (params.kind == sphere_kind::uv) {
+      generate_uv(level, out, tangents);
+    } else {
+      std::vector<glm::vec3> points;
+      std::vector<uint32_t> triangles;
+      if (params.kind == sphere_kind::ico)
+        generate_ico_directions(level, points, triangles);
+      else
+        generate_cube_directions(level, points, triangles);
+      build_seamless(points, triangles, out);
+      if (tangents) {
+        tangents->resize(out.vertices.size());
+        for (size_t i = 0; i < out.vertices.size(); i++) (*tangents)[i] = tangent_at_u(out.vertices[i].uv.x);
+      }
+    }
+
+    float lo[3] = { std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+    float hi[3] = { std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest() };
+    for (vertex& v : out.vertices) {
+      v.position *= params.radius;
+      for (int c = 0; c < 3; c++) {
+        lo[c] = std::min(lo[c], v.position[c]);
+        hi[c] = std::max(hi[c], v.position[c]);
+      }
+    }
+    out.bounds_min = glm::vec3(lo[0], lo[1], lo[2]);
+    out.bounds_max = glm::vec3(hi[0], hi[1], hi[2]);
+  }
+
+  void generate_sphere_lods(const sphere_params& params, indexed_mesh& out) {
+    generate_sphere(params, out);
+    optimize_mesh(out);
+    build_meshlets(out);
+    out.lods.push_back({ 0, (uint32_t)out.indices.size(), 0.0f });
+
+    indexed_mesh coarser;
+    for (int level = std::max(0, params.level) - 1; level >= 0; level--) {
+      generate_sphere(sphere_params(params.kind, level, params.radius), coarser);
+      uint32_t base = (uint32_t)out.vertices.size();
+      out.lods.push_back({ (uint32_t)out.indices.size(), (uint32_t)coarser.indices.size(), chord_error(coarser, params.radius) });
+      out.vertices.insert(out.vertices.end(), coarser.vertices.begin(), coarser.vertices.end());
+      for (uint32_t index : coarser.indices) out.indices.push_back(base + index);
+    }
+  }
+
+}
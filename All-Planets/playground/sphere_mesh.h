@@ -0,0 +1,57 @@
+#ifndef SPHERE_MESH_H
+#define SPHERE_MESH_H
+
+#include <cstddef>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "playground/mesh_pipeline.h"
+
+// Procedural spheres, generated straight into indexed buffers. Normals and
+// tangents are analytic, UVs follow the equirectangular convention of
+// spherical_uv, and vertices on the u = 0 / u = 1 seam and at the poles are
+// duplicated so that no triangle interpolates across the seam.
+namespace mesh {
+
+  enum class sphere_kind {
+    uv,   // latitude/longitude grid: 8 << level slices, 4 << level stacks
+    ico,  // icosahedron, each triangle split in four `level` times
+    cube  // cube with (1 << level)^2 quads per face, projected onto the sphere
+  };
+
+  struct sphere_params {
+    sphere_kind kind;
+    int level;
+    float radius;
+
+    sphere_params(sphere_kind k = sphere_kind::uv, int l = 3, float r = 1.0f) : kind(k), level(l), radius(r) {}
+  };
+
+  // Triangle count of a generated sphere, for sizing buffers up front.
+  constexpr size_t sphere_triangle_count(sphere_kind kind, int level) {
+    return kind == sphere_kind::uv ? (size_t)2 * (8u << level) * ((4u << level) - 1)
+         : kind == sphere_kind::ico ? (size_t)20 << (2 * level)
+         : (size_t)12 << (2 * level);
+  }
+
+  // Generates the sphere into out (vertices, indices, bounds), counter-
+  // clockwise seen from outside. tangents, if given, receives one tangent per
+  // vertex pointing along +u, with the bitangent sign (+v) in w.
+  // UV spheres up to level 5 use sine/cosine tables built at compile time.
+  void generate_sphere(const sphere_params& params, indexed_mesh& out, std::vector<glm::vec4>* tangents = nullptr);
+
+  // The sphere at params.level plus every coarser level down to 0, as one
+  // LOD chain (see indexed_mesh::lods). Each level brings its own vertices;
+  // its error is how far its flat triangles sink below the true sphere.
+  // Level 0 is reordered for the GPU (see optimize_mesh) and split into
+  // meshlets (see build_meshlets).
+  void generate_sphere_lods(const sphere_params& params, indexed_mesh& out);
+
+  // Maps a point on the surface of the cube [-1, 1]^3 onto the unit sphere,
+  // spreading the cells more evenly than plain normalization would.
+  glm::vec3 cube_to_sphere(const glm::vec3& p);
+
+}
+
+#endif
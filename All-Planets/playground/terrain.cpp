@@ -0,0 +1,318 @@
+#include "terrain.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <common/image.hpp>
+#include "playground/sphere_mesh.h"
+
+namespace terrain {
+
+  namespace {
+
+    const float pi = 3.14159265358979f;
+
+    // Face normal and first grid axis; the second axis is cross(normal,
+    // first). Same faces as the sphere_kind::cube generator.
+    const float faces[6][2][3] = {
+      { { 1, 0, 0 }, { 0, 0, -1 } }, { { -1, 0, 0 }, { 0, 0, 1 } },
+      { { 0, 1, 0 }, { 1, 0, 0 } },  { { 0, -1, 0 }, { 1, 0, 0 } },
+      { { 0, 0, 1 }, { 1, 0, 0 } },  { { 0, 0, -1 }, { -1, 0, 0 } }
+    };
+
+    // Detail octaves start at this frequency (cycles per unit of direction)
+    const float detail_frequency = 32.0f;
+    const int detail_octaves = 12;
+    const int base_octaves = 4;
+
+    // Unit direction of face coordinates (s, t) in [-1, 1]; a little past
+    // the face edge still gives a direction continuing the face
+    glm::vec3 face_direction(uint32_t face, float s, float t) {
+      glm::vec3 normal(faces[face][0][0], faces[face][0][1], faces[face][0][2]);
+      glm::vec3 axis_u(faces[face][1][0], faces[face][1][1], faces[face][1][2]);
+      glm::vec3 axis_v = glm::cross(normal, axis_u);
+      return glm::normalize(mesh::cube_to_sphere(normal + axis_u * s + axis_v * t));
+    }
+
+    // Face coordinates of the chunk's corner (x, y) = (0, 0) and its size
+    void face_range(const chunk_key& key, float& s0, float& t0, float& size) {
+      size = 2.0f / (float)(1u << key.level);
+      s0 = -1.0f + size * key.x;
+      t0 = -1.0f + size * key.y;
+    }
+
+    float skirt_depth(const planet_params& params, int level) { return 0.05f * chunk_size(params, level); }
+
+    uint32_t hash(int32_t x, int32_t y, int32_t z) {
+      uint32_t h = (uint32_t)x * 0x8da6b343u ^ (uint32_t)y * 0xd8163841u ^ (uint32_t)z * 0xcb1ab31fu;
+      h ^= h >> 16;
+      h *= 0x7feb352du;
+      h ^= h >> 15;
+      h *= 0x846ca68bu;
+      return h ^ (h >> 16);
+    }
+
+    // Trilinear value noise in [0, 1] with a smoothstep fade
+    float value_noise(const glm::vec3& p) {
+      glm::vec3 cell = glm::floor(p);
+      glm::vec3 f = p - cell;
+      glm::vec3 w = f * f * (3.0f - 2.0f * f);
+      int32_t x = (int32_t)cell.x, y = (int32_t)cell.y, z = (int32_t)cell.z;
+      float c[8];
+      for (int i = 0; i < 8; i++) c[i] = (hash(x + (i & 1), y + (i >> 1 & 1), z + (i >> 2)) >> 8) * (1.0f / 16777216.0f);
+      float x00 = c[0] + (c[1] - c[0]) * w.x, x10 = c[2] + (c[3] - c[2]) * w.x;
+      float x01 = c[4] + (c[5] - c[4]) * w.x, x11 = c[6] + (c[7] - c[6]) * w.x;
+      float y0 = x00 + (x10 - x00) * w.y, y1 = x01 + (x11 - x01) * w.y;
+      return y0 + (y1 - y0) * w.z;
+    }
+
+    // Octaves halve in amplitude and double in frequency. The sum is scaled
+    // by the amplitude of all `total` octaves, so leaving out the finest
+    // ones only removes detail and never shifts the surface.
+    float fractal_noise(const glm::vec3& direction, float frequency, int octaves, int total) {
+      float sum = 0.0f, amplitude = 0.5f, norm = 0.0f;
+      for (int o = 0; o < total; o++) {
+        if (o < octaves) sum += amplitude * value_noise(direction * frequency + glm::vec3(17.0f * o));
+        norm += amplitude;
+        amplitude *= 0.5f;
+        frequency *= 2.0f;
+      }
+      return sum / norm;
+    }
+
+    glm::vec2 body_uv(const glm::vec3& d) {
+      // As the generated body spheres, so the same textures fit
+      return glm::vec2(0.5f - std::atan2(d.z, d.x) / (2.0f * pi), 0.5f + std::asin(glm::clamp(d.y, -1.0f, 1.0f)) / pi);
+    }
+
+  }
+
+  bool heightmap::load_bmp(const std::string& path) {
+    BMPImage image;
+    if (!readBMP(path.c_str(), image) || image.width == 0 || image.height == 0) return false;
+    width_ = image.width;
+    height_ = image.height;
+    samples_.resize((size_t)width_ * height_);
+    // Rows are bottom-up like the texture upload, so row 0 is v = 0
+    for (size_t i = 0; i < samples_.size(); i++)
+      samples_[i] = (image.data[3 * i] + image.data[3 * i + 1] + image.data[3 * i + 2]) * (1.0f / 765.0f);
+    return true;
+  }
+
+  float heightmap::sample(const glm::vec3& direction) const {
+    if (samples_.empty()) return 0.0f;
+    glm::vec2 uv = body_uv(direction);
+    float x = uv.x * width_ - 0.5f, y = glm::clamp(uv.y * height_ - 0.5f, 0.0f, (float)(height_ - 1));
+    float fx = std::floor(x), fy = std::floor(y);
+    float wx = x - fx, wy = y - fy;
+    // Wraps around in longitude, clamps at the poles
+    unsigned int x0 = (unsigned int)(((int)fx % (int)width_ + (int)width_) % (int)width_), x1 = (x0 + 1) % width_;
+    unsigned int y0 = (unsigned int)fy, y1 = std::min(y0 + 1, height_ - 1);
+    const float* r0 = &samples_[(size_t)y0 * width_];
+    const float* r1 = &samples_[(size_t)y1 * width_];
+    float a = r0[x0] + (r0[x1] - r0[x0]) * wx;
+    float b = r1[x0] + (r1[x1] - r1[x0]) * wx;
+    return a + (b - a) * wy;
+  }
+
+  float surface_height(const planet_params& params, const heightmap* map, const glm::vec3& direction, int level) {
+    float base = map && !map->empty() ? map->sample(direction) : fractal_noise(direction, 2.0f, base_octaves, base_octaves);
+    // Octaves whose cells span fewer than two grid cells would only alias
+    float spacing = 2.0f / ((float)(1 << level) * params.grid);
+    int octaves = 0;
+    for (float f = detail_frequency; octaves < detail_octaves && f * spacing < 0.5f; f *= 2.0f) octaves++;
+    return params.height_scale * base + params.detail_scale * fractal_noise(direction, detail_frequency, octaves, detail_octaves);
+  }
+
+  float max_height(const planet_params& params) { return params.height_scale + params.detail_scale; }
+
+  chunk_bounds bounds_of(const planet_params& params, const chunk_key& key) {
+    float s0, t0, size;
+    face_range(key, s0, t0, size);
+    float low = params.radius - skirt_depth(params, key.level), high = params.radius + max_height(params);
+    glm::vec3 lo(high), hi(-high);
+    for (int j = 0; j <= 2; j++) {
+      for (int i = 0; i <= 2; i++) {
+        glm::vec3 d = face_direction(key.face, s0 + 0.5f * size * i, t0 + 0.5f * size * j);
+        lo = glm::min(lo, glm::min(d * low, d * high));
+        hi = glm::max(hi, glm::max(d * low, d * high));
+      }
+    }
+    chunk_bounds b;
+    b.center = 0.5f * (lo + hi);
+    // Between the samples the surface bulges out by up to the sagitta of a
+    // half chunk wide arc
+    float half = 0.5f * chunk_size(params, key.level);
+    b.radius = 0.5f * glm::length(hi - lo) + half * half / (2.0f * params.radius);
+    return b;
+  }
+
+  bool below_horizon(const planet_params& params, const glm::vec3& eye, const chunk_bounds& b) {
+    float d = glm::length(eye), c = glm::length(b.center);
+    if (d <= params.radius || c <= b.radius) return false;
+    // A point at distance rho from the centre is hidden once its angle from
+    // the eye's direction exceeds acos(R / d) + acos(R / rho); the bounds
+    // reach at most asin(radius / c) around their centre
+    float rho = std::min(c + b.radius, params.radius + max_height(params));
+    float angle = std::acos(glm::clamp(glm::dot(eye, b.center) / (d * c), -1.0f, 1.0f));
+    float spread = std::asin(b.radius / c);
+    return angle - spread > std::acos(params.radius / d) + std::acos(std::min(1.0f, params.radius / rho));
+  }
+
+  namespace {
+
+    bool in_view(const planet_params& params, const glm::vec3& eye, const mesh::frustum& f, const chunk_bounds& b) {
+      for (const glm::vec4& p : f.planes)
+        if (glm::dot(glm::vec3(p), b.center) + p.w < -b.radius) return false;
+      return !below_horizon(params, eye, b);
+    }
+
+    // key is resident and in view, b are its bounds
+    void select(const planet_params& params, const glm::vec3& eye, const mesh::frustum& f,
+                const std::function<const chunk_bounds*(const chunk_key&)>& resident, const chunk_key& key,
+                const chunk_bounds& b, std::vector<chunk_key>& draw, std::vector<chunk_key>& wanted) {
+      float distance = std::max(0.0f, glm::length(eye - b.center) - b.radius);
+      if ((int)key.level < params.max_level && distance < params.split_distance * chunk_size(params, key.level)) {
+        // Children that are built are judged by their own bounds, the others
+        // by what they could hold
+        chunk_key children[4];
+        const chunk_bounds* bounds[4];
+        bool ready = true;
+        for (int i = 0; i < 4; i++) {
+          children[i] = key.child(i);
+          bounds[i] = resident(children[i]);
+          if (!bounds[i] && in_view(params, eye, f, bounds_of(params, children[i]))) {
+            wanted.push_back(children[i]);
+            ready = false;
+          }
+        }
+        if (ready) {
+          for (int i = 0; i < 4; i++)
+            if (bounds[i] && in_view(params, eye, f, *bounds[i]))
+              select(params, eye, f, resident, children[i], *bounds[i], draw, wanted);
+          return;
+        }
+      }
+      draw.push_back(key);
+    }
+
+  }
+
+  void select_chunks(const planet_params& params, const glm::vec3& eye, const mesh::frustum& f,
+                     const std::function<const chunk_bounds*(const chunk_key&)>& resident, std::vector<chunk_key>& draw,
+                     std::vector<chunk_key>& wanted) {
+    draw.clear();
+    wanted.clear();
+    for (uint32_t i = 0; i < root_count; i++) {
+      chunk_key root = root_chunk(i);
+      const chunk_bounds* b = resident(root);
+      if (b && in_view(params, eye, f, *b)) select(params, eye, f, resident, root, *b, draw, wanted);
+    }
+    std::stable_sort(wanted.begin(), wanted.end(), [](const chunk_key& a, const chunk_key& b) { return a.level < b.level; });
+  }
+
+  void chunk_indices(int grid, std::vector<uint32_t>& out) {
+    uint32_t row = grid + 1;
+    out.clear();
+    out.reserve(6 * grid * grid + 4 * 6 * grid);
+    for (int y = 0; y < grid; y++) {
+      for (int x = 0; x < grid; x++) {
+        uint32_t a = y * row + x;
+        uint32_t d = a + row;
+        out.insert(out.end(), { a, a + 1, d + 1, a, d + 1, d });
+      }
+    }
+    // Edges in the order bottom, right, top, left, each walked along +u or
+    // +v; top and left face the other way and wind the other way round
+    uint32_t skirt = row * row;
+    for (int e = 0; e < 4; e++) {
+      for (int k = 0; k < grid; k++) {
+        uint32_t g0, g1;
+        if (e == 0) g0 = k;                    // y = 0
+        else if (e == 1) g0 = k * row + grid;  // x = grid
+        else if (e == 2) g0 = grid * row + k;  // y = grid
+        else g0 = k * row;                     // x = 0
+        g1 = g0 + (e == 0 || e == 2 ? 1 : row);
+        uint32_t s0 = skirt + e * row + k, s1 = s0 + 1;
+        if (e < 2) out.insert(out.end(), { g0, s0, g1, g1, s0, s1 });
+        else out.insert(out.end(), { g0, g1, s0, g1, s1, s0 });
+      }
+    }
+  }
+
+  void build_chunk(const planet_params& params, const heightmap* map, const chunk_key& key, chunk_mesh& out) {
+    int grid = params.grid;
+    int row = grid + 1;
+    float s0, t0, size;
+    face_range(key, s0, t0, size);
+    float step = size / grid;
+
+    // Positions on a grid one cell wider on every side, so every normal is a
+    // central difference; chunks of the same face share their edge normals
+    int wide = grid + 3;
+    std::vector<glm::vec3> directions((size_t)wide * wide);
+    std::vector<glm::vec3> positions((size_t)wide * wide);
+    for (int j = 0; j < wide; j++) {
+      for (int i = 0; i < wide; i++) {
+        glm::vec3 d = face_direction(key.face, s0 + step * (i - 1), t0 + step * (j - 1));
+        directions[j * wide + i] = d;
+        positions[j * wide + i] = d * (params.radius + surface_height(params, map, d, key.level));
+      }
+    }
+
+    out.key = key;
+    out.origin = face_direction(key.face, s0 + 0.5f * size, t0 + 0.5f * size) * params.radius;
+    out.vertices.resize(chunk_vertex_count(grid));
+    float u_min = 1.0f, u_max = 0.0f;
+    for (int j = 0; j < row; j++) {
+      for (int i = 0; i < row; i++) {
+        size_t w = (size_t)(j + 1) * wide + (i + 1);
+        glm::vec3 du = positions[w + 1] - positions[w - 1];
+        glm::vec3 dv = positions[w + wide] - positions[w - wide];
+        mesh::vertex& v = out.vertices[j * row + i];
+        v.position = positions[w] - out.origin;
+        v.normal = glm::normalize(glm::cross(du, dv));
+        v.uv = body_uv(directions[w]);
+        u_min = std::min(u_min, v.uv.x);
+        u_max = std::max(u_max, v.uv.x);
+      }
+    }
+    // A pole is a corner here (the roots are a level down) and atan2 gives
+    // it an arbitrary u; the diagonal neighbour's is the middle of the
+    // longitudes the chunk covers there
+    for (int c = 0; c < 4; c++) {
+      int i = c & 1 ? grid : 0, j = c >> 1 ? grid : 0;
+      const glm::vec3& d = directions[(size_t)(j + 1) * wide + (i + 1)];
+      if (d.x * d.x + d.z * d.z < 1e-10f)
+        out.vertices[j * row + i].uv.x = out.vertices[(c & 1 ? grid - 1 : 1) + (c >> 1 ? grid - 1 : 1) * row].uv.x;
+    }
+    // Across the seam, continue past u = 1 rather than sweep the texture
+    // backwards. No chunk spans more than a quarter turn otherwise.
+    if (u_max - u_min > 0.5f)
+      for (int k = 0; k < row * row; k++)
+        if (out.vertices[k].uv.x < 0.5f) out.vertices[k].uv.x += 1.0f;
+
+    // Skirts: the edge vertices again, lowered
+    float depth = skirt_depth(params, key.level);
+    for (int e = 0; e < 4; e++) {
+      for (int k = 0; k < row; k++) {
+        int i = e == 0 || e == 2 ? k : (e == 1 ? grid : 0);
+        int j = e == 1 || e == 3 ? k : (e == 2 ? grid : 0);
+        mesh::vertex v = out.vertices[j * row + i];
+        v.position -= directions[(size_t)(j + 1) * wide + (i + 1)] * depth;
+        out.vertices[row * row + e * row + k] = v;
+      }
+    }
+
+    glm::vec3 lo(out.vertices[0].position), hi(lo);
+    for (const mesh::vertex& v : out.vertices) {
+      lo = glm::min(lo, v.position);
+      hi = glm::max(hi, v.position);
+    }
+    out.bounds.center = out.origin + 0.5f * (lo + hi);
+    out.bounds.radius = 0.0f;
+    for (const mesh::vertex& v : out.vertices)
+      out.bounds.radius = std::max(out.bounds.radius, glm::length(out.origin + v.position - out.bounds.center));
+  }
+
+}
@@ -0,0 +1,135 @@
+#ifndef TERRAIN_H
+#define TERRAIN_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "playground/mesh_meshlet.h"
+#include "playground/mesh_pipeline.h"
+
+// Planetary terrain on a cube-sphere: each quarter of a cube face is the
+// root of a quadtree whose nodes (chunks) are grids of the same resolution
+// displaced by a height field, so a chunk four levels down is 16 times
+// denser than its root. Nothing in here touches OpenGL; chunks are built on
+// worker threads and uploaded by PlanetTerrain.
+namespace terrain {
+
+  // A node of one of the six quadtrees: cell (x, y) of the 2^level x 2^level
+  // grid on cube face `face` (same face order as sphere_kind::cube).
+  struct chunk_key {
+    uint32_t face;
+    uint32_t level;
+    uint32_t x;
+    uint32_t y;
+
+    uint64_t id() const { return (uint64_t)face << 61 | (uint64_t)level << 56 | (uint64_t)x << 28 | y; }
+    chunk_key child(int i) const { return { face, level + 1, 2 * x + (i & 1), 2 * y + (i >> 1) }; }
+    chunk_key parent() const { return { face, level - 1, x / 2, y / 2 }; }
+  };
+
+  // The quadtrees start at level 1, not at whole faces: the poles sit at the
+  // centres of the +y and -y faces, so this way they are only ever a chunk
+  // corner and no chunk wraps all the way round one (see build_chunk).
+  const uint32_t root_level = 1;
+  const uint32_t root_count = 6u << (2 * root_level);
+  // Root i of root_count
+  inline chunk_key root_chunk(uint32_t i) {
+    uint32_t side = 1u << root_level;
+    return { i / (side * side), root_level, i % side, i / side % side };
+  }
+
+  // Heights in [0, 1], equirectangular like the body textures (u along
+  // longitude, v = 0 at the south pole), sampled bilinearly.
+  class heightmap {
+  public:
+    heightmap() : width_(0), height_(0) {}
+
+    // Luminance of a 24 bit BMP. Returns false if it cannot be read.
+    bool load_bmp(const std::string& path);
+    bool empty() const { return samples_.empty(); }
+    float sample(const glm::vec3& direction) const;
+
+  private:
+    unsigned int width_;
+    unsigned int height_;
+    std::vector<float> samples_;
+  };
+
+  struct planet_params {
+    float radius;          // model units, the surface at height 0
+    float height_scale;    // displacement of a heightmap value of 1
+    float detail_scale;    // amplitude of the fractal noise added on top; carries the whole relief without a heightmap
+    int grid;              // quads along a chunk side
+    int max_level;         // deepest quadtree level
+    float split_distance;  // a chunk splits while the eye is closer than this many chunk sizes
+
+    planet_params(float r = 75.0f)
+      : radius(r), height_scale(0.01f * r), detail_scale(0.005f * r), grid(32), max_level(12), split_distance(2.0f) {}
+  };
+
+  // Height above the radius at a unit direction, in model units. Noise
+  // octaves finer than the grid of a chunk at `level` cannot be resolved
+  // there and are left out.
+  float surface_height(const planet_params& params, const heightmap* map, const glm::vec3& direction, int level);
+  // Highest surface_height can return
+  float max_height(const planet_params& params);
+
+  // Edge length of a chunk at level, measured along the surface
+  inline float chunk_size(const planet_params& params, int level) {
+    return params.radius * 1.5707963f / (float)(1 << level);
+  }
+
+  struct chunk_bounds {
+    glm::vec3 center;
+    float radius;
+  };
+  // Bounding sphere of everything a chunk can hold, skirts included, known
+  // before it is built: it spans the whole height range of the planet
+  chunk_bounds bounds_of(const planet_params& params, const chunk_key& key);
+
+  // True if the planet, as a solid ball of params.radius, hides the whole
+  // of b from eye. Every point of the surface lies above that ball.
+  bool below_horizon(const planet_params& params, const glm::vec3& eye, const chunk_bounds& b);
+
+  // Picks the chunks to draw for eye and the frustum f, both in model
+  // space. Walking down from the roots, a chunk splits while the eye
+  // is within split_distance chunk sizes of it, but only once every child
+  // that is in view is resident; until then it is drawn itself, so the
+  // surface never has holes while children load. resident is asked about
+  // every chunk the walk touches and returns the bounds of the built chunk,
+  // or null if it is not resident (the roots must be). wanted receives the
+  // missing children, coarsest first. Chunks out of the frustum or below the
+  // horizon are skipped along with their subtrees.
+  void select_chunks(const planet_params& params, const glm::vec3& eye, const mesh::frustum& f,
+                     const std::function<const chunk_bounds*(const chunk_key&)>& resident, std::vector<chunk_key>& draw,
+                     std::vector<chunk_key>& wanted);
+
+  // Vertices per chunk: the (grid + 1)^2 surface grid, then one skirt vertex
+  // below every edge vertex, edge by edge
+  inline size_t chunk_vertex_count(int grid) { return (size_t)(grid + 1) * (grid + 1) + 4 * (size_t)(grid + 1); }
+  // Index buffer shared by every chunk: the grid, counter-clockwise from
+  // outside, then the skirts hanging from its four edges. Skirts hide the
+  // cracks where chunks of different levels meet.
+  void chunk_indices(int grid, std::vector<uint32_t>& out);
+
+  struct chunk_mesh {
+    chunk_key key;
+    glm::vec3 origin;                   // model space; vertex positions are relative to it
+    chunk_bounds bounds;                // of the vertices, model space
+    std::vector<mesh::vertex> vertices; // chunk_vertex_count(grid) of them
+  };
+
+  // Builds the displaced grid of one chunk with normals from the height
+  // field and UVs of the body texture (continued past u = 1 where a chunk
+  // straddles the seam, for GL_REPEAT; a pole corner takes the u of its
+  // diagonal neighbour). Thread safe.
+  void build_chunk(const planet_params& params, const heightmap* map, const chunk_key& key, chunk_mesh& out);
+
+}
+
+#endif
@@ -0,0 +1,101 @@
+#include "vertex_format.h"
+
+#include <cmath>
+#include <cstring>
+
+#include <glm/gtc/packing.hpp>
+
+#include <common/parallel.hpp>
+
+namespace mesh {
+
+  namespace {
+
+    size_t position_bytes(position_encoding e) { return e == position_encoding::float3 ? 12 : 8; }
+    size_t normal_bytes(normal_encoding e) { return e == normal_encoding::float3 ? 12 : 4; }
+    size_t uv_bytes(uv_encoding e) { return e == uv_encoding::float2 ? 8 : 4; }
+
+    float sign_not_zero(float v) { return v >= 0.0f ? 1.0f : -1.0f; }
+
+  }
+
+  vertex_layout layout_of(const vertex_format& format) {
+    vertex_layout layout;
+    layout.position = 0;
+    layout.normal = layout.position + position_bytes(format.position);
+    layout.uv = layout.normal + normal_bytes(format.normal);
+    layout.stride = layout.uv + uv_bytes(format.uv);
+    return layout;
+  }
+
+  glm::vec2 octahedral_encode(const glm::vec3& n) {
+    float l1 = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+    if (!(l1 > 0.0f)) return glm::vec2(0.0f);
+    glm::vec2 p(n.x / l1, n.y / l1);
+    // Lower hemisphere folds over the diagonals
+    if (n.z < 0.0f)
+      p = glm::vec2((1.0f - std::fabs(p.y)) * sign_not_zero(p.x), (1.0f - std::fabs(p.x)) * sign_not_zero(p.y));
+    return p;
+  }
+
+  glm::vec3 octahedral_decode(const glm::vec2& e) {
+    glm::vec3 n(e.x, e.y, 1.0f - std::fabs(e.x) - std::fabs(e.y));
+    if (n.z < 0.0f) {
+      float x = n.x;
+      n.x = (1.0f - std::fabs(n.y)) * sign_not_zero(x);
+      n.y = (1.0f - std::fabs(x)) * sign_not_zero(n.y);
+    }
+    return glm::normalize(n);
+  }
+
+  void pack_vertices(const vertex* vertices, size_t count, const vertex_format& format,
+                     const glm::vec3& bounds_min, const glm::vec3& bounds_max, packed_vertices& out) {
+    vertex_layout layout = layout_of(format);
+    out.decode = vertex_decode();
+    out.decode.format = format;
+    out.stride = layout.stride;
+    out.count = count;
+    out.data.assign(count * layout.stride, 0);
+
+    glm::vec3 inverse_extent(0.0f);
+    if (format.position == position_encoding::unorm16) {
+      glm::vec3 extent = bounds_max - bounds_min;
+      out.decode.position_offset = bounds_min;
+      out.decode.position_scale = extent;
+      for (int c = 0; c < 3; c++) inverse_extent[c] = extent[c] > 0.0f ? 1.0f / extent[c] : 0.0f;
+    }
+
+    parallelFor(count, 16384, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) {
+        const vertex& v = vertices[i];
+        uint8_t* dst = out.data.data() + i * layout.stride;
+
+        if (format.position == position_encoding::float3) {
+          std::memcpy(dst + layout.position, &v.position, 12);
+        } else {
+          uint16_t q[3];
+          for (int c = 0; c < 3; c++) q[c] = glm::packUnorm1x16((v.position[c] - bounds_min[c]) * inverse_extent[c]);
+          std::memcpy(dst + layout.position, q, sizeof(q));
+        }
+
+        if (format.normal == normal_encoding::float3) {
+          std::memcpy(dst + layout.normal, &v.normal, 12);
+        } else if (format.normal == normal_encoding::octahedral16) {
+          uint32_t q = glm::packSnorm2x16(octahedral_encode(v.normal));
+          std::memcpy(dst + layout.normal, &q, sizeof(q));
+        } else {
+          uint32_t q = glm::packSnorm3x10_1x2(glm::vec4(v.normal, 0.0f));
+          std::memcpy(dst + layout.normal, &q, sizeof(q));
+        }
+
+        if (format.uv == uv_encoding::float2) {
+          std::memcpy(dst + layout.uv, &v.uv, 8);
+        } else {
+          uint32_t q = glm::packHalf2x16(v.uv);
+          std::memcpy(dst + layout.uv, &q, sizeof(q));
+        }
+      }
+    });
+  }
+
+}
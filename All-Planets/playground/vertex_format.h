@@ -0,0 +1,96 @@
+#ifndef VERTEX_FORMAT_H
+#define VERTEX_FORMAT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "playground/mesh_pipeline.h"
+
+// GPU vertex layouts. Meshes are processed and cached as float mesh::vertex;
+// pack_vertices converts them into one interleaved buffer in the selected
+// format right before upload. Attribute locations stay 0 position, 1 normal,
+// 2 UV whatever the format; vertex_decode carries what the vertex shader
+// needs to undo the encoding.
+namespace mesh {
+
+  enum class position_encoding {
+    float3,   // 12 bytes
+    unorm16   // 3 x 16 bit + 2 bytes padding, relative to the mesh bounds
+  };
+
+  enum class normal_encoding {
+    float3,       // 12 bytes
+    octahedral16, // 2 x snorm16 octahedral map, decoded in the shader
+    snorm10       // 10_10_10_2 snorm, decoded by the vertex fetch
+  };
+
+  enum class uv_encoding {
+    float2,   // 8 bytes
+    half2     // 2 x half float
+  };
+
+  struct vertex_format {
+    position_encoding position;
+    normal_encoding normal;
+    uv_encoding uv;
+
+    vertex_format(position_encoding p = position_encoding::float3, normal_encoding n = normal_encoding::float3,
+                  uv_encoding u = uv_encoding::float2) : position(p), normal(n), uv(u) {}
+    bool operator==(const vertex_format& o) const { return position == o.position && normal == o.normal && uv == o.uv; }
+    bool operator!=(const vertex_format& o) const { return !(*this == o); }
+  };
+
+  // Same layout as mesh::vertex, 32 bytes.
+  inline vertex_format float_format() { return vertex_format(); }
+  // Float positions, octahedral normals, half UVs: 20 bytes.
+  inline vertex_format packed_format() {
+    return vertex_format(position_encoding::float3, normal_encoding::octahedral16, uv_encoding::half2);
+  }
+  // Quantised positions, octahedral normals, half UVs: 16 bytes.
+  inline vertex_format compact_format() {
+    return vertex_format(position_encoding::unorm16, normal_encoding::octahedral16, uv_encoding::half2);
+  }
+
+  // Byte offsets of the attributes within one vertex, and the vertex size.
+  struct vertex_layout {
+    size_t position;
+    size_t normal;
+    size_t uv;
+    size_t stride;
+  };
+  vertex_layout layout_of(const vertex_format& format);
+
+  // Undoes the encoding in the vertex shader:
+  //   position = position_offset + position_scale * attribute 0
+  //   normal   = octahedral ? octahedral_decode(attribute 1.xy) : attribute 1.xyz
+  struct vertex_decode {
+    vertex_format format;
+    glm::vec3 position_scale;
+    glm::vec3 position_offset;
+
+    vertex_decode() : position_scale(1.0f), position_offset(0.0f) {}
+    bool octahedral() const { return format.normal == normal_encoding::octahedral16; }
+  };
+
+  struct packed_vertices {
+    vertex_decode decode;
+    size_t stride;
+    size_t count;
+    std::vector<uint8_t> data;
+  };
+
+  // Packs count vertices into format. Quantised positions are taken relative
+  // to [bounds_min, bounds_max], which must contain every vertex.
+  void pack_vertices(const vertex* vertices, size_t count, const vertex_format& format,
+                     const glm::vec3& bounds_min, const glm::vec3& bounds_max, packed_vertices& out);
+
+  // Octahedral map of a unit vector onto [-1, 1]^2 and back.
+  glm::vec2 octahedral_encode(const glm::vec3& n);
+  glm::vec3 octahedral_decode(const glm::vec2& e);
+
+}
+
+#endif
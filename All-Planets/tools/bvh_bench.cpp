@@ -0,0 +1,240 @@
+// Benchmark and cross-check for the picking BVH (playground/mesh_bvh.h).
+//
+// Builds a bumpy sphere of about 2M triangles (or segments^2 * 2 for the
+// segments given as first argument), places it in the scene instances
+// times (16 by default, so tens of millions of triangles) with rotations,
+// scales and offsets, and times
+//  - the mesh build and the scene build,
+//  - raycast, nearest_point and overlap_sphere against the scene.
+// A sample of every query is checked against brute force over all the
+// triangles; the program fails on any mismatch.
+//
+// Usage: bvh_bench [segments] [instances]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <playground/mesh_bvh.h>
+
+namespace {
+
+  typedef std::chrono::steady_clock bench_clock;
+
+  double seconds_since(bench_clock::time_point start) {
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+  }
+
+  // Latitude-longitude sphere of radius about 1 with ridges, so that the
+  // nearest point and the first hit are not trivially the radial ones
+  void bumpy_sphere(int segments, std::vector<mesh::vertex>& vertices, std::vector<uint32_t>& indices) {
+    for (int row = 0; row <= segments; row++) {
+      float theta = 3.14159265f * row / segments;
+      for (int col = 0; col <= segments; col++) {
+        float phi = 6.28318531f * col / segments;
+        glm::vec3 d(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+        float r = 1.0f + 0.05f * std::sin(7.0f * theta) * std::sin(5.0f * phi);
+        vertices.push_back(mesh::vertex{ d * r, d, glm::vec2((float)col / segments, (float)row / segments) });
+      }
+    }
+    for (int row = 0; row < segments; row++)
+      for (int col = 0; col < segments; col++) {
+        uint32_t a = row * (segments + 1) + col, b = a + 1, c = a + segments + 1, d = c + 1;
+        uint32_t quad[] = { a, c, b, b, c, d };
+        indices.insert(indices.end(), quad, quad + 6);
+      }
+  }
+
+  glm::vec3 corner(const std::vector<mesh::vertex>& vertices, const std::vector<uint32_t>& indices, uint32_t t, int k) {
+    return vertices[indices[3 * (size_t)t + k]].position;
+  }
+
+  // The queries one triangle at a time, in world space
+  struct brute_force {
+    const std::vector<mesh::vertex>& vertices;
+    const std::vector<uint32_t>& indices;
+    const std::vector<mesh::bvh_instance>& instances;
+
+    float raycast(const glm::vec3& origin, const glm::vec3& direction) const {
+      float best = INFINITY;
+      for (const mesh::bvh_instance& instance : instances) {
+        glm::mat4 inverse = glm::inverse(instance.model);
+        glm::vec3 o = glm::vec3(inverse * glm::vec4(origin, 1.0f)), d = glm::vec3(inverse * glm::vec4(direction, 0.0f));
+        for (uint32_t t = 0; t < indices.size() / 3; t++) {
+          glm::vec3 a = corner(vertices, indices, t, 0), e1 = corner(vertices, indices, t, 1) - a,
+                    e2 = corner(vertices, indices, t, 2) - a;
+          glm::vec3 p = glm::cross(d, e2);
+          float det = glm::dot(e1, p);
+          if (det == 0.0f) continue;
+          glm::vec3 s = o - a;
+          float u = glm::dot(s, p) / det;
+          glm::vec3 q = glm::cross(s, e1);
+          float v = glm::dot(d, q) / det;
+          float hit = glm::dot(e2, q) / det;
+          if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && hit >= 0.0f) best = std::min(best, hit);
+        }
+      }
+      return best;
+    }
+
+    // Plane distance when the foot of the perpendicular is inside, else the nearest edge
+    float distance(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) const {
+      glm::vec3 e0 = b - a, e1 = c - a, w = p - a;
+      float d00 = glm::dot(e0, e0), d01 = glm::dot(e0, e1), d11 = glm::dot(e1, e1);
+      float d20 = glm::dot(w, e0), d21 = glm::dot(w, e1);
+      float det = d00 * d11 - d01 * d01;
+      if (det > 0.0f) {
+        float v = (d11 * d20 - d01 * d21) / det, u = (d00 * d21 - d01 * d20) / det;
+        if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f) return glm::length(w - v * e0 - u * e1);
+      }
+      auto segment = [&](const glm::vec3& s, const glm::vec3& e) {
+        float t = glm::clamp(glm::dot(p - s, e - s) / std::max(glm::dot(e - s, e - s), 1e-30f), 0.0f, 1.0f);
+        return glm::length(p - (s + t * (e - s)));
+      };
+      return std::min(segment(a, b), std::min(segment(b, c), segment(c, a)));
+    }
+
+    float nearest(const glm::vec3& p, size_t& overlap, float radius) const {
+      float best = INFINITY;
+      overlap = 0;
+      for (const mesh::bvh_instance& instance : instances) {
+        for (uint32_t t = 0; t < indices.size() / 3; t++) {
+          glm::vec3 a = glm::vec3(instance.model * glm::vec4(corner(vertices, indices, t, 0), 1.0f));
+          glm::vec3 b = glm::vec3(instance.model * glm::vec4(corner(vertices, indices, t, 1), 1.0f));
+          glm::vec3 c = glm::vec3(instance.model * glm::vec4(corner(vertices, indices, t, 2), 1.0f));
+          float d = distance(p, a, b, c);
+          best = std::min(best, d);
+          if (d <= radius) overlap++;
+        }
+      }
+      return best;
+    }
+  };
+
+  bool close(float a, float b, float scale) {
+    if (std::isinf(a) || std::isinf(b)) return a == b;
+    return std::abs(a - b) <= 1e-4f * scale;
+  }
+
+}
+
+int main(int argc, char* argv[]) {
+  int segments = 1000;
+  size_t instance_count = 16;
+  if (argc > 1) segments = std::max(2, atoi(argv[1]));
+  if (argc > 2) instance_count = std::max<size_t>(1, (size_t)std::strtoul(argv[2], nullptr, 10));
+
+  std::vector<mesh::vertex> vertices;
+  std::vector<uint32_t> indices;
+  bumpy_sphere(segments, vertices, indices);
+  size_t triangles = indices.size() / 3;
+
+  auto start = bench_clock::now();
+  mesh::triangle_bvh bvh;
+  mesh::build_triangle_bvh(vertices.data(), indices.data(), indices.size(), bvh);
+  double t_build = seconds_since(start);
+  size_t leaves = 0;
+  for (size_t i = 0; i < bvh.node_count; i++) leaves += bvh.nodes[i].count != 0;
+  std::printf("mesh: %zu triangles, build %.1f ms (%.1f Mtriangles/s), %zu nodes, %zu leaves\n", triangles,
+              t_build * 1e3, triangles / t_build / 1e6, bvh.node_count, leaves);
+
+  // Instances on a ring, each turned and scaled differently
+  std::mt19937 rng(1234);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  std::vector<mesh::bvh_instance> instances;
+  for (size_t i = 0; i < instance_count; i++) {
+    float angle = 6.28318531f * i / instance_count;
+    glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(6.0f * std::cos(angle), unit(rng) - 0.5f, 6.0f * std::sin(angle)));
+    model = glm::rotate(model, 6.28318531f * unit(rng), glm::normalize(glm::vec3(unit(rng), unit(rng), unit(rng)) + 0.1f));
+    model = glm::scale(model, glm::vec3(0.5f + unit(rng)));
+    instances.push_back(mesh::bvh_instance{ &bvh, model });
+  }
+  start = bench_clock::now();
+  mesh::scene_bvh scene;
+  mesh::build_scene_bvh(instances.data(), instances.size(), scene);
+  std::printf("scene: %zu instances, %.1f Mtriangles, build %.3f ms\n", instance_count, triangles * instance_count / 1e6,
+              seconds_since(start) * 1e3);
+
+  // Rays from outside the ring at points on the instances, and points
+  // around the instances for the distance queries
+  const int queries = 100000;
+  std::vector<glm::vec3> origins(queries), directions(queries), points(queries);
+  for (int q = 0; q < queries; q++) {
+    const mesh::bvh_instance& target = instances[q % instance_count];
+    glm::vec3 center = glm::vec3(target.model[3]);
+    float z = 2.0f * unit(rng) - 1.0f, phi = 6.28318531f * unit(rng);
+    glm::vec3 d(std::sqrt(1.0f - z * z) * std::cos(phi), z, std::sqrt(1.0f - z * z) * std::sin(phi));
+    origins[q] = center + 20.0f * d;
+    directions[q] = glm::normalize(center + 0.8f * (glm::vec3(unit(rng), unit(rng), unit(rng)) - 0.5f) - origins[q]);
+    points[q] = center + (0.5f + unit(rng)) * 1.5f * d;
+  }
+
+  int hits = 0;
+  std::vector<float> ray_t(queries);
+  start = bench_clock::now();
+  for (int q = 0; q < queries; q++) {
+    mesh::ray_hit hit;
+    ray_t[q] = mesh::raycast(scene, origins[q], directions[q], INFINITY, hit) ? hit.t : INFINITY;
+    hits += !std::isinf(ray_t[q]);
+  }
+  double t_ray = seconds_since(start);
+
+  std::vector<float> nearest(queries);
+  start = bench_clock::now();
+  for (int q = 0; q < queries; q++) {
+    mesh::point_hit hit;
+    nearest[q] = mesh::nearest_point(scene, points[q], INFINITY, hit) ? hit.distance : INFINITY;
+  }
+  double t_nearest = seconds_since(start);
+
+  const float overlap_radius = 0.05f;
+  std::vector<size_t> overlaps(queries);
+  std::vector<mesh::triangle_ref> found;
+  start = bench_clock::now();
+  for (int q = 0; q < queries; q++) {
+    found.clear();
+    overlaps[q] = mesh::overlap_sphere(scene, origins[q] + ray_t[q] * directions[q], overlap_radius, found);
+  }
+  double t_overlap = seconds_since(start);
+
+  // Overlap cost follows the triangles found, so they go next to its time
+  size_t overlapping = 0;
+  for (size_t o : overlaps) overlapping += o;
+  std::printf("%d queries, microseconds each: raycast %.2f (%d hits), nearest_point %.2f, overlap_sphere %.2f (%.0f triangles)\n",
+              queries, t_ray / queries * 1e6, hits, t_nearest / queries * 1e6, t_overlap / queries * 1e6,
+              (double)overlapping / queries);
+
+  // Brute force on a sample
+  brute_force reference{ vertices, indices, instances };
+  const int checked = std::max(4, (int)(200000000 / (triangles * instance_count)));
+  bool ok = true;
+  for (int q = 0; q < std::min(checked, queries); q++) {
+    float t = reference.raycast(origins[q], directions[q]);
+    if (!close(t, ray_t[q], 20.0f)) {
+      std::fprintf(stderr, "raycast %d: bvh %g, brute force %g\n", q, ray_t[q], t);
+      ok = false;
+    }
+    size_t overlap;
+    float d = reference.nearest(points[q], overlap, 0.0f);
+    if (!close(d, nearest[q], 1.0f)) {
+      std::fprintf(stderr, "nearest_point %d: bvh %g, brute force %g\n", q, nearest[q], d);
+      ok = false;
+    }
+    if (!std::isinf(ray_t[q])) {
+      reference.nearest(origins[q] + ray_t[q] * directions[q], overlap, overlap_radius);
+      // Triangles right on the boundary may go either way in float
+      if (overlap == 0 || std::abs((double)overlap - (double)overlaps[q]) > 0.01 * overlap + 2) {
+        std::fprintf(stderr, "overlap_sphere %d: bvh %zu, brute force %zu\n", q, overlaps[q], overlap);
+        ok = false;
+      }
+    }
+  }
+  std::printf("%s against brute force on %d queries\n", ok ? "matches" : "MISMATCH", std::min(checked, queries));
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,173 @@
+// Benchmark and cross-check for the SoA mesh kernels (playground/mesh_simd.h).
+//
+// Generates n random points (1M, or the count given as first argument) on a
+// spherical shell and times, per kernel,
+//  - ref:     the per-vertex glm/libm code the load path used before,
+//  - scalar, sse2, avx2: the SoA kernels at each level the CPU supports.
+// Every SIMD level is checked against the reference; the program fails if
+// bounds differ, if affine/normalize differ by more than float rounding or
+// if UVs are off by more than the documented approximation error.
+//
+// Usage: mesh_kernel_bench [points]
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include <playground/mesh_simd.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+namespace {
+
+  typedef std::chrono::steady_clock bench_clock;
+
+  double seconds_since(bench_clock::time_point start) {
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+  }
+
+  struct soa {
+    std::vector<float> x, y, z;
+
+    explicit soa(size_t n = 0) : x(n), y(n), z(n) {}
+    size_t size() const { return x.size(); }
+  };
+
+  // The reference path, one glm::vec3 at a time as in the original stages.
+  void ref_bounds(const soa& p, glm::vec3& min, glm::vec3& max) {
+    for (size_t i = 0; i < p.size(); i++) {
+      glm::vec3 v(p.x[i], p.y[i], p.z[i]);
+      min = glm::vec3(std::min(min.x, v.x), std::min(min.y, v.y), std::min(min.z, v.z));
+      max = glm::vec3(std::max(max.x, v.x), std::max(max.y, v.y), std::max(max.z, v.z));
+    }
+  }
+
+  void ref_affine(soa& p, const glm::vec3& center, float scale) {
+    for (size_t i = 0; i < p.size(); i++) {
+      glm::vec3 v = (glm::vec3(p.x[i], p.y[i], p.z[i]) - center) * scale;
+      p.x[i] = v.x; p.y[i] = v.y; p.z[i] = v.z;
+    }
+  }
+
+  void ref_normalize(const soa& p, soa& out) {
+    for (size_t i = 0; i < p.size(); i++) {
+      glm::vec3 v(p.x[i], p.y[i], p.z[i]);
+      float len = glm::length(v);
+      glm::vec3 n = len > 0.0f ? v / len : glm::vec3(0.0f);
+      out.x[i] = n.x; out.y[i] = n.y; out.z[i] = n.z;
+    }
+  }
+
+  void ref_spherical_uv(const soa& p, std::vector<float>& u, std::vector<float>& v) {
+    for (size_t i = 0; i < p.size(); i++) {
+      glm::vec3 d(p.x[i], p.y[i], p.z[i]);
+      float len = glm::length(d);
+      if (len == 0.0f) { u[i] = v[i] = 0.5f; continue; }
+      d /= len;
+      u[i] = glm::clamp(0.5f - (float)(std::atan2(d.z, d.x) / (2.0 * M_PI)), 0.0f, 1.0f);
+      v[i] = glm::clamp(0.5f + (float)(std::asin(glm::clamp(d.y, -1.0f, 1.0f)) / M_PI), 0.0f, 1.0f);
+    }
+  }
+
+  float max_diff(const std::vector<float>& a, const std::vector<float>& b) {
+    float d = 0.0f;
+    for (size_t i = 0; i < a.size(); i++) d = std::max(d, std::abs(a[i] - b[i]));
+    return d;
+  }
+
+  template <typename F>
+  double best_of(int runs, F f) {
+    double best = 1e30;
+    for (int i = 0; i < runs; i++) {
+      auto start = bench_clock::now();
+      f();
+      best = std::min(best, seconds_since(start));
+    }
+    return best;
+  }
+
+  bool check(const char* what, const char* level, float diff, float limit) {
+    if (diff <= limit) return true;
+    std::fprintf(stderr, "%s at %s: max difference %g exceeds %g\n", what, level, diff, limit);
+    return false;
+  }
+
+}
+
+int main(int argc, char* argv[]) {
+  size_t n = 1000000;
+  if (argc > 1) n = (size_t)std::strtoul(argv[1], nullptr, 10);
+
+  // Points on a sphere of radius 50-100 around an offset centre, plus the
+  // awkward directions: the poles, the seam and the origin.
+  soa points(n);
+  std::mt19937 rng(1234);
+  std::normal_distribution<float> gauss;
+  std::uniform_real_distribution<float> radius(50.0f, 100.0f);
+  for (size_t i = 0; i < n; i++) {
+    glm::vec3 d(gauss(rng), gauss(rng), gauss(rng));
+    glm::vec3 p = glm::normalize(d) * radius(rng) + glm::vec3(10.0f, -20.0f, 5.0f);
+    points.x[i] = p.x; points.y[i] = p.y; points.z[i] = p.z;
+  }
+  const glm::vec3 special[] = { { 0, 1, 0 }, { 0, -1, 0 }, { -1, 0, 0 }, { -1, 0, -1e-7f }, { -1, 0, 1e-7f }, { 0, 0, 0 } };
+  for (size_t i = 0; i < sizeof(special) / sizeof(special[0]) && i < n; i++) {
+    points.x[i] = special[i].x; points.y[i] = special[i].y; points.z[i] = special[i].z;
+  }
+
+  const glm::vec3 center(10.0f, -20.0f, 5.0f);
+  const float scale = 0.75f;
+  int runs = n <= 1000000 ? 5 : 2;
+
+  // Reference results and timings
+  glm::vec3 ref_min(1e30f), ref_max(-1e30f);
+  soa ref_moved = points, ref_unit(n);
+  std::vector<float> ref_u(n), ref_v(n);
+  double t_bounds = best_of(runs, [&] { ref_min = glm::vec3(1e30f); ref_max = glm::vec3(-1e30f); ref_bounds(points, ref_min, ref_max); });
+  double t_affine = best_of(runs, [&] { ref_moved = points; ref_affine(ref_moved, center, scale); });
+  double t_normalize = best_of(runs, [&] { ref_normalize(points, ref_unit); });
+  double t_uv = best_of(runs, [&] { ref_spherical_uv(points, ref_u, ref_v); });
+
+  double mvert = n / 1e6;
+  std::printf("%zu points, Mvertices/s (affine includes a copy of the input)\n", n);
+  std::printf("%8s %12s %12s %12s %12s\n", "level", "bounds", "affine", "normalize", "uv");
+  std::printf("%8s %12.1f %12.1f %12.1f %12.1f\n", "ref", mvert / t_bounds, mvert / t_affine, mvert / t_normalize, mvert / t_uv);
+
+  bool ok = true;
+  const mesh::simd_level levels[] = { mesh::simd_level::scalar, mesh::simd_level::sse2, mesh::simd_level::avx2 };
+  for (mesh::simd_level level : levels) {
+    if (level > mesh::simd_supported()) continue;
+    mesh::set_simd_level(level);
+    const char* name = mesh::simd_level_name(level);
+
+    glm::vec3 min(1e30f), max(-1e30f);
+    soa moved = points, unit(n);
+    std::vector<float> u(n), v(n);
+    t_bounds = best_of(runs, [&] { min = glm::vec3(1e30f); max = glm::vec3(-1e30f); mesh::soa_bounds(points.x.data(), points.y.data(), points.z.data(), n, min, max); });
+    t_affine = best_of(runs, [&] { moved = points; mesh::soa_affine(moved.x.data(), moved.y.data(), moved.z.data(), n, center, scale); });
+    t_normalize = best_of(runs, [&] { mesh::soa_normalize(points.x.data(), points.y.data(), points.z.data(), n, unit.x.data(), unit.y.data(), unit.z.data()); });
+    t_uv = best_of(runs, [&] { mesh::soa_spherical_uv(points.x.data(), points.y.data(), points.z.data(), n, u.data(), v.data()); });
+    std::printf("%8s %12.1f %12.1f %12.1f %12.1f\n", name, mvert / t_bounds, mvert / t_affine, mvert / t_normalize, mvert / t_uv);
+
+    // Bounds are exact; affine may fuse the multiply-add; the unit vectors
+    // and UVs carry float rounding of the length and the approximations.
+    // Near the poles one ulp of y moves asin(y) by up to sqrt(2 * eps), which
+    // swamps the approximation error in v.
+    ok &= check("bounds", name, glm::length(min - ref_min) + glm::length(max - ref_max), 0.0f);
+    float affine = std::max({ max_diff(moved.x, ref_moved.x), max_diff(moved.y, ref_moved.y), max_diff(moved.z, ref_moved.z) });
+    ok &= check("affine", name, affine, 1e-4f);
+    float normalize = std::max({ max_diff(unit.x, ref_unit.x), max_diff(unit.y, ref_unit.y), max_diff(unit.z, ref_unit.z) });
+    ok &= check("normalize", name, normalize, 1e-6f);
+    float uv_u = max_diff(u, ref_u), uv_v = max_diff(v, ref_v);
+    ok &= check("u", name, uv_u, mesh::fast_atan2_max_error / (2.0f * (float)M_PI) + 1e-6f);
+    ok &= check("v", name, uv_v, (mesh::fast_asin_max_error + std::sqrt(2.0f * FLT_EPSILON)) / (float)M_PI);
+    std::printf("%8s max |du| %.2g, |dv| %.2g, |dn| %.2g\n", "", uv_u, uv_v, normalize);
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,163 @@
+// Checks the SSE2 and AVX2 mesh kernels (playground/mesh_simd.h) against the
+// scalar ones, on the inputs the vector paths get wrong most easily:
+//  - every count from 0 to 40, so every tail length of 4 and 8 wide
+//    vectors, starting at unaligned offsets,
+//  - zero length vectors (normalize to zero, UV (0.5, 0.5)) and vectors
+//    short enough that the squared length is denormal,
+//  - the poles, where v must be exactly 0 and 1, and the seam,
+//  - the extremes of the bounds sitting in the tail.
+// Nothing may be written past n. Levels the CPU lacks are skipped. Exits
+// with 1 if any check fails.
+//
+// Usage: mesh_simd_test
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include <playground/mesh_simd.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+namespace {
+
+  bool ok = true;
+
+  void check(bool condition, const char* what, const char* level, size_t n, size_t offset) {
+    if (condition) return;
+    std::printf("FAIL: %s at %s, n = %zu, offset %zu\n", what, level, n, offset);
+    ok = false;
+  }
+
+  // Written past n in every buffer; must survive every kernel
+  const float sentinel = -12345.0f;
+  const size_t padding = 16;
+
+  struct results {
+    std::vector<float> x, y, z;     // input, then affine in place
+    std::vector<float> nx, ny, nz;  // normalize
+    std::vector<float> u, v;        // spherical_uv
+    glm::vec3 min, max;
+  };
+
+  // Runs every kernel at the active level on the n points at offset
+  results run(const std::vector<glm::vec3>& points, size_t offset, size_t n) {
+    size_t size = offset + n + padding;
+    results r;
+    for (std::vector<float>* a : { &r.x, &r.y, &r.z, &r.nx, &r.ny, &r.nz, &r.u, &r.v }) a->assign(size, sentinel);
+    for (size_t i = 0; i < n; i++) {
+      r.x[offset + i] = points[i].x;
+      r.y[offset + i] = points[i].y;
+      r.z[offset + i] = points[i].z;
+    }
+    const float* x = r.x.data() + offset;
+    const float* y = r.y.data() + offset;
+    const float* z = r.z.data() + offset;
+    r.min = glm::vec3(FLT_MAX);
+    r.max = glm::vec3(-FLT_MAX);
+    mesh::soa_bounds(x, y, z, n, r.min, r.max);
+    mesh::soa_normalize(x, y, z, n, r.nx.data() + offset, r.ny.data() + offset, r.nz.data() + offset);
+    mesh::soa_spherical_uv(x, y, z, n, r.u.data() + offset, r.v.data() + offset);
+    mesh::soa_affine(r.x.data() + offset, r.y.data() + offset, r.z.data() + offset, n, glm::vec3(1.0f, -2.0f, 0.5f), 0.75f);
+    return r;
+  }
+
+  float max_diff(const std::vector<float>& a, const std::vector<float>& b, size_t begin, size_t end) {
+    float d = 0.0f;
+    for (size_t i = begin; i < end; i++) d = std::max(d, std::abs(a[i] - b[i]));
+    return d;
+  }
+
+  bool untouched(const std::vector<float>& a, size_t begin) {
+    for (size_t i = begin; i < a.size(); i++)
+      if (a[i] != sentinel) return false;
+    return true;
+  }
+
+}
+
+int main() {
+  // Special directions first, so that small counts hit them; then random
+  // points, with the largest and smallest coordinates placed last
+  std::vector<glm::vec3> points = {
+    { 0, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 5, 0 }, { 0, -0.25f, 0 },
+    { -1, 0, 0 }, { -1, 0, -1e-7f }, { -1, 0, 1e-7f }, { 1e-20f, -1e-20f, 1e-20f }, { -0.0f, 0.0f, -0.0f },
+  };
+  std::mt19937 rng(17);
+  std::uniform_real_distribution<float> coordinate(-100.0f, 100.0f);
+  while (points.size() < 38) points.push_back(glm::vec3(coordinate(rng), coordinate(rng), coordinate(rng)));
+  points.push_back(glm::vec3(150.0f, -150.0f, 150.0f));
+  points.push_back(glm::vec3(-150.0f, 150.0f, -150.0f));
+
+  // The exact answers for the special directions, at every level
+  const mesh::simd_level levels[] = { mesh::simd_level::scalar, mesh::simd_level::sse2, mesh::simd_level::avx2 };
+  for (mesh::simd_level level : levels) {
+    if (level > mesh::simd_supported()) {
+      std::printf("%s: not supported here, skipped\n", mesh::simd_level_name(level));
+      continue;
+    }
+    mesh::set_simd_level(level);
+    const char* name = mesh::simd_level_name(level);
+    // 16 points: the specials run through the vector body at every width
+    results r = run(points, 0, 16);
+    check(r.nx[0] == 0.0f && r.ny[0] == 0.0f && r.nz[0] == 0.0f, "zero vector normalizes to zero", name, 16, 0);
+    // asin(0) is off by the approximation error, which is a little over
+    // one ulp of v there
+    float equator = mesh::fast_asin_max_error / (float)M_PI;
+    check(r.u[0] == 0.5f && std::abs(r.v[0] - 0.5f) <= equator, "zero vector maps to (0.5, 0.5)", name, 16, 0);
+    check(r.nx[9] == 0.0f && r.ny[9] == 0.0f && r.nz[9] == 0.0f && r.u[9] == 0.5f && std::abs(r.v[9] - 0.5f) <= equator,
+          "signed zero vector", name, 16, 0);
+    check(r.v[1] == 1.0f && r.v[2] == 0.0f && r.v[3] == 1.0f, "poles map to v = 1 and v = 0", name, 16, 0);
+    check(r.ny[1] == 1.0f && r.ny[2] == -1.0f && r.ny[3] == 1.0f && r.ny[4] == -1.0f, "poles normalize exactly", name, 16, 0);
+    check(std::abs(r.u[5] - 1.0f) <= 1e-6f || std::abs(r.u[5]) <= 1e-6f, "seam u is 0 or 1", name, 16, 0);
+    check(std::abs(r.u[6] - 1.0f) <= 1e-6f && std::abs(r.u[7]) <= 1e-6f, "either side of the seam", name, 16, 0);
+    float tiny = std::sqrt(r.nx[8] * r.nx[8] + r.ny[8] * r.ny[8] + r.nz[8] * r.nz[8]);
+    // A denormal squared length keeps some 18 bits
+    check(tiny == 0.0f || std::abs(tiny - 1.0f) <= 1e-5f, "denormal squared length gives zero or a unit vector", name, 16, 0);
+  }
+
+  // Every count and offset against the scalar kernels. Bounds and affine
+  // are exact; normalize and u may differ by the rounding of a fused
+  // multiply-add, v also by the sqrt(2 * eps) one ulp of y is worth at the
+  // poles.
+  const float normalize_limit = 1e-6f;
+  const float u_limit = 1e-6f;
+  const float v_limit = std::sqrt(2.0f * FLT_EPSILON) / (float)M_PI;
+  for (size_t offset = 0; offset < 4; offset++) {
+    for (size_t n = 0; n <= points.size(); n++) {
+      mesh::set_simd_level(mesh::simd_level::scalar);
+      results want = run(points, offset, n);
+      for (mesh::simd_level level : levels) {
+        if (level > mesh::simd_supported()) continue;
+        mesh::set_simd_level(level);
+        const char* name = mesh::simd_level_name(level);
+        results got = run(points, offset, n);
+        size_t end = offset + n;
+        check(got.min == want.min && got.max == want.max, "bounds", name, n, offset);
+        check(max_diff(got.x, want.x, offset, end) == 0.0f && max_diff(got.y, want.y, offset, end) == 0.0f &&
+              max_diff(got.z, want.z, offset, end) == 0.0f, "affine", name, n, offset);
+        float normalize = std::max({ max_diff(got.nx, want.nx, offset, end), max_diff(got.ny, want.ny, offset, end),
+                                     max_diff(got.nz, want.nz, offset, end) });
+        check(normalize <= normalize_limit, "normalize", name, n, offset);
+        check(max_diff(got.u, want.u, offset, end) <= u_limit, "u", name, n, offset);
+        check(max_diff(got.v, want.v, offset, end) <= v_limit, "v", name, n, offset);
+        bool clean = true;
+        for (const std::vector<float>* a : { &got.x, &got.y, &got.z, &got.nx, &got.ny, &got.nz, &got.u, &got.v }) {
+          clean &= untouched(*a, end);
+          for (size_t i = 0; i < offset; i++) clean &= (*a)[i] == sentinel;
+        }
+        check(clean, "nothing written outside the n points", name, n, offset);
+      }
+    }
+  }
+
+  mesh::set_simd_level(mesh::simd_supported());
+  std::printf(ok ? "mesh_simd: all checks passed\n" : "mesh_simd: FAILED\n");
+  return ok ? 0 : 1;
+}
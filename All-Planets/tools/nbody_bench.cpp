@@ -0,0 +1,168 @@
+// Benchmark and cross-check for the Barnes-Hut integrator (playground/nbody.h).
+//
+// Builds a self-gravitating Plummer sphere of n equal masses (100k, or the
+// count given as first argument). At every SIMD level the CPU supports it
+// times the tree build plus force evaluation, and compares the tree's
+// accelerations for a sample of particles with a direct sum in double;
+// direct mode is checked the same way on a smaller sphere. Finally a planet
+// formation disc, a star and 2000 particles carrying another 1% of its mass
+// on circular orbits, runs a thousand leapfrog steps and the total energy,
+// summed in double, must stay put. The program fails if any check is off.
+//
+// Usage: nbody_bench [particles]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include <playground/mesh_simd.h>
+#include <playground/nbody.h>
+
+namespace {
+
+  typedef std::chrono::steady_clock bench_clock;
+
+  const float softening = 0.01f;
+
+  double seconds_since(bench_clock::time_point start) {
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+  }
+
+  template <typename F>
+  double best_of(int runs, F f) {
+    double best = 1e30;
+    for (int i = 0; i < runs; i++) {
+      auto start = bench_clock::now();
+      f();
+      best = std::min(best, seconds_since(start));
+    }
+    return best;
+  }
+
+  void make_plummer(nbody::particle_system& system, size_t particles, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    system.clear();
+    for (size_t i = 0; i < particles; i++) {
+      // Radius from the inverse of the enclosed mass fraction, cut at 10 scale lengths
+      float r;
+      do r = 1.0f / std::sqrt(std::pow(std::max(unit(rng), 1e-6f), -2.0f / 3.0f) - 1.0f);
+      while (r > 10.0f);
+      float cos_t = 2.0f * unit(rng) - 1.0f, sin_t = std::sqrt(1.0f - cos_t * cos_t);
+      float phi = 6.2831853f * unit(rng);
+      system.add(r * glm::vec3(sin_t * std::cos(phi), cos_t, sin_t * std::sin(phi)), glm::vec3(0.0f),
+                 1.0f / particles);
+    }
+  }
+
+  void make_disc(nbody::particle_system& system, size_t particles, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::normal_distribution<float> normal(0.0f, 1.0f);
+    const float disc_mass = 0.01f;
+    system.clear();
+    system.add(glm::vec3(0.0f), glm::vec3(0.0f), 1.0f);
+    for (size_t i = 0; i < particles; i++) {
+      // Uniform surface density from radius 1 to 10
+      float r = std::sqrt(1.0f + 99.0f * unit(rng));
+      float angle = 6.2831853f * unit(rng);
+      float enclosed = 1.0f + disc_mass * (r * r - 1.0f) / 99.0f;
+      float speed = std::sqrt(enclosed / r);
+      glm::vec3 p(r * std::cos(angle), 0.02f * r * normal(rng), r * std::sin(angle));
+      glm::vec3 v(speed * std::sin(angle), 0.0f, -speed * std::cos(angle));
+      system.add(p, v, disc_mass / particles);
+    }
+  }
+
+  glm::dvec3 reference_acceleration(const nbody::particle_system& system, size_t target) {
+    glm::dvec3 p(system.position(target)), a(0.0);
+    double eps2 = (double)softening * softening;
+    for (size_t j = 0; j < system.size(); j++) {
+      glm::dvec3 d = glm::dvec3(system.position(j)) - p;
+      double r2 = glm::dot(d, d) + eps2;
+      if (r2 > 0.0) a += d * (system.mass(j) / (r2 * std::sqrt(r2)));
+    }
+    return a * (double)system.settings().gravity;
+  }
+
+  double total_energy(const nbody::particle_system& system) {
+    double eps2 = (double)softening * softening, energy = 0.0;
+    for (size_t i = 0; i < system.size(); i++) {
+      glm::dvec3 v(system.velocity(i)), p(system.position(i));
+      energy += 0.5 * system.mass(i) * glm::dot(v, v);
+      for (size_t j = i + 1; j < system.size(); j++) {
+        glm::dvec3 d = glm::dvec3(system.position(j)) - p;
+        energy -= system.settings().gravity * system.mass(i) * system.mass(j) / std::sqrt(glm::dot(d, d) + eps2);
+      }
+    }
+    return energy;
+  }
+
+  // Relative acceleration errors of a strided sample; returns the 99th percentile
+  float sampled_error(const nbody::particle_system& system, size_t samples, float& median) {
+    std::vector<float> errors;
+    size_t stride = std::max<size_t>(system.size() / samples, 1);
+    for (size_t i = 0; i < system.size(); i += stride) {
+      glm::dvec3 expected = reference_acceleration(system, i);
+      errors.push_back((float)(glm::length(glm::dvec3(system.acceleration(i)) - expected) / glm::length(expected)));
+    }
+    std::sort(errors.begin(), errors.end());
+    median = errors[errors.size() / 2];
+    return errors[errors.size() * 99 / 100];
+  }
+
+}
+
+int main(int argc, char* argv[]) {
+  size_t particles = 100000;
+  if (argc > 1) particles = (size_t)std::strtoul(argv[1], nullptr, 10);
+
+  nbody::options tree_options;
+  tree_options.softening = softening;
+  nbody::options direct_options = tree_options;
+  direct_options.direct = true;
+
+  nbody::particle_system sphere(tree_options), small_sphere(direct_options);
+  make_plummer(sphere, particles, 1234);
+  make_plummer(small_sphere, 4096, 99);
+  std::printf("%zu particles, theta %.2f, leaves of %zu, groups of %zu\n", sphere.size(), tree_options.theta,
+              tree_options.leaf_size, tree_options.group_size);
+
+  bool ok = true;
+  const mesh::simd_level levels[] = { mesh::simd_level::scalar, mesh::simd_level::sse2, mesh::simd_level::avx2 };
+  for (mesh::simd_level level : levels) {
+    if (level > mesh::simd_supported()) continue;
+    mesh::set_simd_level(level);
+    const char* name = mesh::simd_level_name(level);
+
+    double tree_seconds = best_of(3, [&] { sphere.compute_accelerations(); });
+    float median, worst = sampled_error(sphere, 500, median);
+    std::printf("%8s tree   %9.1f ms, %zu nodes, force error median %.2g, 99th percentile %.2g\n", name,
+                tree_seconds * 1e3, sphere.tree().size(), median, worst);
+    if (worst > 0.01f) ok = false;
+
+    double direct_seconds = best_of(3, [&] { small_sphere.compute_accelerations(); });
+    worst = sampled_error(small_sphere, 500, median);
+    std::printf("%8s direct %9.1f ms for %zu particles, force error 99th percentile %.2g\n", name, direct_seconds * 1e3,
+                small_sphere.size(), worst);
+    if (worst > 1e-4f) ok = false;
+  }
+
+  // A thousand steps of 1/200 of the inner orbit, five turns there
+  nbody::particle_system run(tree_options);
+  make_disc(run, 2000, 7);
+  double before = total_energy(run);
+  auto start = bench_clock::now();
+  for (int i = 0; i < 1000; i++) run.step(0.01f * 3.14159265f);
+  double seconds = seconds_since(start);
+  double drift = std::abs(total_energy(run) / before - 1.0);
+  std::printf("leapfrog: %zu particles, 1000 steps in %.2f s, relative energy change %.2g\n", run.size(), seconds, drift);
+  if (drift > 1e-4) ok = false;
+
+  if (!ok) std::fprintf(stderr, "nbody_bench: error above tolerance\n");
+  return ok ? 0 : 1;
+}
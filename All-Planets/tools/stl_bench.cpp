@@ -0,0 +1,158 @@
+// Benchmark for the binary STL loaders.
+//
+// Writes synthetic binary STL files from 1k up to 10M triangles (or the
+// count given as first argument) and compares
+//  - stream:  the original per-float std::ifstream::read parser,
+//  - parse:   stl::parse_stl (mapped file, copied into stl_data),
+//  - view:    stl::binary_stl_view, touching every record in place,
+//  - soa:     stl::binary_stl_view::extract_soa.
+//
+// Usage: stl_bench [max_triangles] [scratch_directory]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <playground/parse_stl.h>
+
+namespace {
+
+  typedef std::chrono::steady_clock bench_clock;
+
+  double seconds_since(bench_clock::time_point start) {
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+  }
+
+  bool write_stl(const std::string& path, uint32_t n_triangles) {
+    std::ofstream out(path.c_str(), std::ios::out | std::ios::binary);
+    if (!out) return false;
+
+    char header[80] = "stl_bench synthetic mesh";
+    out.write(header, sizeof(header));
+    out.write(reinterpret_cast<const char*>(&n_triangles), sizeof(n_triangles));
+
+    std::vector<stl::record> batch(65536);
+    uint32_t written = 0;
+    while (written < n_triangles) {
+      uint32_t n = std::min<uint32_t>(n_triangles - written, (uint32_t)batch.size());
+      for (uint32_t i = 0; i < n; i++) {
+        float f = (float)(written + i);
+        stl::record& r = batch[i];
+        r.normal = stl::point(0.0f, 0.0f, 1.0f);
+        r.v1 = stl::point(f, 0.0f, 0.0f);
+        r.v2 = stl::point(f + 1.0f, 0.0f, 0.0f);
+        r.v3 = stl::point(f, 1.0f, 0.0f);
+        r.attribute_bytes = 0;
+      }
+      out.write(reinterpret_cast<const char*>(batch.data()), n * sizeof(stl::record));
+      written += n;
+    }
+    return (bool)out;
+  }
+
+  // The parser as it was before binary_stl_view: one ifstream::read per float.
+  float stream_float(std::ifstream& s) {
+    float f;
+    s.read(reinterpret_cast<char*>(&f), 4);
+    return f;
+  }
+
+  stl::point stream_point(std::ifstream& s) {
+    float x = stream_float(s);
+    float y = stream_float(s);
+    float z = stream_float(s);
+    return stl::point(x, y, z);
+  }
+
+  size_t parse_stream(const std::string& path) {
+    std::ifstream stl_file(path.c_str(), std::ios::in | std::ios::binary);
+    char header_info[80];
+    uint32_t num_triangles = 0;
+    stl_file.read(header_info, 80);
+    stl_file.read(reinterpret_cast<char*>(&num_triangles), 4);
+    stl::stl_data info("");
+    for (uint32_t i = 0; i < num_triangles; i++) {
+      auto normal = stream_point(stl_file);
+      auto v1 = stream_point(stl_file);
+      auto v2 = stream_point(stl_file);
+      auto v3 = stream_point(stl_file);
+      info.triangles.push_back(stl::triangle(normal, v1, v2, v3));
+      char dummy[2];
+      stl_file.read(dummy, 2);
+    }
+    return info.triangles.size();
+  }
+
+  size_t parse_mapped(const std::string& path) {
+    return stl::parse_stl(path).triangles.size();
+  }
+
+  // Sums a coordinate so the compiler cannot skip the reads.
+  volatile float sink;
+
+  size_t touch_view(const std::string& path) {
+    stl::binary_stl_view view;
+    if (!view.open(path)) return 0;
+    float acc = 0.0f;
+    for (const stl::record& r : view)
+      acc += r.v1.x + r.v2.y + r.v3.z;
+    sink = acc;
+    return view.size();
+  }
+
+  size_t extract_soa(const std::string& path) {
+    stl::binary_stl_view view;
+    if (!view.open(path)) return 0;
+    stl::soa_triangles soa;
+    view.extract_soa(soa);
+    return soa.nx.size();
+  }
+
+  template <typename F>
+  double best_of(int runs, const std::string& path, uint32_t expected, F f) {
+    double best = 1e30;
+    for (int i = 0; i < runs; i++) {
+      auto start = bench_clock::now();
+      size_t n = f(path);
+      double t = seconds_since(start);
+      if (n != expected) {
+        std::fprintf(stderr, "%s: expected %u triangles, got %zu\n", path.c_str(), expected, n);
+        std::exit(1);
+      }
+      best = std::min(best, t);
+    }
+    return best;
+  }
+
+}
+
+int main(int argc, char* argv[]) {
+  uint32_t max_triangles = 10000000;
+  if (argc > 1) max_triangles = (uint32_t)std::strtoul(argv[1], nullptr, 10);
+  std::string dir = argc > 2 ? argv[2] : ".";
+
+  std::printf("%12s %12s %12s %12s %12s %12s\n", "triangles", "MB", "stream ms", "parse ms", "view ms", "soa ms");
+  for (uint32_t n = 1000; n <= max_triangles; n *= 10) {
+    std::string path = dir + "/stl_bench_" + std::to_string(n) + ".stl";
+    if (!write_stl(path, n)) {
+      std::fprintf(stderr, "could not write %s\n", path.c_str());
+      return 1;
+    }
+
+    int runs = n <= 100000 ? 5 : 2;
+    double stream = best_of(runs, path, n, parse_stream);
+    double parse = best_of(runs, path, n, parse_mapped);
+    double view = best_of(runs, path, n, touch_view);
+    double soa = best_of(runs, path, n, extract_soa);
+    double mb = (84.0 + 50.0 * n) / (1024.0 * 1024.0);
+    std::printf("%12u %12.1f %12.2f %12.2f %12.2f %12.2f\n", n, mb, stream * 1e3, parse * 1e3, view * 1e3, soa * 1e3);
+
+    std::remove(path.c_str());
+  }
+  return 0;
+}
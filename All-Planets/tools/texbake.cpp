@@ -0,0 +1,119 @@
+// Offline texture baker.
+//
+// Converts a 24 bit BMP into a block compressed .dds or .ktx with a full,
+// precomputed mip chain, so the game uploads it with glCompressedTexImage2D
+// and never calls glGenerateMipmap. Colour maps are filtered in linear light
+// (sRGB decode, average, encode); pass --linear for data maps (normal or
+// height maps) that must be filtered as stored.
+//
+// Rows keep the BMP's bottom-up order, so a baked map is a drop-in for the
+// BMP it came from (the same UVs sample the same texels).
+//
+// Usage: texbake [--bc1|--bc3|--bc7] [--linear] [--srgb-format] [--no-mips] [--simd level] input.bmp output.(dds|ktx)
+//   --bc1          4 bpp, opaque colour (default)
+//   --bc3          8 bpp, colour + alpha
+//   --bc7          8 bpp, best quality
+//   --linear       box filter the mips without sRGB conversion
+//   --srgb-format  tag the output as sRGB (the GPU decodes it on sampling)
+//   --no-mips      level 0 only
+//   --simd level   run the encoder kernels at scalar, sse2 or avx2 (default: the best the CPU has)
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <common/image.hpp>
+#include <common/texture_bake.hpp>
+#include <playground/mesh_simd.h>
+
+namespace {
+
+  typedef std::chrono::steady_clock bench_clock;
+
+  double seconds_since(bench_clock::time_point start) {
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+  }
+
+  bool ends_with(const std::string& s, const char* suffix) {
+    size_t n = std::strlen(suffix);
+    if (s.size() < n) return false;
+    for (size_t i = 0; i < n; i++) {
+      char c = s[s.size() - n + i];
+      if (c >= 'A' && c <= 'Z') c = char(c - 'A' + 'a');
+      if (c != suffix[i]) return false;
+    }
+    return true;
+  }
+
+  int usage() {
+    std::fprintf(stderr, "usage: texbake [--bc1|--bc3|--bc7] [--linear] [--srgb-format] [--no-mips] [--simd scalar|sse2|avx2] "
+                         "input.bmp output.(dds|ktx)\n");
+    return 1;
+  }
+
+}
+
+int main(int argc, char** argv) {
+  BlockFormat format = BLOCK_BC1;
+  bool linear = false;
+  bool srgb_format = false;
+  bool mips = true;
+  std::vector<std::string> files;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--bc1") format = BLOCK_BC1;
+    else if (arg == "--bc3") format = BLOCK_BC3;
+    else if (arg == "--bc7") format = BLOCK_BC7;
+    else if (arg == "--linear") linear = true;
+    else if (arg == "--srgb-format") srgb_format = true;
+    else if (arg == "--no-mips") mips = false;
+    else if (arg == "--simd" && i + 1 < argc) {
+      std::string level = argv[++i];
+      if (level == "scalar") mesh::set_simd_level(mesh::simd_level::scalar);
+      else if (level == "sse2") mesh::set_simd_level(mesh::simd_level::sse2);
+      else if (level == "avx2") mesh::set_simd_level(mesh::simd_level::avx2);
+      else return usage();
+    }
+    else if (arg.size() > 1 && arg[0] == '-') return usage();
+    else files.push_back(arg);
+  }
+  if (files.size() != 2) return usage();
+  const std::string& input = files[0];
+  const std::string& output = files[1];
+  bool ktx = ends_with(output, ".ktx");
+  if (!ktx && !ends_with(output, ".dds")) return usage();
+
+  bench_clock::time_point start = bench_clock::now();
+
+  BMPImage bmp;
+  if (!readBMP(input.c_str(), bmp)) return 1;
+  RGBAImage base;
+  bmpToRGBA(bmp, base);
+  bmp.data.clear();
+
+  std::vector<RGBAImage> chain;
+  if (mips)
+    buildMipChain(base, !linear, chain);
+  else
+    chain.assign(1, base);
+  double mip_time = seconds_since(start);
+
+  DDSImage baked;
+  bakeTexture(chain, format, srgb_format, baked);
+  double total_time = seconds_since(start);
+
+  bool ok = ktx ? writeKTX(output.c_str(), baked) : writeDDS(output.c_str(), baked);
+  if (!ok) return 1;
+
+  static const char* names[] = { "BC1", "BC2", "BC3", "BC7" };
+  size_t raw = size_t(base.width) * base.height * 3;
+  std::printf("%s: %ux%u, %zu levels, %s%s, %.2f MB (24 bit level 0 alone: %.2f MB)\n",
+              output.c_str(), baked.width, baked.height, baked.levels.size(), names[format],
+              srgb_format ? " sRGB" : "", baked.data.size() / (1024.0 * 1024.0), raw / (1024.0 * 1024.0));
+  std::printf("mips %.3f s, compression %.3f s (%s kernels)\n", mip_time, total_time - mip_time,
+              mesh::simd_level_name(mesh::simd_active()));
+  return 0;
+}
@@ -0,0 +1,166 @@
+// Checks for indexVBO (common/vboindexer.hpp).
+//
+//  - bit exact welding: +0 and -0 merge, neighbouring floats do not,
+//  - welding with a tolerance: duplicates on either side of a grid cell
+//    border merge, vertices further apart than epsilon in any attribute do
+//    not, and a vertex joins the first output vertex it is near,
+//  - a jittered soup welds exactly as the original linear search did,
+//  - the index type follows the vertex count.
+// Exits with 1 if any check fails.
+//
+// Usage: vboindexer_test
+
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include <common/vboindexer.hpp>
+
+namespace {
+
+  bool ok = true;
+
+  void check(bool condition, const char* what) {
+    if (!condition) {
+      std::printf("FAIL: %s\n", what);
+      ok = false;
+    }
+  }
+
+  struct soup {
+    std::vector<glm::vec3> vertices;
+    std::vector<glm::vec2> uvs;
+    std::vector<glm::vec3> normals;
+
+    void add(glm::vec3 v, glm::vec2 uv = glm::vec2(0.0f), glm::vec3 n = glm::vec3(0.0f, 0.0f, 1.0f)) {
+      vertices.push_back(v);
+      uvs.push_back(uv);
+      normals.push_back(n);
+    }
+  };
+
+  std::vector<unsigned int> weld(soup& in, float epsilon, size_t* outCount = nullptr) {
+    std::vector<unsigned int> indices;
+    std::vector<glm::vec3> vertices, normals;
+    std::vector<glm::vec2> uvs;
+    indexVBO(in.vertices, in.uvs, in.normals, indices, vertices, uvs, normals, epsilon);
+    if (outCount) *outCount = vertices.size();
+    return indices;
+  }
+
+  // The linear search indexVBO replaced: first output vertex within epsilon
+  std::vector<unsigned int> weldLinear(const soup& in, float epsilon) {
+    auto near = [&](float a, float b) { return std::fabs(a - b) < epsilon; };
+    std::vector<unsigned int> indices, firsts;
+    for (size_t i = 0; i < in.vertices.size(); i++) {
+      unsigned int found = (unsigned int)firsts.size();
+      for (unsigned int o = 0; o < firsts.size() && found == firsts.size(); o++) {
+        size_t j = firsts[o];
+        bool same = true;
+        for (int c = 0; c < 3; c++) same = same && near(in.vertices[i][c], in.vertices[j][c]) && near(in.normals[i][c], in.normals[j][c]);
+        for (int c = 0; c < 2; c++) same = same && near(in.uvs[i][c], in.uvs[j][c]);
+        if (same) found = o;
+      }
+      if (found == firsts.size()) firsts.push_back((unsigned int)i);
+      indices.push_back(found);
+    }
+    return indices;
+  }
+
+  void testExact() {
+    soup s;
+    s.add(glm::vec3(0.0f, 1.0f, 2.0f));
+    s.add(glm::vec3(-0.0f, 1.0f, 2.0f));
+    s.add(glm::vec3(std::nextafter(0.0f, 1.0f), 1.0f, 2.0f));
+    std::vector<unsigned int> indices = weld(s, 0.0f);
+    check(indices == std::vector<unsigned int>({ 0, 0, 1 }), "exact: +0 and -0 merge, the next float does not");
+  }
+
+  void testCellBorders() {
+    // Cells are 2 * epsilon wide, so borders sit at multiples of 0.02 (and
+    // at odd multiples of 0.005 for a grid rounding to epsilon); pairs
+    // 0.0002 apart straddle one on each axis in turn, and one on all three
+    float epsilon = 0.01f;
+    const float borders[] = { 0.02f, -0.02f, 0.0f, 1.0f, -3.14f, 0.005f, -0.015f };
+    for (float border : borders) {
+      for (int axis = 0; axis < 4; axis++) {
+        soup s;
+        glm::vec3 a(0.5f), b(0.5f);
+        for (int c = 0; c < 3; c++) {
+          if (axis == 3 || axis == c) {
+            a[c] = border - 0.0001f;
+            b[c] = border + 0.0001f;
+          }
+        }
+        s.add(a);
+        s.add(b);
+        s.add(b, glm::vec2(0.5f, 0.0f));  // UV too far: stays apart
+        size_t count;
+        std::vector<unsigned int> indices = weld(s, epsilon, &count);
+        check(indices == std::vector<unsigned int>({ 0, 0, 1 }) && count == 2, "tolerance: duplicates across a cell border merge");
+      }
+    }
+
+    soup apart;
+    apart.add(glm::vec3(0.0195f, 0.0f, 0.0f));
+    apart.add(glm::vec3(0.0305f, 0.0f, 0.0f));
+    check(weld(apart, epsilon) == std::vector<unsigned int>({ 0, 1 }), "tolerance: vertices further than epsilon apart stay apart");
+
+    // b is near a and merges; c is near b but not a, and b never became an
+    // output vertex, so c starts one of its own
+    soup chain;
+    chain.add(glm::vec3(0.0f));
+    chain.add(glm::vec3(0.008f, 0.0f, 0.0f));
+    chain.add(glm::vec3(0.016f, 0.0f, 0.0f));
+    check(weld(chain, epsilon) == std::vector<unsigned int>({ 0, 0, 1 }), "tolerance: a vertex joins the first output vertex it is near");
+  }
+
+  void testAgainstLinearSearch() {
+    // Clusters of jittered copies, many straddling cell borders
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> centre(-1.0f, 1.0f), jitter(-0.004f, 0.004f);
+    std::uniform_int_distribution<int> uvPick(0, 2);
+    soup s;
+    for (int cluster = 0; cluster < 600; cluster++) {
+      glm::vec3 p(centre(rng), centre(rng), centre(rng));
+      glm::vec3 n = glm::normalize(p);
+      for (int copy = 0; copy < 6; copy++) {
+        glm::vec3 j(jitter(rng), jitter(rng), jitter(rng));
+        s.add(p + j, glm::vec2(0.25f * uvPick(rng), 0.5f), n + j);
+      }
+    }
+    for (float epsilon : { 0.001f, 0.005f, 0.01f, 0.03f }) {
+      char what[96];
+      std::snprintf(what, sizeof(what), "tolerance %g: same welding as the linear search", epsilon);
+      check(weld(s, epsilon) == weldLinear(s, epsilon), what);
+    }
+  }
+
+  void testIndexWidth() {
+    soup small, large;
+    for (int i = 0; i < 65536; i++) small.add(glm::vec3((float)i, 0.0f, 0.0f));
+    for (int i = 0; i < 65537; i++) large.add(glm::vec3((float)i, 0.0f, 0.0f));
+    IndexBuffer indices;
+    std::vector<glm::vec3> vertices, normals;
+    std::vector<glm::vec2> uvs;
+    indexVBO(small.vertices, small.uvs, small.normals, indices, vertices, uvs, normals);
+    check(!indices.wide() && indices.size() == 65536, "65536 vertices fit 16 bit indices");
+    indexVBO(large.vertices, large.uvs, large.normals, indices, vertices, uvs, normals);
+    check(indices.wide() && indices.size() == 65537, "65537 vertices need 32 bit indices");
+
+    std::vector<unsigned short> narrow;
+    bool fits = indexVBO(large.vertices, large.uvs, large.normals, narrow, vertices, uvs, normals);
+    check(!fits && narrow.empty() && vertices.empty(), "unsigned short refuses 65537 vertices");
+  }
+
+}
+
+int main() {
+  testExact();
+  testCellBorders();
+  testAgainstLinearSearch();
+  testIndexWidth();
+  std::printf(ok ? "vboindexer: all checks passed\n" : "vboindexer: FAILED\n");
+  return ok ? 0 : 1;
+}